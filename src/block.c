@@ -27,6 +27,7 @@
 #include "volumegroup.h"
 
 #include "daemon.h"
+#include "util.h"
 
 #include "com.redhat.lvm2.h"
 
@@ -231,22 +232,8 @@ gboolean
 storage_block_is_unused (StorageBlock *self,
                     GError **error)
 {
-  const gchar *device_file;
-  int fd;
-
   g_return_val_if_fail (STORAGE_IS_BLOCK (self), FALSE);
-
-  device_file = storage_block_get_device (self);
-  fd = open (device_file, O_RDONLY | O_EXCL);
-  if (fd < 0)
-    {
-      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                   "Error opening device %s: %m",
-                   device_file);
-      return FALSE;
-    }
-  close (fd);
-  return TRUE;
+  return storage_util_device_is_unused (storage_block_get_device (self), error);
 }
 
 void
@@ -290,7 +277,7 @@ storage_block_update_lv (StorageBlock *self,
 void
 storage_block_update_pv (StorageBlock *self,
                          StorageVolumeGroup *group,
-                         GVariant *pv_info)
+                         const StoragePvRecord *pv)
 {
   StorageDaemon *daemon;
 
@@ -303,12 +290,12 @@ storage_block_update_pv (StorageBlock *self,
      if (self->iface_physical_volume == NULL)
         {
           self->iface_physical_volume = storage_physical_volume_new ();
-          storage_physical_volume_update (self->iface_physical_volume, group, pv_info);
+          storage_physical_volume_update (self->iface_physical_volume, group, pv);
           storage_daemon_publish (daemon, storage_block_get_object_path (self), FALSE, self->iface_physical_volume);
         }
       else
         {
-          storage_physical_volume_update (self->iface_physical_volume, group, pv_info);
+          storage_physical_volume_update (self->iface_physical_volume, group, pv);
         }
     }
   else
@@ -26,6 +26,7 @@
 #include <gudev/gudev.h>
 
 #include "types.h"
+#include "vgmodel.h"
 
 G_BEGIN_DECLS
 
@@ -63,7 +64,7 @@ void               storage_block_update_lv        (StorageBlock *self,
 
 void               storage_block_update_pv        (StorageBlock *self,
                                                    StorageVolumeGroup *group,
-                                                   GVariant *pv_info);
+                                                   const StoragePvRecord *pv);
 
 LvmLogicalVolumeBlock  *  storage_block_get_logical_volume_block   (StorageBlock *self);
 
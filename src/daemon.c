@@ -26,7 +26,9 @@
 #include "invocation.h"
 #include "job.h"
 #include "manager.h"
+#include "process.h"
 #include "spawnedjob.h"
+#include "stats.h"
 #include "threadedjob.h"
 #include "util.h"
 #include "volumegroup.h"
@@ -78,12 +80,16 @@ struct _StorageDaemon
 
   GDBusObjectManagerServer *object_manager;
   StorageManager *manager;
+  StorageStats *stats;
 
   /* may be NULL if polkit is masked */
   PolkitAuthority *authority;
 
   /* The libdir if overridden */
   gchar *resource_dir;
+
+  /* StorageProcess of helpers from spawn_for_variant, until reaped */
+  GHashTable *helpers;
 };
 
 struct _StorageDaemonClass
@@ -113,8 +119,10 @@ storage_daemon_finalize (GObject *object)
   g_clear_object (&self->authority);
   g_object_unref (self->connection);
   g_object_unref (self->manager);
+  g_clear_object (&self->stats);
   g_object_unref (self->object_manager);
   g_free (self->resource_dir);
+  g_hash_table_unref (self->helpers);
 
   storage_invocation_cleanup ();
 
@@ -184,6 +192,7 @@ storage_daemon_init (StorageDaemon *self)
   default_daemon = self;
 
   self->name_flags = G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT;
+  self->helpers = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -266,6 +275,9 @@ on_manager_ready (GObject *source,
   self->manager = storage_manager_new_finish (source, res);
   storage_daemon_publish (self, "/org/freedesktop/UDisks2/Manager", FALSE, self->manager);
 
+  self->stats = storage_stats_new ();
+  storage_daemon_publish (self, "/org/freedesktop/UDisks2/Manager", FALSE, self->stats);
+
   self->name_owner_id = g_bus_own_name_on_connection (self->connection,
                                                       "com.redhat.storaged",
                                                       self->name_flags,
@@ -275,27 +287,42 @@ on_manager_ready (GObject *source,
                                                       NULL);
 }
 
+static void
+on_authority_ready (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  StorageDaemon *self = user_data;
+  GError *error = NULL;
+
+  self->authority = polkit_authority_get_finish (result, &error);
+  if (self->authority == NULL)
+    {
+      g_warning ("Error initializing polkit authority: %s (%s, %d)",
+                 error->message, g_quark_to_string (error->domain), error->code);
+      g_error_free (error);
+    }
+
+  storage_invocation_set_authority (self->authority);
+  g_object_unref (self);
+}
+
 static void
 storage_daemon_constructed (GObject *object)
 {
   StorageDaemon *self = STORAGE_DAEMON (object);
-  GError *error;
 
   G_OBJECT_CLASS (storage_daemon_parent_class)->constructed (object);
 
+  storage_stats_initialize ();
+
   storage_invocation_initialize (self->connection,
                             on_client_appeared,
                             on_client_disappeared,
                             self);
 
-  error = NULL;
-  self->authority = polkit_authority_get_sync (NULL, &error);
-  if (self->authority == NULL)
-    {
-      g_warning ("Error initializing polkit authority: %s (%s, %d)",
-                 error->message, g_quark_to_string (error->domain), error->code);
-      g_error_free (error);
-    }
+  /* Don't hold up startup waiting for polkitd */
+  polkit_authority_get_async (NULL, on_authority_ready, g_object_ref (self));
 
   /* Yes, we use the same paths as the main udisks daemon on purpose */
   self->object_manager = g_dbus_object_manager_server_new ("/org/freedesktop/UDisks2");
@@ -472,7 +499,8 @@ static guint job_id = 0;
  * @command_line_format: printf()-style format for the command line to spawn.
  * @...: Arguments for @command_line_format.
  *
- * Launches a new job for @command_line_format.
+ * Launches a new job for @command_line_format. The command runs with
+ * the #StorageJobPolicy configured for @job_operation.
  *
  * The job is started immediately - connect to the
  * #UDisksSpawnedJob::spawned-job-completed or #UDisksJob::completed
@@ -525,6 +553,15 @@ storage_daemon_launch_spawned_job (StorageDaemon *self,
   return job;
 }
 
+static void
+on_job_output_line (StorageSpawnedJob *job,
+                    const gchar *stream,
+                    const gchar *line,
+                    gpointer user_data)
+{
+  lvm_job_output_emit_line (LVM_JOB_OUTPUT (user_data), stream, line);
+}
+
 StorageJob *
 storage_daemon_launch_spawned_jobv (StorageDaemon *self,
                                     gpointer object_or_interface,
@@ -538,13 +575,16 @@ storage_daemon_launch_spawned_jobv (StorageDaemon *self,
 {
   StorageSpawnedJob *job;
   GDBusObjectSkeleton *job_object;
+  LvmJobOutput *job_output;
   gchar *job_object_path;
 
   g_return_val_if_fail (STORAGE_IS_DAEMON (self), NULL);
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
 
   job = storage_spawned_job_new (argv, input_string,
-                                 run_as_uid, run_as_euid, cancellable);
+                                 run_as_uid, run_as_euid,
+                                 storage_job_policy_lookup (job_operation),
+                                 cancellable);
 
   if (object_or_interface != NULL)
     storage_job_add_thing (STORAGE_JOB (job), object_or_interface);
@@ -555,6 +595,12 @@ storage_daemon_launch_spawned_jobv (StorageDaemon *self,
   g_dbus_object_skeleton_add_interface (job_object, G_DBUS_INTERFACE_SKELETON (job));
   g_free (job_object_path);
 
+  /* Output is read from the main loop, so nothing has been missed yet */
+  job_output = lvm_job_output_skeleton_new ();
+  g_dbus_object_skeleton_add_interface (job_object, G_DBUS_INTERFACE_SKELETON (job_output));
+  g_signal_connect_object (job, "output-line", G_CALLBACK (on_job_output_line), job_output, 0);
+  g_object_unref (job_output);
+
   udisks_job_set_cancelable (UDISKS_JOB (job), TRUE);
   udisks_job_set_operation (UDISKS_JOB (job), job_operation);
   udisks_job_set_started_by_uid (UDISKS_JOB (job), job_started_by_uid);
@@ -583,6 +629,7 @@ storage_daemon_launch_spawned_jobv (StorageDaemon *self,
  * @cancellable: A #GCancellable or %NULL.
  *
  * Launches a new job by running @job_func in a new dedicated thread.
+ * The thread runs with the #StorageJobPolicy configured for @job_operation.
  *
  * The job is started immediately - connect to the
  * #StorageThreadedJob::threaded-job-completed or #StorageJob::completed
@@ -618,6 +665,7 @@ storage_daemon_launch_threaded_job  (StorageDaemon *daemon,
   job = storage_threaded_job_new (job_func,
                              user_data,
                              user_data_free_func,
+                             storage_job_policy_lookup (job_operation),
                              cancellable);
   if (object_or_interface != NULL)
     storage_job_add_thing (STORAGE_JOB (job), object_or_interface);
@@ -692,41 +740,40 @@ storage_daemon_get_jobs (StorageDaemon *self)
 }
 
 struct VariantReaderData {
+  StorageDaemon *daemon;
   const GVariantType *type;
   void (*callback) (GPid pid, GVariant *result, GError *error, gpointer user_data);
   gpointer user_data;
-  GPid pid;
-  GIOChannel *output_channel;
   GByteArray *output;
-  gint output_watch;
+  gchar *stats_name;
+  gint64 start_time;
 };
 
-static gboolean
-variant_reader_child_output (GIOChannel *source,
-                             GIOCondition condition,
+static void
+variant_reader_child_output (StorageProcess *process,
+                             gint fd,
+                             const gchar *buf,
+                             gsize len,
                              gpointer user_data)
 {
   struct VariantReaderData *data = user_data;
-  guint8 buf[1024];
-  gsize bytes_read;
-
-  g_io_channel_read_chars (source, (gchar *)buf, sizeof buf, &bytes_read, NULL);
-  g_byte_array_append (data->output, buf, bytes_read);
-  return TRUE;
+  g_byte_array_append (data->output, (const guint8 *)buf, len);
 }
 
 static void
-variant_reader_watch_child (GPid     pid,
-                            gint     status,
-                            gpointer user_data)
+variant_reader_child_exit (StorageProcess *process,
+                           gint status,
+                           gpointer user_data)
 {
   struct VariantReaderData *data = user_data;
-  guint8 *buf;
-  gsize buf_size;
+  GPid pid = storage_process_get_pid (process);
   GVariant *result;
   GError *error = NULL;
 
-  data->pid = 0;
+  g_hash_table_remove (data->daemon->helpers, GINT_TO_POINTER (pid));
+  storage_process_release (process, NULL, NULL);
+
+  storage_stats_record_since (data->stats_name, data->start_time);
 
   if (!g_spawn_check_exit_status (status, &error))
     {
@@ -736,12 +783,6 @@ variant_reader_watch_child (GPid     pid,
     }
   else
     {
-      if (g_io_channel_read_to_end (data->output_channel, (gchar **)&buf, &buf_size, NULL) == G_IO_STATUS_NORMAL)
-        {
-          g_byte_array_append (data->output, buf, buf_size);
-          g_free (buf);
-        }
-
       result = g_variant_new_from_data (data->type,
                                         data->output->data,
                                         data->output->len,
@@ -751,16 +792,33 @@ variant_reader_watch_child (GPid     pid,
       data->callback (pid, result, NULL, data->user_data);
       g_variant_unref (result);
     }
+
+  g_free (data->stats_name);
+  g_free (data);
 }
 
-static void
-variant_reader_destroy (gpointer user_data)
+static gchar *
+variant_reader_stats_name (const gchar **argv)
 {
-  struct VariantReaderData *data = user_data;
+  gchar *base;
+  gchar *name;
+  gint i;
 
-  g_source_remove (data->output_watch);
-  g_io_channel_unref (data->output_channel);
-  g_free (data);
+  /* The helper's command, like "list" or "show", is what's interesting */
+  for (i = 1; argv[i] != NULL; i++)
+    {
+      if (argv[i][0] != '-')
+        break;
+    }
+
+  base = g_path_get_basename (argv[0]);
+  if (g_str_equal (base, "storaged-lvm-helper") && argv[i] != NULL)
+    name = g_strdup_printf ("helper.%s", argv[i]);
+  else
+    name = g_strdup_printf ("spawn.%s", base);
+
+  g_free (base);
+  return name;
 }
 
 GPid
@@ -772,9 +830,9 @@ storage_daemon_spawn_for_variant (StorageDaemon *daemon,
 {
   GError *error = NULL;
   struct VariantReaderData *data;
+  StorageProcess *process;
   gchar *prog = NULL;
   GPid pid;
-  gint output_fd;
   gchar *cmd;
 
   /*
@@ -792,43 +850,63 @@ storage_daemon_spawn_for_variant (StorageDaemon *daemon,
   g_debug ("spawning for variant: %s", cmd);
   g_free (cmd);
 
-  if (!g_spawn_async_with_pipes (NULL,
-                                 (gchar **)argv,
-                                 NULL,
-                                 G_SPAWN_DO_NOT_REAP_CHILD,
-                                 NULL,
-                                 NULL,
-                                 &pid,
-                                 NULL,
-                                 &output_fd,
-                                 NULL,
-                                 &error))
-    {
-      callback (0, NULL, error, user_data);
-      g_error_free (error);
-      return 0;
-    }
-
   data = g_new0 (struct VariantReaderData, 1);
 
+  data->daemon = daemon;
   data->type = type;
   data->callback = callback;
   data->user_data = user_data;
 
-  data->pid = pid;
+  data->stats_name = variant_reader_stats_name (argv);
+  data->start_time = g_get_monotonic_time ();
   data->output = g_byte_array_new ();
-  data->output_channel = g_io_channel_unix_new (output_fd);
-  g_io_channel_set_encoding (data->output_channel, NULL, NULL);
-  g_io_channel_set_flags (data->output_channel, G_IO_FLAG_NONBLOCK, NULL);
-  data->output_watch = g_io_add_watch (data->output_channel, G_IO_IN, variant_reader_child_output, data);
 
-  g_child_watch_add_full (G_PRIORITY_DEFAULT_IDLE,
-                          pid, variant_reader_watch_child, data, variant_reader_destroy);
+  process = storage_process_spawn (argv, STORAGE_PROCESS_INHERIT_STDERR,
+                                   NULL, NULL, NULL,
+                                   variant_reader_child_output,
+                                   variant_reader_child_exit,
+                                   data, &error);
+  if (process == NULL)
+    {
+      callback (0, NULL, error, user_data);
+      g_error_free (error);
+      g_byte_array_free (data->output, TRUE);
+      g_free (data->stats_name);
+      g_free (data);
+      g_free (prog);
+      return 0;
+    }
+
+  pid = storage_process_get_pid (process);
+  g_hash_table_insert (daemon->helpers, GINT_TO_POINTER (pid), process);
+
+  cmd = g_strconcat (data->stats_name, ".spawned", NULL);
+  storage_stats_count (cmd, 1);
+  g_free (cmd);
 
   g_free (prog);
   return pid;
 }
 
+/*
+ * Sends @signum to a helper started by storage_daemon_spawn_for_variant,
+ * unless it has exited already. Until its callback has been called, the
+ * helper is not reaped, so @pid can't belong to some other process.
+ */
+gboolean
+storage_daemon_kill_spawned (StorageDaemon *daemon,
+                             GPid pid,
+                             gint signum)
+{
+  StorageProcess *process;
+
+  process = g_hash_table_lookup (daemon->helpers, GINT_TO_POINTER (pid));
+  if (process == NULL)
+    return FALSE;
+
+  return storage_process_kill (process, signum);
+}
+
 void
 storage_daemon_publish (StorageDaemon *self,
                         const gchar *path,
@@ -97,6 +97,10 @@ GPid                       storage_daemon_spawn_for_variant   (StorageDaemon *se
                                                                void (*callback) (GPid, GVariant *, GError *, gpointer),
                                                                gpointer user_data);
 
+gboolean                   storage_daemon_kill_spawned        (StorageDaemon *self,
+                                                               GPid pid,
+                                                               gint signum);
+
 G_END_DECLS
 
 #endif /* __STORAGE_DAEMON_H__ */
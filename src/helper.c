@@ -33,7 +33,11 @@
    seem to be thread-safe, so we use processes.
 
    However, we don't want to risk blocking during startup of storaged.
-   In that case, we ignore locks.
+   In that case, we ignore locks.  Since the data read without locks
+   might be inconsistent, "show" then also reports whether a writer
+   held the volume group lock while we were reading it.  Storaged uses
+   that to decide which volume groups need to be read again once it is
+   up.
 
    The program can list all volume groups or can return all needed
    information for a single volume group.  Output is a GVariant, by
@@ -43,9 +47,14 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <glib.h>
 #include <lvm2app.h>
 
+#include "lvmconfig.h"
+
 static gboolean opt_binary = FALSE;
 static gboolean opt_no_lock = FALSE;
 
@@ -87,6 +96,47 @@ list_volume_groups (void)
   return g_variant_builder_end (&result);
 }
 
+/*
+ * LVM takes an exclusive flock on this file while it changes the
+ * volume group.  Holding a shared one for as long as we read means
+ * that nobody can change it meanwhile, without waiting for anybody
+ * who is changing it right now.  Returns the locked fd to close when
+ * done, or -1.  Sets @locked when somebody is writing.  The file is
+ * created like LVM does, so that a writer who comes along later can't
+ * miss our lock.  When it can't be opened or locked for any other
+ * reason, nothing tells us that the read was consistent, so it counts
+ * as locked as well.
+ */
+static int
+lock_volume_group (const char *name,
+                   gboolean *locked)
+{
+  gchar *path;
+  int fd;
+
+  *locked = FALSE;
+
+  path = g_strdup_printf ("%s/V_%s", LVM_LOCKING_DIR, name);
+  fd = open (path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0777);
+  g_free (path);
+
+  if (fd < 0)
+    {
+      *locked = TRUE;
+      return -1;
+    }
+
+  if (flock (fd, LOCK_SH | LOCK_NB) < 0)
+    {
+      /* Not only EWOULDBLOCK: without the lock the read isn't verified */
+      *locked = TRUE;
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
 static void
 add_string (GVariantBuilder *bob,
             const gchar *key,
@@ -162,6 +212,11 @@ show_volume_group (const char *name)
   lvm_t lvm;
   vg_t vg;
   GVariantBuilder result;
+  gboolean locked = FALSE;
+  int lock_fd = -1;
+
+  if (opt_no_lock)
+    lock_fd = lock_volume_group (name, &locked);
 
   lvm = init_lvm ();
   vg = lvm_vg_open (lvm, name, "r", 0);
@@ -180,6 +235,7 @@ show_volume_group (const char *name)
       add_uint64 (&result, "size", lvm_vg_get_size (vg));
       add_uint64 (&result, "free-size", lvm_vg_get_free_size (vg));
       add_uint64 (&result, "extent-size", lvm_vg_get_extent_size (vg));
+      add_uint64 (&result, "seqno", lvm_vg_get_seqno (vg));
 
       g_variant_builder_init (&lvs, G_VARIANT_TYPE("aa{sv}"));
       list = lvm_vg_list_lvs (vg);
@@ -200,6 +256,9 @@ show_volume_group (const char *name)
       g_variant_builder_add (&result, "{sv}", "pvs", g_variant_builder_end (&pvs));
 
       lvm_vg_close (vg);
+
+      if (opt_no_lock)
+        g_variant_builder_add (&result, "{sv}", "locked", g_variant_new_boolean (locked));
     }
   else
     {
@@ -207,6 +266,9 @@ show_volume_group (const char *name)
       exit (2);
     }
 
+  if (lock_fd >= 0)
+    close (lock_fd);
+
   lvm_quit (lvm);
   return g_variant_builder_end (&result);
 }
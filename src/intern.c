@@ -0,0 +1,188 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "intern.h"
+#include "stats.h"
+
+#include <string.h>
+
+/**
+ * SECTION:storageintern
+ * @title: Interned strings
+ * @short_description: Sharing names and paths between objects
+ *
+ * With tens of thousands of logical volumes, the same names and paths
+ * are kept by the model objects and by the hash tables that index them.
+ * Instead of each keeping its own copy, they share one reference
+ * counted copy from storage_intern().  Unlike g_intern_string(), the
+ * copy goes away again with its last reference.
+ *
+ * The "intern.strings" and "intern.bytes" counters say how many
+ * distinct strings are kept and how much memory they take, and
+ * "intern.saved" how much the copies of them would have taken in
+ * addition.  They are only published when the counters are read, see
+ * storage_intern_publish_stats(), to keep taking references cheap.
+ */
+
+typedef struct {
+  guint ref_count;
+  gsize size;               /* of str, with the terminating nul */
+  gchar str[1];
+} Interned;
+
+static struct {
+  GMutex mutex;
+  GHashTable *strings;      /* str -> Interned *, owned by the Interned */
+  guint64 bytes;
+  guint64 saved;
+} intern;
+
+static Interned *
+interned_of (const gchar *str)
+{
+  return (Interned *)(str - G_STRUCT_OFFSET (Interned, str));
+}
+
+/**
+ * storage_intern:
+ * @str: A string.
+ *
+ * Returns the shared copy of @str, making one if there is none yet.
+ * Thread-safe.
+ *
+ * Returns: The shared copy of @str, or %NULL if @str is %NULL. Give
+ *   it up with storage_intern_unref().
+ */
+const gchar *
+storage_intern (const gchar *str)
+{
+  Interned *interned;
+  gsize len;
+
+  if (str == NULL)
+    return NULL;
+
+  g_mutex_lock (&intern.mutex);
+
+  if (intern.strings == NULL)
+    intern.strings = g_hash_table_new (g_str_hash, g_str_equal);
+
+  interned = g_hash_table_lookup (intern.strings, str);
+  if (interned != NULL)
+    {
+      interned->ref_count++;
+      intern.saved += interned->size;
+    }
+  else
+    {
+      len = strlen (str);
+      interned = g_malloc (G_STRUCT_OFFSET (Interned, str) + len + 1);
+      interned->ref_count = 1;
+      interned->size = len + 1;
+      memcpy (interned->str, str, len + 1);
+      g_hash_table_insert (intern.strings, interned->str, interned);
+      intern.bytes += G_STRUCT_OFFSET (Interned, str) + interned->size;
+    }
+
+  g_mutex_unlock (&intern.mutex);
+
+  return interned->str;
+}
+
+/**
+ * storage_intern_ref:
+ * @interned: A string from storage_intern(), or %NULL.
+ *
+ * Takes another reference to @interned. Thread-safe.
+ *
+ * Returns: @interned.
+ */
+const gchar *
+storage_intern_ref (const gchar *interned)
+{
+  if (interned == NULL)
+    return NULL;
+
+  g_mutex_lock (&intern.mutex);
+  interned_of (interned)->ref_count++;
+  intern.saved += interned_of (interned)->size;
+  g_mutex_unlock (&intern.mutex);
+
+  return interned;
+}
+
+/**
+ * storage_intern_unref:
+ * @interned: A string from storage_intern(), or %NULL.
+ *
+ * Gives up a reference to @interned, and frees it with the last one.
+ * Can be used as the #GDestroyNotify of hash table keys. Thread-safe.
+ */
+void
+storage_intern_unref (const gchar *interned)
+{
+  Interned *entry;
+
+  if (interned == NULL)
+    return;
+
+  entry = interned_of (interned);
+
+  g_mutex_lock (&intern.mutex);
+  if (--entry->ref_count > 0)
+    {
+      intern.saved -= entry->size;
+    }
+  else
+    {
+      g_hash_table_remove (intern.strings, entry->str);
+      intern.bytes -= G_STRUCT_OFFSET (Interned, str) + entry->size;
+      g_free (entry);
+    }
+  g_mutex_unlock (&intern.mutex);
+}
+
+/**
+ * storage_intern_publish_stats:
+ *
+ * Copies the current size of the string table into the
+ * "intern.strings", "intern.bytes" and "intern.saved" counters.
+ * Called when the counters are read. Thread-safe.
+ */
+void
+storage_intern_publish_stats (void)
+{
+  guint64 strings;
+  guint64 bytes;
+  guint64 saved;
+
+  g_mutex_lock (&intern.mutex);
+  strings = intern.strings ? g_hash_table_size (intern.strings) : 0;
+  bytes = intern.bytes;
+  saved = intern.saved;
+  g_mutex_unlock (&intern.mutex);
+
+  storage_stats_set ("intern.strings", strings);
+  storage_stats_set ("intern.bytes", bytes);
+  storage_stats_set ("intern.saved", saved);
+}
@@ -16,6 +16,7 @@
 #include "daemon.h"
 #include "com.redhat.lvm2.h"
 #include "invocation.h"
+#include "stats.h"
 #include "util.h"
 
 #include <glib.h>
@@ -23,6 +24,7 @@
 
 #include <polkit/polkit.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 enum {
@@ -40,17 +42,47 @@ struct {
   gpointer client_user_data;
 
   GMutex mutex;
-  GCond wait_cond;
   GHashTable *clients;
   PolkitAuthority *authority;
+  GDBusConnection *connection;
+
+  /* Only touched in the main context */
+  gboolean authority_loading;
+  GList *authority_waiting;
+
+  /* Guarded by the mutex */
+  GHashTable *traces;
+  GList *credentials_queue;
 } inv;
 
+/* Calls that take longer than this get logged, see below */
+static gint64 slow_call_usec = 1000 * 1000;
+
+/* How long a positive polkit result is reused, see below */
+static gint64 authorization_ttl_usec = 10 * 1000 * 1000;
+
+/* Don't let calls that never get a reply fill up memory, see below */
+#define MAX_TRACES 1024
+#define MAX_TRACE_STAGES 16
+
+typedef struct {
+  gchar *method;
+  gchar *sender;
+  guint n_stages;
+  struct {
+    const gchar *name;
+    gint64 time;
+  } stages[MAX_TRACE_STAGES];
+} InvocationTrace;
+
 typedef struct {
   gint refs;
 
   /* Guarded by the mutex */
   uid_t uid_peer;
   gint uid_state;
+  GHashTable *authorized;
+  GList *waiting;
 
   /* Never change once configured */
   guint watch;
@@ -66,6 +98,7 @@ invocation_client_unref (gpointer data)
   if (g_atomic_int_dec_and_test (&client->refs))
     {
       g_object_unref (client->subject);
+      g_hash_table_destroy (client->authorized);
       if (client->watch)
         g_bus_unwatch_name (client->watch);
       g_free (client->bus_name);
@@ -97,25 +130,19 @@ invocation_client_lookup (GDBusMethodInvocation *invocation,
   if (client)
     {
       invocation_client_ref (client);
+
+      /*
+       * Calls are only dispatched once the credentials are known, see
+       * authorization_begin(), so this never has to wait.
+       */
       if (uid_of_client)
         {
           *uid_of_client = G_MAXUINT;
-          while (client->uid_state == UID_LOADING)
-            g_cond_wait (&inv.wait_cond, &inv.mutex);
-
-          switch (client->uid_state)
-            {
-            case UID_VALID:
-              *uid_of_client = client->uid_peer;
-              break;
-            case UID_FAILED:
-              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
-                           "Cannot determine the unix credentials of the calling process");
-              break;
-            default:
-              g_assert_not_reached ();
-              break;
-            }
+          if (client->uid_state == UID_VALID)
+            *uid_of_client = client->uid_peer;
+          else
+            g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                         "Cannot determine the unix credentials of the calling process");
         }
     }
   else
@@ -130,45 +157,118 @@ invocation_client_lookup (GDBusMethodInvocation *invocation,
   return client;
 }
 
+static void authorization_continue (gpointer data,
+                                    gpointer user_data);
+
 static void
-on_get_connection_unix_user (GObject *source,
-                             GAsyncResult *res,
-                             gpointer user_data)
+on_get_connection_credentials (GObject *source,
+                               GAsyncResult *res,
+                               gpointer user_data)
 {
-  gchar *bus_name = user_data;
-  InvocationClient *client;
+  InvocationClient *client = user_data;
   GError *error = NULL;
   GVariant *value;
+  GVariant *creds;
+  GList *waiting;
+  guint32 uid = ~0;
+  gint state = UID_FAILED;
 
   value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source),
                                          res, &error);
 
-  g_mutex_lock (&inv.mutex);
-
-  client = g_hash_table_lookup (inv.clients, bus_name);
+  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      /* Older bus daemons don't have GetConnectionCredentials */
+      g_clear_error (&error);
+      g_dbus_connection_call (G_DBUS_CONNECTION (source),
+                              "org.freedesktop.DBus",  /* bus name */
+                              "/org/freedesktop/DBus", /* object path */
+                              "org.freedesktop.DBus",  /* interface */
+                              "GetConnectionUnixUser", /* method */
+                              g_variant_new ("(s)", client->bus_name),
+                              G_VARIANT_TYPE ("(u)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1, /* timeout_msec */
+                              NULL, on_get_connection_credentials,
+                              client);
+      return;
+    }
 
   if (error == NULL)
     {
-      if (client)
+      if (g_variant_is_of_type (value, G_VARIANT_TYPE ("(u)")))
+        {
+          g_variant_get (value, "(u)", &uid);
+          state = UID_VALID;
+        }
+      else
         {
-          g_variant_get (value, "(u)", &client->uid_peer);
-          client->uid_state = UID_VALID;
+          g_variant_get (value, "(@a{sv})", &creds);
+          if (g_variant_lookup (creds, "UnixUserID", "u", &uid))
+            state = UID_VALID;
+          g_variant_unref (creds);
         }
       g_variant_unref (value);
-      g_debug ("GetConnectionUnixUser('%s') == %u", bus_name, client->uid_peer);
+    }
+
+  if (state == UID_VALID)
+    {
+      g_debug ("Credentials of '%s': uid %u", client->bus_name, uid);
     }
   else
     {
-      if (client)
-        client->uid_state = UID_FAILED;
-      g_critical ("GetConnectionUnixUser('%s') failed: %s", bus_name, error->message);
-      g_error_free (error);
+      g_critical ("Couldn't get credentials of '%s': %s", client->bus_name,
+                  error ? error->message : "no UnixUserID");
+      g_clear_error (&error);
     }
 
-  g_cond_broadcast (&inv.wait_cond);
+  g_mutex_lock (&inv.mutex);
+  client->uid_peer = uid;
+  client->uid_state = state;
+  waiting = g_list_reverse (client->waiting);
+  client->waiting = NULL;
   g_mutex_unlock (&inv.mutex);
 
-  g_free (bus_name);
+  /* Calls that arrived while we were asking, in the order they came */
+  g_list_foreach (waiting, authorization_continue, NULL);
+  g_list_free (waiting);
+
+  invocation_client_unref (client);
+}
+
+static gboolean
+on_flush_credentials (gpointer user_data)
+{
+  InvocationClient *client;
+  GList *queue, *l;
+
+  g_mutex_lock (&inv.mutex);
+  queue = g_list_reverse (inv.credentials_queue);
+  inv.credentials_queue = NULL;
+  g_mutex_unlock (&inv.mutex);
+
+  /*
+   * Send these all at once, rather than one after the other as the
+   * clients showed up, and let the bus answer them as a batch.
+   */
+  for (l = queue; l != NULL; l = g_list_next (l))
+    {
+      client = l->data;
+      g_dbus_connection_call (inv.connection,
+                              "org.freedesktop.DBus",    /* bus name */
+                              "/org/freedesktop/DBus",   /* object path */
+                              "org.freedesktop.DBus",    /* interface */
+                              "GetConnectionCredentials", /* method */
+                              g_variant_new ("(s)", client->bus_name),
+                              G_VARIANT_TYPE ("(a{sv})"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1, /* timeout_msec */
+                              NULL, on_get_connection_credentials,
+                              client); /* owns the reference */
+    }
+
+  g_list_free (queue);
+  return FALSE;
 }
 
 static gboolean
@@ -199,7 +299,12 @@ on_client_vanished (GDBusConnection *connection,
   g_mutex_lock (&inv.mutex);
   client = g_hash_table_lookup (inv.clients, name);
   if (client)
-    g_hash_table_steal (inv.clients, name);
+    {
+      g_hash_table_steal (inv.clients, name);
+
+      /* A new owner of this name must not inherit any authorizations */
+      g_hash_table_remove_all (client->authorized);
+    }
   g_mutex_unlock (&inv.mutex);
 
   if (client)
@@ -216,6 +321,7 @@ invocation_client_create (GDBusConnection *connection,
                           const gchar *bus_name)
 {
   InvocationClient *client;
+  gboolean flush = FALSE;
 
   g_mutex_lock (&inv.mutex);
   client = g_hash_table_lookup (inv.clients, bus_name);
@@ -228,15 +334,11 @@ invocation_client_create (GDBusConnection *connection,
    * Each time we see an incoming function call, keep the service alive for
    * that client, and each invocation of the client
    *
-   * We would also like to get client credentials here and not pass client
-   * messages into the rest of the machinery until that has completed.
-   * Unfortunately the necessary patch in gio has not yet been merged.
-   *
-   * So we do an async call and if it hasn't completed by the time we need
-   * the caller credentials, then we block and wait for it. Since it's the
-   * system bus responding, it should respond pretty quickly.
+   * The client's credentials are requested from the main context along
+   * with those of any other new clients. Method calls from the client
+   * are not authorized or dispatched until they arrive.
    *
-   * See invocation_client_lookup() for the waiting side of things.
+   * See authorization_begin() for the waiting side of things.
    */
 
   client = g_new0 (InvocationClient, 1);
@@ -245,38 +347,26 @@ invocation_client_create (GDBusConnection *connection,
   client->refs = 1;
   client->uid_peer = ~0;
   client->uid_state = UID_LOADING;
+  client->authorized = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
   client->watch = g_bus_watch_name_on_connection (connection, bus_name,
                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
                                                   NULL, on_client_vanished, NULL, NULL);
 
-  g_debug ("GetConnectionUnixUser('%s') ...", bus_name);
-
-  /*
-   * This async call in the GDBusWorker thread main context will not
-   * be blocked by the daemon main context blocking.
-   */
-
-  g_dbus_connection_call (connection,
-                          "org.freedesktop.DBus",  /* bus name */
-                          "/org/freedesktop/DBus", /* object path */
-                          "org.freedesktop.DBus",  /* interface */
-                          "GetConnectionUnixUser", /* method */
-                          g_variant_new ("(s)", bus_name),
-                          G_VARIANT_TYPE ("(u)"),
-                          G_DBUS_CALL_FLAGS_NONE,
-                          -1, /* timeout_msec */
-                          NULL, on_get_connection_unix_user,
-                          g_strdup (bus_name));
-
   g_mutex_lock (&inv.mutex);
   if (!g_hash_table_lookup (inv.clients, bus_name))
     {
       g_hash_table_replace (inv.clients, client->bus_name, client);
+      flush = (inv.credentials_queue == NULL);
+      inv.credentials_queue = g_list_prepend (inv.credentials_queue,
+                                              invocation_client_ref (client));
       client = NULL;
     }
   g_mutex_unlock (&inv.mutex);
 
+  if (flush)
+    g_main_context_invoke (NULL, on_flush_credentials, NULL);
+
   if (client)
     {
       invocation_client_unref (client);
@@ -289,6 +379,272 @@ invocation_client_create (GDBusConnection *connection,
     }
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
+
+/*
+ * Each method call gets a trace, from the moment it arrives in the
+ * connection filter until its reply goes out.  Interesting points in
+ * between add a stage with storage_invocation_trace().  Completed
+ * traces feed the "call.*" histograms and slow calls get logged.
+ *
+ * Traces are keyed by sender and serial, since that's what a reply
+ * carries as well.
+ *
+ * Clients can send any interface and member name they like, so only
+ * methods that the daemon actually implements get their own
+ * histograms.  All others are traced as "unknown".
+ */
+
+static const struct {
+  const gchar *interface;
+  const gchar *members[4];
+} standard_methods[] = {
+  { "org.freedesktop.DBus.Properties", { "Get", "GetAll", "Set", NULL } },
+  { "org.freedesktop.DBus.ObjectManager", { "GetManagedObjects", NULL } },
+  { "org.freedesktop.DBus.Introspectable", { "Introspect", NULL } },
+  { "org.freedesktop.DBus.Peer", { "Ping", "GetMachineId", NULL } },
+};
+
+static gboolean
+trace_method_is_known (const gchar *interface,
+                       const gchar *member)
+{
+  GDBusInterfaceInfo *infos[] = {
+    lvm_manager_interface_info (),
+    lvm_stats_interface_info (),
+    lvm_job_output_interface_info (),
+    lvm_logical_volume_block_interface_info (),
+    lvm_physical_volume_block_interface_info (),
+    lvm_volume_group_interface_info (),
+    lvm_logical_volume_interface_info (),
+    udisks_job_interface_info (),
+  };
+  guint i, j;
+
+  if (interface == NULL || member == NULL)
+    return FALSE;
+
+  for (i = 0; i < G_N_ELEMENTS (infos); i++)
+    {
+      if (g_str_equal (infos[i]->name, interface))
+        return g_dbus_interface_info_lookup_method (infos[i], member) != NULL;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (standard_methods); i++)
+    {
+      if (!g_str_equal (standard_methods[i].interface, interface))
+        continue;
+      for (j = 0; standard_methods[i].members[j] != NULL; j++)
+        {
+          if (g_str_equal (standard_methods[i].members[j], member))
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static gboolean
+trace_evict_oldest (void)
+{
+  GHashTableIter iter;
+  InvocationTrace *trace;
+  gpointer oldest = NULL;
+  gpointer key;
+  gint64 begin = G_MAXINT64;
+
+  /* Called with the mutex held */
+  g_hash_table_iter_init (&iter, inv.traces);
+  while (g_hash_table_iter_next (&iter, &key, (gpointer *)&trace))
+    {
+      if (trace->stages[0].time < begin)
+        {
+          begin = trace->stages[0].time;
+          oldest = key;
+        }
+    }
+
+  if (oldest == NULL)
+    return FALSE;
+
+  g_hash_table_remove (inv.traces, oldest);
+  return TRUE;
+}
+
+static gchar *
+trace_key (const gchar *sender,
+           guint32 serial)
+{
+  return g_strdup_printf ("%s/%u", sender, serial);
+}
+
+static void
+invocation_trace_free (gpointer data)
+{
+  InvocationTrace *trace = data;
+  g_free (trace->method);
+  g_free (trace->sender);
+  g_free (trace);
+}
+
+static void
+trace_add_stage (InvocationTrace *trace,
+                 const gchar *stage)
+{
+  /* Called with the mutex held */
+  if (trace->n_stages < MAX_TRACE_STAGES)
+    {
+      trace->stages[trace->n_stages].name = stage;
+      trace->stages[trace->n_stages].time = g_get_monotonic_time ();
+      trace->n_stages++;
+    }
+}
+
+static void
+trace_begin (GDBusMessage *message)
+{
+  InvocationTrace *trace;
+  const gchar *interface;
+  const gchar *member;
+
+  if (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)
+    return;
+
+  trace = g_new0 (InvocationTrace, 1);
+  trace->sender = g_strdup (g_dbus_message_get_sender (message));
+  interface = g_dbus_message_get_interface (message);
+  member = g_dbus_message_get_member (message);
+  if (trace_method_is_known (interface, member))
+    trace->method = g_strdup_printf ("%s.%s", interface, member);
+  else
+    trace->method = g_strdup ("unknown");
+  trace_add_stage (trace, "received");
+
+  g_mutex_lock (&inv.mutex);
+
+  /*
+   * Calls that never get a reply, such as those of callers that went
+   * away, would otherwise stay here forever.
+   */
+  while (g_hash_table_size (inv.traces) >= MAX_TRACES && trace_evict_oldest ())
+    storage_stats_count ("call.traces-evicted", 1);
+
+  g_hash_table_replace (inv.traces,
+                        trace_key (trace->sender, g_dbus_message_get_serial (message)),
+                        trace);
+  g_mutex_unlock (&inv.mutex);
+}
+
+static void
+trace_finish (InvocationTrace *trace)
+{
+  GString *breakdown;
+  gint64 begin;
+  gint64 total;
+  gchar *name;
+  guint i;
+
+  begin = trace->stages[0].time;
+  total = trace->stages[trace->n_stages - 1].time - begin;
+
+  name = g_strdup_printf ("call.%s", trace->method);
+  storage_stats_record (name, total);
+  g_free (name);
+
+  for (i = 1; i < trace->n_stages; i++)
+    {
+      name = g_strdup_printf ("call.%s.%s", trace->method, trace->stages[i].name);
+      storage_stats_record (name, trace->stages[i].time - trace->stages[i - 1].time);
+      g_free (name);
+    }
+
+  if (slow_call_usec > 0 && total >= slow_call_usec)
+    {
+      breakdown = g_string_new ("");
+      for (i = 0; i < trace->n_stages; i++)
+        {
+          g_string_append_printf (breakdown, "%s%s=%" G_GINT64_FORMAT "ms",
+                                  i == 0 ? "" : " ", trace->stages[i].name,
+                                  (trace->stages[i].time - begin) / 1000);
+        }
+      g_message ("Slow call: method=%s sender=%s total=%" G_GINT64_FORMAT "ms stages: %s",
+                 trace->method, trace->sender, total / 1000, breakdown->str);
+      g_string_free (breakdown, TRUE);
+    }
+}
+
+static void
+trace_complete (GDBusMessage *reply)
+{
+  InvocationTrace *trace = NULL;
+  gpointer key;
+  gchar *lookup;
+
+  lookup = trace_key (g_dbus_message_get_destination (reply),
+                      g_dbus_message_get_reply_serial (reply));
+
+  g_mutex_lock (&inv.mutex);
+  if (g_hash_table_lookup_extended (inv.traces, lookup, &key, (gpointer *)&trace))
+    {
+      g_hash_table_steal (inv.traces, lookup);
+      g_free (key);
+      trace_add_stage (trace, "completed");
+    }
+  g_mutex_unlock (&inv.mutex);
+
+  g_free (lookup);
+
+  if (trace)
+    {
+      trace_finish (trace);
+      invocation_trace_free (trace);
+    }
+}
+
+/**
+ * storage_invocation_trace:
+ * @invocation: A method invocation.
+ * @stage: A static string naming the stage that was reached.
+ *
+ * Records that handling of @invocation reached @stage, for the call
+ * latency breakdown. Thread-safe.
+ */
+void
+storage_invocation_trace (GDBusMethodInvocation *invocation,
+                          const gchar *stage)
+{
+  InvocationTrace *trace;
+  GDBusMessage *message;
+  gchar *key;
+
+  message = g_dbus_method_invocation_get_message (invocation);
+  key = trace_key (g_dbus_message_get_sender (message),
+                   g_dbus_message_get_serial (message));
+
+  g_mutex_lock (&inv.mutex);
+  trace = g_hash_table_lookup (inv.traces, key);
+  if (trace)
+    trace_add_stage (trace, stage);
+  g_mutex_unlock (&inv.mutex);
+
+  g_free (key);
+}
+
+/**
+ * storage_invocation_set_slow_call_threshold:
+ * @msec: Threshold in milliseconds, or 0 to not log slow calls.
+ *
+ * Method calls taking at least @msec get a breakdown of where the
+ * time went in the log. Call before storage_invocation_initialize().
+ */
+void
+storage_invocation_set_slow_call_threshold (guint msec)
+{
+  slow_call_usec = (gint64)msec * 1000;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static GDBusMessage *
 on_connection_filter (GDBusConnection *connection,
                       GDBusMessage *message,
@@ -298,39 +654,32 @@ on_connection_filter (GDBusConnection *connection,
   GDBusMessageType type;
   const gchar *sender;
 
+  type = g_dbus_message_get_message_type (message);
+
   if (!incoming)
-    return message;
+    {
+      if (type == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+          g_strcmp0 (g_dbus_message_get_member (message), "PropertiesChanged") == 0)
+        storage_stats_count ("dbus.properties-changed", 1);
+      else if (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+               type == G_DBUS_MESSAGE_TYPE_ERROR)
+        trace_complete (message);
+      return message;
+    }
 
-  type = g_dbus_message_get_message_type (message);
   if (type == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
     {
       sender = g_dbus_message_get_sender (message);
       g_return_val_if_fail (sender != NULL, NULL);
+      trace_begin (message);
       invocation_client_create (connection, sender);
     }
 
   return message;
 }
 
-typedef struct {
-  GObject *instance;
-  PolkitDetails *details;
-} ObjectGetDetails;
-
-static gboolean
-object_get_polkit_details (gpointer user_data)
-{
-  ObjectGetDetails *ogd = user_data;
-  g_object_get (ogd->instance, "polkit-details", &ogd->details, NULL);
-  g_mutex_lock (&inv.mutex);
-  g_cond_broadcast (&inv.wait_cond);
-  g_mutex_unlock (&inv.mutex);
-  return FALSE;
-}
-
 static const gchar *
 lookup_method_action_and_details (gpointer instance,
-                                  InvocationClient *client,
                                   uid_t uid,
                                   const GDBusMethodInfo *method,
                                   PolkitDetails **details)
@@ -356,18 +705,7 @@ lookup_method_action_and_details (gpointer instance,
 
   object_class = G_OBJECT_GET_CLASS (instance);
   if (g_object_class_find_property (object_class, "polkit-details") != NULL)
-    {
-      ObjectGetDetails ogd = { instance, NULL };
-
-      g_main_context_invoke (NULL, object_get_polkit_details, &details);
-
-      g_mutex_lock (&inv.mutex);
-      while (ogd.details == NULL)
-        g_cond_wait (&inv.wait_cond, &inv.mutex);
-      g_mutex_unlock (&inv.mutex);
-
-      *details = ogd.details;
-    }
+    g_object_get (instance, "polkit-details", details, NULL);
 
   if (!*details || polkit_details_lookup (*details, "polkit.message"))
     {
@@ -430,53 +768,263 @@ authorize_without_polkit (InvocationClient *client,
   return FALSE;
 }
 
+/*
+ * Clients like to call Poll() and friends over and over, and asking
+ * polkit each time costs a round trip to polkitd.  So remember positive
+ * results for a short while, per client.  The key is the uid, action
+ * and the full details: a different device or message is a different
+ * question.
+ *
+ * Only results that were granted without any user interaction are
+ * remembered. A challenge is never a positive result, and a result
+ * obtained by authenticating (even if polkit retains it) should be
+ * asked for again, so that polkit stays in charge of its expiry.
+ */
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+static gchar *
+authorization_cache_key (uid_t uid,
+                         const gchar *action_id,
+                         PolkitDetails *details)
+{
+  GString *key;
+  gchar **keys;
+  guint i;
+
+  key = g_string_new ("");
+  g_string_append_printf (key, "%u\n%s", (guint)uid, action_id);
+
+  if (details)
+    {
+      keys = polkit_details_get_keys (details);
+      if (keys)
+        {
+          qsort (keys, g_strv_length (keys), sizeof (gchar *), compare_strings);
+          for (i = 0; keys[i] != NULL; i++)
+            {
+              g_string_append_printf (key, "\n%s=%s", keys[i],
+                                      polkit_details_lookup (details, keys[i]));
+            }
+          g_strfreev (keys);
+        }
+    }
+
+  return g_string_free (key, FALSE);
+}
+
 static gboolean
-on_authorize_method (GDBusInterfaceSkeleton *instance,
-                     GDBusMethodInvocation *invocation,
-                     gpointer user_data)
+authorization_cache_lookup (InvocationClient *client,
+                            const gchar *key)
 {
-  const GDBusMethodInfo *info;
-  PolkitAuthorizationResult *result = NULL;
-  PolkitCheckAuthorizationFlags flags;
+  gint64 *expires;
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&inv.mutex);
+  expires = g_hash_table_lookup (client->authorized, key);
+  if (expires)
+    {
+      if (*expires > g_get_monotonic_time ())
+        ret = TRUE;
+      else
+        g_hash_table_remove (client->authorized, key);
+    }
+  g_mutex_unlock (&inv.mutex);
+
+  return ret;
+}
+
+static void
+authorization_cache_store (InvocationClient *client,
+                           const gchar *key,
+                           PolkitAuthorizationResult *result)
+{
+  gint64 *expires;
+
+  if (authorization_ttl_usec <= 0 ||
+      !polkit_authorization_result_get_is_authorized (result) ||
+      polkit_authorization_result_get_is_challenge (result) ||
+      polkit_authorization_result_get_temporary_authorization_id (result) != NULL)
+    return;
+
+  expires = g_new (gint64, 1);
+  *expires = g_get_monotonic_time () + authorization_ttl_usec;
+
+  g_mutex_lock (&inv.mutex);
+  g_hash_table_replace (client->authorized, g_strdup (key), expires);
+  g_mutex_unlock (&inv.mutex);
+}
+
+static void
+on_authority_changed (PolkitAuthority *authority,
+                      gpointer user_data)
+{
+  GHashTableIter iter;
+  InvocationClient *client;
+
+  /* Rules or sessions changed, nothing we remember is reliable */
+  g_mutex_lock (&inv.mutex);
+  g_hash_table_iter_init (&iter, inv.clients);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&client))
+    g_hash_table_remove_all (client->authorized);
+  g_mutex_unlock (&inv.mutex);
+}
+
+/**
+ * storage_invocation_set_authorization_cache_ttl:
+ * @sec: How long to reuse a positive authorization, or 0 to always ask polkit.
+ *
+ * Call before storage_invocation_initialize().
+ */
+void
+storage_invocation_set_authorization_cache_ttl (guint sec)
+{
+  authorization_ttl_usec = (gint64)sec * G_USEC_PER_SEC;
+}
+
+/*
+ * Authorization never blocks. The skeleton emits g-authorize-method in
+ * a thread of its own for each call, and we take the invocation over
+ * from there: the credentials of the caller and the polkit check are
+ * waited for asynchronously in the main context, which then dispatches
+ * the method itself, just like the skeleton would have.
+ */
+
+typedef struct {
+  GDBusInterfaceSkeleton *instance;
+  GDBusMethodInvocation *invocation;
+  InvocationClient *client;
   const gchar *action_id;
   PolkitDetails *details;
-  GError *error = NULL;
-  InvocationClient *client;
-  gboolean ret = FALSE;
+  PolkitCheckAuthorizationFlags flags;
+  gboolean interactive;
+  gchar *cache_key;
+  gint64 begin;
   uid_t uid;
+} PendingAuthorization;
+
+static void
+pending_authorization_free (PendingAuthorization *pending)
+{
+  g_object_unref (pending->instance);
+  g_object_unref (pending->invocation);
+  if (pending->client)
+    invocation_client_unref (pending->client);
+  g_clear_object (&pending->details);
+  g_free (pending->cache_key);
+  g_free (pending);
+}
 
-  info = g_dbus_method_invocation_get_method_info (invocation);
+static gboolean
+invocation_client_is_tracked (InvocationClient *client)
+{
+  gboolean ret;
 
-  client = invocation_client_lookup (invocation, &uid, &error);
-  if (error)
+  g_mutex_lock (&inv.mutex);
+  ret = (client != NULL && g_hash_table_lookup (inv.clients, client->bus_name) == client);
+  g_mutex_unlock (&inv.mutex);
+
+  return ret;
+}
+
+static gboolean
+invocation_sender_is_tracked (GDBusMethodInvocation *invocation)
+{
+  gboolean ret;
+
+  g_mutex_lock (&inv.mutex);
+  ret = g_hash_table_contains (inv.clients, g_dbus_method_invocation_get_sender (invocation));
+  g_mutex_unlock (&inv.mutex);
+
+  return ret;
+}
+
+static void
+authorization_finish (PendingAuthorization *pending,
+                      gboolean authorized)
+{
+  GDBusMethodInvocation *invocation = pending->invocation;
+  GDBusInterfaceVTable *vtable;
+
+  /*
+   * The caller might have gone away while polkit was asked.  The
+   * method would then fail to find out who called it, which must not
+   * happen, so it isn't run at all.
+   */
+  if (authorized && !invocation_client_is_tracked (pending->client))
     {
-      g_dbus_method_invocation_return_gerror (invocation, error);
-      g_error_free (error);
-      return TRUE;
+      storage_invocation_trace (invocation, "caller-vanished");
+      g_dbus_method_invocation_return_error_literal (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                     "The caller disconnected during authorization");
+      authorized = FALSE;
     }
 
-  /* Only allow root when no polkit authority */
-  if (inv.authority == NULL)
+  if (authorized)
     {
-      ret = authorize_without_polkit (client, uid, invocation);
-      goto out;
+      storage_invocation_trace (invocation, "authorized");
+      vtable = g_dbus_interface_skeleton_get_vtable (pending->instance);
+      (vtable->method_call) (g_dbus_method_invocation_get_connection (invocation),
+                             g_dbus_method_invocation_get_sender (invocation),
+                             g_dbus_method_invocation_get_object_path (invocation),
+                             g_dbus_method_invocation_get_interface_name (invocation),
+                             g_dbus_method_invocation_get_method_name (invocation),
+                             g_dbus_method_invocation_get_parameters (invocation),
+                             g_object_ref (invocation),
+                             pending->instance);
     }
 
-  action_id = lookup_method_action_and_details (instance, client, uid, info, &details);
-  if (action_id == NULL)
-    action_id = "com.redhat.lvm2.manage-lvm";
+  pending_authorization_free (pending);
+}
 
-  flags = lookup_invocation_flags (invocation, info);
+static void
+on_check_authorization (GObject *source,
+                        GAsyncResult *res,
+                        gpointer user_data)
+{
+  PendingAuthorization *pending = user_data;
+  GDBusMethodInvocation *invocation = pending->invocation;
+  PolkitAuthorizationResult *result;
+  GError *error = NULL;
+  gboolean ret = FALSE;
 
-  result = polkit_authority_check_authorization_sync (inv.authority,
-                                                      client->subject,
-                                                      action_id,
-                                                      details,
-                                                      flags,
-                                                      NULL, /* GCancellable* */
-                                                      &error);
+  result = polkit_authority_check_authorization_finish (POLKIT_AUTHORITY (source), res, &error);
 
-  g_clear_object (&details);
+  /*
+   * The first check is made without interaction: only such a result can
+   * be remembered, and a challenge that the caller allows us to pursue
+   * gets asked again.
+   */
+  if (result && !pending->interactive)
+    {
+      if (polkit_authorization_result_get_is_authorized (result))
+        {
+          authorization_cache_store (pending->client, pending->cache_key, result);
+        }
+      else if (polkit_authorization_result_get_is_challenge (result) &&
+               (pending->flags & POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION))
+        {
+          g_object_unref (result);
+          pending->interactive = TRUE;
+          polkit_authority_check_authorization (inv.authority,
+                                                pending->client->subject,
+                                                pending->action_id,
+                                                pending->details,
+                                                pending->flags,
+                                                NULL, /* GCancellable* */
+                                                on_check_authorization,
+                                                pending);
+          return;
+        }
+    }
+
+  storage_stats_record_since ("polkit.check", pending->begin);
+  storage_stats_count (result && polkit_authorization_result_get_is_authorized (result) ?
+                       "polkit.authorized" : "polkit.denied", 1);
 
   if (result == NULL)
     {
@@ -486,8 +1034,7 @@ on_authorize_method (GDBusInterfaceSkeleton *instance,
            * manager returning org.freedesktop.systemd1.Masked)
            */
           g_debug ("CheckAuthorization() failed: %s", error->message);
-          ret = authorize_without_polkit (client, uid, invocation);
-          goto out;
+          ret = authorize_without_polkit (pending->client, pending->uid, invocation);
         }
       else
         {
@@ -498,11 +1045,9 @@ on_authorize_method (GDBusInterfaceSkeleton *instance,
                                                  error->message,
                                                  g_quark_to_string (error->domain),
                                                  error->code);
-          goto out;
         }
     }
-
-  if (!polkit_authorization_result_get_is_authorized (result))
+  else if (!polkit_authorization_result_get_is_authorized (result))
     {
       if (polkit_authorization_result_get_dismissed (result))
         g_dbus_method_invocation_return_error_literal (invocation,
@@ -513,16 +1058,126 @@ on_authorize_method (GDBusInterfaceSkeleton *instance,
                                                        polkit_authorization_result_get_is_challenge (result) ?
                                                        UDISKS_ERROR_NOT_AUTHORIZED_CAN_OBTAIN : UDISKS_ERROR_NOT_AUTHORIZED,
                                                        "Not authorized to perform operation");
-      goto out;
+    }
+  else
+    {
+      ret = TRUE;
     }
 
-  ret = TRUE;
-
-out:
-  invocation_client_unref (client);
   g_clear_error (&error);
   g_clear_object (&result);
-  return ret;
+  authorization_finish (pending, ret);
+}
+
+static void
+authorization_continue (gpointer data,
+                        gpointer user_data)
+{
+  PendingAuthorization *pending = data;
+  const GDBusMethodInfo *info;
+  gint state;
+
+  /* Called in the main context once the credentials are in */
+  g_mutex_lock (&inv.mutex);
+  state = pending->client->uid_state;
+  pending->uid = pending->client->uid_peer;
+  g_mutex_unlock (&inv.mutex);
+
+  if (state != UID_VALID)
+    {
+      g_dbus_method_invocation_return_error_literal (pending->invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                     "Cannot determine the unix credentials of the calling process");
+      authorization_finish (pending, FALSE);
+      return;
+    }
+
+  /* Hold the call until the daemon knows whether polkit is there */
+  if (inv.authority_loading)
+    {
+      inv.authority_waiting = g_list_prepend (inv.authority_waiting, pending);
+      return;
+    }
+
+  /* Only allow root when no polkit authority */
+  if (inv.authority == NULL)
+    {
+      authorization_finish (pending, authorize_without_polkit (pending->client, pending->uid,
+                                                               pending->invocation));
+      return;
+    }
+
+  info = g_dbus_method_invocation_get_method_info (pending->invocation);
+  pending->action_id = lookup_method_action_and_details (pending->instance, pending->uid,
+                                                         info, &pending->details);
+  if (pending->action_id == NULL)
+    pending->action_id = "com.redhat.lvm2.manage-lvm";
+
+  pending->flags = lookup_invocation_flags (pending->invocation, info);
+
+  pending->cache_key = authorization_cache_key (pending->uid, pending->action_id, pending->details);
+  if (authorization_cache_lookup (pending->client, pending->cache_key))
+    {
+      storage_stats_count ("polkit.cache-hit", 1);
+      authorization_finish (pending, TRUE);
+      return;
+    }
+
+  pending->begin = g_get_monotonic_time ();
+  polkit_authority_check_authorization (inv.authority,
+                                        pending->client->subject,
+                                        pending->action_id,
+                                        pending->details,
+                                        POLKIT_CHECK_AUTHORIZATION_FLAGS_NONE,
+                                        NULL, /* GCancellable* */
+                                        on_check_authorization,
+                                        pending);
+}
+
+static gboolean
+authorization_begin (gpointer user_data)
+{
+  PendingAuthorization *pending = user_data;
+  GError *error = NULL;
+  gboolean ready = FALSE;
+
+  storage_invocation_trace (pending->invocation, "authorizing");
+
+  pending->client = invocation_client_lookup (pending->invocation, NULL, &error);
+  if (error)
+    {
+      g_dbus_method_invocation_return_gerror (pending->invocation, error);
+      g_error_free (error);
+      authorization_finish (pending, FALSE);
+      return FALSE;
+    }
+
+  g_mutex_lock (&inv.mutex);
+  if (pending->client->uid_state == UID_LOADING)
+    pending->client->waiting = g_list_prepend (pending->client->waiting, pending);
+  else
+    ready = TRUE;
+  g_mutex_unlock (&inv.mutex);
+
+  if (ready)
+    authorization_continue (pending, NULL);
+
+  return FALSE;
+}
+
+static gboolean
+on_authorize_method (GDBusInterfaceSkeleton *instance,
+                     GDBusMethodInvocation *invocation,
+                     gpointer user_data)
+{
+  PendingAuthorization *pending;
+
+  pending = g_new0 (PendingAuthorization, 1);
+  pending->instance = g_object_ref (instance);
+  pending->invocation = g_object_ref (invocation);
+  g_main_context_invoke (NULL, authorization_begin, pending);
+
+  /* Tells the skeleton that we've taken over, see above */
+  return FALSE;
 }
 
 static GObject *
@@ -552,7 +1207,6 @@ storage_invocation_initialize (GDBusConnection *connection,
                                gpointer user_data)
 {
   GObjectClass *object_class;
-  GError *error = NULL;
 
   inv.client_appeared = client_appeared;
   inv.client_disappeared = client_disappeared;
@@ -566,15 +1220,48 @@ storage_invocation_initialize (GDBusConnection *connection,
 
   inv.clients = g_hash_table_new_full (g_str_hash, g_str_equal,
                                        NULL, invocation_client_unref);
+  inv.traces = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, invocation_trace_free);
 
+  inv.connection = g_object_ref (connection);
   g_dbus_connection_add_filter (connection, on_connection_filter, NULL, NULL);
 
-  inv.authority = polkit_authority_get_sync (NULL, &error);
-  if (error != NULL)
+  /* The daemon looks up the authority asynchronously, see below */
+  inv.authority_loading = TRUE;
+}
+
+/**
+ * storage_invocation_set_authority:
+ * @authority: (allow-none): The polkit authority, or %NULL if there is none.
+ *
+ * Called by the daemon once its asynchronous polkit lookup completes.
+ * Authorizations that came in before then are held and continue here.
+ * Without an authority only root is allowed to call methods.
+ */
+void
+storage_invocation_set_authority (PolkitAuthority *authority)
+{
+  GList *waiting;
+
+  if (inv.authority)
     {
-      g_warning ("Couldn't connect to polkit: %s", error->message);
-      g_error_free (error);
+      g_signal_handlers_disconnect_by_func (inv.authority, on_authority_changed, NULL);
+      g_clear_object (&inv.authority);
+    }
+
+  if (authority)
+    {
+      inv.authority = g_object_ref (authority);
+      g_signal_connect (inv.authority, "changed", G_CALLBACK (on_authority_changed), NULL);
     }
+
+  inv.authority_loading = FALSE;
+  waiting = g_list_reverse (inv.authority_waiting);
+  inv.authority_waiting = NULL;
+
+  /* Calls that arrived while polkit was looked up, in the order they came */
+  g_list_foreach (waiting, authorization_continue, NULL);
+  g_list_free (waiting);
 }
 
 void
@@ -586,7 +1273,120 @@ storage_invocation_cleanup (void)
 
   if (inv.clients)
     g_hash_table_destroy (inv.clients);
+  if (inv.traces)
+    g_hash_table_destroy (inv.traces);
+  g_list_free_full (inv.credentials_queue, invocation_client_unref);
+  inv.credentials_queue = NULL;
+  if (inv.authority)
+    g_signal_handlers_disconnect_by_func (inv.authority, on_authority_changed, NULL);
   g_clear_object (&inv.authority);
+  inv.authority_loading = FALSE;
+  g_clear_object (&inv.connection);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+  GDBusMethodInvocation *invocation;
+  StorageCheckFunc check_func;
+  StorageReadyFunc ready_func;
+  gpointer user_data;
+  GDestroyNotify user_data_free_func;
+} CheckData;
+
+static void
+check_data_free (gpointer data)
+{
+  CheckData *check = data;
+  if (check->user_data_free_func)
+    (check->user_data_free_func) (check->user_data);
+  g_object_unref (check->invocation);
+  g_free (check);
+}
+
+static void
+check_in_thread (GTask *task,
+                 gpointer source_object,
+                 gpointer task_data,
+                 GCancellable *cancellable)
+{
+  CheckData *check = task_data;
+  GError *error = NULL;
+
+  if ((check->check_func) (check->user_data, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+on_check_done (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+  CheckData *check = g_task_get_task_data (G_TASK (result));
+  GError *error = NULL;
+
+  storage_invocation_trace (check->invocation, "checked");
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_dbus_method_invocation_take_error (check->invocation, error);
+    }
+
+  /* Don't launch anything for a caller that went away meanwhile */
+  else if (!invocation_sender_is_tracked (check->invocation))
+    {
+      storage_invocation_trace (check->invocation, "caller-vanished");
+      g_dbus_method_invocation_return_error_literal (check->invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                     "The caller disconnected during the check");
+    }
+  else
+    {
+      (check->ready_func) (check->invocation, check->user_data);
+    }
+}
+
+/**
+ * storage_invocation_check_in_thread:
+ * @invocation: The method invocation being handled.
+ * @check_func: Validation that may block, run in a worker thread.
+ * @ready_func: Continues handling @invocation in the main context.
+ * @user_data: Data for both functions.
+ * @user_data_free_func: Frees @user_data when done, or %NULL.
+ *
+ * For method handlers that need to touch devices before they can launch
+ * their job: @check_func runs in a worker thread, so that a slow or hung
+ * disk doesn't stall the main loop. If it fails, its error is returned
+ * for @invocation, as is an error when the caller disconnected meanwhile.
+ * Otherwise @ready_func is called in the thread-default main context of
+ * the caller.  Resolve anything about the caller, such as
+ * storage_invocation_get_caller_uid(), before calling this.
+ *
+ * @check_func must only use what's in @user_data, and not touch any
+ * objects that the main loop might change meanwhile.
+ */
+void
+storage_invocation_check_in_thread (GDBusMethodInvocation *invocation,
+                                    StorageCheckFunc check_func,
+                                    StorageReadyFunc ready_func,
+                                    gpointer user_data,
+                                    GDestroyNotify user_data_free_func)
+{
+  CheckData *check;
+  GTask *task;
+
+  check = g_new0 (CheckData, 1);
+  check->invocation = g_object_ref (invocation);
+  check->check_func = check_func;
+  check->ready_func = ready_func;
+  check->user_data = user_data;
+  check->user_data_free_func = user_data_free_func;
+
+  task = g_task_new (NULL, NULL, on_check_done, NULL);
+  g_task_set_task_data (task, check, check_data_free);
+  g_task_run_in_thread (task, check_in_thread);
+  g_object_unref (task);
 }
 
 uid_t
@@ -596,6 +1396,9 @@ storage_invocation_get_caller_uid (GDBusMethodInvocation *invocation)
   GError *error = NULL;
   uid_t uid;
 
+  /* Handlers ask for this right before they launch their job */
+  storage_invocation_trace (invocation, "launching-job");
+
   client = invocation_client_lookup (invocation, &uid, &error);
   if (client)
     {
@@ -17,19 +17,41 @@
 #define __STORAGE_INVOCATION_H__
 
 #include <gio/gio.h>
+#include <polkit/polkit.h>
 
 G_BEGIN_DECLS
 
 typedef void (* StorageClientFunc) (const gchar *bus_name,
                                     gpointer user_data);
 
+typedef gboolean (* StorageCheckFunc) (gpointer user_data,
+                                       GError **error);
+
+typedef void (* StorageReadyFunc) (GDBusMethodInvocation *invocation,
+                                   gpointer user_data);
+
 void                 storage_invocation_initialize        (GDBusConnection *connection,
                                                            StorageClientFunc client_appeared,
                                                            StorageClientFunc client_disappeared,
                                                            gpointer user_data);
 
+void                 storage_invocation_set_authority     (PolkitAuthority *authority);
+
 uid_t                storage_invocation_get_caller_uid    (GDBusMethodInvocation *invocation);
 
+void                 storage_invocation_trace             (GDBusMethodInvocation *invocation,
+                                                           const gchar *stage);
+
+void                 storage_invocation_check_in_thread   (GDBusMethodInvocation *invocation,
+                                                           StorageCheckFunc check_func,
+                                                           StorageReadyFunc ready_func,
+                                                           gpointer user_data,
+                                                           GDestroyNotify user_data_free_func);
+
+void                 storage_invocation_set_slow_call_threshold (guint msec);
+
+void                 storage_invocation_set_authorization_cache_ttl (guint sec);
+
 void                 storage_invocation_cleanup           (void);
 
 G_END_DECLS
@@ -27,6 +27,7 @@
 
 #include "block.h"
 #include "job.h"
+#include "stats.h"
 
 #define MAX_SAMPLES 100
 
@@ -47,6 +48,7 @@ typedef struct
 struct _StorageJobPrivate
 {
   GCancellable *cancellable;
+  const StorageJobPolicy *policy;
 
   gboolean auto_estimate;
   gulong notify_progress_signal_handler_id;
@@ -62,6 +64,7 @@ enum
   PROP_0,
   PROP_DAEMON,
   PROP_CANCELLABLE,
+  PROP_POLICY,
   PROP_AUTO_ESTIMATE,
 };
 
@@ -124,6 +127,10 @@ storage_job_set_property (GObject *object,
       self->priv->cancellable = g_value_dup_object (value);
       break;
 
+    case PROP_POLICY:
+      self->priv->policy = g_value_get_pointer (value);
+      break;
+
     case PROP_AUTO_ESTIMATE:
       storage_job_set_auto_estimate (self, g_value_get_boolean (value));
       break;
@@ -136,6 +143,24 @@ storage_job_set_property (GObject *object,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_completed_record_stats (UDisksJob *job,
+                           gboolean success,
+                           const gchar *message,
+                           gpointer user_data)
+{
+  gchar *name;
+
+  name = g_strdup_printf ("job.%s", udisks_job_get_operation (job));
+  storage_stats_record (name, g_get_real_time () - (gint64)udisks_job_get_start_time (job));
+  g_free (name);
+
+  name = g_strdup_printf ("job.%s.%s", udisks_job_get_operation (job),
+                          success ? "succeeded" : "failed");
+  storage_stats_count (name, 1);
+  g_free (name);
+}
+
 static void
 storage_job_constructed (GObject *object)
 {
@@ -144,6 +169,8 @@ storage_job_constructed (GObject *object)
   if (self->priv->cancellable == NULL)
     self->priv->cancellable = g_cancellable_new ();
 
+  g_signal_connect (self, "completed", G_CALLBACK (on_completed_record_stats), NULL);
+
   if (G_OBJECT_CLASS (storage_job_parent_class)->constructed != NULL)
     G_OBJECT_CLASS (storage_job_parent_class)->constructed (object);
 }
@@ -188,6 +215,20 @@ storage_job_class_init (StorageJobClass *klass)
                                                         G_PARAM_CONSTRUCT_ONLY |
                                                         G_PARAM_STATIC_STRINGS));
 
+  /**
+   * StorageJob:policy:
+   *
+   * The #StorageJobPolicy to run the job with, or %NULL.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_POLICY,
+                                   g_param_spec_pointer ("policy",
+                                                         "Policy",
+                                                         "The scheduling policy of the job",
+                                                         G_PARAM_WRITABLE |
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+
   /**
    * StorageJob:auto-estimate:
    *
@@ -225,6 +266,21 @@ storage_job_get_cancellable (StorageJob *self)
   return self->priv->cancellable;
 }
 
+/**
+ * storage_job_get_policy:
+ * @self: A #StorageJob.
+ *
+ * Gets the scheduling policy that @job runs with.
+ *
+ * Returns: A #StorageJobPolicy or %NULL. Do not free.
+ */
+const StorageJobPolicy *
+storage_job_get_policy (StorageJob *self)
+{
+  g_return_val_if_fail (STORAGE_IS_JOB (self), NULL);
+  return self->priv->policy;
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 /**
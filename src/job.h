@@ -25,6 +25,7 @@
 #include <udisks/udisks.h>
 
 #include "types.h"
+#include "jobpolicy.h"
 
 G_BEGIN_DECLS
 
@@ -64,7 +65,8 @@ struct _StorageJobClass
   gpointer padding[8];
 };
 
-typedef gboolean   (* StorageJobFunc)            (GCancellable *cancellable,
+typedef gboolean   (* StorageJobFunc)            (StorageThreadedJob *job,
+                                                  GCancellable *cancellable,
                                                   gpointer user_data,
                                                   GError **error);
 
@@ -72,6 +74,9 @@ GType              storage_job_get_type          (void) G_GNUC_CONST;
 
 GCancellable *     storage_job_get_cancellable   (StorageJob *self);
 
+const StorageJobPolicy *
+                   storage_job_get_policy        (StorageJob *self);
+
 gboolean           storage_job_get_auto_estimate (StorageJob *self);
 
 void               storage_job_set_auto_estimate (StorageJob *self,
@@ -0,0 +1,631 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "config.h"
+
+#include "jobpolicy.h"
+
+#include <gio/gio.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Long running jobs like pvmove or zeroing a device compete with the
+ * applications for the same disks. The administrator can decide how
+ * they are scheduled, per operation, in a key file like this:
+ *
+ *   [lvm-vg-empty-device]
+ *   IOSchedulingClass=idle
+ *   Nice=10
+ *   IOMax=wbps=52428800 rbps=52428800
+ *   CPUMax=20000 100000
+ *
+ *   [lvm-*-zero]
+ *   IOSchedulingClass=best-effort
+ *   IOSchedulingPriority=7
+ *
+ *   [lvm-*]
+ *   TimeoutSec=3600
+ *   TimeoutStopSec=30
+ *
+ * Group names are glob patterns matched against the job operation, and
+ * the first group that matches wins. The I/O scheduling class and nice
+ * level are applied to spawned processes and to the threads of threaded
+ * jobs. IOMax and CPUMax need a cgroup, which only a spawned process can
+ * be placed into: each such job gets a cgroup of its own below the one
+ * of the daemon, with the IOMax limits written to io.max for every block
+ * device and CPUMax written to cpu.max.
+ *
+ * A command that runs longer than TimeoutSec fails its job. It gets
+ * SIGTERM, and SIGKILL when it is still there TimeoutStopSec later.
+ */
+
+/* Not in glibc, as in ionice(1) */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+enum {
+  IOPRIO_CLASS_NONE,
+  IOPRIO_CLASS_RT,
+  IOPRIO_CLASS_BE,
+  IOPRIO_CLASS_IDLE,
+};
+
+enum {
+  IOPRIO_WHO_PROCESS = 1,
+};
+
+typedef struct {
+  gchar *pattern;
+  StorageJobPolicy policy;
+} PolicyEntry;
+
+/* Loaded once at startup, read-only afterwards */
+static GPtrArray *policies = NULL;
+
+/* The cgroup that job cgroups are created in, or NULL */
+static gchar *cgroup_base = NULL;
+
+static gint cgroup_counter = 0;
+
+static gboolean
+write_cgroup_file (const gchar *path,
+                   const gchar *value,
+                   GError **error)
+{
+  gssize len;
+  gint errsv;
+  gint fd;
+
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Couldn't open %s: %s", path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  len = strlen (value);
+  if (write (fd, value, len) != len)
+    {
+      errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Couldn't write '%s' to %s: %s", value, path, g_strerror (errsv));
+      close (fd);
+      return FALSE;
+    }
+
+  close (fd);
+  return TRUE;
+}
+
+static gboolean
+parse_seconds (GKeyFile *file,
+               const gchar *group,
+               const gchar *key,
+               guint *seconds,
+               GError **error)
+{
+  GError *local_error = NULL;
+  gint value;
+
+  if (!g_key_file_has_key (file, group, key, NULL))
+    return TRUE;
+
+  value = g_key_file_get_integer (file, group, key, &local_error);
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+  if (value < 0)
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "%s can't be negative", key);
+      return FALSE;
+    }
+
+  *seconds = value;
+  return TRUE;
+}
+
+static gboolean
+parse_policy (GKeyFile *file,
+              const gchar *group,
+              StorageJobPolicy *policy,
+              GError **error)
+{
+  GError *local_error = NULL;
+  gchar *str;
+
+  str = g_key_file_get_string (file, group, "IOSchedulingClass", NULL);
+  if (str != NULL)
+    {
+      if (g_str_equal (str, "realtime"))
+        policy->io_class = IOPRIO_CLASS_RT;
+      else if (g_str_equal (str, "best-effort"))
+        policy->io_class = IOPRIO_CLASS_BE;
+      else if (g_str_equal (str, "idle"))
+        policy->io_class = IOPRIO_CLASS_IDLE;
+      else
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "Invalid IOSchedulingClass: %s", str);
+          g_free (str);
+          return FALSE;
+        }
+      g_free (str);
+    }
+
+  if (g_key_file_has_key (file, group, "IOSchedulingPriority", NULL))
+    {
+      policy->io_level = g_key_file_get_integer (file, group, "IOSchedulingPriority", &local_error);
+      if (local_error != NULL)
+        {
+          g_propagate_error (error, local_error);
+          return FALSE;
+        }
+      if (policy->io_level < 0 || policy->io_level > 7)
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "IOSchedulingPriority must be between 0 and 7");
+          return FALSE;
+        }
+      if (policy->io_class == IOPRIO_CLASS_NONE)
+        policy->io_class = IOPRIO_CLASS_BE;
+    }
+  else if (policy->io_class == IOPRIO_CLASS_BE || policy->io_class == IOPRIO_CLASS_RT)
+    {
+      policy->io_level = 4;
+    }
+
+  if (g_key_file_has_key (file, group, "Nice", NULL))
+    {
+      policy->nice = g_key_file_get_integer (file, group, "Nice", &local_error);
+      if (local_error != NULL)
+        {
+          g_propagate_error (error, local_error);
+          return FALSE;
+        }
+      if (policy->nice < -20 || policy->nice > 19)
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "Nice must be between -20 and 19");
+          return FALSE;
+        }
+      policy->set_nice = TRUE;
+    }
+
+  if (!parse_seconds (file, group, "TimeoutSec", &policy->timeout, error) ||
+      !parse_seconds (file, group, "TimeoutStopSec", &policy->stop_timeout, error))
+    return FALSE;
+
+  policy->io_max = g_key_file_get_string (file, group, "IOMax", NULL);
+  policy->cpu_max = g_key_file_get_string (file, group, "CPUMax", NULL);
+  return TRUE;
+}
+
+static void
+policy_entry_free (gpointer data)
+{
+  PolicyEntry *entry = data;
+  g_free (entry->pattern);
+  g_free (entry->policy.io_max);
+  g_free (entry->policy.cpu_max);
+  g_free (entry);
+}
+
+static void
+setup_cgroups (void)
+{
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gchar *leaf = NULL;
+  gchar *procs = NULL;
+  gchar *control = NULL;
+  gchar *pid = NULL;
+  gchar *base = NULL;
+  gchar *line;
+  gchar *end;
+
+  if (!g_file_get_contents ("/proc/self/cgroup", &contents, NULL, &error))
+    goto out;
+
+  /* Only the unified hierarchy is supported: "0::/system.slice/storaged.service" */
+  if (g_str_has_prefix (contents, "0::"))
+    line = contents;
+  else
+    line = strstr (contents, "\n0::");
+  if (line == NULL)
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Not running in a unified cgroup hierarchy");
+      goto out;
+    }
+  line = strstr (line, "::") + 2;
+  end = strchr (line, '\n');
+  if (end != NULL)
+    *end = '\0';
+  base = g_build_filename ("/sys/fs/cgroup", line, NULL);
+
+  /*
+   * Controllers can only be enabled for the children of a cgroup that has
+   * no processes in it, so the daemon moves itself into a leaf next to
+   * the job cgroups. This needs Delegate=yes in the service file.
+   */
+  leaf = g_build_filename (base, "daemon", NULL);
+  if (mkdir (leaf, 0755) < 0 && errno != EEXIST)
+    {
+      g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Couldn't create %s: %s", leaf, g_strerror (errno));
+      goto out;
+    }
+
+  procs = g_build_filename (leaf, "cgroup.procs", NULL);
+  pid = g_strdup_printf ("%d", (gint) getpid ());
+  if (!write_cgroup_file (procs, pid, &error))
+    goto out;
+
+  control = g_build_filename (base, "cgroup.subtree_control", NULL);
+  if (!write_cgroup_file (control, "+io", &error) ||
+      !write_cgroup_file (control, "+cpu", &error))
+    goto out;
+
+  cgroup_base = base;
+  base = NULL;
+
+out:
+  if (error != NULL)
+    {
+      g_message ("Job I/O and CPU limits are disabled: %s", error->message);
+      g_error_free (error);
+    }
+  g_free (contents);
+  g_free (leaf);
+  g_free (procs);
+  g_free (control);
+  g_free (pid);
+  g_free (base);
+}
+
+/**
+ * storage_job_policy_load:
+ * @path: The configuration file.
+ *
+ * Loads the scheduling policies for jobs from @path. A missing file
+ * means that jobs run like any other process of the daemon.
+ *
+ * This is called once, at startup.
+ */
+void
+storage_job_policy_load (const gchar *path)
+{
+  GError *error = NULL;
+  gboolean want_cgroups = FALSE;
+  PolicyEntry *entry;
+  GKeyFile *file;
+  gchar **groups;
+  guint i;
+
+  g_return_if_fail (policies == NULL);
+
+  file = g_key_file_new ();
+  if (!g_key_file_load_from_file (file, path, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_message ("Couldn't load job configuration %s: %s", path, error->message);
+      g_error_free (error);
+      g_key_file_free (file);
+      return;
+    }
+
+  policies = g_ptr_array_new_with_free_func (policy_entry_free);
+  groups = g_key_file_get_groups (file, NULL);
+  for (i = 0; groups[i] != NULL; i++)
+    {
+      entry = g_new0 (PolicyEntry, 1);
+      entry->pattern = g_strdup (groups[i]);
+      if (!parse_policy (file, groups[i], &entry->policy, &error))
+        {
+          g_message ("%s: [%s]: %s", path, groups[i], error->message);
+          g_clear_error (&error);
+          policy_entry_free (entry);
+          continue;
+        }
+      if (entry->policy.io_max != NULL || entry->policy.cpu_max != NULL)
+        want_cgroups = TRUE;
+      g_ptr_array_add (policies, entry);
+    }
+
+  g_strfreev (groups);
+  g_key_file_free (file);
+
+  if (want_cgroups)
+    setup_cgroups ();
+}
+
+/**
+ * storage_job_policy_lookup:
+ * @operation: The operation of a job, such as "lvm-vg-empty-device".
+ *
+ * Finds the policy that jobs for @operation should run with.
+ *
+ * Returns: The policy or %NULL if there is none. Do not free.
+ */
+const StorageJobPolicy *
+storage_job_policy_lookup (const gchar *operation)
+{
+  PolicyEntry *entry;
+  guint i;
+
+  if (policies == NULL || operation == NULL)
+    return NULL;
+
+  for (i = 0; i < policies->len; i++)
+    {
+      entry = policies->pdata[i];
+      if (g_pattern_match_simple (entry->pattern, operation))
+        return &entry->policy;
+    }
+
+  return NULL;
+}
+
+static void
+write_io_max (const gchar *cgroup,
+              const gchar *limits)
+{
+  GError *error = NULL;
+  const gchar *name;
+  gchar *contents;
+  gchar *path;
+  gchar *value;
+  GDir *dir;
+
+  dir = g_dir_open ("/sys/block", 0, &error);
+  if (dir == NULL)
+    {
+      g_message ("Couldn't list block devices: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  path = g_build_filename (cgroup, "io.max", NULL);
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *dev_path = g_build_filename ("/sys/block", name, "dev", NULL);
+      if (g_file_get_contents (dev_path, &contents, NULL, NULL))
+        {
+          value = g_strdup_printf ("%s %s", g_strstrip (contents), limits);
+          if (!write_cgroup_file (path, value, &error))
+            {
+              /* Not every kind of block device can be throttled */
+              g_debug ("%s", error->message);
+              g_clear_error (&error);
+            }
+          g_free (value);
+          g_free (contents);
+        }
+      g_free (dev_path);
+    }
+
+  g_free (path);
+  g_dir_close (dir);
+}
+
+/**
+ * storage_job_policy_create_cgroup:
+ * @policy: (allow-none): A #StorageJobPolicy.
+ * @cgroup_path: (out): Location for the path of the new cgroup.
+ *
+ * Creates a cgroup with the limits of @policy for one spawned job. The
+ * child process moves itself into it with
+ * storage_job_policy_apply_in_child().
+ *
+ * Returns: A file descriptor for the cgroup.procs file of the new
+ * cgroup, or -1 if @policy has no limits or cgroups can't be used.
+ */
+gint
+storage_job_policy_create_cgroup (const StorageJobPolicy *policy,
+                                  gchar **cgroup_path)
+{
+  GError *error = NULL;
+  gchar *path;
+  gchar *file;
+  gint fd = -1;
+
+  *cgroup_path = NULL;
+
+  if (policy == NULL || cgroup_base == NULL ||
+      (policy->io_max == NULL && policy->cpu_max == NULL))
+    return -1;
+
+  path = g_strdup_printf ("%s/job-%d", cgroup_base,
+                          g_atomic_int_add (&cgroup_counter, 1));
+  if (mkdir (path, 0755) < 0 && errno != EEXIST)
+    {
+      g_message ("Couldn't create %s: %s", path, g_strerror (errno));
+      g_free (path);
+      return -1;
+    }
+
+  if (policy->cpu_max != NULL)
+    {
+      file = g_build_filename (path, "cpu.max", NULL);
+      if (!write_cgroup_file (file, policy->cpu_max, &error))
+        {
+          g_message ("%s", error->message);
+          g_clear_error (&error);
+        }
+      g_free (file);
+    }
+
+  if (policy->io_max != NULL)
+    write_io_max (path, policy->io_max);
+
+  file = g_build_filename (path, "cgroup.procs", NULL);
+  fd = open (file, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      g_message ("Couldn't open %s: %s", file, g_strerror (errno));
+      storage_job_policy_remove_cgroup (path);
+      g_free (path);
+    }
+  else
+    {
+      *cgroup_path = path;
+    }
+
+  g_free (file);
+  return fd;
+}
+
+/**
+ * storage_job_policy_remove_cgroup:
+ * @cgroup_path: (allow-none): A path from storage_job_policy_create_cgroup().
+ *
+ * Removes the cgroup of a job after its processes have exited.
+ */
+void
+storage_job_policy_remove_cgroup (const gchar *cgroup_path)
+{
+  if (cgroup_path == NULL)
+    return;
+
+  /* Something the job started might still be running in it */
+  if (rmdir (cgroup_path) < 0)
+    g_debug ("Couldn't remove %s: %s", cgroup_path, g_strerror (errno));
+}
+
+/**
+ * storage_job_policy_apply_in_child:
+ * @policy: (allow-none): A #StorageJobPolicy.
+ * @cgroup_procs_fd: The result of storage_job_policy_create_cgroup().
+ *
+ * Applies @policy to the calling process. This is called in the forked
+ * child before exec, so it only makes async-signal-safe calls. It must
+ * be called before the child drops its privileges.
+ */
+void
+storage_job_policy_apply_in_child (const StorageJobPolicy *policy,
+                                   gint cgroup_procs_fd)
+{
+  if (cgroup_procs_fd >= 0 && write (cgroup_procs_fd, "0", 1) != 1)
+    {
+      /* Running without the limits is better than not running at all */
+    }
+
+  if (policy == NULL)
+    return;
+
+  if (policy->io_class != IOPRIO_CLASS_NONE)
+    syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+             IOPRIO_PRIO_VALUE (policy->io_class, policy->io_level));
+  if (policy->set_nice)
+    setpriority (PRIO_PROCESS, 0, policy->nice);
+}
+
+/**
+ * storage_job_policy_needs_child:
+ * @policy: (allow-none): A #StorageJobPolicy.
+ *
+ * Whether storage_job_policy_apply_in_child() needs to change the I/O
+ * priority or nice level for @policy. Entering a cgroup is not counted.
+ *
+ * Returns: %TRUE if @policy changes the scheduling of a process.
+ */
+gboolean
+storage_job_policy_needs_child (const StorageJobPolicy *policy)
+{
+  return policy != NULL && (policy->io_class != IOPRIO_CLASS_NONE || policy->set_nice);
+}
+
+/**
+ * storage_job_policy_enter_thread:
+ * @policy: (allow-none): A #StorageJobPolicy.
+ * @saved: Location to save the current scheduling of the thread in.
+ *
+ * Applies @policy to the calling thread, and to the threads and
+ * processes it starts. On Linux both the I/O priority and the nice
+ * level are per thread. Cgroup limits can't be applied to a single
+ * thread and are ignored.
+ *
+ * Call storage_job_policy_leave_thread() when the job is done, since
+ * threaded jobs run in a shared pool of threads.
+ */
+void
+storage_job_policy_enter_thread (const StorageJobPolicy *policy,
+                                 StorageJobPolicySaved *saved)
+{
+  saved->ioprio = -1;
+  saved->nice = 0;
+
+  if (policy == NULL)
+    return;
+
+  if (policy->io_class != IOPRIO_CLASS_NONE)
+    {
+      saved->ioprio = syscall (SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+      if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                   IOPRIO_PRIO_VALUE (policy->io_class, policy->io_level)) < 0)
+        g_message ("Couldn't set the I/O priority of a job: %s", g_strerror (errno));
+    }
+
+  if (policy->set_nice)
+    {
+      errno = 0;
+      saved->nice = getpriority (PRIO_PROCESS, 0);
+      if (errno != 0)
+        saved->nice = 0;
+      if (setpriority (PRIO_PROCESS, 0, policy->nice) < 0)
+        g_message ("Couldn't set the nice level of a job: %s", g_strerror (errno));
+    }
+}
+
+/**
+ * storage_job_policy_leave_thread:
+ * @policy: (allow-none): The #StorageJobPolicy passed to storage_job_policy_enter_thread().
+ * @saved: The scheduling saved by storage_job_policy_enter_thread().
+ *
+ * Restores the scheduling of the calling thread.
+ */
+void
+storage_job_policy_leave_thread (const StorageJobPolicy *policy,
+                                 StorageJobPolicySaved *saved)
+{
+  if (policy == NULL)
+    return;
+
+  if (policy->io_class != IOPRIO_CLASS_NONE && saved->ioprio >= 0)
+    syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, saved->ioprio);
+  if (policy->set_nice)
+    setpriority (PRIO_PROCESS, 0, saved->nice);
+}
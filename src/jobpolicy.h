@@ -0,0 +1,86 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __STORAGE_JOB_POLICY_H__
+#define __STORAGE_JOB_POLICY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _StorageJobPolicy StorageJobPolicy;
+
+/**
+ * StorageJobPolicy:
+ * @io_class: The I/O scheduling class, or 0 to leave it alone.
+ * @io_level: The I/O scheduling priority within @io_class, 0 to 7.
+ * @set_nice: Whether to change the CPU nice level.
+ * @nice: The CPU nice level, -20 to 19.
+ * @io_max: Limits written to io.max for each block device, or %NULL.
+ * @cpu_max: The value for cpu.max, or %NULL.
+ * @timeout: Seconds after which a command is stopped, or 0 for no limit.
+ * @stop_timeout: Seconds between SIGTERM and SIGKILL when a command is
+ *   stopped, or 0 for the default.
+ *
+ * How the processes and threads of a job are scheduled, and how long
+ * its commands may take.
+ */
+struct _StorageJobPolicy
+{
+  gint io_class;
+  gint io_level;
+  gboolean set_nice;
+  gint nice;
+  gchar *io_max;
+  gchar *cpu_max;
+  guint timeout;
+  guint stop_timeout;
+};
+
+typedef struct {
+  gint ioprio;
+  gint nice;
+} StorageJobPolicySaved;
+
+void                       storage_job_policy_load            (const gchar *path);
+
+const StorageJobPolicy *   storage_job_policy_lookup          (const gchar *operation);
+
+gint                       storage_job_policy_create_cgroup   (const StorageJobPolicy *policy,
+                                                               gchar **cgroup_path);
+
+void                       storage_job_policy_remove_cgroup   (const gchar *cgroup_path);
+
+void                       storage_job_policy_apply_in_child  (const StorageJobPolicy *policy,
+                                                               gint cgroup_procs_fd);
+
+gboolean                   storage_job_policy_needs_child     (const StorageJobPolicy *policy);
+
+void                       storage_job_policy_enter_thread    (const StorageJobPolicy *policy,
+                                                               StorageJobPolicySaved *saved);
+
+void                       storage_job_policy_leave_thread    (const StorageJobPolicy *policy,
+                                                               StorageJobPolicySaved *saved);
+
+G_END_DECLS
+
+#endif /* __STORAGE_JOB_POLICY_H__ */
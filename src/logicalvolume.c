@@ -27,9 +27,12 @@
 
 #include "block.h"
 #include "daemon.h"
+#include "intern.h"
 #include "invocation.h"
+#include "threadedjob.h"
 #include "util.h"
 #include "volumegroup.h"
+#include "zero.h"
 
 /**
  * SECTION:storagelogicalvolume
@@ -52,7 +55,7 @@ struct _StorageLogicalVolume
 {
   LvmLogicalVolumeSkeleton parent_instance;
 
-  gchar *name;
+  const gchar *name;
   gboolean needs_publish;
   gboolean needs_udev_hack;
   StorageVolumeGroup *volume_group;
@@ -105,7 +108,7 @@ storage_logical_volume_finalize (GObject *obj)
 {
   StorageLogicalVolume *self = STORAGE_LOGICAL_VOLUME (obj);
 
-  g_free (self->name);
+  storage_intern_unref (self->name);
 
   G_OBJECT_CLASS (storage_logical_volume_parent_class)->finalize (obj);
 }
@@ -149,8 +152,8 @@ storage_logical_volume_set_property (GObject *obj,
   switch (prop_id)
     {
     case PROP_NAME:
-      g_free (self->name);
-      self->name = g_value_dup_string (value);
+      storage_intern_unref (self->name);
+      self->name = storage_intern (g_value_get_string (value));
       break;
     case PROP_GROUP:
       storage_logical_volume_set_volume_group (self, g_value_get_object (value));
@@ -246,46 +249,38 @@ storage_logical_volume_new (StorageVolumeGroup *group,
 /**
  * storage_logical_volume_update:
  * @logical_volume: A #StorageLogicalVolume.
- * @vg: LVM volume group
- * @lv: LVM logical volume
+ * @group: The volume group.
+ * @lv: The logical volume as reported by LVM.
  *
  * Updates the interface.
  */
 void
 storage_logical_volume_update (StorageLogicalVolume *self,
                                StorageVolumeGroup *group,
-                               GVariant *info,
-                               gboolean *needs_polling_ret)
+                               const StorageLvRecord *lv)
 {
   LvmLogicalVolume *iface;
   const char *type;
   gboolean active;
   const char *pool_objpath;
   const char *origin_objpath;
-  const gchar *dev_file;
-  const gchar *str;
-  guint64 num;
   gchar *path;
 
   iface = LVM_LOGICAL_VOLUME (self);
 
-  if (g_variant_lookup (info, "uuid", "&s", &str))
-    lvm_logical_volume_set_uuid (iface, str);
+  if (lv->uuid)
+    lvm_logical_volume_set_uuid (iface, lv->uuid);
 
-  if (g_variant_lookup (info, "size", "t", &num))
-    lvm_logical_volume_set_size (iface, num);
+  if (lv->flags & STORAGE_MODEL_HAS_SIZE)
+    lvm_logical_volume_set_size (iface, lv->size);
 
   type = "block";
   active = FALSE;
-  if (g_variant_lookup (info, "lv_attr", "&s", &str)
-      && str && strlen (str) > 6)
+  if (lv->lv_attr && strlen (lv->lv_attr) > 6)
     {
-      char volume_type = str[0];
-      char state =       str[4];
-      char target_type = str[6];
-
-      if (target_type == 't')
-        *needs_polling_ret = TRUE;
+      char volume_type = lv->lv_attr[0];
+      char state =       lv->lv_attr[4];
+      char target_type = lv->lv_attr[6];
 
       if (target_type == 't' && volume_type == 't')
         type = "pool";
@@ -296,29 +291,27 @@ storage_logical_volume_update (StorageLogicalVolume *self,
   lvm_logical_volume_set_type_ (iface, type);
   lvm_logical_volume_set_active (iface, active);
 
-  if (g_variant_lookup (info, "data_percent", "t", &num)
-      && (int64_t)num >= 0)
-    lvm_logical_volume_set_data_allocated_ratio (iface, num/100000000.0);
+  if ((lv->flags & STORAGE_MODEL_HAS_DATA_PERCENT)
+      && (int64_t)lv->data_percent >= 0)
+    lvm_logical_volume_set_data_allocated_ratio (iface, lv->data_percent/100000000.0);
 
-  if (g_variant_lookup (info, "metadata_percent", "t", &num)
-      && (int64_t)num >= 0)
-    lvm_logical_volume_set_metadata_allocated_ratio (iface, num/100000000.0);
+  if ((lv->flags & STORAGE_MODEL_HAS_METADATA_PERCENT)
+      && (int64_t)lv->metadata_percent >= 0)
+    lvm_logical_volume_set_metadata_allocated_ratio (iface, lv->metadata_percent/100000000.0);
 
   pool_objpath = "/";
-  if (g_variant_lookup (info, "pool_lv", "&s", &str)
-      && str != NULL && *str)
+  if (lv->pool_lv && *lv->pool_lv)
     {
-      StorageLogicalVolume *pool = storage_volume_group_find_logical_volume (group, str);
+      StorageLogicalVolume *pool = storage_volume_group_find_logical_volume (group, lv->pool_lv);
       if (pool)
         pool_objpath = storage_logical_volume_get_object_path (pool);
     }
   lvm_logical_volume_set_thin_pool (iface, pool_objpath);
 
   origin_objpath = "/";
-  if (g_variant_lookup (info, "origin", "&s", &str)
-      && str != NULL && *str)
+  if (lv->origin && *lv->origin)
     {
-      StorageLogicalVolume *origin = storage_volume_group_find_logical_volume (group, str);
+      StorageLogicalVolume *origin = storage_volume_group_find_logical_volume (group, lv->origin);
       if (origin)
         origin_objpath = storage_logical_volume_get_object_path (origin);
     }
@@ -326,9 +319,7 @@ storage_logical_volume_update (StorageLogicalVolume *self,
 
   storage_logical_volume_set_volume_group (self, group);
 
-  dev_file = NULL;
-  if (self->needs_udev_hack
-      && g_variant_lookup (info, "lv_path", "&s", &dev_file))
+  if (self->needs_udev_hack && lv->lv_path)
     {
       // LVM2 versions before 2.02.105 sometimes incorrectly leave the
       // DM_UDEV_DISABLE_OTHER_RULES flag set for thin volumes.  As a
@@ -337,7 +328,7 @@ storage_logical_volume_update (StorageLogicalVolume *self,
       //
       // https://www.redhat.com/archives/linux-lvm/2014-January/msg00030.html
 
-      storage_util_trigger_udev (dev_file);
+      storage_util_trigger_udev (lv->lv_path);
       self->needs_udev_hack = FALSE;
     }
 
@@ -389,16 +380,74 @@ on_complete_delete (UDisksJob *job,
     }
 }
 
+typedef struct {
+  gchar *full_name;
+  gchar *device;
+} LogicalVolumeDeleteJobData;
+
+static void
+logical_volume_delete_job_free (gpointer user_data)
+{
+  LogicalVolumeDeleteJobData *data = user_data;
+  g_free (data->full_name);
+  g_free (data->device);
+  g_free (data);
+}
+
+static void
+on_discard_progress (gdouble progress,
+                     gpointer user_data)
+{
+  storage_threaded_job_set_progress (user_data, progress);
+}
+
+static gboolean
+logical_volume_discard_delete_job_thread (StorageThreadedJob *job,
+                                          GCancellable *cancellable,
+                                          gpointer user_data,
+                                          GError **error)
+{
+  LogicalVolumeDeleteJobData *data = user_data;
+  gchar *standard_output;
+  gchar *standard_error;
+  gint exit_status;
+  gboolean ret;
+
+  const gchar *argv[] = { "lvremove", "-f", data->full_name, NULL };
+
+  if (!storage_util_discard_device (data->device, cancellable,
+                                    on_discard_progress, job, error))
+    return FALSE;
+
+  ret = g_spawn_sync (NULL, (gchar **)argv, NULL,
+                      G_SPAWN_SEARCH_PATH, NULL, NULL,
+                      &standard_output, &standard_error,
+                      &exit_status, error);
+
+  if (ret)
+    {
+      ret = storage_util_check_status_and_output ("lvremove",
+                                                  exit_status, standard_output,
+                                                  standard_error, error);
+      g_free (standard_output);
+      g_free (standard_error);
+    }
+
+  return ret;
+}
+
 static gboolean
 handle_delete (LvmLogicalVolume *volume,
                GDBusMethodInvocation *invocation,
                GVariant *options)
 {
   StorageLogicalVolume *self = STORAGE_LOGICAL_VOLUME (volume);
+  LogicalVolumeDeleteJobData *data;
   gchar *full_name = NULL;
   StorageVolumeGroup *group;
   StorageDaemon *daemon;
   StorageJob *job;
+  gboolean discard = FALSE;
 
   daemon = storage_daemon_get ();
 
@@ -407,14 +456,42 @@ handle_delete (LvmLogicalVolume *volume,
                                storage_volume_group_get_name (group),
                                storage_logical_volume_get_name (self));
 
-  job = storage_daemon_launch_spawned_job (daemon, self,
-                                      "lvm-lvol-delete",
-                                      storage_invocation_get_caller_uid (invocation),
-                                      NULL, /* GCancellable */
-                                      0,    /* uid_t run_as_uid */
-                                      0,    /* uid_t run_as_euid */
-                                      NULL,  /* input_string */
-                                      "lvremove", "-f", full_name, NULL);
+  g_variant_lookup (options, "discard", "b", &discard);
+
+  if (discard)
+    {
+      if (g_strcmp0 (lvm_logical_volume_get_type_ (volume), "block") != 0 ||
+          !lvm_logical_volume_get_active (volume))
+        {
+          g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                                 "Only active block volumes can be discarded");
+          g_free (full_name);
+          return TRUE;
+        }
+
+      data = g_new0 (LogicalVolumeDeleteJobData, 1);
+      data->full_name = g_strdup (full_name);
+      data->device = g_strdup_printf ("/dev/%s", full_name);
+
+      job = storage_daemon_launch_threaded_job (daemon, self,
+                                                "lvm-lvol-delete",
+                                                storage_invocation_get_caller_uid (invocation),
+                                                logical_volume_discard_delete_job_thread,
+                                                data,
+                                                logical_volume_delete_job_free,
+                                                NULL);
+    }
+  else
+    {
+      job = storage_daemon_launch_spawned_job (daemon, self,
+                                          "lvm-lvol-delete",
+                                          storage_invocation_get_caller_uid (invocation),
+                                          NULL, /* GCancellable */
+                                          0,    /* uid_t run_as_uid */
+                                          0,    /* uid_t run_as_euid */
+                                          NULL,  /* input_string */
+                                          "lvremove", "-f", full_name, NULL);
+    }
 
   g_signal_connect_data (job, "completed", G_CALLBACK (on_complete_delete),
                          g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
@@ -425,6 +502,62 @@ handle_delete (LvmLogicalVolume *volume,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_complete_zero (UDisksJob *job,
+                  gboolean success,
+                  gchar *message,
+                  gpointer user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
+  if (success)
+    {
+      lvm_logical_volume_complete_zero (NULL, invocation);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Error zeroing logical volume: %s", message);
+    }
+}
+
+static gboolean
+handle_zero (LvmLogicalVolume *volume,
+             GDBusMethodInvocation *invocation,
+             GVariant *options)
+{
+  StorageLogicalVolume *self = STORAGE_LOGICAL_VOLUME (volume);
+  StorageVolumeGroup *group;
+  guint64 max_rate = 0;
+  gchar *device;
+  StorageJob *job;
+
+  if (g_strcmp0 (lvm_logical_volume_get_type_ (volume), "block") != 0 ||
+      !lvm_logical_volume_get_active (volume))
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Only active block volumes can be zeroed");
+      return TRUE;
+    }
+
+  g_variant_lookup (options, "max-rate", "t", &max_rate);
+
+  group = storage_logical_volume_get_volume_group (self);
+  device = g_strdup_printf ("/dev/%s/%s",
+                            storage_volume_group_get_name (group),
+                            storage_logical_volume_get_name (self));
+
+  job = storage_zero_job_launch (self, "lvm-lvol-zero", device, max_rate,
+                                 storage_invocation_get_caller_uid (invocation));
+
+  g_signal_connect_data (job, "completed", G_CALLBACK (on_complete_zero),
+                         g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
+
+  g_free (device);
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 on_rename_logical_volume (StorageDaemon *daemon,
                           StorageLogicalVolume *volume,
@@ -515,6 +648,9 @@ on_resize_complete (UDisksJob *job,
                     gpointer user_data)
 {
   GDBusMethodInvocation *invocation = user_data;
+
+  storage_invocation_trace (invocation, "job-completed");
+
   if (success)
     {
       lvm_logical_volume_complete_resize (NULL, invocation);
@@ -809,6 +945,7 @@ logical_volume_iface_init (LvmLogicalVolumeIface *iface)
   iface->handle_activate = handle_activate;
   iface->handle_deactivate = handle_deactivate;
   iface->handle_create_snapshot = handle_create_snapshot;
+  iface->handle_zero = handle_zero;
 }
 
 const gchar *
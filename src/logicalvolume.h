@@ -23,6 +23,7 @@
 #define __STORAGE_LOGICAL_VOLUME_H__
 
 #include "types.h"
+#include "vgmodel.h"
 
 G_BEGIN_DECLS
 
@@ -46,8 +47,7 @@ void                    storage_logical_volume_set_volume_group (StorageLogicalV
 
 void                    storage_logical_volume_update           (StorageLogicalVolume *self,
                                                                  StorageVolumeGroup *group,
-                                                                 GVariant *info,
-                                                                 gboolean *needs_polling_ret);
+                                                                 const StorageLvRecord *lv);
 
 G_END_DECLS
 
@@ -0,0 +1,32 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __STORAGE_LVM_CONFIG_H__
+#define __STORAGE_LVM_CONFIG_H__
+
+/*
+ * Shared by the daemon and storaged-lvm-helper, which doesn't link
+ * against the rest of the daemon.  Keep this free of other includes.
+ */
+
+/* Default value of global/locking_dir in lvm.conf */
+#define LVM_LOCKING_DIR "/run/lock/lvm"
+
+#endif /* __STORAGE_LVM_CONFIG_H__ */
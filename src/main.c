@@ -20,8 +20,13 @@
 #include "config.h"
 
 #include "daemon.h"
+#include "invocation.h"
+#include "jobpolicy.h"
+#include "manager.h"
 
 #include "util.h"
+#include "volumegroup.h"
+#include "watchdog.h"
 
 #include <glib/gi18n.h>
 #include <glib-unix.h>
@@ -35,11 +40,25 @@ static GMainLoop *loop = NULL;
 static gboolean opt_replace = FALSE;
 static gboolean opt_debug = FALSE;
 static gchar *opt_resources = NULL;
+static gchar *opt_job_config = NULL;
+static gint opt_slow_call = 1000;
+static gint opt_auth_cache = 10;
+static gchar *opt_replay = NULL;
+static gdouble opt_replay_speed = 1.0;
+static gint opt_stall = 500;
+static gboolean opt_keep_reports = FALSE;
 static GOptionEntry opt_entries[] =
 {
   {"replace", 'r', 0, G_OPTION_ARG_NONE, &opt_replace, "Replace existing daemon", NULL},
   {"debug", 'd', 0, G_OPTION_ARG_NONE, &opt_debug, "Print debug information on stderr", NULL},
   { "resource-dir", 'D', 0, G_OPTION_ARG_FILENAME, &opt_resources, "Directory to find resources, eg. helper binaries", "<full path>" },
+  { "job-config", 0, 0, G_OPTION_ARG_FILENAME, &opt_job_config, "Scheduling of jobs per operation", "<full path>" },
+  { "slow-call-threshold", 0, 0, G_OPTION_ARG_INT, &opt_slow_call, "Log method calls that take longer, 0 to disable", "<msec>" },
+  { "authorization-cache", 0, 0, G_OPTION_ARG_INT, &opt_auth_cache, "Reuse non-interactive polkit authorizations, 0 to disable", "<sec>" },
+  { "replay-uevents", 0, 0, G_OPTION_ARG_FILENAME, &opt_replay, "Replay recorded uevents instead of listening to udev", "<full path>" },
+  { "replay-speed", 0, 0, G_OPTION_ARG_DOUBLE, &opt_replay_speed, "Speed up the replay, 0 for as fast as possible", "<factor>" },
+  { "stall-threshold", 0, 0, G_OPTION_ARG_INT, &opt_stall, "Report when the main loop is busy for longer, 0 to disable", "<msec>" },
+  { "keep-lvm-reports", 0, 0, G_OPTION_ARG_NONE, &opt_keep_reports, "Keep the complete output of the LVM helper, for debugging", NULL },
   {NULL }
 };
 
@@ -61,6 +80,10 @@ on_bus_acquired (GObject *source,
     }
   else
     {
+      storage_invocation_set_slow_call_threshold (MAX (opt_slow_call, 0));
+      storage_invocation_set_authorization_cache_ttl (MAX (opt_auth_cache, 0));
+      storage_manager_set_uevent_replay (opt_replay, MAX (opt_replay_speed, 0));
+      storage_volume_group_set_keep_reports (opt_keep_reports);
       *daemon = g_object_new (STORAGE_TYPE_DAEMON,
                               "connection", connection,
                               "resource-dir", opt_resources,
@@ -83,6 +106,22 @@ on_sigint (gpointer user_data)
   return FALSE;
 }
 
+static gboolean
+on_sigusr1 (gpointer user_data)
+{
+  StorageDaemon **daemon = user_data;
+  StorageManager *manager;
+
+  /* Lets tests and benchmarks drive updates without touching LVM */
+  manager = *daemon ? storage_daemon_get_manager (*daemon) : NULL;
+  if (manager)
+    {
+      g_debug ("Caught SIGUSR1, rescanning volume groups");
+      storage_manager_rescan (manager);
+    }
+  return TRUE;
+}
+
 static gboolean
 on_stdout_close (GIOChannel *channel,
                  GIOCondition condition,
@@ -273,11 +312,23 @@ main (int argc,
 
   g_info ("storaged version %s starting", PACKAGE_VERSION);
 
+  /* This may move the daemon into another cgroup, so do it early */
+  if (opt_job_config)
+    storage_job_policy_load (opt_job_config);
+  else
+    storage_job_policy_load (PACKAGE_SYSCONF_DIR "/storaged/jobs.conf");
+
+  /* Before the daemon starts dispatching in the main loop */
+  if (opt_stall > 0)
+    storage_watchdog_start (opt_stall, opt_debug);
+
   loop = g_main_loop_new (NULL, FALSE);
 
   g_unix_signal_add (SIGINT, on_sigint, NULL);
   g_unix_signal_add (SIGTERM, on_sigint, NULL);
   g_unix_signal_add (SIGHUP, on_sigint, NULL);
+  if (opt_debug)
+    g_unix_signal_add (SIGUSR1, on_sigusr1, &daemon);
 
   g_bus_get (G_BUS_TYPE_SYSTEM, NULL, &on_bus_acquired, &daemon);
 
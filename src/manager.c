@@ -23,7 +23,12 @@
 
 #include "block.h"
 #include "daemon.h"
+#include "intern.h"
 #include "invocation.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "threadedjob.h"
+#include "ueventreplay.h"
 #include "util.h"
 #include "volumegroup.h"
 
@@ -48,6 +53,24 @@ struct _StorageManager
 
   gint lvm_delayed_update_id;
 
+  /* When the oldest uevent that no update has started for came in */
+  gint64 uevents_pending_since;
+  StorageUeventReplay *uevent_replay;
+
+  /* Rate limits writing the warm-start snapshot */
+  guint snapshot_timeout_id;
+  gboolean snapshot_writing;
+  gboolean snapshot_dirty;
+  gboolean restoring_snapshot;
+
+  /* Startup runs these phases concurrently, see init_async */
+  gint64 startup_begin;
+  gint64 startup_udisks;
+  gint64 startup_lvm;
+  gint64 startup_udev;
+  gint64 startup_ready;
+  GHashTable *udev_volume_groups;
+
   /* GDBusObjectManager is that special kind of ugly */
   gulong sig_object_added;
   gulong sig_object_removed;
@@ -76,29 +99,265 @@ G_DEFINE_TYPE_WITH_CODE (StorageManager, storage_manager, LVM_TYPE_MANAGER_SKELE
                          G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, async_initable_iface_init);
 );
 
+/* See storage_manager_set_uevent_replay */
+static gchar *uevent_replay_path = NULL;
+static gdouble uevent_replay_speed = 1.0;
+
 struct UpdateData {
   StorageManager *self;
   gboolean ignore_locks;
   GTask *task;
+  gint64 uevents_since;
 
   int pending_vg_updates;
 };
 
+static void
+startup_phase_done (StorageManager *self,
+                    gint64 *phase,
+                    const gchar *name)
+{
+  GVariantBuilder builder;
+
+  if (*phase != 0)
+    return;
+
+  *phase = g_get_monotonic_time () - self->startup_begin;
+  g_debug ("startup phase %s finished after %" G_GINT64_FORMAT " ms", name, *phase / 1000);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+  if (self->startup_ready)
+    g_variant_builder_add (&builder, "{st}", "ready", (guint64)self->startup_ready);
+  if (self->startup_lvm)
+    g_variant_builder_add (&builder, "{st}", "lvm", (guint64)self->startup_lvm);
+  if (self->startup_udisks)
+    g_variant_builder_add (&builder, "{st}", "udisks", (guint64)self->startup_udisks);
+  if (self->startup_udev)
+    g_variant_builder_add (&builder, "{st}", "udev", (guint64)self->startup_udev);
+  lvm_manager_set_startup_phases (LVM_MANAGER (self), g_variant_builder_end (&builder));
+}
+
 static void trigger_delayed_lvm_update (StorageManager *self);
 
+static void
+check_udev_volume_groups (StorageManager *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  /* Need both the LVM coldplug and the udev enumeration */
+  if (!self->udev_volume_groups || !self->startup_lvm)
+    return;
+
+  /*
+   * Logical volumes that udev knows about must belong to a volume
+   * group we have.  If one doesn't, the volume group appeared after
+   * the helper listed them, so look again.
+   */
+  g_hash_table_iter_init (&iter, self->udev_volume_groups);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (self->name_to_volume_group, key))
+        {
+          g_debug ("udev knows about unlisted volume group %s", (gchar *)key);
+          trigger_delayed_lvm_update (self);
+          break;
+        }
+    }
+
+  g_hash_table_unref (self->udev_volume_groups);
+  self->udev_volume_groups = NULL;
+}
+
+/* Seconds between writes of the snapshot, at most */
+#define SNAPSHOT_INTERVAL 2
+
+static void
+write_snapshot_thread (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (storage_snapshot_save (task_data, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+on_snapshot_written (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+  StorageManager *self = STORAGE_MANAGER (source);
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_message ("Couldn't write snapshot: %s", error->message);
+      g_error_free (error);
+    }
+
+  self->snapshot_writing = FALSE;
+
+  /* Changed again while the last one was being written */
+  if (self->snapshot_dirty)
+    {
+      self->snapshot_dirty = FALSE;
+      storage_manager_schedule_snapshot (self);
+    }
+}
+
+static gboolean
+write_snapshot (gpointer user_data)
+{
+  StorageManager *self = STORAGE_MANAGER (user_data);
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+  GVariant *info;
+  GTask *task;
+
+  self->snapshot_timeout_id = 0;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_hash_table_iter_init (&iter, self->name_to_volume_group);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      info = storage_volume_group_get_info (value);
+      if (info)
+        {
+          g_variant_builder_add (&builder, "{sv}", key, info);
+          g_variant_unref (info);
+        }
+    }
+
+  /* Serializing and writing the file is slow, keep it off the main loop */
+  self->snapshot_writing = TRUE;
+  task = g_task_new (self, NULL, on_snapshot_written, NULL);
+  g_task_set_task_data (task, g_variant_ref_sink (g_variant_builder_end (&builder)),
+                        (GDestroyNotify) g_variant_unref);
+  g_task_run_in_thread (task, write_snapshot_thread);
+  g_object_unref (task);
+
+  return FALSE;
+}
+
+/**
+ * storage_manager_schedule_snapshot:
+ * @self: A #StorageManager.
+ *
+ * Notes that the model changed and should be written to the
+ * warm-start snapshot soon. Writes are coalesced.
+ */
+void
+storage_manager_schedule_snapshot (StorageManager *self)
+{
+  if (self->restoring_snapshot || self->snapshot_timeout_id)
+    return;
+
+  if (self->snapshot_writing)
+    {
+      self->snapshot_dirty = TRUE;
+      return;
+    }
+
+  self->snapshot_timeout_id = g_timeout_add_seconds (SNAPSHOT_INTERVAL, write_snapshot, self);
+}
+
+static gboolean
+restore_snapshot (StorageManager *self)
+{
+  StorageVolumeGroup *group;
+  GVariant *volume_groups;
+  GVariantIter iter;
+  GError *error = NULL;
+  const gchar *name;
+  GVariant *info;
+
+  volume_groups = storage_snapshot_load (&error);
+  if (volume_groups == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_message ("Ignoring snapshot: %s", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  self->restoring_snapshot = TRUE;
+
+  g_variant_iter_init (&iter, volume_groups);
+  while (g_variant_iter_next (&iter, "{&sv}", &name, &info))
+    {
+      if (g_variant_is_of_type (info, G_VARIANT_TYPE ("a{sv}"))
+          && !g_hash_table_contains (self->name_to_volume_group, name))
+        {
+          g_debug ("restoring volume group from snapshot: %s", name);
+          group = storage_volume_group_new (self, name);
+          g_hash_table_insert (self->name_to_volume_group,
+                               (gchar *)storage_intern_ref (storage_volume_group_get_name (group)), group);
+          storage_volume_group_update_from_snapshot (group, info);
+        }
+      g_variant_unref (info);
+    }
+
+  self->restoring_snapshot = FALSE;
+  g_variant_unref (volume_groups);
+
+  return g_hash_table_size (self->name_to_volume_group) > 0;
+}
+
+static void
+lvm_update_stale_volume_groups (StorageManager *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint count = 0;
+
+  g_hash_table_iter_init (&iter, self->name_to_volume_group);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (storage_volume_group_is_possibly_stale (value))
+        {
+          storage_volume_group_update (value, FALSE, NULL, NULL);
+          count++;
+        }
+    }
+
+  g_debug ("re-reading %u of %u volume groups after coldplug", count,
+           g_hash_table_size (self->name_to_volume_group));
+}
+
+static void   start_uevent_replay   (StorageManager *self);
+
 static void
 lvm_update_done (struct UpdateData *data)
 {
+  /* How long the model was behind the uevents that this update covers */
+  if (data->uevents_since)
+    storage_stats_record_since ("uevent.staleness", data->uevents_since);
+
   if (data->ignore_locks)
     {
-      // Do a warmplug right away because we might have gotten invalid
-      // data when ignoring locking during coldplug.
-
-      trigger_delayed_lvm_update (data->self);
+      // Do a warmplug right away for the volume groups that might
+      // have given us invalid data when ignoring locking during
+      // coldplug.  Ones that were read consistently don't need it.
+
+      lvm_update_stale_volume_groups (data->self);
+
+      /* Anything restored from the snapshot has been reconciled now */
+      lvm_manager_set_stale (LVM_MANAGER (data->self), FALSE);
+      startup_phase_done (data->self, &data->self->startup_lvm, "lvm");
+      check_udev_volume_groups (data->self);
+      g_signal_emit (data->self, signals[COLDPLUG_COMPLETED_SIGNAL], 0);
+      start_uevent_replay (data->self);
     }
 
   if (data->task)
     {
+      startup_phase_done (data->self, &data->self->startup_ready, "ready");
       g_task_return_boolean (data->task, TRUE);
       g_object_unref (data->task);
     }
@@ -162,6 +421,7 @@ lvm_update_from_variant (GPid pid,
           /* Object unpublishes itself */
           g_object_run_dispose (G_OBJECT (group));
           g_hash_table_iter_remove (&vg_name_iter);
+          storage_manager_schedule_snapshot (self);
         }
     }
 
@@ -177,7 +437,8 @@ lvm_update_from_variant (GPid pid,
           group = storage_volume_group_new (self, name);
           g_debug ("adding volume group: %s", name);
 
-          g_hash_table_insert (self->name_to_volume_group, g_strdup (name), group);
+          g_hash_table_insert (self->name_to_volume_group,
+                               (gchar *)storage_intern_ref (storage_volume_group_get_name (group)), group);
         }
 
       data->pending_vg_updates += 1;
@@ -204,6 +465,8 @@ lvm_update (StorageManager *self,
   data->task = task;
   data->ignore_locks = ignore_locks;
   data->pending_vg_updates = 0;
+  data->uevents_since = self->uevents_pending_since;
+  self->uevents_pending_since = 0;
 
   storage_daemon_spawn_for_variant (storage_daemon_get (), args, G_VARIANT_TYPE("as"),
                                     lvm_update_from_variant, data);
@@ -228,19 +491,31 @@ trigger_delayed_lvm_update (StorageManager *self)
 
   self->lvm_delayed_update_id =
     g_timeout_add (100, delayed_lvm_update, self);
+  g_source_set_name_by_id (self->lvm_delayed_update_id, "lvm update");
+}
+
+/**
+ * storage_manager_rescan:
+ * @self: A #StorageManager.
+ *
+ * Reads all volume groups again soon, as if a uevent had come in for
+ * one of them.
+ */
+void
+storage_manager_rescan (StorageManager *self)
+{
+  trigger_delayed_lvm_update (self);
 }
 
 static gboolean
-is_logical_volume (GUdevDevice *device)
+is_logical_volume (const gchar *dm_vg_name)
 {
-  const gchar *dm_vg_name = g_udev_device_get_property (device, "DM_VG_NAME");
   return dm_vg_name && *dm_vg_name;
 }
 
 static gboolean
-has_physical_volume_label (GUdevDevice *device)
+has_physical_volume_label (const gchar *id_fs_type)
 {
-  const gchar *id_fs_type = g_udev_device_get_property (device, "ID_FS_TYPE");
   return g_strcmp0 (id_fs_type, "LVM2_member") == 0;
 }
 
@@ -253,6 +528,10 @@ find_block (StorageManager *self,
   GDBusObject *object;
   const gchar *path;
 
+  /* Still connecting to udisksd */
+  if (self->udisks_client == NULL)
+    return NULL;
+
   real_block = udisks_client_get_block_for_dev (self->udisks_client, device_number);
   if (real_block != NULL)
     {
@@ -268,12 +547,12 @@ find_block (StorageManager *self,
 
 static gboolean
 is_recorded_as_physical_volume (StorageManager *self,
-                                GUdevDevice *device)
+                                dev_t device_number)
 {
   StorageBlock *block;
   gboolean ret = FALSE;
 
-  block = find_block (self, g_udev_device_get_device_number (device));
+  block = find_block (self, device_number);
   if (block != NULL)
     {
       ret = (storage_block_get_physical_volume_block (block) != NULL);
@@ -286,12 +565,21 @@ is_recorded_as_physical_volume (StorageManager *self,
 static void
 handle_block_uevent_for_lvm (StorageManager *self,
                              const gchar *action,
-                             GUdevDevice *device)
+                             dev_t device_number,
+                             const gchar *dm_vg_name,
+                             const gchar *id_fs_type)
 {
-  if (is_logical_volume (device)
-      || has_physical_volume_label (device)
-      || is_recorded_as_physical_volume (self, device))
-    trigger_delayed_lvm_update (self);
+  if (is_logical_volume (dm_vg_name)
+      || has_physical_volume_label (id_fs_type)
+      || is_recorded_as_physical_volume (self, device_number))
+    {
+      /* An update is pending anyway, this uevent gets folded into it */
+      if (self->lvm_delayed_update_id > 0)
+        storage_stats_count ("uevent.coalesced", 1);
+      if (self->uevents_pending_since == 0)
+        self->uevents_pending_since = g_get_monotonic_time ();
+      trigger_delayed_lvm_update (self);
+    }
 }
 
 static void
@@ -302,7 +590,65 @@ on_uevent (GUdevClient *client,
 {
   g_debug ("udev event '%s' for %s", action,
            device ? g_udev_device_get_name (device) : "???");
-  handle_block_uevent_for_lvm (user_data, action, device);
+  storage_stats_count ("uevent.received", 1);
+  handle_block_uevent_for_lvm (user_data, action,
+                               g_udev_device_get_device_number (device),
+                               g_udev_device_get_property (device, "DM_VG_NAME"),
+                               g_udev_device_get_property (device, "ID_FS_TYPE"));
+}
+
+static void
+on_replayed_uevent (const gchar *action,
+                    const gchar *name,
+                    guint64 device_number,
+                    GVariant *properties,
+                    gpointer user_data)
+{
+  const gchar *dm_vg_name = NULL;
+  const gchar *id_fs_type = NULL;
+
+  g_debug ("replayed udev event '%s' for %s", action, name);
+  g_variant_lookup (properties, "DM_VG_NAME", "&s", &dm_vg_name);
+  g_variant_lookup (properties, "ID_FS_TYPE", "&s", &id_fs_type);
+  handle_block_uevent_for_lvm (user_data, action, device_number, dm_vg_name, id_fs_type);
+}
+
+/**
+ * storage_manager_set_uevent_replay:
+ * @path: A recording of uevents, or %NULL.
+ * @speed: How much faster than recorded to replay, or 0 for as fast
+ *   as possible.
+ *
+ * Makes managers created afterwards ignore udev, and replay the
+ * uevents recorded in @path once they are done with the coldplug.
+ * See #StorageUeventReplay.
+ */
+void
+storage_manager_set_uevent_replay (const gchar *path,
+                                   gdouble speed)
+{
+  g_free (uevent_replay_path);
+  uevent_replay_path = g_strdup (path);
+  uevent_replay_speed = speed;
+}
+
+static void
+start_uevent_replay (StorageManager *self)
+{
+  GError *error = NULL;
+
+  if (uevent_replay_path == NULL || self->uevent_replay != NULL)
+    return;
+
+  self->uevent_replay = storage_uevent_replay_new (uevent_replay_path, uevent_replay_speed, &error);
+  if (self->uevent_replay == NULL)
+    {
+      g_message ("Couldn't replay uevents: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  storage_uevent_replay_start (self->uevent_replay, on_replayed_uevent, self);
 }
 
 static void
@@ -338,7 +684,7 @@ on_udisks_interface_added (GDBusObjectManager *udisks_object_manager,
                           "udev-client", self->udev_client,
                           NULL);
 
-  g_hash_table_insert (self->udisks_path_to_block, g_strdup (path), overlay);
+  g_hash_table_insert (self->udisks_path_to_block, (gchar *)storage_intern (path), overlay);
 
   update_block_from_all_volume_groups (self, overlay);
 }
@@ -421,11 +767,6 @@ storage_manager_find_block (StorageManager *self,
 static void
 storage_manager_init (StorageManager *self)
 {
-  GDBusObjectManager *object_manager;
-  GError *error = NULL;
-  GList *objects, *o;
-  GList *interfaces, *i;
-
   const gchar *subsystems[] = {
       "block",
       "iscsi_connection",
@@ -433,17 +774,34 @@ storage_manager_init (StorageManager *self)
       NULL
   };
 
-  self->name_to_volume_group = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+  self->name_to_volume_group = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      (GDestroyNotify) storage_intern_unref,
                                                       (GDestroyNotify) g_object_unref);
 
-  self->udisks_path_to_block = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+  self->udisks_path_to_block = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      (GDestroyNotify) storage_intern_unref,
                                                       (GDestroyNotify) g_object_unref);
 
   /* get ourselves an udev client */
   self->udev_client = g_udev_client_new (subsystems);
-  g_signal_connect (self->udev_client, "uevent", G_CALLBACK (on_uevent), self);
 
-  self->udisks_client = udisks_client_new_sync (NULL, &error);
+  /* A replay takes the place of the real uevents */
+  if (uevent_replay_path == NULL)
+    g_signal_connect (self->udev_client, "uevent", G_CALLBACK (on_uevent), self);
+}
+
+static void
+on_udisks_client_ready (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+  StorageManager *self = user_data;
+  GDBusObjectManager *object_manager;
+  GError *error = NULL;
+  GList *objects, *o;
+  GList *interfaces, *i;
+
+  self->udisks_client = udisks_client_new_finish (result, &error);
   if (error != NULL)
     {
       g_critical ("Couldn't connect to the main udisksd: %s", error->message);
@@ -471,16 +829,49 @@ storage_manager_init (StorageManager *self)
       self->sig_interface_removed = g_signal_connect (object_manager, "interface-removed",
                                                       G_CALLBACK (on_udisks_interface_removed), self);
     }
+
+  startup_phase_done (self, &self->startup_udisks, "udisks");
+  g_object_unref (self);
 }
 
 static void
-storage_manager_constructed (GObject *object)
+enumerate_udev_thread (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
 {
-  StorageManager *self = STORAGE_MANAGER (object);
+  const gchar *subsystems[] = { "block", NULL };
+  GUdevClient *client;
+  GHashTable *names;
+  GList *devices, *l;
+
+  /* libudev isn't thread safe, so use our own client here */
+  client = g_udev_client_new (subsystems);
+  names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  devices = g_udev_client_query_by_subsystem (client, "block");
+  for (l = devices; l != NULL; l = g_list_next (l))
+    {
+      if (is_logical_volume (g_udev_device_get_property (l->data, "DM_VG_NAME")))
+        g_hash_table_add (names, g_strdup (g_udev_device_get_property (l->data, "DM_VG_NAME")));
+    }
+
+  g_list_free_full (devices, g_object_unref);
+  g_object_unref (client);
+
+  g_task_return_pointer (task, names, (GDestroyNotify) g_hash_table_unref);
+}
 
-  G_OBJECT_CLASS (storage_manager_parent_class)->constructed (object);
+static void
+on_udev_enumerated (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  StorageManager *self = STORAGE_MANAGER (source);
 
-  udisks_client_settle (self->udisks_client);
+  self->udev_volume_groups = g_task_propagate_pointer (G_TASK (result), NULL);
+  startup_phase_done (self, &self->startup_udev, "udev");
+  check_udev_volume_groups (self);
 }
 
 static void
@@ -492,8 +883,36 @@ storage_manager_init_async (GAsyncInitable       *initable,
 {
   StorageManager *self = STORAGE_MANAGER (initable);
   GTask *task;
+  GTask *udev_task;
 
   task = g_task_new (initable, cancellable, callback, user_data);
+  self->startup_begin = g_get_monotonic_time ();
+
+  /*
+   * Connecting to udisksd, the LVM coldplug, and enumerating udev all
+   * happen at the same time.  Only the LVM coldplug is needed before
+   * we can answer; blocks get linked up as udisksd tells us about them.
+   */
+  udisks_client_new (NULL, on_udisks_client_ready, g_object_ref (self));
+
+  udev_task = g_task_new (self, NULL, on_udev_enumerated, NULL);
+  g_task_run_in_thread (udev_task, enumerate_udev_thread);
+  g_object_unref (udev_task);
+
+  /*
+   * With a snapshot from our previous run we can answer right away.
+   * The coldplug then reconciles the published objects with what LVM
+   * actually has, and clears the Stale property when it's done.
+   */
+  if (restore_snapshot (self))
+    {
+      lvm_manager_set_stale (LVM_MANAGER (self), TRUE);
+      startup_phase_done (self, &self->startup_ready, "ready");
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      task = NULL;
+    }
+
   lvm_update (self, TRUE, task);
 }
 
@@ -526,7 +945,14 @@ storage_manager_finalize (GObject *object)
       g_object_unref (self->udisks_client);
     }
 
+  if (self->snapshot_timeout_id)
+    g_source_remove (self->snapshot_timeout_id);
+
+  if (self->uevent_replay)
+    storage_uevent_replay_free (self->uevent_replay);
   g_clear_object (&self->udev_client);
+  if (self->udev_volume_groups)
+    g_hash_table_unref (self->udev_volume_groups);
   g_hash_table_unref (self->name_to_volume_group);
   g_hash_table_unref (self->udisks_path_to_block);
 
@@ -538,7 +964,6 @@ storage_manager_class_init (StorageManagerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
-  object_class->constructed = storage_manager_constructed;
   object_class->finalize = storage_manager_finalize;
 
   signals[COLDPLUG_COMPLETED_SIGNAL] =
@@ -556,10 +981,122 @@ storage_manager_class_init (StorageManagerClass *klass)
 typedef struct {
   gchar **devices;
   gchar *vgname;
+  uid_t caller_uid;
 } VolumeGroupCreateJobData;
 
+/* How many devices get prepared at the same time */
+#define MAX_PREPARE_THREADS 8
+
+typedef gboolean (* DeviceFunc) (const gchar *device,
+                                 GError **error);
+
+typedef struct {
+  StorageThreadedJob *job;
+  GCancellable *cancellable;
+  gchar **devices;
+  DeviceFunc func;
+  GError **errors;
+  gint done;
+  guint progress_total;
+} ParallelDevices;
+
+static void
+parallel_device_func (gpointer item,
+                      gpointer user_data)
+{
+  ParallelDevices *par = user_data;
+  guint i = GPOINTER_TO_UINT (item) - 1;
+  GError *error = NULL;
+  gint done;
+
+  if (!g_cancellable_set_error_if_cancelled (par->cancellable, &error))
+    (par->func) (par->devices[i], &error);
+  par->errors[i] = error;
+
+  done = g_atomic_int_add (&par->done, 1) + 1;
+  if (par->progress_total > 0)
+    storage_threaded_job_set_progress (par->job, (gdouble)done / par->progress_total);
+}
+
+/*
+ * Runs @func for all @devices in a bounded number of threads and waits
+ * for all of them. Each finished device adds one step of @progress_total
+ * to the progress of @job, unless that's zero. If more than one device
+ * fails, the messages are all reported together.
+ */
 static gboolean
-volume_group_create_job_thread (GCancellable *cancellable,
+for_each_device_in_parallel (StorageThreadedJob *job,
+                             GCancellable *cancellable,
+                             gchar **devices,
+                             DeviceFunc func,
+                             guint progress_total,
+                             GError **error)
+{
+  ParallelDevices par = { job, cancellable, devices, func, NULL, 0, progress_total };
+  GThreadPool *pool;
+  GString *message = NULL;
+  guint n_devices;
+  guint n_failed = 0;
+  guint first_failed = 0;
+  guint i;
+
+  n_devices = g_strv_length (devices);
+  if (n_devices == 0)
+    return TRUE;
+
+  par.errors = g_new0 (GError *, n_devices);
+
+  pool = g_thread_pool_new (parallel_device_func, &par,
+                            MIN (n_devices, MAX_PREPARE_THREADS),
+                            FALSE, NULL);
+  for (i = 0; i < n_devices; i++)
+    g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < n_devices; i++)
+    {
+      if (par.errors[i] == NULL)
+        continue;
+      if (n_failed++ == 0)
+        {
+          first_failed = i;
+          message = g_string_new (par.errors[i]->message);
+        }
+      else
+        g_string_append_printf (message, "; %s", par.errors[i]->message);
+    }
+
+  if (n_failed == 1)
+    {
+      g_propagate_error (error, par.errors[first_failed]);
+      par.errors[first_failed] = NULL;
+    }
+  else if (n_failed > 1)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "%u of %u devices failed: %s", n_failed, n_devices, message->str);
+    }
+
+  for (i = 0; i < n_devices; i++)
+    g_clear_error (&par.errors[i]);
+  g_free (par.errors);
+  if (message)
+    g_string_free (message, TRUE);
+
+  return n_failed == 0;
+}
+
+static gboolean
+trigger_udev (const gchar *device,
+              GError **error)
+{
+  storage_util_trigger_udev (device);
+  return TRUE;
+}
+
+static gboolean
+volume_group_create_job_thread (StorageThreadedJob *job,
+                                GCancellable *cancellable,
                                 gpointer user_data,
                                 GError **error)
 {
@@ -569,13 +1106,16 @@ volume_group_create_job_thread (GCancellable *cancellable,
   gint exit_status;
   GPtrArray *argv;
   gboolean ret;
+  guint n_devices;
   gint i;
 
-  for (i = 0; data->devices[i] != NULL; i++)
-    {
-      if (!storage_util_wipe_block (data->devices[i], error))
-        return FALSE;
-    }
+  /* Each device is a step, and so is vgcreate itself */
+  n_devices = g_strv_length (data->devices);
+  storage_threaded_job_set_progress (job, 0.0);
+
+  if (!for_each_device_in_parallel (job, cancellable, data->devices,
+                                    storage_util_wipe_block, n_devices + 1, error))
+    return FALSE;
 
   argv = g_ptr_array_new ();
   g_ptr_array_add (argv, (gchar *)"vgcreate");
@@ -600,9 +1140,10 @@ volume_group_create_job_thread (GCancellable *cancellable,
 
   if (ret)
     {
+      storage_threaded_job_set_progress (job, 1.0);
+
       // https://bugzilla.redhat.com/show_bug.cgi?id=1084944
-      for (i = 0; data->devices[i] != NULL; i++)
-        storage_util_trigger_udev (data->devices[i]);
+      for_each_device_in_parallel (job, NULL, data->devices, trigger_udev, 0, NULL);
     }
 
   g_free (standard_output);
@@ -639,6 +1180,7 @@ on_create_volume_group (StorageDaemon *daemon,
 
   if (g_str_equal (storage_volume_group_get_name (group), complete->data.vgname))
     {
+      storage_invocation_trace (complete->invocation, "published");
       lvm_manager_complete_volume_group_create (NULL, complete->invocation,
                                                 storage_volume_group_get_object_path (group));
       g_signal_handler_disconnect (daemon, complete->wait_sig);
@@ -653,6 +1195,8 @@ on_create_complete (UDisksJob *job,
 {
   CompleteClosure *complete = user_data;
 
+  storage_invocation_trace (complete->invocation, "job-completed");
+
   if (success)
     return;
 
@@ -661,73 +1205,50 @@ on_create_complete (UDisksJob *job,
   g_signal_handler_disconnect (storage_daemon_get (), complete->wait_sig);
 }
 
-static gboolean
-handle_volume_group_create (LvmManager *manager,
-                            GDBusMethodInvocation *invocation,
-                            const gchar *arg_name,
-                            const gchar *const *arg_blocks,
-                            GVariant *arg_options)
+static void
+volume_group_create_data_free (gpointer user_data)
 {
-  StorageManager *self = STORAGE_MANAGER (manager);
-  GError *error = NULL;
-  GList *blocks = NULL;
-  GList *l;
-  guint n;
-  StorageDaemon *daemon;
-  gchar *encoded_name = NULL;
-  CompleteClosure *complete;
-  StorageJob *job;
+  VolumeGroupCreateJobData *data = user_data;
+  g_strfreev (data->devices);
+  g_free (data->vgname);
+  g_free (data);
+}
 
-  daemon = storage_daemon_get ();
+static gboolean
+volume_group_create_check (gpointer user_data,
+                           GError **error)
+{
+  VolumeGroupCreateJobData *data = user_data;
 
-  /* Collect and validate block objects
-   *
-   * Also, check we can open the block devices at the same time - this
-   * is to avoid start deleting half the block devices while the other
-   * half is already in use.
+  /*
+   * Check we can open all the block devices - this is to avoid start
+   * deleting half the block devices while the other half is already
+   * in use.
    */
-  for (n = 0; arg_blocks != NULL && arg_blocks[n] != NULL; n++)
-    {
-      StorageBlock *block = NULL;
-
-      block = storage_manager_find_block (self, arg_blocks[n]);
-
-      /* Assumes ref, do this early for memory management */
-      blocks = g_list_prepend (blocks, block);
-
-      if (block == NULL)
-        {
-          g_dbus_method_invocation_return_error (invocation,
-                                                 UDISKS_ERROR,
-                                                 UDISKS_ERROR_FAILED,
-                                                 "Invalid object path %s at index %d",
-                                                 arg_blocks[n], n);
-          goto out;
-        }
+  return for_each_device_in_parallel (NULL, NULL, data->devices,
+                                      storage_util_device_is_unused, 0, error);
+}
 
-      if (!storage_block_is_unused (block, &error))
-        {
-          g_dbus_method_invocation_take_error (invocation, error);
-          goto out;
-        }
-    }
+static void
+volume_group_create_ready (GDBusMethodInvocation *invocation,
+                           gpointer user_data)
+{
+  VolumeGroupCreateJobData *data = user_data;
+  CompleteClosure *complete;
+  StorageDaemon *daemon;
+  StorageJob *job;
 
-  blocks = g_list_reverse (blocks);
+  daemon = storage_daemon_get ();
 
   /* Create the volume group... */
   complete = g_new0 (CompleteClosure, 1);
   complete->invocation = g_object_ref (invocation);
-  complete->data.vgname = g_strdup (arg_name);
-  complete->data.devices = g_new0 (gchar *, n + 1);
-  for (n = 0, l = blocks; l != NULL; l = g_list_next (l), n++)
-    {
-      g_assert (arg_blocks[n] != NULL);
-      complete->data.devices[n] = g_strdup (storage_block_get_device (l->data));
-    }
+  complete->data.vgname = g_strdup (data->vgname);
+  complete->data.devices = g_strdupv (data->devices);
 
   job = storage_daemon_launch_threaded_job (daemon, NULL,
                                        "lvm-vg-create",
-                                       storage_invocation_get_caller_uid (invocation),
+                                       data->caller_uid,
                                        volume_group_create_job_thread,
                                        &complete->data,
                                        NULL, NULL);
@@ -740,10 +1261,51 @@ handle_volume_group_create (LvmManager *manager,
                                               "published::StorageVolumeGroup",
                                               G_CALLBACK (on_create_volume_group),
                                               complete, complete_closure_free, 0);
+}
+
+static gboolean
+handle_volume_group_create (LvmManager *manager,
+                            GDBusMethodInvocation *invocation,
+                            const gchar *arg_name,
+                            const gchar *const *arg_blocks,
+                            GVariant *arg_options)
+{
+  StorageManager *self = STORAGE_MANAGER (manager);
+  VolumeGroupCreateJobData *data;
+  StorageBlock *block;
+  guint n;
+
+  data = g_new0 (VolumeGroupCreateJobData, 1);
+  data->vgname = g_strdup (arg_name);
+  data->devices = g_new0 (gchar *, (arg_blocks ? g_strv_length ((gchar **)arg_blocks) : 0) + 1);
+
+  /* Collect and validate block objects */
+  for (n = 0; arg_blocks != NULL && arg_blocks[n] != NULL; n++)
+    {
+      block = storage_manager_find_block (self, arg_blocks[n]);
+      if (block == NULL)
+        {
+          g_dbus_method_invocation_return_error (invocation,
+                                                 UDISKS_ERROR,
+                                                 UDISKS_ERROR_FAILED,
+                                                 "Invalid object path %s at index %d",
+                                                 arg_blocks[n], n);
+          volume_group_create_data_free (data);
+          return TRUE;
+        }
+
+      data->devices[n] = g_strdup (storage_block_get_device (block));
+      g_object_unref (block);
+    }
+
+  /* While the caller is surely still there */
+  data->caller_uid = storage_invocation_get_caller_uid (invocation);
 
-out:
-  g_list_free_full (blocks, g_object_unref);
-  g_free (encoded_name);
+  /* Opening the devices may block, so do that off the main loop */
+  storage_invocation_check_in_thread (invocation,
+                                      volume_group_create_check,
+                                      volume_group_create_ready,
+                                      data, volume_group_create_data_free);
 
   return TRUE; /* returning TRUE means that we handled the method invocation */
 }
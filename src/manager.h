@@ -46,6 +46,13 @@ GList *                storage_manager_get_blocks          (StorageManager *self
 StorageBlock *         storage_manager_find_block          (StorageManager *self,
                                                             const gchar *udisks_path);
 
+void                   storage_manager_schedule_snapshot   (StorageManager *self);
+
+void                   storage_manager_rescan              (StorageManager *self);
+
+void                   storage_manager_set_uevent_replay   (const gchar *path,
+                                                            gdouble speed);
+
 G_END_DECLS
 
 #endif /* __STORAGE_MANAGER_H__ */
@@ -22,9 +22,12 @@
 #include "config.h"
 
 #include "daemon.h"
+#include "intern.h"
+#include "invocation.h"
 #include "physicalvolume.h"
 #include "volumegroup.h"
 #include "util.h"
+#include "zero.h"
 
 #include <glib/gi18n-lib.h>
 
@@ -48,6 +51,8 @@ typedef struct _StoragePhysicalVolumeClass   StoragePhysicalVolumeClass;
 struct _StoragePhysicalVolume
 {
   LvmPhysicalVolumeBlockSkeleton parent_instance;
+
+  const gchar *device;
 };
 
 struct _StoragePhysicalVolumeClass
@@ -69,10 +74,22 @@ storage_physical_volume_init (StoragePhysicalVolume *self)
 
 }
 
+static void
+storage_physical_volume_finalize (GObject *object)
+{
+  StoragePhysicalVolume *self = STORAGE_PHYSICAL_VOLUME (object);
+
+  storage_intern_unref (self->device);
+
+  G_OBJECT_CLASS (storage_physical_volume_parent_class)->finalize (object);
+}
+
 static void
 storage_physical_volume_class_init (StoragePhysicalVolumeClass *klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
+  gobject_class->finalize = storage_physical_volume_finalize;
 }
 
 /**
@@ -93,32 +110,84 @@ storage_physical_volume_new (void)
 /**
  * storage_physical_volume_update:
  * @physical_volume: A #StoragePhysicalVolume.
- * @object: The enclosing #StorageBlockObject instance.
+ * @group: The volume group.
+ * @pv: The physical volume as reported by LVM.
  *
  * Updates the interface.
  */
 void
 storage_physical_volume_update (StoragePhysicalVolume *self,
                                 StorageVolumeGroup *group,
-                                GVariant *info)
+                                const StoragePvRecord *pv)
 {
   LvmPhysicalVolumeBlock *iface;
-  guint64 num;
 
   iface = LVM_PHYSICAL_VOLUME_BLOCK (self);
 
+  if (pv->device && pv->device != self->device)
+    {
+      storage_intern_unref (self->device);
+      self->device = storage_intern_ref (pv->device);
+    }
+
   lvm_physical_volume_block_set_volume_group (iface, storage_volume_group_get_object_path (group));
 
-  if (g_variant_lookup (info, "size", "t", &num))
-    lvm_physical_volume_block_set_size (iface, num);
+  if (pv->flags & STORAGE_MODEL_HAS_SIZE)
+    lvm_physical_volume_block_set_size (iface, pv->size);
 
-  if (g_variant_lookup (info, "free-size", "t", &num))
-    lvm_physical_volume_block_set_free_size (iface, num);
+  if (pv->flags & STORAGE_MODEL_HAS_FREE_SIZE)
+    lvm_physical_volume_block_set_free_size (iface, pv->free_size);
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_complete_zero (UDisksJob *job,
+                  gboolean success,
+                  gchar *message,
+                  gpointer user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
+  if (success)
+    {
+      lvm_physical_volume_block_complete_zero (NULL, invocation);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "Error zeroing physical volume: %s", message);
+    }
+}
+
+static gboolean
+handle_zero (LvmPhysicalVolumeBlock *physical_volume,
+             GDBusMethodInvocation *invocation,
+             GVariant *options)
+{
+  StoragePhysicalVolume *self = STORAGE_PHYSICAL_VOLUME (physical_volume);
+  guint64 max_rate = 0;
+  StorageJob *job;
+
+  if (self->device == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                                             "The device of the physical volume is not known");
+      return TRUE;
+    }
+
+  g_variant_lookup (options, "max-rate", "t", &max_rate);
+
+  job = storage_zero_job_launch (self, "lvm-pv-zero", self->device, max_rate,
+                                 storage_invocation_get_caller_uid (invocation));
+
+  g_signal_connect_data (job, "completed", G_CALLBACK (on_complete_zero),
+                         g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
+
+  return TRUE;
+}
+
 static void
 physical_volume_iface_init (LvmPhysicalVolumeBlockIface *iface)
 {
+  iface->handle_zero = handle_zero;
 }
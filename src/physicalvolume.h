@@ -23,6 +23,7 @@
 #define __STORAGE_PHYSICAL_VOLUME_H__
 
 #include "types.h"
+#include "vgmodel.h"
 
 G_BEGIN_DECLS
 
@@ -36,7 +37,7 @@ StoragePhysicalVolume *  storage_physical_volume_new        (void);
 
 void                     storage_physical_volume_update     (StoragePhysicalVolume *self,
                                                              StorageVolumeGroup *group,
-                                                             GVariant *info);
+                                                             const StoragePvRecord *pv);
 
 G_END_DECLS
 
@@ -0,0 +1,714 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "process.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/**
+ * SECTION:storageprocess
+ * @title: StorageProcess
+ * @short_description: Running other programs
+ *
+ * This is how the daemon runs the helpers it reads variants from, the
+ * commands of spawned jobs, and the pvmove processes of EmptyDevice,
+ * and collects their output. Threaded jobs still run their short
+ * one-off commands with g_spawn_sync().
+ *
+ * Unless the caller needs to run code in the child before exec, the
+ * child is started with posix_spawn(), which doesn't copy the page
+ * tables of the daemon and so stays fast however big the daemon
+ * gets. Otherwise it is forked by g_spawn_async_with_pipes().
+ *
+ * The child is then watched through a pidfd, which becomes readable
+ * when the child exits, and is reaped right there together with
+ * reading the last of its output. Until then its pid can't be reused,
+ * so storage_process_kill() never hits an unrelated process. On
+ * kernels without pidfds, GChildWatch is used instead.
+ *
+ * A child that doesn't react to SIGTERM can be given a deadline with
+ * storage_process_terminate(), after which it gets SIGKILL. When it
+ * was started in a process group of its own, both signals go to
+ * everything it started as well.
+ */
+
+#define PROCESS_READ_SIZE  (64 * 1024)
+
+struct _StorageProcess
+{
+  gint ref_count;
+
+  gchar *name;
+  GPid pid;
+  gint pidfd;
+  gboolean new_group;
+  gboolean exited;
+  gboolean released;
+
+  GMainContext *context;
+  GSource *exit_source;
+  GSource *kill_source;
+
+  /* indexed by the fd in the child, only 1 and 2 are used */
+  gint output_fds[3];
+  GSource *output_sources[3];
+  gchar *buffer;
+
+  StorageProcessOutputFunc output_func;
+  StorageProcessExitFunc exit_func;
+  gpointer user_data;
+
+  GDestroyNotify reaped_notify;
+  gpointer reaped_data;
+};
+
+static StorageProcess *
+process_ref (StorageProcess *process)
+{
+  process->ref_count++;
+  return process;
+}
+
+static void
+close_output (StorageProcess *process,
+              gint fd)
+{
+  if (process->output_sources[fd] != NULL)
+    {
+      g_source_destroy (process->output_sources[fd]);
+      process->output_sources[fd] = NULL;
+    }
+  if (process->output_fds[fd] != -1)
+    {
+      g_warn_if_fail (close (process->output_fds[fd]) == 0);
+      process->output_fds[fd] = -1;
+    }
+}
+
+static void
+process_unref (gpointer user_data)
+{
+  StorageProcess *process = user_data;
+
+  if (--process->ref_count > 0)
+    return;
+
+  close_output (process, 1);
+  close_output (process, 2);
+  if (process->pidfd != -1)
+    g_warn_if_fail (close (process->pidfd) == 0);
+  if (process->context != NULL)
+    g_main_context_unref (process->context);
+  g_free (process->buffer);
+  g_free (process->name);
+  g_free (process);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gint
+open_pidfd (GPid pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall (SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static GSource *
+add_fd_watch (StorageProcess *process,
+              gint fd,
+              GIOFunc func)
+{
+  GIOChannel *channel;
+  GSource *source;
+
+  channel = g_io_channel_unix_new (fd);
+  source = g_io_create_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR);
+  g_source_set_name (source, process->name);
+  g_source_set_callback (source, (GSourceFunc) func, process_ref (process), process_unref);
+  g_source_attach (source, process->context);
+  g_source_unref (source);
+  g_io_channel_unref (channel);
+
+  return source;
+}
+
+static void
+drain_output (StorageProcess *process,
+              gint fd)
+{
+  gssize len;
+
+  /* Something the child started might keep the pipe open, so don't block */
+  while (process->output_fds[fd] != -1)
+    {
+      len = read (process->output_fds[fd], process->buffer, PROCESS_READ_SIZE);
+      if (len < 0 && errno == EINTR)
+        continue;
+      if (len <= 0)
+        break;
+      if (process->output_func)
+        process->output_func (process, fd, process->buffer, len, process->user_data);
+    }
+}
+
+static gboolean
+on_output (StorageProcess *process,
+           gint fd)
+{
+  gssize len;
+
+  len = read (process->output_fds[fd], process->buffer, PROCESS_READ_SIZE);
+  if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    return TRUE;
+
+  if (len > 0)
+    {
+      if (process->output_func)
+        process->output_func (process, fd, process->buffer, len, process->user_data);
+      return TRUE;
+    }
+
+  /* The end of the output, the source goes away by returning FALSE */
+  process->output_sources[fd] = NULL;
+  close_output (process, fd);
+  return FALSE;
+}
+
+static gboolean
+on_stdout (GIOChannel *channel,
+           GIOCondition condition,
+           gpointer user_data)
+{
+  return on_output (user_data, 1);
+}
+
+static gboolean
+on_stderr (GIOChannel *channel,
+           GIOCondition condition,
+           gpointer user_data)
+{
+  return on_output (user_data, 2);
+}
+
+static void
+on_reaped (StorageProcess *process,
+           gint status)
+{
+  process->exited = TRUE;
+  process->exit_source = NULL;
+
+  drain_output (process, 1);
+  close_output (process, 1);
+  drain_output (process, 2);
+  close_output (process, 2);
+
+  if (process->pidfd != -1)
+    {
+      g_warn_if_fail (close (process->pidfd) == 0);
+      process->pidfd = -1;
+    }
+
+  if (process->released)
+    {
+      if (process->reaped_notify)
+        process->reaped_notify (process->reaped_data);
+    }
+  else if (process->exit_func)
+    {
+      process->exit_func (process, status, process->user_data);
+    }
+}
+
+static gboolean
+on_pidfd (GIOChannel *channel,
+          GIOCondition condition,
+          gpointer user_data)
+{
+  StorageProcess *process = user_data;
+  gint status = 0;
+  pid_t pid;
+
+  do
+    pid = waitpid (process->pid, &status, WNOHANG);
+  while (pid < 0 && errno == EINTR);
+
+  if (pid == 0)
+    return TRUE;
+
+  if (pid < 0)
+    {
+      g_warning ("Couldn't reap child %d: %s", (gint) process->pid, g_strerror (errno));
+      status = W_EXITCODE (255, 0);
+    }
+
+  on_reaped (process, status);
+  return FALSE;
+}
+
+static void
+on_child_watch (GPid pid,
+                gint status,
+                gpointer user_data)
+{
+  on_reaped (user_data, status);
+}
+
+static gboolean
+send_signal (StorageProcess *process,
+             gint signum)
+{
+  /* The group keeps the pid of its leader while it is not reaped */
+  if (process->new_group)
+    return kill (-process->pid, signum) == 0;
+
+#ifdef SYS_pidfd_send_signal
+  if (process->pidfd != -1)
+    return syscall (SYS_pidfd_send_signal, process->pidfd, signum, NULL, 0) == 0;
+#endif
+
+  /* Without a pidfd, GChildWatch might have reaped it already */
+  return kill (process->pid, signum) == 0;
+}
+
+static gboolean
+on_grace_expired (gpointer user_data)
+{
+  StorageProcess *process = user_data;
+  gboolean killed = FALSE;
+
+  process->kill_source = NULL;
+
+  /*
+   * The leader of a group might be gone while something it started
+   * still hangs on. As long as any of them is left, the group id can't
+   * be reused, so it is still safe to signal the group then.
+   */
+  if (!process->exited)
+    killed = send_signal (process, SIGKILL);
+  else if (process->new_group)
+    killed = kill (-process->pid, SIGKILL) == 0;
+
+  if (killed)
+    {
+      if (process->exited)
+        g_message ("Killed what was left of process group %d after SIGTERM", (gint) process->pid);
+      else
+        g_message ("Killed process %d, it didn't exit after SIGTERM", (gint) process->pid);
+      storage_stats_count ("process.killed", 1);
+    }
+
+  return FALSE;
+}
+
+/* In the forked child, the new group comes before the setup of the caller */
+typedef struct {
+  GSpawnChildSetupFunc func;
+  gpointer data;
+  gboolean new_group;
+} ChildSetup;
+
+static void
+child_setup_wrapper (gpointer user_data)
+{
+  ChildSetup *setup = user_data;
+
+  if (setup->new_group)
+    setpgid (0, 0);
+  setup->func (setup->data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+set_spawn_error (GError **error,
+                 const gchar *program,
+                 gint errsv)
+{
+  GSpawnError code;
+
+  switch (errsv)
+    {
+    case ENOENT:
+      code = G_SPAWN_ERROR_NOENT;
+      break;
+    case EACCES:
+      code = G_SPAWN_ERROR_ACCES;
+      break;
+    case ENOMEM:
+      code = G_SPAWN_ERROR_NOMEM;
+      break;
+    default:
+      code = G_SPAWN_ERROR_FAILED;
+      break;
+    }
+
+  g_set_error (error, G_SPAWN_ERROR, code,
+               "Failed to execute child process \"%s\" (%s)",
+               program, g_strerror (errsv));
+}
+
+static gboolean
+posix_spawn_with_pipes (const gchar **argv,
+                        gboolean new_group,
+                        GPid *pid,
+                        gint *stdin_fd,
+                        gint *stdout_fd,
+                        gint *stderr_fd,
+                        GError **error)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  gint in_pipe[2] = { -1, -1 };
+  gint out_pipe[2] = { -1, -1 };
+  gint err_pipe[2] = { -1, -1 };
+  gboolean ret = FALSE;
+  gint res;
+  gint i;
+
+  if ((stdin_fd && pipe2 (in_pipe, O_CLOEXEC) < 0) ||
+      pipe2 (out_pipe, O_CLOEXEC) < 0 ||
+      (stderr_fd && pipe2 (err_pipe, O_CLOEXEC) < 0))
+    {
+      res = errno;
+      g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                   "Failed to create pipe for communicating with child process (%s)",
+                   g_strerror (res));
+      goto out;
+    }
+
+  posix_spawn_file_actions_init (&actions);
+  if (stdin_fd)
+    posix_spawn_file_actions_adddup2 (&actions, in_pipe[0], 0);
+  else
+    posix_spawn_file_actions_addopen (&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2 (&actions, out_pipe[1], 1);
+  if (stderr_fd)
+    posix_spawn_file_actions_adddup2 (&actions, err_pipe[1], 2);
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+  posix_spawn_file_actions_addclosefrom_np (&actions, 3);
+#endif
+
+  /* Don't pass on our signal mask, or that we ignore SIGPIPE */
+  posix_spawnattr_init (&attr);
+  sigemptyset (&mask);
+  posix_spawnattr_setsigmask (&attr, &mask);
+  sigaddset (&mask, SIGPIPE);
+  posix_spawnattr_setsigdefault (&attr, &mask);
+  if (new_group)
+    {
+      posix_spawnattr_setpgroup (&attr, 0);
+      posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF |
+                                       POSIX_SPAWN_SETPGROUP);
+    }
+  else
+    {
+      posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    }
+
+  res = posix_spawnp (pid, argv[0], &actions, &attr, (gchar * const *) argv, environ);
+
+  posix_spawnattr_destroy (&attr);
+  posix_spawn_file_actions_destroy (&actions);
+
+  if (res != 0)
+    {
+      set_spawn_error (error, argv[0], res);
+      goto out;
+    }
+
+  if (stdin_fd)
+    {
+      *stdin_fd = in_pipe[1];
+      in_pipe[1] = -1;
+    }
+  *stdout_fd = out_pipe[0];
+  out_pipe[0] = -1;
+  if (stderr_fd)
+    {
+      *stderr_fd = err_pipe[0];
+      err_pipe[0] = -1;
+    }
+  ret = TRUE;
+
+out:
+  for (i = 0; i < 2; i++)
+    {
+      if (in_pipe[i] != -1)
+        close (in_pipe[i]);
+      if (out_pipe[i] != -1)
+        close (out_pipe[i]);
+      if (err_pipe[i] != -1)
+        close (err_pipe[i]);
+    }
+  return ret;
+}
+
+/**
+ * storage_process_spawn:
+ * @argv: The command line to run, looked up in PATH.
+ * @flags: Flags from #StorageProcessFlags.
+ * @child_setup: (allow-none): Called in the child before exec.
+ * @child_setup_data: The data for @child_setup.
+ * @stdin_fd: (out) (allow-none): Return location for the write end of
+ *   a pipe to the standard input of the child, or %NULL to give it
+ *   /dev/null.
+ * @output_func: (allow-none): Called with the output of the child.
+ * @exit_func: (allow-none): Called once the child has exited.
+ * @user_data: The data for @output_func and @exit_func.
+ * @error: Return location for error or %NULL.
+ *
+ * Starts @argv as a child process. Its output and its exit are
+ * delivered to the
+ * <link linkend="g-main-context-push-thread-default">thread-default main loop</link>
+ * of the calling thread.
+ *
+ * Passing a @child_setup function means that the daemon has to be
+ * forked, so only do that when there is something that needs to
+ * happen in the child.
+ *
+ * Returns: A #StorageProcess, or %NULL if @error is set. Give it up
+ * with storage_process_release().
+ */
+StorageProcess *
+storage_process_spawn (const gchar **argv,
+                       StorageProcessFlags flags,
+                       GSpawnChildSetupFunc child_setup,
+                       gpointer child_setup_data,
+                       gint *stdin_fd,
+                       StorageProcessOutputFunc output_func,
+                       StorageProcessExitFunc exit_func,
+                       gpointer user_data,
+                       GError **error)
+{
+  gboolean inherit_stderr = (flags & STORAGE_PROCESS_INHERIT_STDERR) != 0;
+  gboolean new_group = (flags & STORAGE_PROCESS_NEW_GROUP) != 0;
+  StorageProcess *process;
+  ChildSetup setup;
+  gint stdout_fd = -1;
+  gint stderr_fd = -1;
+  GPid pid;
+  gint fd;
+
+  g_return_val_if_fail (argv != NULL && argv[0] != NULL, NULL);
+
+  if (child_setup == NULL)
+    {
+      if (!posix_spawn_with_pipes (argv, new_group, &pid, stdin_fd, &stdout_fd,
+                                   inherit_stderr ? NULL : &stderr_fd, error))
+        return NULL;
+    }
+  else
+    {
+      setup.func = child_setup;
+      setup.data = child_setup_data;
+      setup.new_group = new_group;
+      if (!g_spawn_async_with_pipes (NULL, /* working directory */
+                                     (gchar **) argv,
+                                     NULL, /* envp */
+                                     G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                     child_setup_wrapper,
+                                     &setup,
+                                     &pid,
+                                     stdin_fd,
+                                     &stdout_fd,
+                                     inherit_stderr ? NULL : &stderr_fd,
+                                     error))
+        return NULL;
+    }
+
+  process = g_new0 (StorageProcess, 1);
+  process->ref_count = 1;
+  process->name = g_path_get_basename (argv[0]);
+  process->pid = pid;
+  process->new_group = new_group;
+  process->output_func = output_func;
+  process->exit_func = exit_func;
+  process->user_data = user_data;
+  process->buffer = g_malloc (PROCESS_READ_SIZE);
+
+  process->context = g_main_context_get_thread_default ();
+  if (process->context != NULL)
+    g_main_context_ref (process->context);
+
+  process->output_fds[0] = -1;
+  process->output_fds[1] = stdout_fd;
+  process->output_fds[2] = stderr_fd;
+  for (fd = 1; fd <= 2; fd++)
+    {
+      if (process->output_fds[fd] == -1)
+        continue;
+      fcntl (process->output_fds[fd], F_SETFL,
+             fcntl (process->output_fds[fd], F_GETFL) | O_NONBLOCK);
+      process->output_sources[fd] = add_fd_watch (process, process->output_fds[fd],
+                                                  fd == 1 ? on_stdout : on_stderr);
+    }
+
+  /* The child is ours to reap, so its pid stays valid for this */
+  process->pidfd = open_pidfd (pid);
+  if (process->pidfd != -1)
+    {
+      process->exit_source = add_fd_watch (process, process->pidfd, on_pidfd);
+    }
+  else
+    {
+      process->exit_source = g_child_watch_source_new (pid);
+      g_source_set_name (process->exit_source, process->name);
+      g_source_set_callback (process->exit_source, (GSourceFunc) on_child_watch,
+                             process_ref (process), process_unref);
+      g_source_attach (process->exit_source, process->context);
+      g_source_unref (process->exit_source);
+    }
+
+  return process;
+}
+
+/**
+ * storage_process_get_pid:
+ * @process: A #StorageProcess.
+ *
+ * Returns: The pid of the child. Once it has exited, this might be
+ * the pid of some other process.
+ */
+GPid
+storage_process_get_pid (StorageProcess *process)
+{
+  return process->pid;
+}
+
+/**
+ * storage_process_has_exited:
+ * @process: A #StorageProcess.
+ *
+ * Returns: Whether the child has exited and has been reaped.
+ */
+gboolean
+storage_process_has_exited (StorageProcess *process)
+{
+  return process->exited;
+}
+
+/**
+ * storage_process_kill:
+ * @process: A #StorageProcess.
+ * @signum: The signal to send.
+ *
+ * Sends @signum to the child, unless it has already been reaped.
+ * With %STORAGE_PROCESS_NEW_GROUP, it goes to the whole process group.
+ *
+ * Returns: %TRUE if the signal was sent.
+ */
+gboolean
+storage_process_kill (StorageProcess *process,
+                      gint signum)
+{
+  if (process->exited)
+    return FALSE;
+
+  return send_signal (process, signum);
+}
+
+/**
+ * storage_process_terminate:
+ * @process: A #StorageProcess.
+ * @grace_seconds: How long the child gets to exit.
+ *
+ * Sends SIGTERM to the child, and SIGKILL if it hasn't exited
+ * @grace_seconds later. With %STORAGE_PROCESS_NEW_GROUP, SIGKILL also
+ * goes to what is left of its process group when the child itself did
+ * exit in time.
+ *
+ * This keeps working after storage_process_release().
+ */
+void
+storage_process_terminate (StorageProcess *process,
+                           guint grace_seconds)
+{
+  if (process->exited || process->kill_source != NULL)
+    return;
+
+  send_signal (process, SIGTERM);
+
+  process->kill_source = g_timeout_source_new_seconds (grace_seconds);
+  g_source_set_name (process->kill_source, process->name);
+  g_source_set_callback (process->kill_source, on_grace_expired,
+                         process_ref (process), process_unref);
+  g_source_attach (process->kill_source, process->context);
+  g_source_unref (process->kill_source);
+}
+
+/**
+ * storage_process_release:
+ * @process: A #StorageProcess.
+ * @reaped_notify: (allow-none): Called once the child has been reaped.
+ * @reaped_data: The data for @reaped_notify.
+ *
+ * Gives up @process. No more output or exit functions are called for
+ * it. A child that is still running is not killed, but it is reaped
+ * in the background when it exits, and @reaped_notify is called then.
+ * If it has already been reaped, @reaped_notify is called right away.
+ *
+ * This can be called from the output and exit functions of @process.
+ */
+void
+storage_process_release (StorageProcess *process,
+                         GDestroyNotify reaped_notify,
+                         gpointer reaped_data)
+{
+  g_return_if_fail (!process->released);
+
+  process->released = TRUE;
+  process->output_func = NULL;
+  process->exit_func = NULL;
+
+  close_output (process, 1);
+  close_output (process, 2);
+
+  if (process->exited)
+    {
+      if (reaped_notify)
+        reaped_notify (reaped_data);
+    }
+  else
+    {
+      process->reaped_notify = reaped_notify;
+      process->reaped_data = reaped_data;
+    }
+
+  process_unref (process);
+}
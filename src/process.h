@@ -0,0 +1,102 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __STORAGE_PROCESS_H__
+#define __STORAGE_PROCESS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _StorageProcess StorageProcess;
+
+/**
+ * StorageProcessFlags:
+ * @STORAGE_PROCESS_NONE: No flags.
+ * @STORAGE_PROCESS_INHERIT_STDERR: The child writes its standard error
+ *   to ours instead of to a pipe.
+ * @STORAGE_PROCESS_NEW_GROUP: The child leads a new process group, and
+ *   signals go to the whole group.
+ *
+ * Flags for storage_process_spawn().
+ */
+typedef enum {
+  STORAGE_PROCESS_NONE           = 0,
+  STORAGE_PROCESS_INHERIT_STDERR = 1 << 0,
+  STORAGE_PROCESS_NEW_GROUP      = 1 << 1,
+} StorageProcessFlags;
+
+/**
+ * StorageProcessOutputFunc:
+ * @process: The #StorageProcess.
+ * @fd: Either 1 for standard output or 2 for standard error.
+ * @data: The bytes that were read.
+ * @len: The number of bytes in @data.
+ * @user_data: The data passed to storage_process_spawn().
+ *
+ * Called whenever the child has written something.
+ */
+typedef void (* StorageProcessOutputFunc) (StorageProcess *process,
+                                           gint fd,
+                                           const gchar *data,
+                                           gsize len,
+                                           gpointer user_data);
+
+/**
+ * StorageProcessExitFunc:
+ * @process: The #StorageProcess.
+ * @status: The wait status, as for g_spawn_check_exit_status().
+ * @user_data: The data passed to storage_process_spawn().
+ *
+ * Called once the child has exited and has been reaped, after all the
+ * output it left in its pipes has been passed on.
+ */
+typedef void (* StorageProcessExitFunc)   (StorageProcess *process,
+                                           gint status,
+                                           gpointer user_data);
+
+StorageProcess *    storage_process_spawn        (const gchar **argv,
+                                                  StorageProcessFlags flags,
+                                                  GSpawnChildSetupFunc child_setup,
+                                                  gpointer child_setup_data,
+                                                  gint *stdin_fd,
+                                                  StorageProcessOutputFunc output_func,
+                                                  StorageProcessExitFunc exit_func,
+                                                  gpointer user_data,
+                                                  GError **error);
+
+GPid                storage_process_get_pid      (StorageProcess *process);
+
+gboolean            storage_process_has_exited   (StorageProcess *process);
+
+gboolean            storage_process_kill         (StorageProcess *process,
+                                                  gint signum);
+
+void                storage_process_terminate    (StorageProcess *process,
+                                                  guint grace_seconds);
+
+void                storage_process_release      (StorageProcess *process,
+                                                  GDestroyNotify reaped_notify,
+                                                  gpointer reaped_data);
+
+G_END_DECLS
+
+#endif /* __STORAGE_PROCESS_H__ */
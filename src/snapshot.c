@@ -0,0 +1,139 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "snapshot.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+
+#include <udisks/udisks.h>
+
+/*
+ * The snapshot is the output of storaged-lvm-helper for every volume
+ * group we know about, so that a restarted daemon can publish its
+ * objects before coldplug is done.  It lives in /run so that it never
+ * survives a reboot.
+ *
+ * The file is a serialized GVariant of type (uta{sv}): the format
+ * version, the time it was written, and a map from volume group name
+ * to the helper's a{sv} for that group.  Bump the version whenever
+ * the helper output changes incompatibly.
+ */
+
+#define SNAPSHOT_DIR      "/run/storaged"
+#define SNAPSHOT_PATH     SNAPSHOT_DIR "/snapshot"
+#define SNAPSHOT_VERSION  1
+#define SNAPSHOT_TYPE     "(uta{sv})"
+
+/**
+ * storage_snapshot_load:
+ * @error: Return location for error.
+ *
+ * Reads the snapshot written by a previous instance of the daemon.
+ *
+ * Returns: A #GVariant of type a{sv} mapping volume
+ * group names to helper output, or %NULL with @error set if there is
+ * no usable snapshot. Free with g_variant_unref().
+ */
+GVariant *
+storage_snapshot_load (GError **error)
+{
+  GVariant *snapshot;
+  GVariant *volume_groups = NULL;
+  gchar *contents;
+  gsize length;
+  guint32 version;
+  guint64 timestamp;
+
+  if (!g_file_get_contents (SNAPSHOT_PATH, &contents, &length, error))
+    return NULL;
+
+  snapshot = g_variant_new_from_data (G_VARIANT_TYPE (SNAPSHOT_TYPE),
+                                      contents, length, FALSE, g_free, contents);
+  g_variant_ref_sink (snapshot);
+
+  if (!g_variant_is_normal_form (snapshot))
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Snapshot %s is corrupted", SNAPSHOT_PATH);
+      goto out;
+    }
+
+  g_variant_get (snapshot, "(ut@a{sv})", &version, &timestamp, &volume_groups);
+  if (version != SNAPSHOT_VERSION)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Snapshot %s has unsupported version %u", SNAPSHOT_PATH, version);
+      g_variant_unref (volume_groups);
+      volume_groups = NULL;
+      goto out;
+    }
+
+  g_debug ("loaded snapshot from %" G_GINT64_FORMAT " seconds ago",
+           (g_get_real_time () - (gint64)timestamp) / G_USEC_PER_SEC);
+
+out:
+  g_variant_unref (snapshot);
+  return volume_groups;
+}
+
+/**
+ * storage_snapshot_save:
+ * @volume_groups: A #GVariant of type a{sv}.
+ * @error: Return location for error.
+ *
+ * Writes @volume_groups as the new snapshot. The file is replaced
+ * atomically, so a reader never sees a partial snapshot.
+ *
+ * Returns: %TRUE on success, %FALSE with @error set otherwise.
+ */
+gboolean
+storage_snapshot_save (GVariant *volume_groups,
+                       GError **error)
+{
+  GVariant *snapshot;
+  GVariant *normal;
+  gboolean ret;
+
+  g_return_val_if_fail (g_variant_is_of_type (volume_groups, G_VARIANT_TYPE ("a{sv}")), FALSE);
+
+  if (g_mkdir_with_parents (SNAPSHOT_DIR, 0700) < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error creating %s: %s", SNAPSHOT_DIR, g_strerror (errno));
+      return FALSE;
+    }
+
+  snapshot = g_variant_new ("(ut@a{sv})", (guint32)SNAPSHOT_VERSION,
+                            (guint64)g_get_real_time (), volume_groups);
+  normal = g_variant_get_normal_form (snapshot);
+  g_variant_unref (g_variant_ref_sink (snapshot));
+
+  /* Writes a temporary file and renames it over the old one */
+  ret = g_file_set_contents (SNAPSHOT_PATH, g_variant_get_data (normal),
+                             g_variant_get_size (normal), error);
+
+  g_variant_unref (normal);
+  return ret;
+}
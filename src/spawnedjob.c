@@ -24,10 +24,13 @@
 #include "spawnedjob.h"
 
 #include "job.h"
+#include "process.h"
+#include "stats.h"
 #include "util.h"
 
 #include <glib/gi18n-lib.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -48,6 +51,27 @@
 
 typedef struct _StorageSpawnedJobClass   StorageSpawnedJobClass;
 
+/*
+ * A command can write any amount of output while it runs. We only keep
+ * its beginning and its end, which is where the interesting parts
+ * usually are, and pass on everything else line by line as it arrives.
+ */
+#define OUTPUT_HEAD_SIZE  (64 * 1024)
+#define OUTPUT_TAIL_SIZE  (64 * 1024)
+#define OUTPUT_LINE_MAX   4096
+
+/* Seconds between SIGTERM and SIGKILL, unless the job policy says otherwise */
+#define STOP_TIMEOUT_DEFAULT  10
+
+typedef struct {
+  const gchar *stream;
+  GString *head;        /* the first OUTPUT_HEAD_SIZE bytes */
+  gchar *tail;          /* a ring with the last bytes after the head */
+  gsize tail_pos;       /* where the next byte goes in @tail */
+  guint64 tail_total;   /* how many bytes went to @tail in total */
+  GString *line;        /* the incomplete last line */
+} OutputBuffer;
+
 /**
  * StorageSpawnedJob:
  *
@@ -68,22 +92,18 @@ struct _StorageSpawnedJob
   uid_t run_as_euid;
   const gchar *input_string_cursor;
 
-  GPid child_pid;
-  gint child_stdin_fd;
-  gint child_stdout_fd;
-  gint child_stderr_fd;
+  gchar *cgroup_path;
+  gint cgroup_procs_fd;
 
+  StorageProcess *process;
+  GSource *timeout_source;
+  gboolean completed;
+  gint child_stdin_fd;
   GIOChannel *child_stdin_channel;
-  GIOChannel *child_stdout_channel;
-  GIOChannel *child_stderr_channel;
-
-  GSource *child_watch_source;
   GSource *child_stdin_source;
-  GSource *child_stdout_source;
-  GSource *child_stderr_source;
 
-  GString *child_stdout;
-  GString *child_stderr;
+  OutputBuffer child_stdout;
+  OutputBuffer child_stderr;
 };
 
 struct _StorageSpawnedJobClass
@@ -111,6 +131,7 @@ enum
 enum
 {
   SPAWNED_JOB_COMPLETED_SIGNAL,
+  OUTPUT_LINE_SIGNAL,
   LAST_SIGNAL
 };
 
@@ -206,6 +227,212 @@ storage_spawned_job_set_property (GObject *object,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+output_buffer_init (OutputBuffer *buffer,
+                    const gchar *stream)
+{
+  buffer->stream = stream;
+  buffer->head = g_string_new (NULL);
+  buffer->line = g_string_new (NULL);
+}
+
+static void
+output_buffer_clear (OutputBuffer *buffer)
+{
+  if (buffer->head != NULL)
+    g_string_free (buffer->head, TRUE);
+  if (buffer->line != NULL)
+    g_string_free (buffer->line, TRUE);
+  g_free (buffer->tail);
+  buffer->head = NULL;
+  buffer->line = NULL;
+  buffer->tail = NULL;
+}
+
+static void
+output_buffer_append (OutputBuffer *buffer,
+                      const gchar *data,
+                      gsize len)
+{
+  gsize n;
+
+  if (buffer->head == NULL)
+    return;
+
+  n = MIN (len, OUTPUT_HEAD_SIZE - buffer->head->len);
+  g_string_append_len (buffer->head, data, n);
+  data += n;
+  len -= n;
+
+  if (len == 0)
+    return;
+
+  if (buffer->tail == NULL)
+    buffer->tail = g_malloc (OUTPUT_TAIL_SIZE);
+
+  buffer->tail_total += len;
+  if (len > OUTPUT_TAIL_SIZE)
+    {
+      data += len - OUTPUT_TAIL_SIZE;
+      len = OUTPUT_TAIL_SIZE;
+    }
+
+  while (len > 0)
+    {
+      n = MIN (len, OUTPUT_TAIL_SIZE - buffer->tail_pos);
+      memcpy (buffer->tail + buffer->tail_pos, data, n);
+      buffer->tail_pos = (buffer->tail_pos + n) % OUTPUT_TAIL_SIZE;
+      data += n;
+      len -= n;
+    }
+}
+
+/* The output that was kept, with a marker where some was dropped */
+static GString *
+output_buffer_to_string (OutputBuffer *buffer)
+{
+  GString *string;
+
+  string = g_string_new (NULL);
+  if (buffer->head == NULL)
+    return string;
+
+  g_string_append_len (string, buffer->head->str, buffer->head->len);
+  if (buffer->tail_total > OUTPUT_TAIL_SIZE)
+    {
+      g_string_append_printf (string, "\n[... %" G_GUINT64_FORMAT " bytes omitted ...]\n",
+                              buffer->tail_total - OUTPUT_TAIL_SIZE);
+      g_string_append_len (string, buffer->tail + buffer->tail_pos,
+                           OUTPUT_TAIL_SIZE - buffer->tail_pos);
+      g_string_append_len (string, buffer->tail, buffer->tail_pos);
+    }
+  else if (buffer->tail_total > 0)
+    {
+      g_string_append_len (string, buffer->tail, buffer->tail_total);
+    }
+
+  return string;
+}
+
+static void
+emit_output_line (StorageSpawnedJob *self,
+                  OutputBuffer *buffer)
+{
+  const gchar *str = buffer->line->str;
+  gsize len = buffer->line->len;
+  const gchar *end;
+  GString *valid;
+
+  if (len > 0 && str[len - 1] == '\r')
+    len--;
+
+  /* D-Bus wants UTF-8, so replace whatever isn't */
+  valid = g_string_sized_new (len);
+  while (!g_utf8_validate (str, len, &end))
+    {
+      g_string_append_len (valid, str, end - str);
+      g_string_append (valid, "\357\277\275");
+      len -= end - str + 1;
+      str = end + 1;
+    }
+  g_string_append_len (valid, str, len);
+
+  g_signal_emit (self, signals[OUTPUT_LINE_SIGNAL], 0, buffer->stream, valid->str);
+
+  g_string_free (valid, TRUE);
+  g_string_truncate (buffer->line, 0);
+}
+
+static void
+output_buffer_split_lines (StorageSpawnedJob *self,
+                           OutputBuffer *buffer,
+                           const gchar *data,
+                           gsize len)
+{
+  const gchar *newline;
+  gsize n;
+
+  if (buffer->line == NULL ||
+      !g_signal_has_handler_pending (self, signals[OUTPUT_LINE_SIGNAL], 0, TRUE))
+    return;
+
+  while (len > 0)
+    {
+      newline = memchr (data, '\n', len);
+      n = newline ? (gsize)(newline - data) : len;
+      n = MIN (n, OUTPUT_LINE_MAX - buffer->line->len);
+      g_string_append_len (buffer->line, data, n);
+      data += n;
+      len -= n;
+
+      if (len > 0 && data[0] == '\n')
+        {
+          data++;
+          len--;
+          emit_output_line (self, buffer);
+        }
+      else if (buffer->line->len >= OUTPUT_LINE_MAX)
+        {
+          emit_output_line (self, buffer);
+        }
+    }
+}
+
+static void
+on_child_output (StorageProcess *process,
+                 gint fd,
+                 const gchar *data,
+                 gsize len,
+                 gpointer user_data)
+{
+  StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (user_data);
+  OutputBuffer *buffer = fd == 1 ? &self->child_stdout : &self->child_stderr;
+
+  output_buffer_append (buffer, data, len);
+  output_buffer_split_lines (self, buffer, data, len);
+}
+
+static void
+output_buffer_flush_line (StorageSpawnedJob *self,
+                          OutputBuffer *buffer)
+{
+  if (buffer->line != NULL && buffer->line->len > 0)
+    emit_output_line (self, buffer);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Only the first of exiting, timing out and being cancelled counts */
+static void
+emit_completed (StorageSpawnedJob *self,
+                GError *error,
+                gint status)
+{
+  GString *standard_output;
+  GString *standard_error;
+  gboolean ret;
+
+  if (self->completed)
+    return;
+  self->completed = TRUE;
+
+  output_buffer_flush_line (self, &self->child_stdout);
+  output_buffer_flush_line (self, &self->child_stderr);
+
+  standard_output = output_buffer_to_string (&self->child_stdout);
+  standard_error = output_buffer_to_string (&self->child_stderr);
+  g_signal_emit (self,
+                 signals[SPAWNED_JOB_COMPLETED_SIGNAL],
+                 0,
+                 error,
+                 status,
+                 standard_output,
+                 standard_error,
+                 &ret);
+  g_string_free (standard_output, TRUE);
+  g_string_free (standard_error, TRUE);
+}
+
 typedef struct
 {
   StorageSpawnedJob *job;
@@ -216,16 +443,9 @@ static gboolean
 emit_completed_with_error_in_idle_cb (gpointer user_data)
 {
   EmitCompletedData *data = user_data;
-  gboolean ret;
 
-  g_signal_emit (data->job,
-                 signals[SPAWNED_JOB_COMPLETED_SIGNAL],
-                 0,
-                 data->error,
-                 0,                        /* status */
-                 data->job->child_stdout,  /* standard_output */
-                 data->job->child_stderr,  /* standard_error */
-                 &ret);
+  emit_completed (data->job, data->error, 0);
+  storage_spawned_job_release_resources (data->job);
   g_object_unref (data->job);
   g_error_free (data->error);
   g_free (data);
@@ -269,34 +489,6 @@ on_cancelled (GCancellable *cancellable,
   g_error_free (error);
 }
 
-static gboolean
-read_child_stderr (GIOChannel *channel,
-                   GIOCondition condition,
-                   gpointer user_data)
-{
-  StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (user_data);
-  gchar buf[1024];
-  gsize bytes_read;
-
-  g_io_channel_read_chars (channel, buf, sizeof buf, &bytes_read, NULL);
-  g_string_append_len (self->child_stderr, buf, bytes_read);
-  return TRUE;
-}
-
-static gboolean
-read_child_stdout (GIOChannel *channel,
-                   GIOCondition condition,
-                   gpointer user_data)
-{
-  StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (user_data);
-  gchar buf[1024];
-  gsize bytes_read;
-
-  g_io_channel_read_chars (channel, buf, sizeof buf, &bytes_read, NULL);
-  g_string_append_len (self->child_stdout, buf, bytes_read);
-  return TRUE;
-}
-
 static gboolean
 write_child_stdin (GIOChannel *channel,
                    GIOCondition condition,
@@ -330,40 +522,55 @@ write_child_stdin (GIOChannel *channel,
 }
 
 static void
-child_watch_cb (GPid     pid,
-                gint     status,
-                gpointer user_data)
+on_child_exit (StorageProcess *process,
+               gint status,
+               gpointer user_data)
 {
   StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (user_data);
-  gchar *buf;
-  gsize buf_size;
-  gboolean ret;
-
-  if (g_io_channel_read_to_end (self->child_stdout_channel, &buf, &buf_size, NULL) == G_IO_STATUS_NORMAL)
-    {
-      g_string_append_len (self->child_stdout, buf, buf_size);
-      g_free (buf);
-    }
-  if (g_io_channel_read_to_end (self->child_stderr_channel, &buf, &buf_size, NULL) == G_IO_STATUS_NORMAL)
-    {
-      g_string_append_len (self->child_stderr, buf, buf_size);
-      g_free (buf);
-    }
 
   /* take a reference so it's safe for a signal-handler to release the last one */
   g_object_ref (self);
-  g_signal_emit (self,
-                 signals[SPAWNED_JOB_COMPLETED_SIGNAL],
-                 0,
-                 NULL, /* GError */
-                 status,
-                 self->child_stdout,
-                 self->child_stderr,
-                 &ret);
-  self->child_pid = 0;
-  self->child_watch_source = NULL;
+  emit_completed (self, NULL, status);
+  storage_spawned_job_release_resources (self);
+  g_object_unref (self);
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+  StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (user_data);
+  const StorageJobPolicy *policy = storage_job_get_policy (STORAGE_JOB (self));
+  GError *error;
+  gchar *holders;
+  gchar *message;
+  gchar *cmd;
+
+  self->timeout_source = NULL;
+  storage_stats_count ("job.timeout", 1);
+
+  /* A command that hangs is usually waiting for a lock */
+  cmd = g_strjoinv (" ", self->argv);
+  holders = storage_util_lvm_lock_holders ();
+  if (holders != NULL)
+    message = g_strdup_printf ("Command-line `%s' didn't finish within %u seconds (LVM locks: %s)",
+                               cmd, policy->timeout, holders);
+  else
+    message = g_strdup_printf ("Command-line `%s' didn't finish within %u seconds",
+                               cmd, policy->timeout);
+  g_message ("%s", message);
+
+  error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_TIMED_OUT, message);
+
+  g_object_ref (self);
+  emit_completed (self, error, 0);
   storage_spawned_job_release_resources (self);
   g_object_unref (self);
+
+  g_error_free (error);
+  g_free (message);
+  g_free (holders);
+  g_free (cmd);
+  return FALSE;
 }
 
 /* careful, this is in the fork()'ed child so all utility threads etc are not available */
@@ -374,6 +581,10 @@ child_setup (gpointer user_data)
   struct passwd *pw;
   gid_t egid;
 
+  /* needs to happen while we are still root */
+  storage_job_policy_apply_in_child (storage_job_get_policy (STORAGE_JOB (self)),
+                                     self->cgroup_procs_fd);
+
   if (self->run_as_uid == getuid () && self->run_as_euid == geteuid ())
     goto out;
 
@@ -432,6 +643,8 @@ static void
 storage_spawned_job_constructed (GObject *object)
 {
   StorageSpawnedJob *self = STORAGE_SPAWNED_JOB (object);
+  const StorageJobPolicy *policy;
+  gboolean needs_setup;
   GError *error;
   gchar *cmd;
 
@@ -458,29 +671,44 @@ storage_spawned_job_constructed (GObject *object)
                                                         self,
                                                         NULL);
 
+  policy = storage_job_get_policy (STORAGE_JOB (self));
+  self->cgroup_procs_fd = storage_job_policy_create_cgroup (policy, &self->cgroup_path);
+
+  /* Only fork when something needs to happen in the child */
+  needs_setup = (storage_job_policy_needs_child (policy) ||
+                 self->cgroup_procs_fd != -1 ||
+                 self->run_as_uid != getuid () ||
+                 self->run_as_euid != geteuid ());
+
+  /* A group of its own, so that stopping it stops everything it started */
   error = NULL;
-  if (!g_spawn_async_with_pipes (NULL, /* working directory */
-                                 self->argv,
-                                 NULL, /* envp */
-                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
-                                 child_setup, /* child_setup */
-                                 self, /* child_setup's user_data */
-                                 &(self->child_pid),
-                                 self->input_string != NULL ? &(self->child_stdin_fd) : NULL,
-                                 &(self->child_stdout_fd),
-                                 &(self->child_stderr_fd),
-                                 &error))
+  self->process = storage_process_spawn ((const gchar **) self->argv,
+                                         STORAGE_PROCESS_NEW_GROUP,
+                                         needs_setup ? child_setup : NULL,
+                                         self,
+                                         self->input_string != NULL ? &(self->child_stdin_fd) : NULL,
+                                         on_child_output,
+                                         on_child_exit,
+                                         self,
+                                         &error);
+  if (self->process == NULL)
     {
       g_prefix_error (&error, "Error spawning command-line `%s': ", cmd);
+      storage_job_policy_remove_cgroup (self->cgroup_path);
+      g_free (self->cgroup_path);
+      self->cgroup_path = NULL;
       emit_completed_with_error_in_idle (self, error);
       g_error_free (error);
       goto out;
     }
 
-  self->child_watch_source = g_child_watch_source_new (self->child_pid);
-  g_source_set_callback (self->child_watch_source, (GSourceFunc) child_watch_cb, self, NULL);
-  g_source_attach (self->child_watch_source, self->main_context);
-  g_source_unref (self->child_watch_source);
+  if (policy != NULL && policy->timeout > 0)
+    {
+      self->timeout_source = g_timeout_source_new_seconds (policy->timeout);
+      g_source_set_callback (self->timeout_source, on_timeout, self, NULL);
+      g_source_attach (self->timeout_source, self->main_context);
+      g_source_unref (self->timeout_source);
+    }
 
   if (self->child_stdin_fd != -1)
     {
@@ -494,32 +722,22 @@ storage_spawned_job_constructed (GObject *object)
       g_source_unref (self->child_stdin_source);
     }
 
-  self->child_stdout_channel = g_io_channel_unix_new (self->child_stdout_fd);
-  g_io_channel_set_flags (self->child_stdout_channel, G_IO_FLAG_NONBLOCK, NULL);
-  self->child_stdout_source = g_io_create_watch (self->child_stdout_channel, G_IO_IN);
-  g_source_set_callback (self->child_stdout_source, (GSourceFunc) read_child_stdout, self, NULL);
-  g_source_attach (self->child_stdout_source, self->main_context);
-  g_source_unref (self->child_stdout_source);
-
-  self->child_stderr_channel = g_io_channel_unix_new (self->child_stderr_fd);
-  g_io_channel_set_flags (self->child_stderr_channel, G_IO_FLAG_NONBLOCK, NULL);
-  self->child_stderr_source = g_io_create_watch (self->child_stderr_channel, G_IO_IN);
-  g_source_set_callback (self->child_stderr_source, (GSourceFunc) read_child_stderr, self, NULL);
-  g_source_attach (self->child_stderr_source, self->main_context);
-  g_source_unref (self->child_stderr_source);
-
 out:
+  if (self->cgroup_procs_fd != -1)
+    {
+      g_warn_if_fail (close (self->cgroup_procs_fd) == 0);
+      self->cgroup_procs_fd = -1;
+    }
   g_free (cmd);
 }
 
 static void
 storage_spawned_job_init (StorageSpawnedJob *self)
 {
-  self->child_stdout = g_string_new (NULL);
-  self->child_stderr = g_string_new (NULL);
+  output_buffer_init (&self->child_stdout, "stdout");
+  output_buffer_init (&self->child_stderr, "stderr");
   self->child_stdin_fd = -1;
-  self->child_stdout_fd = -1;
-  self->child_stderr_fd = -1;
+  self->cgroup_procs_fd = -1;
 }
 
 static void
@@ -605,6 +823,9 @@ storage_spawned_job_class_init (StorageSpawnedJobClass *klass)
    * @standard_output: Standard output from the command line that was run.
    * @standard_error: Standard error output from the command line that was run.
    *
+   * Only the first and the last 64 KiB of each output are kept. When
+   * more was written, a line in between says how much was left out.
+   *
    * Emitted when the spawned job is complete. If spawning the command
    * failed or if the job was cancelled, @error will
    * non-%NULL. Otherwise you can use macros such as WIFEXITED() and
@@ -640,6 +861,33 @@ storage_spawned_job_class_init (StorageSpawnedJobClass *klass)
                   G_TYPE_INT,
                   G_TYPE_GSTRING,
                   G_TYPE_GSTRING);
+
+  /**
+   * StorageSpawnedJob::output-line:
+   * @job: The #StorageSpawnedJob emitting the signal.
+   * @stream: Either "stdout" or "stderr".
+   * @line: A line of output, without the newline, as valid UTF-8.
+   *
+   * Emitted for every line the command writes, as soon as it is
+   * complete. Very long lines are split. Unlike the output passed to
+   * #StorageSpawnedJob::spawned-job-completed, nothing is left out.
+   *
+   * This signal is emitted in the
+   * <link linkend="g-main-context-push-thread-default">thread-default main loop</link>
+   * of the thread that @job was created in.
+   */
+  signals[OUTPUT_LINE_SIGNAL] =
+    g_signal_new ("output-line",
+                  STORAGE_TYPE_SPAWNED_JOB,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_generic,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_STRING,
+                  G_TYPE_STRING);
 }
 
 /**
@@ -648,6 +896,7 @@ storage_spawned_job_class_init (StorageSpawnedJobClass *klass)
  * @input_string: A string to write to stdin of the spawned program or %NULL.
  * @run_as_uid: The #uid_t to run the program as.
  * @run_as_euid: The effective #uid_t to run the program as.
+ * @policy: (allow-none): The #StorageJobPolicy to run the program with.
  * @cancellable: A #GCancellable or %NULL.
  *
  * Creates a new #StorageSpawnedJob instance.
@@ -663,6 +912,7 @@ storage_spawned_job_new (const gchar **argv,
                          const gchar *input_string,
                          uid_t run_as_uid,
                          uid_t run_as_euid,
+                         const StorageJobPolicy *policy,
                          GCancellable *cancellable)
 {
   g_return_val_if_fail (argv != NULL, NULL);
@@ -673,6 +923,7 @@ storage_spawned_job_new (const gchar **argv,
                        "input-string", input_string,
                        "run-as-uid", run_as_uid,
                        "run-as-euid", run_as_euid,
+                       "policy", policy,
                        "cancellable", cancellable,
                        NULL);
 }
@@ -751,111 +1002,78 @@ storage_spawned_job_completed_default (StorageSpawnedJob *self,
 }
 
 static void
-child_watch_from_release_cb (GPid pid,
-                             gint status,
-                             gpointer user_data)
+remove_cgroup_when_reaped (gpointer user_data)
 {
+  gchar *cgroup_path = user_data;
+  storage_job_policy_remove_cgroup (cgroup_path);
+  g_free (cgroup_path);
 }
 
 /* called when we're done running the command line */
 static void
 storage_spawned_job_release_resources (StorageSpawnedJob *self)
 {
-  /* Nuke the child, if necessary */
-  if (self->child_watch_source != NULL)
+  const StorageJobPolicy *policy = storage_job_get_policy (STORAGE_JOB (self));
+
+  if (self->timeout_source != NULL)
     {
-      g_source_destroy (self->child_watch_source);
-      self->child_watch_source = NULL;
+      g_source_destroy (self->timeout_source);
+      self->timeout_source = NULL;
     }
 
-  if (self->child_pid != 0)
+  /* Nuke the child, if necessary */
+  if (self->process != NULL)
     {
-      GSource *source;
-
-      g_debug ("ugh, need to kill %d", (gint) self->child_pid);
-      kill (self->child_pid, SIGTERM);
-
-      /* OK, we need to reap for the child ourselves - we don't want
-       * to use waitpid() because that might block the calling
-       * thread (the child might handle SIGTERM and use several
-       * seconds for cleanup/rollback).
-       *
-       * So we use GChildWatch instead.
+      if (!storage_process_has_exited (self->process))
+        {
+          g_debug ("ugh, need to kill %d", (gint) storage_process_get_pid (self->process));
+          storage_process_terminate (self->process,
+                                     policy != NULL && policy->stop_timeout > 0 ?
+                                     policy->stop_timeout : STOP_TIMEOUT_DEFAULT);
+        }
+
+      /* The child might handle SIGTERM and take several seconds for
+       * cleanup/rollback, or not react at all and get SIGKILL later.
+       * So it is reaped in the background. Its cgroup can only be
+       * removed once it is gone.
        *
        * Note that we might be called from the finalizer so avoid
-       * taking references to ourselves. We do need to pass the
-       * GSource so we can nuke it once handled.
+       * taking references to ourselves.
        */
-      source = g_child_watch_source_new (self->child_pid);
-      g_source_set_callback (source,
-                             (GSourceFunc) child_watch_from_release_cb,
-                             source,
-                             (GDestroyNotify) g_source_destroy);
-      g_source_attach (source, self->main_context);
-      g_source_unref (source);
-
-      self->child_pid = 0;
+      storage_process_release (self->process,
+                               self->cgroup_path != NULL ? remove_cgroup_when_reaped : NULL,
+                               self->cgroup_path);
+      self->cgroup_path = NULL;
+      self->process = NULL;
     }
 
-  if (self->child_stdout != NULL)
+  if (self->cgroup_path != NULL)
     {
-      g_string_free (self->child_stdout, TRUE);
-      self->child_stdout = NULL;
+      storage_job_policy_remove_cgroup (self->cgroup_path);
+      g_free (self->cgroup_path);
+      self->cgroup_path = NULL;
     }
 
-  if (self->child_stderr != NULL)
-    {
-      g_string_free (self->child_stderr, TRUE);
-      self->child_stderr = NULL;
-    }
+  output_buffer_clear (&self->child_stdout);
+  output_buffer_clear (&self->child_stderr);
 
   if (self->child_stdin_channel != NULL)
     {
       g_io_channel_unref (self->child_stdin_channel);
       self->child_stdin_channel = NULL;
     }
-  if (self->child_stdout_channel != NULL)
-    {
-      g_io_channel_unref (self->child_stdout_channel);
-      self->child_stdout_channel = NULL;
-    }
-  if (self->child_stderr_channel != NULL)
-    {
-      g_io_channel_unref (self->child_stderr_channel);
-      self->child_stderr_channel = NULL;
-    }
 
   if (self->child_stdin_source != NULL)
     {
       g_source_destroy (self->child_stdin_source);
       self->child_stdin_source = NULL;
     }
-  if (self->child_stdout_source != NULL)
-    {
-      g_source_destroy (self->child_stdout_source);
-      self->child_stdout_source = NULL;
-    }
-  if (self->child_stderr_source != NULL)
-    {
-      g_source_destroy (self->child_stderr_source);
-      self->child_stderr_source = NULL;
-    }
 
   if (self->child_stdin_fd != -1)
     {
       g_warn_if_fail (close (self->child_stdin_fd) == 0);
       self->child_stdin_fd = -1;
     }
-  if (self->child_stdout_fd != -1)
-    {
-      g_warn_if_fail (close (self->child_stdout_fd) == 0);
-      self->child_stdout_fd = -1;
-    }
-  if (self->child_stderr_fd != -1)
-    {
-      g_warn_if_fail (close (self->child_stderr_fd) == 0);
-      self->child_stderr_fd = -1;
-    }
 
   if (self->cancellable_handler_id > 0)
     {
@@ -25,6 +25,7 @@
 #include <gio/gio.h>
 
 #include "types.h"
+#include "jobpolicy.h"
 
 G_BEGIN_DECLS
 
@@ -38,6 +39,7 @@ StorageSpawnedJob  *  storage_spawned_job_new       (const gchar **argv,
                                                      const gchar *input_string,
                                                      uid_t run_as_uid,
                                                      uid_t run_as_euid,
+                                                     const StorageJobPolicy *policy,
                                                      GCancellable *cancellable);
 
 const gchar **        storage_spawned_job_get_argv  (StorageSpawnedJob *job);
@@ -0,0 +1,322 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "intern.h"
+#include "stats.h"
+#include "watchdog.h"
+
+#include <string.h>
+
+/**
+ * SECTION:storagestats
+ * @title: StorageStats
+ * @short_description: Performance counters of the daemon
+ *
+ * Any part of the daemon can bump a named counter or record a
+ * duration in a named histogram, from any thread.  The
+ * #LvmStats interface makes them available over D-Bus.
+ *
+ * Histograms have logarithmic buckets: bucket 0 counts samples of
+ * zero microseconds, bucket i counts samples from 2^(i-1) up to
+ * 2^i microseconds, and the last bucket also counts everything
+ * larger.
+ */
+
+#define N_BUCKETS 28
+
+typedef struct {
+  guint64 count;
+  guint64 sum;
+  guint64 max;
+  guint64 buckets[N_BUCKETS];
+} Histogram;
+
+static struct {
+  GMutex mutex;
+  GHashTable *counters;    /* name -> guint64 * */
+  GHashTable *histograms;  /* name -> Histogram * */
+  gint64 dispatch_begin;
+} stats;
+
+typedef struct _StorageStatsClass StorageStatsClass;
+
+struct _StorageStats
+{
+  LvmStatsSkeleton parent_instance;
+};
+
+struct _StorageStatsClass
+{
+  LvmStatsSkeletonClass parent_class;
+};
+
+static void stats_iface_init (LvmStatsIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (StorageStats, storage_stats, LVM_TYPE_STATS_SKELETON,
+                         G_IMPLEMENT_INTERFACE (LVM_TYPE_STATS, stats_iface_init)
+);
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+stats_ensure_tables (void)
+{
+  /* Called with the mutex held */
+  if (stats.counters == NULL)
+    {
+      stats.counters = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      stats.histograms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    }
+}
+
+/**
+ * storage_stats_count:
+ * @counter: The name of the counter.
+ * @amount: How much to add.
+ *
+ * Adds @amount to the counter called @counter. Thread-safe.
+ */
+void
+storage_stats_count (const gchar *counter,
+                     guint64 amount)
+{
+  guint64 *value;
+
+  g_mutex_lock (&stats.mutex);
+  stats_ensure_tables ();
+
+  value = g_hash_table_lookup (stats.counters, counter);
+  if (value == NULL)
+    {
+      value = g_new0 (guint64, 1);
+      g_hash_table_insert (stats.counters, g_strdup (counter), value);
+    }
+  *value += amount;
+
+  g_mutex_unlock (&stats.mutex);
+}
+
+/**
+ * storage_stats_set:
+ * @counter: The name of the counter.
+ * @value: The new value.
+ *
+ * Sets the counter called @counter to @value, for counters that
+ * measure a level rather than count events. Thread-safe.
+ */
+void
+storage_stats_set (const gchar *counter,
+                   guint64 value)
+{
+  guint64 *stored;
+
+  g_mutex_lock (&stats.mutex);
+  stats_ensure_tables ();
+
+  stored = g_hash_table_lookup (stats.counters, counter);
+  if (stored == NULL)
+    {
+      stored = g_new0 (guint64, 1);
+      g_hash_table_insert (stats.counters, g_strdup (counter), stored);
+    }
+  *stored = value;
+
+  g_mutex_unlock (&stats.mutex);
+}
+
+/**
+ * storage_stats_record:
+ * @histogram: The name of the histogram.
+ * @usec: A duration in microseconds.
+ *
+ * Adds a sample to the histogram called @histogram. Thread-safe.
+ */
+void
+storage_stats_record (const gchar *histogram,
+                      gint64 usec)
+{
+  Histogram *hist;
+  guint bucket;
+
+  if (usec < 0)
+    usec = 0;
+
+  bucket = MIN (g_bit_storage (usec), N_BUCKETS - 1);
+  if (usec == 0)
+    bucket = 0;
+
+  g_mutex_lock (&stats.mutex);
+  stats_ensure_tables ();
+
+  hist = g_hash_table_lookup (stats.histograms, histogram);
+  if (hist == NULL)
+    {
+      hist = g_new0 (Histogram, 1);
+      g_hash_table_insert (stats.histograms, g_strdup (histogram), hist);
+    }
+
+  hist->count++;
+  hist->sum += usec;
+  hist->max = MAX (hist->max, (guint64)usec);
+  hist->buckets[bucket]++;
+
+  g_mutex_unlock (&stats.mutex);
+}
+
+/**
+ * storage_stats_record_since:
+ * @histogram: The name of the histogram.
+ * @since_usec: A time from g_get_monotonic_time().
+ *
+ * Records the time elapsed since @since_usec in @histogram.
+ */
+void
+storage_stats_record_since (const gchar *histogram,
+                            gint64 since_usec)
+{
+  storage_stats_record (histogram, g_get_monotonic_time () - since_usec);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gint
+stats_poll (GPollFD *fds,
+            guint nfds,
+            gint timeout)
+{
+  gint ret;
+
+  /*
+   * Everything the main loop does between two polls is dispatching
+   * (and preparing and checking) sources, so that's what we measure.
+   */
+  if (stats.dispatch_begin)
+    storage_stats_record_since ("mainloop.dispatch", stats.dispatch_begin);
+  storage_watchdog_dispatch_end ();
+
+  ret = g_poll (fds, nfds, timeout);
+
+  stats.dispatch_begin = g_get_monotonic_time ();
+  storage_watchdog_dispatch_begin ();
+  return ret;
+}
+
+/**
+ * storage_stats_initialize:
+ *
+ * Starts measuring time spent in the default main context. Call
+ * from the main thread.
+ */
+void
+storage_stats_initialize (void)
+{
+  g_main_context_set_poll_func (NULL, stats_poll);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+storage_stats_init (StorageStats *self)
+{
+
+}
+
+static void
+storage_stats_class_init (StorageStatsClass *klass)
+{
+
+}
+
+/**
+ * storage_stats_new:
+ *
+ * Creates a new #StorageStats instance, which exports the counters
+ * and histograms over D-Bus.
+ *
+ * Returns: A new #StorageStats. Free with g_object_unref().
+ */
+StorageStats *
+storage_stats_new (void)
+{
+  return g_object_new (STORAGE_TYPE_STATS, NULL);
+}
+
+static gboolean
+handle_get_counters (LvmStats *object,
+                     GDBusMethodInvocation *invocation)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+  /* Levels that are cheaper to look up now than to keep up to date */
+  storage_intern_publish_stats ();
+
+  g_mutex_lock (&stats.mutex);
+  stats_ensure_tables ();
+  g_hash_table_iter_init (&iter, stats.counters);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_variant_builder_add (&builder, "{st}", key, *(guint64 *)value);
+  g_mutex_unlock (&stats.mutex);
+
+  lvm_stats_complete_get_counters (object, invocation, g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+static gboolean
+handle_get_histograms (LvmStats *object,
+                       GDBusMethodInvocation *invocation)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+  Histogram *hist;
+  GVariant *buckets;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(tttat)}"));
+
+  g_mutex_lock (&stats.mutex);
+  stats_ensure_tables ();
+  g_hash_table_iter_init (&iter, stats.histograms);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      hist = value;
+      buckets = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, hist->buckets,
+                                           N_BUCKETS, sizeof (guint64));
+      g_variant_builder_add (&builder, "{s(ttt@at)}", key,
+                             hist->count, hist->sum, hist->max, buckets);
+    }
+  g_mutex_unlock (&stats.mutex);
+
+  lvm_stats_complete_get_histograms (object, invocation, g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+static void
+stats_iface_init (LvmStatsIface *iface)
+{
+  iface->handle_get_counters = handle_get_counters;
+  iface->handle_get_histograms = handle_get_histograms;
+}
@@ -0,0 +1,53 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __STORAGE_STATS_H__
+#define __STORAGE_STATS_H__
+
+#include "types.h"
+
+G_BEGIN_DECLS
+
+#define STORAGE_TYPE_STATS         (storage_stats_get_type ())
+#define STORAGE_STATS(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), STORAGE_TYPE_STATS, StorageStats))
+#define STORAGE_IS_STATS(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), STORAGE_TYPE_STATS))
+
+GType                  storage_stats_get_type         (void) G_GNUC_CONST;
+
+StorageStats *         storage_stats_new              (void);
+
+void                   storage_stats_initialize       (void);
+
+void                   storage_stats_count            (const gchar *counter,
+                                                       guint64 amount);
+
+void                   storage_stats_set              (const gchar *counter,
+                                                       guint64 value);
+
+void                   storage_stats_record           (const gchar *histogram,
+                                                       gint64 usec);
+
+void                   storage_stats_record_since     (const gchar *histogram,
+                                                       gint64 since_usec);
+
+G_END_DECLS
+
+#endif /* __STORAGE_STATS_H__ */
@@ -0,0 +1,545 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Opens many connections to the daemon and calls its methods at a
+ * fixed rate, whether or not earlier calls have returned.  The calls
+ * are a mix of property reads, GetManagedObjects, Poll and the creation
+ * and deletion of logical volumes in a volume group on a loop device.
+ * Reports the throughput and latency of each method, and how long the
+ * InterfacesAdded signal for a new logical volume takes to arrive after
+ * it was asked for.  The results are written as JSON, all times in
+ * microseconds.
+ *
+ * Like the tests, this only runs when $TEST_TARGET is set.
+ */
+
+#include "config.h"
+
+#include "testing.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MIB (G_GUINT64_CONSTANT (1024) * 1024)
+
+/* Creating and deleting logical volumes serializes on the volume group lock */
+#define MAX_MUTATIONS 8
+
+static gint opt_clients = 16;
+static gint opt_rate = 200;
+static gint opt_duration = 30;
+static gint opt_outstanding = 1000;
+static gchar *opt_mix = NULL;
+static gchar *opt_output = NULL;
+
+static const GOptionEntry option_entries[] = {
+  { "clients", 0, 0, G_OPTION_ARG_INT, &opt_clients,
+    "Number of bus connections (default 16)", "N" },
+  { "rate", 0, 0, G_OPTION_ARG_INT, &opt_rate,
+    "Calls per second over all connections (default 200)", "N" },
+  { "duration", 0, 0, G_OPTION_ARG_INT, &opt_duration,
+    "Seconds to keep calling (default 30)", "SECS" },
+  { "max-outstanding", 0, 0, G_OPTION_ARG_INT, &opt_outstanding,
+    "Skip calls while this many are unanswered (default 1000)", "N" },
+  { "mix", 0, 0, G_OPTION_ARG_STRING, &opt_mix,
+    "Relative weights of the calls (default get=70,objects=10,poll=10,mutate=10)", "MIX" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+typedef enum {
+  CALL_GET,
+  CALL_OBJECTS,
+  CALL_POLL,
+  CALL_CREATE,
+  CALL_DELETE,
+  N_CALLS
+} CallKind;
+
+static const gchar *call_names[N_CALLS] = {
+  "GetAll", "GetManagedObjects", "Poll", "CreatePlainVolume", "Delete"
+};
+
+typedef struct {
+  GArray *latencies;
+  guint errors;
+  guint skipped;
+} CallStats;
+
+typedef struct {
+  GDBusConnection **clients;
+  guint next_client;
+
+  gchar *vgname;
+  gchar *vgpath;
+  gchar *device;
+  gpointer daemon;
+
+  guint weights[CALL_DELETE];
+  guint total_weight;
+
+  gint64 start;
+  guint64 issued;
+  guint outstanding;
+  guint mutations;
+  guint serial;
+
+  CallStats stats[N_CALLS];
+
+  /* Logical volume name -> start of its CreatePlainVolume call */
+  GHashTable *creating;
+  GArray *signal_lag;
+} Load;
+
+typedef struct {
+  Load *load;
+  CallKind kind;
+  gint64 start;
+  gchar *name;
+} Call;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+parse_mix (Load *load)
+{
+  const gchar *names[] = { "get", "objects", "poll", "mutate" };
+  gchar **pairs;
+  gchar *value;
+  guint i, j;
+
+  load->weights[CALL_GET] = 70;
+  load->weights[CALL_OBJECTS] = 10;
+  load->weights[CALL_POLL] = 10;
+  load->weights[CALL_CREATE] = 10;
+
+  if (opt_mix)
+    {
+      memset (load->weights, 0, sizeof (load->weights));
+      pairs = g_strsplit (opt_mix, ",", -1);
+      for (i = 0; pairs[i] != NULL; i++)
+        {
+          value = strchr (pairs[i], '=');
+          if (value)
+            *(value++) = '\0';
+          for (j = 0; j < G_N_ELEMENTS (names); j++)
+            {
+              if (g_str_equal (pairs[i], names[j]))
+                load->weights[j] = value ? strtoul (value, NULL, 10) : 1;
+            }
+        }
+      g_strfreev (pairs);
+    }
+
+  load->total_weight = 0;
+  for (i = 0; i < G_N_ELEMENTS (load->weights); i++)
+    load->total_weight += load->weights[i];
+}
+
+static CallKind
+pick_call (Load *load)
+{
+  guint r;
+  guint i;
+
+  r = g_random_int_range (0, load->total_weight);
+  for (i = 0; i < G_N_ELEMENTS (load->weights); i++)
+    {
+      if (r < load->weights[i])
+        break;
+      r -= load->weights[i];
+    }
+  return i;
+}
+
+static void   issue_call   (Load *load,
+                            CallKind kind,
+                            const gchar *object_path);
+
+static void
+on_call_done (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+  Call *call = user_data;
+  Load *load = call->load;
+  CallStats *stats = &load->stats[call->kind];
+  GVariant *retval;
+  GError *error = NULL;
+  const gchar *path;
+  gint64 elapsed;
+
+  retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  elapsed = g_get_monotonic_time () - call->start;
+  load->outstanding--;
+
+  if (error)
+    {
+      if (stats->errors++ == 0)
+        g_printerr ("%s: %s failed: %s\n", g_get_prgname (), call_names[call->kind], error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_array_append_val (stats->latencies, elapsed);
+    }
+
+  /* Every new logical volume is deleted again right away */
+  if (call->kind == CALL_CREATE && retval)
+    {
+      g_variant_get (retval, "(&o)", &path);
+      issue_call (load, CALL_DELETE, path);
+    }
+  else if (call->kind == CALL_CREATE || call->kind == CALL_DELETE)
+    {
+      load->mutations--;
+    }
+
+  if (call->kind == CALL_CREATE && !retval)
+    g_hash_table_remove (load->creating, call->name);
+
+  if (retval)
+    g_variant_unref (retval);
+  g_free (call->name);
+  g_free (call);
+}
+
+static GVariant *
+no_options (void)
+{
+  return g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0);
+}
+
+static void
+issue_call (Load *load,
+            CallKind kind,
+            const gchar *object_path)
+{
+  GDBusConnection *client;
+  const gchar *path = load->vgpath;
+  const gchar *interface = "com.redhat.lvm2.VolumeGroup";
+  const gchar *method = call_names[kind];
+  GVariant *parameters = NULL;
+  Call *call;
+  gint64 *start;
+
+  if (kind == CALL_CREATE && load->mutations >= MAX_MUTATIONS)
+    {
+      load->stats[kind].skipped++;
+      return;
+    }
+
+  call = g_new0 (Call, 1);
+  call->load = load;
+  call->kind = kind;
+
+  switch (kind)
+    {
+    case CALL_GET:
+      interface = "org.freedesktop.DBus.Properties";
+      parameters = g_variant_new ("(s)", "com.redhat.lvm2.VolumeGroup");
+      break;
+    case CALL_OBJECTS:
+      path = "/org/freedesktop/UDisks2";
+      interface = "org.freedesktop.DBus.ObjectManager";
+      break;
+    case CALL_POLL:
+      break;
+    case CALL_CREATE:
+      call->name = g_strdup_printf ("load%u", load->serial++);
+      parameters = g_variant_new ("(st@a{sv})", call->name, 4 * MIB, no_options ());
+      load->mutations++;
+      break;
+    case CALL_DELETE:
+      path = object_path;
+      interface = "com.redhat.lvm2.LogicalVolume";
+      parameters = g_variant_new ("(@a{sv})", no_options ());
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  client = load->clients[load->next_client++ % opt_clients];
+  call->start = g_get_monotonic_time ();
+  if (call->name)
+    {
+      start = g_new (gint64, 1);
+      *start = call->start;
+      g_hash_table_insert (load->creating, g_strdup (call->name), start);
+    }
+
+  load->outstanding++;
+  g_dbus_connection_call (client, "com.redhat.storaged", path, interface, method,
+                          parameters, NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          G_MAXINT, NULL, on_call_done, call);
+}
+
+static void
+on_interfaces_added (GDBusConnection *connection,
+                     const gchar *sender_name,
+                     const gchar *object_path,
+                     const gchar *interface_name,
+                     const gchar *signal_name,
+                     GVariant *parameters,
+                     gpointer user_data)
+{
+  Load *load = user_data;
+  GVariant *interfaces;
+  GVariant *props;
+  const gchar *name;
+  gint64 *start;
+  gint64 lag;
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oa{sa{sv}})")))
+    return;
+
+  interfaces = g_variant_get_child_value (parameters, 1);
+  props = g_variant_lookup_value (interfaces, "com.redhat.lvm2.LogicalVolume", NULL);
+  g_variant_unref (interfaces);
+  if (props == NULL)
+    return;
+
+  /* The reply goes to another connection, and can come before or after this */
+  if (g_variant_lookup (props, "Name", "&s", &name))
+    {
+      start = g_hash_table_lookup (load->creating, name);
+      if (start)
+        {
+          lag = g_get_monotonic_time () - *start;
+          g_array_append_val (load->signal_lag, lag);
+          g_hash_table_remove (load->creating, name);
+        }
+    }
+
+  g_variant_unref (props);
+}
+
+/*
+ * Issues as many calls as are due by now.  The schedule doesn't wait
+ * for answers, so a daemon that falls behind sees the load pile up
+ * like it would with real clients.
+ */
+static gboolean
+on_tick (gpointer user_data)
+{
+  Load *load = user_data;
+  guint64 due;
+
+  due = (g_get_monotonic_time () - load->start) * opt_rate / G_USEC_PER_SEC;
+  while (load->issued < due)
+    {
+      CallKind kind = pick_call (load);
+      if (load->outstanding >= (guint)opt_outstanding)
+        load->stats[kind].skipped++;
+      else
+        issue_call (load, kind, NULL);
+      load->issued++;
+    }
+
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+setup_volume_group (Load *load)
+{
+  GVariant *retval = NULL;
+  GError *error = NULL;
+  gint64 deadline;
+
+  load->vgname = g_strdup ("storagedload");
+  load->vgpath = storage_util_build_object_path ("/org/freedesktop/UDisks2/lvm", load->vgname, NULL);
+
+  testing_target_execute (NULL, "truncate", "-s", "1G", "storaged-load.img", NULL);
+  testing_target_execute (&load->device, "losetup", "-f", "--show", "storaged-load.img", NULL);
+  g_strstrip (load->device);
+  testing_target_execute (NULL, "vgcreate", load->vgname, load->device, NULL);
+
+  load->daemon = testing_target_launch ("*Acquired*on the system message bus*",
+                                        BUILDDIR "/src/storaged",
+                                        "--resource-dir=" BUILDDIR "/src",
+                                        "--replace", "--debug",
+                                        NULL);
+
+  /* Wait until the daemon has published the volume group */
+  deadline = g_get_monotonic_time () + testing_timeout * G_USEC_PER_SEC;
+  while (retval == NULL)
+    {
+      retval = g_dbus_connection_call_sync (load->clients[0], "com.redhat.storaged", load->vgpath,
+                                            "org.freedesktop.DBus.Properties", "GetAll",
+                                            g_variant_new ("(s)", "com.redhat.lvm2.VolumeGroup"),
+                                            NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                            -1, NULL, &error);
+      if (retval == NULL)
+        {
+          if (g_get_monotonic_time () > deadline)
+            g_error ("Volume group %s didn't appear: %s", load->vgname, error->message);
+          g_clear_error (&error);
+          g_usleep (100 * G_TIME_SPAN_MILLISECOND);
+        }
+    }
+  g_variant_unref (retval);
+}
+
+static void
+teardown_volume_group (Load *load)
+{
+  testing_target_execute (NULL, "vgremove", "-f", load->vgname, NULL);
+  testing_target_execute (NULL, "losetup", "-d", load->device, NULL);
+  testing_target_execute (NULL, "rm", "-f", "storaged-load.img", NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GString *json;
+  gboolean timeout = FALSE;
+  gint64 elapsed;
+  guint completed = 0;
+  guint tick;
+  guint drain;
+  guint i;
+  Load load = { NULL, };
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  context = g_option_context_new ("- measure how storaged copes with many clients");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  parse_mix (&load);
+  if (opt_clients < 1 || opt_rate < 1 || opt_duration < 1 || opt_outstanding < 1 || load.total_weight == 0)
+    {
+      g_printerr ("%s: invalid settings\n", g_get_prgname ());
+      return 2;
+    }
+
+  /* Same exit code as a skipped automake test */
+  if (!testing_target_init ())
+    return 77;
+
+  load.clients = g_new0 (GDBusConnection *, opt_clients);
+  for (i = 0; i < (guint)opt_clients; i++)
+    load.clients[i] = testing_target_connect ();
+  for (i = 0; i < N_CALLS; i++)
+    load.stats[i].latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  load.creating = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  load.signal_lag = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  setup_volume_group (&load);
+
+  /* Like any client that follows the objects, though only one of them does */
+  g_dbus_connection_signal_subscribe (load.clients[0], "com.redhat.storaged",
+                                      "org.freedesktop.DBus.ObjectManager", "InterfacesAdded",
+                                      NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                      on_interfaces_added, &load, NULL);
+
+  load.start = g_get_monotonic_time ();
+  tick = g_timeout_add (1, on_tick, &load);
+  g_timeout_add_seconds (opt_duration, testing_callback_set_flag, &timeout);
+  while (!timeout)
+    g_main_context_iteration (NULL, TRUE);
+  g_source_remove (tick);
+  elapsed = g_get_monotonic_time () - load.start;
+
+  /* Let the calls that are still out come back, including the deletes */
+  timeout = FALSE;
+  drain = g_timeout_add_seconds (testing_timeout, testing_callback_set_flag, &timeout);
+  while (load.outstanding > 0 && !timeout)
+    g_main_context_iteration (NULL, TRUE);
+  if (!timeout)
+    g_source_remove (drain);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"settings\": { \"clients\": %d, \"rate\": %d, \"duration\": %d, "
+                          "\"get\": %u, \"objects\": %u, \"poll\": %u, \"mutate\": %u },\n",
+                          opt_clients, opt_rate, opt_duration,
+                          load.weights[CALL_GET], load.weights[CALL_OBJECTS],
+                          load.weights[CALL_POLL], load.weights[CALL_CREATE]);
+
+  g_string_append (json, "  \"methods\": {\n");
+  for (i = 0; i < N_CALLS; i++)
+    {
+      CallStats *stats = &load.stats[i];
+      completed += stats->latencies->len;
+      g_string_append_printf (json, "    \"%s\": { \"throughput\": %.1f, \"errors\": %u, "
+                              "\"skipped\": %u, \"latency\": ",
+                              call_names[i], stats->latencies->len * (gdouble)G_USEC_PER_SEC / elapsed,
+                              stats->errors, stats->skipped);
+      testing_append_samples (json, stats->latencies);
+      g_string_append_printf (json, " }%s\n", i + 1 < N_CALLS ? "," : "");
+    }
+  g_string_append (json, "  },\n");
+
+  g_string_append_printf (json, "  \"throughput\": %.1f,\n  \"unanswered\": %u,\n  \"signal-lag\": ",
+                          completed * (gdouble)G_USEC_PER_SEC / elapsed, load.outstanding);
+  testing_append_samples (json, load.signal_lag);
+  g_string_append (json, "\n}\n");
+
+  for (i = 0; i < (guint)opt_clients; i++)
+    g_object_unref (load.clients[i]);
+  testing_target_wait (load.daemon);
+  teardown_volume_group (&load);
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        {
+          g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+          g_error_free (error);
+          return 1;
+        }
+    }
+  else
+    {
+      fputs (json->str, stdout);
+    }
+
+  g_string_free (json, TRUE);
+  for (i = 0; i < N_CALLS; i++)
+    g_array_free (load.stats[i].latencies, TRUE);
+  g_hash_table_unref (load.creating);
+  g_array_free (load.signal_lag, TRUE);
+  g_free (load.clients);
+  g_free (load.vgname);
+  g_free (load.vgpath);
+  g_free (load.device);
+  g_free (opt_mix);
+  g_free (opt_output);
+  return 0;
+}
@@ -0,0 +1,459 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Replays a recording of uevents into the daemon, which runs on top of
+ * synthetic-lvm-helper, and records what the daemon did about them:
+ * how often it read the volume groups again, how many helpers it
+ * spawned for that, how much CPU time it used, and how long its model
+ * lagged behind the uevents.  No real hardware is involved.
+ *
+ * The recording is made with uevent-record, and must be readable at
+ * the same path here and on the target.  By default, uevent-storm.txt
+ * from the source tree is used, whose volume group names match those
+ * of the synthetic helper.  The results are written as JSON, times in
+ * microseconds and memory in KiB.
+ *
+ * Like the tests, this only runs when $TEST_TARGET is set.
+ */
+
+#include "config.h"
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static gchar *opt_recording = NULL;
+static gdouble opt_speed = 1.0;
+static gint opt_vgs = 4;
+static gint opt_lvs = 1000;
+static gint opt_timeout = 300;
+static gchar *opt_output = NULL;
+
+static const GOptionEntry option_entries[] = {
+  { "recording", 0, 0, G_OPTION_ARG_FILENAME, &opt_recording,
+    "The uevents to replay (default uevent-storm.txt)", "FILE" },
+  { "speed", 0, 0, G_OPTION_ARG_DOUBLE, &opt_speed,
+    "Replay this much faster than recorded, 0 for at once (default 1)", "FACTOR" },
+  { "vgs", 0, 0, G_OPTION_ARG_INT, &opt_vgs,
+    "Number of synthetic volume groups (default 4)", "N" },
+  { "lvs", 0, 0, G_OPTION_ARG_INT, &opt_lvs,
+    "Logical volumes per volume group (default 1000)", "N" },
+  { "timeout", 0, 0, G_OPTION_ARG_INT, &opt_timeout,
+    "Seconds to wait for the daemon to settle (default 300)", "SECS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  GDBusConnection *bus;
+  gpointer daemon;
+  gchar *pid;
+  gchar *dir;
+} Bench;
+
+typedef struct {
+  guint64 cpu;
+  guint64 rss;
+  guint64 hwm;
+} Usage;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Same rules as storage_uevent_replay_new() */
+static guint
+count_uevents (const gchar *path)
+{
+  gchar *contents;
+  gchar **lines;
+  GError *error = NULL;
+  guint count = 0;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    g_error ("%s", error->message);
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      g_strstrip (lines[i]);
+      if (lines[i][0] != '\0' && lines[i][0] != '#')
+        count++;
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+  return count;
+}
+
+static GVariant *
+fetch_stats (Bench *bench,
+             const gchar *method,
+             const gchar *type)
+{
+  GVariant *retval;
+  GVariant *stats;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "com.redhat.storaged",
+                                        "/org/freedesktop/UDisks2/Manager",
+                                        "com.redhat.lvm2.Stats", method,
+                                        NULL, G_VARIANT_TYPE (type),
+                                        G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                        -1, NULL, &error);
+  g_assert_no_error (error);
+
+  stats = g_variant_get_child_value (retval, 0);
+  g_variant_unref (retval);
+  return stats;
+}
+
+static guint64
+lookup_counter (GVariant *counters,
+                const gchar *name)
+{
+  guint64 value = 0;
+  g_variant_lookup (counters, name, "t", &value);
+  return value;
+}
+
+/* vg.poll.spawned is also counted as helper.show.spawned */
+static guint64
+sum_spawned (GVariant *counters)
+{
+  GVariantIter iter;
+  const gchar *name;
+  guint64 value;
+  guint64 spawned = 0;
+
+  g_variant_iter_init (&iter, counters);
+  while (g_variant_iter_next (&iter, "{&st}", &name, &value))
+    {
+      if (g_str_has_prefix (name, "helper.") && g_str_has_suffix (name, ".spawned"))
+        spawned += value;
+    }
+  return spawned;
+}
+
+/* A helper is recorded in its histogram once it has been reaped */
+static guint64
+sum_reaped (GVariant *histograms)
+{
+  GVariantIter iter;
+  const gchar *name;
+  guint64 count;
+  guint64 reaped = 0;
+
+  g_variant_iter_init (&iter, histograms);
+  while (g_variant_iter_next (&iter, "{&s(ttt@at)}", &name, &count, NULL, NULL, NULL))
+    {
+      if (g_str_has_prefix (name, "helper."))
+        reaped += count;
+    }
+  return reaped;
+}
+
+static gchar *
+fetch_daemon_pid (Bench *bench)
+{
+  GVariant *retval;
+  guint32 pid;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                        "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+                                        g_variant_new ("(s)", "com.redhat.storaged"),
+                                        G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE,
+                                        -1, NULL, &error);
+  g_assert_no_error (error);
+
+  g_variant_get (retval, "(u)", &pid);
+  g_variant_unref (retval);
+  return g_strdup_printf ("%u", pid);
+}
+
+static guint64
+parse_status_kib (const gchar *status,
+                  const gchar *field)
+{
+  const gchar *line;
+
+  line = strstr (status, field);
+  if (line == NULL)
+    return 0;
+  return g_ascii_strtoull (line + strlen (field), NULL, 10);
+}
+
+/* The daemon runs on the target, so ask there */
+static void
+fetch_usage (Bench *bench,
+             Usage *usage)
+{
+  gchar *path;
+  gchar *output;
+  gchar **fields;
+  gchar *end;
+
+  path = g_strdup_printf ("/proc/%s/stat", bench->pid);
+  testing_target_execute (&output, "cat", path, NULL);
+  g_free (path);
+
+  /* utime and stime are the 14th and 15th field, counting after the command name */
+  end = strrchr (output, ')');
+  g_assert (end != NULL);
+  fields = g_strsplit (end + 2, " ", -1);
+  g_assert (g_strv_length (fields) > 12);
+  usage->cpu = (g_ascii_strtoull (fields[11], NULL, 10) + g_ascii_strtoull (fields[12], NULL, 10))
+               * G_USEC_PER_SEC / sysconf (_SC_CLK_TCK);
+  g_strfreev (fields);
+  g_free (output);
+
+  path = g_strdup_printf ("/proc/%s/status", bench->pid);
+  testing_target_execute (&output, "cat", path, NULL);
+  g_free (path);
+
+  usage->rss = parse_status_kib (output, "VmRSS:");
+  usage->hwm = parse_status_kib (output, "VmHWM:");
+  g_free (output);
+}
+
+/*
+ * Waits until all uevents have been replayed, and no helper has been
+ * spawned or is running for longer than the daemon delays its updates.
+ */
+static void
+wait_for_settled (Bench *bench,
+                  guint uevents)
+{
+  GVariant *counters;
+  GVariant *histograms;
+  guint64 replayed;
+  guint64 spawned;
+  guint64 reaped;
+  guint64 last_spawned = G_MAXUINT64;
+  gint64 quiet_since = 0;
+  gint64 deadline;
+  gint64 now;
+
+  deadline = g_get_monotonic_time () + opt_timeout * G_USEC_PER_SEC;
+
+  for (;;)
+    {
+      counters = fetch_stats (bench, "GetCounters", "(a{st})");
+      histograms = fetch_stats (bench, "GetHistograms", "(a{s(tttat)})");
+      replayed = lookup_counter (counters, "uevent.replayed");
+      spawned = sum_spawned (counters);
+      reaped = sum_reaped (histograms);
+      g_variant_unref (counters);
+      g_variant_unref (histograms);
+
+      now = g_get_monotonic_time ();
+      if (replayed < uevents || spawned != reaped || spawned != last_spawned)
+        quiet_since = now;
+      else if (now - quiet_since > 500 * G_TIME_SPAN_MILLISECOND)
+        break;
+      last_spawned = spawned;
+
+      if (now > deadline)
+        g_error ("Timed out with %" G_GUINT64_FORMAT " of %u uevents replayed, and %"
+                 G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " helpers reaped",
+                 replayed, uevents, reaped, spawned);
+      g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+    }
+}
+
+static void
+append_histogram (GString *json,
+                  GVariant *histograms,
+                  const gchar *name)
+{
+  guint64 count = 0;
+  guint64 sum = 0;
+  guint64 max = 0;
+
+  g_variant_lookup (histograms, name, "(ttt@at)", &count, &sum, &max, NULL);
+  g_string_append_printf (json, "{ \"count\": %" G_GUINT64_FORMAT ", \"mean\": %" G_GUINT64_FORMAT
+                          ", \"max\": %" G_GUINT64_FORMAT " }",
+                          count, count ? sum / count : 0, max);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+bench_replay (Bench *bench,
+              GString *json)
+{
+  gchar *config;
+  gchar *resource_dir;
+  gchar *replay;
+  gchar *speed;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  GVariant *counters;
+  GVariant *histograms;
+  guint64 spawned;
+  guint64 refreshes;
+  gint64 start;
+  gint64 end;
+  guint uevents;
+  Usage usage;
+
+  uevents = count_uevents (opt_recording);
+
+  config = g_strdup_printf ("STORAGED_SYNTHETIC_LVM=vgs=%d,lvs=%d,churn=0,resize=0,state=%s",
+                            opt_vgs, opt_lvs, bench->dir);
+  resource_dir = g_strdup_printf ("--resource-dir=%s", bench->dir);
+  replay = g_strdup_printf ("--replay-uevents=%s", opt_recording);
+  speed = g_strdup_printf ("--replay-speed=%s", g_ascii_dtostr (buf, sizeof (buf), opt_speed));
+
+  start = g_get_monotonic_time ();
+  bench->daemon = testing_target_launch ("*Acquired*on the system message bus*",
+                                         "env", config, BUILDDIR "/src/storaged",
+                                         resource_dir, replay, speed, "--replace", "--debug",
+                                         NULL);
+
+  bench->pid = fetch_daemon_pid (bench);
+  wait_for_settled (bench, uevents);
+  end = g_get_monotonic_time ();
+
+  fetch_usage (bench, &usage);
+  counters = fetch_stats (bench, "GetCounters", "(a{st})");
+  histograms = fetch_stats (bench, "GetHistograms", "(a{s(tttat)})");
+
+  /*
+   * The coldplug lists the volume groups and shows each of them once,
+   * and every update after that was due to a replayed uevent.
+   */
+  spawned = sum_spawned (counters) - (1 + opt_vgs);
+  refreshes = lookup_counter (counters, "helper.list.spawned") - 1;
+
+  g_string_append_printf (json, "  \"replay\": { \"uevents\": %u, \"coalesced\": %" G_GUINT64_FORMAT
+                          ", \"refreshes\": %" G_GUINT64_FORMAT ", \"helpers-spawned\": %" G_GUINT64_FORMAT
+                          ", \"time\": %" G_GINT64_FORMAT ", \"cpu\": %" G_GUINT64_FORMAT
+                          ", \"rss\": %" G_GUINT64_FORMAT ", \"rss-peak\": %" G_GUINT64_FORMAT
+                          ", \"staleness\": ",
+                          uevents, lookup_counter (counters, "uevent.coalesced"),
+                          refreshes, spawned, end - start, usage.cpu, usage.rss, usage.hwm);
+  append_histogram (json, histograms, "uevent.staleness");
+  g_string_append (json, " }\n");
+
+  g_variant_unref (counters);
+  g_variant_unref (histograms);
+  g_free (speed);
+  g_free (replay);
+  g_free (resource_dir);
+  g_free (config);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GString *json;
+  gchar *helper;
+  Bench bench = { NULL, };
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  context = g_option_context_new ("- replay recorded uevents into storaged");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (opt_speed < 0 || opt_vgs < 1 || opt_lvs < 0 || opt_timeout < 1)
+    {
+      g_printerr ("%s: invalid settings\n", g_get_prgname ());
+      return 2;
+    }
+
+  if (opt_recording == NULL)
+    opt_recording = g_strdup (SRCDIR "/src/tests/uevent-storm.txt");
+  if (!g_path_is_absolute (opt_recording))
+    {
+      g_printerr ("%s: %s: the recording needs a full path\n", g_get_prgname (), opt_recording);
+      return 2;
+    }
+
+  /* Same exit code as a skipped automake test */
+  if (!testing_target_init ())
+    return 77;
+
+  bench.bus = testing_target_connect ();
+
+  /* The helper is found as storaged-lvm-helper in the resource directory */
+  testing_target_execute (&bench.dir, "mktemp", "-d", "/tmp/storaged-replay.XXXXXX", NULL);
+  g_strstrip (bench.dir);
+  helper = g_build_filename (bench.dir, "storaged-lvm-helper", NULL);
+  testing_target_execute (NULL, "ln", "-s", BUILDDIR "/src/tests/synthetic-lvm-helper", helper, NULL);
+  g_free (helper);
+
+  /* Neither start from nor leave behind a snapshot of other volume groups */
+  testing_target_execute (NULL, "rm", "-f", "/run/storaged/snapshot", NULL);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"settings\": { \"recording\": \"%s\", \"speed\": %g, "
+                          "\"volume-groups\": %d, \"logical-volumes\": %d },\n",
+                          opt_recording, opt_speed, opt_vgs, opt_lvs);
+
+  bench_replay (&bench, json);
+
+  g_string_append (json, "}\n");
+
+  g_clear_object (&bench.bus);
+  testing_target_wait (bench.daemon);
+
+  testing_target_execute (NULL, "rm", "-rf", bench.dir, "/run/storaged/snapshot", NULL);
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        {
+          g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+          g_error_free (error);
+          return 1;
+        }
+    }
+  else
+    {
+      fputs (json->str, stdout);
+    }
+
+  g_string_free (json, TRUE);
+  g_free (bench.pid);
+  g_free (bench.dir);
+  g_free (opt_recording);
+  g_free (opt_output);
+  return 0;
+}
@@ -0,0 +1,633 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Builds a topology of volume groups, logical volumes and thin pools on
+ * sparse loop devices on the target, starts the daemon on top of it and
+ * measures how it copes.  The results are written as JSON, all times in
+ * microseconds.
+ *
+ * Like the tests, this only runs when $TEST_TARGET is set.
+ */
+
+#include "config.h"
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MIB (G_GUINT64_CONSTANT (1024) * 1024)
+
+static gint opt_vgs = 2;
+static gint opt_lvs = 8;
+static gint opt_pools = 1;
+static gint opt_thins = 2;
+static gint opt_samples = 20;
+static gint opt_timeout = 300;
+static gchar *opt_output = NULL;
+
+static const GOptionEntry option_entries[] = {
+  { "vgs", 0, 0, G_OPTION_ARG_INT, &opt_vgs,
+    "Number of volume groups (default 2)", "N" },
+  { "lvs", 0, 0, G_OPTION_ARG_INT, &opt_lvs,
+    "Plain logical volumes per volume group (default 8)", "M" },
+  { "thin-pools", 0, 0, G_OPTION_ARG_INT, &opt_pools,
+    "Thin pools per volume group (default 1)", "K" },
+  { "thin-volumes", 0, 0, G_OPTION_ARG_INT, &opt_thins,
+    "Thin volumes per thin pool (default 2)", "T" },
+  { "samples", 0, 0, G_OPTION_ARG_INT, &opt_samples,
+    "Timed operations of each kind (default 20)", "S" },
+  { "timeout", 0, 0, G_OPTION_ARG_INT, &opt_timeout,
+    "Seconds to wait for the daemon to settle (default 300)", "SECS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  GDBusConnection *bus;
+  GDBusObjectManager *objman;
+  gpointer daemon;
+
+  GPtrArray *vgnames;
+  GPtrArray *devices;
+  GPtrArray *files;
+
+  /* Names of logical volumes we care about, and how many of them are on the bus */
+  GHashTable *expected;
+  guint present;
+} Bench;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_interface_added (GDBusObjectManager *objman,
+                    GDBusObject *object,
+                    GDBusInterface *interface,
+                    gpointer user_data)
+{
+  Bench *bench = user_data;
+  const gchar *name;
+  gpointer orig_key;
+  gpointer seen;
+
+  if (!g_str_equal (g_dbus_proxy_get_interface_name (G_DBUS_PROXY (interface)), "com.redhat.lvm2.LogicalVolume"))
+    return;
+
+  name = testing_proxy_string (G_DBUS_PROXY (interface), "Name");
+  if (name && g_hash_table_lookup_extended (bench->expected, name, &orig_key, &seen) && !seen)
+    {
+      g_hash_table_insert (bench->expected, g_strdup (name), GINT_TO_POINTER (TRUE));
+      bench->present++;
+    }
+}
+
+static void
+on_interface_removed (GDBusObjectManager *objman,
+                      GDBusObject *object,
+                      GDBusInterface *interface,
+                      gpointer user_data)
+{
+  Bench *bench = user_data;
+  const gchar *name;
+
+  if (!g_str_equal (g_dbus_proxy_get_interface_name (G_DBUS_PROXY (interface)), "com.redhat.lvm2.LogicalVolume"))
+    return;
+
+  name = testing_proxy_string (G_DBUS_PROXY (interface), "Name");
+  if (name && g_hash_table_lookup (bench->expected, name))
+    {
+      g_hash_table_insert (bench->expected, g_strdup (name), GINT_TO_POINTER (FALSE));
+      bench->present--;
+    }
+}
+
+static void
+expect_logical_volume (Bench *bench,
+                       const gchar *name)
+{
+  g_hash_table_insert (bench->expected, g_strdup (name), GINT_TO_POINTER (FALSE));
+}
+
+static void
+count_present (Bench *bench)
+{
+  GList *objects, *l;
+  GDBusInterface *interface;
+
+  objects = g_dbus_object_manager_get_objects (bench->objman);
+  for (l = objects; l != NULL; l = g_list_next (l))
+    {
+      interface = g_dbus_object_get_interface (l->data, "com.redhat.lvm2.LogicalVolume");
+      if (interface)
+        {
+          on_interface_added (bench->objman, l->data, interface, bench);
+          g_object_unref (interface);
+        }
+    }
+  g_list_free_full (objects, g_object_unref);
+}
+
+/*
+ * Returns the time at which the wanted number of logical volumes were
+ * on the bus.  The benchmark gives up when that takes too long.
+ */
+static gint64
+wait_for_present (Bench *bench,
+                  guint want)
+{
+  GSource *source;
+  gboolean timeout = FALSE;
+
+  source = g_timeout_source_new_seconds (opt_timeout);
+  g_source_set_callback (source, testing_callback_set_flag, &timeout, NULL);
+  g_source_attach (source, NULL);
+  while (bench->present != want && !timeout)
+    g_main_context_iteration (NULL, TRUE);
+  g_source_destroy (source);
+  g_source_unref (source);
+
+  if (timeout)
+    g_error ("Timed out waiting for %u logical volumes, %u are there", want, bench->present);
+
+  return g_get_monotonic_time ();
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+build_topology (Bench *bench)
+{
+  gchar *file;
+  gchar *device;
+  gchar *vgname;
+  gchar *size;
+  gchar *pool;
+  gchar *name;
+  guint64 needed;
+  gint i, j, k;
+
+  /* Each plain volume and thin pool takes a few extents, leave room for the timed operations */
+  needed = (opt_lvs * 4 + opt_pools * 16 + 64) * MIB;
+  size = g_strdup_printf ("%" G_GUINT64_FORMAT, needed + 256 * MIB);
+
+  for (i = 0; i < opt_vgs; i++)
+    {
+      file = g_strdup_printf ("storaged-bench-%d.img", i);
+      testing_target_execute (NULL, "truncate", "-s", size, file, NULL);
+      testing_target_execute (&device, "losetup", "-f", "--show", file, NULL);
+      g_strstrip (device);
+      g_ptr_array_add (bench->files, file);
+      g_ptr_array_add (bench->devices, device);
+
+      vgname = g_strdup_printf ("storaged-bench-%d", i);
+      testing_target_execute (NULL, "vgcreate", vgname, device, NULL);
+      g_ptr_array_add (bench->vgnames, vgname);
+
+      for (j = 0; j < opt_lvs; j++)
+        {
+          name = g_strdup_printf ("bench%dlv%d", i, j);
+          testing_target_execute (NULL, "lvcreate", vgname, "--name", name,
+                                  "--size", "4m", "--zero", "n", NULL);
+          expect_logical_volume (bench, name);
+          g_free (name);
+        }
+
+      for (j = 0; j < opt_pools; j++)
+        {
+          name = g_strdup_printf ("bench%dpool%d", i, j);
+          pool = g_strdup_printf ("%s/%s", vgname, name);
+          testing_target_execute (NULL, "lvcreate", "--thinpool", pool, "--size", "8m", NULL);
+          expect_logical_volume (bench, name);
+          g_free (name);
+
+          for (k = 0; k < opt_thins; k++)
+            {
+              name = g_strdup_printf ("bench%dpool%dthin%d", i, j, k);
+              testing_target_execute (NULL, "lvcreate", "--thin", pool, "--name", name,
+                                      "--virtualsize", "64m", NULL);
+              expect_logical_volume (bench, name);
+              g_free (name);
+            }
+
+          g_free (pool);
+        }
+    }
+
+  g_free (size);
+}
+
+static void
+destroy_topology (Bench *bench)
+{
+  guint i;
+
+  for (i = 0; i < bench->vgnames->len; i++)
+    testing_target_execute (NULL, "vgremove", "-f", bench->vgnames->pdata[i], NULL);
+  for (i = 0; i < bench->devices->len; i++)
+    testing_target_execute (NULL, "losetup", "-d", bench->devices->pdata[i], NULL);
+  for (i = 0; i < bench->files->len; i++)
+    testing_target_execute (NULL, "rm", "-f", bench->files->pdata[i], NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static GVariant *
+fetch_counters (Bench *bench)
+{
+  GVariant *retval;
+  GVariant *counters;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "com.redhat.storaged",
+                                        "/org/freedesktop/UDisks2/Manager",
+                                        "com.redhat.lvm2.Stats", "GetCounters",
+                                        NULL, G_VARIANT_TYPE ("(a{st})"),
+                                        G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                        -1, NULL, &error);
+  g_assert_no_error (error);
+
+  counters = g_variant_get_child_value (retval, 0);
+  g_variant_unref (retval);
+  return counters;
+}
+
+static void
+append_counters (GString *json,
+                 GVariant *before,
+                 GVariant *after)
+{
+  GVariantIter iter;
+  const gchar *name;
+  guint64 value;
+  guint64 old;
+  guint64 spawned = 0;
+
+  g_string_append (json, "{ ");
+
+  g_variant_iter_init (&iter, after);
+  while (g_variant_iter_next (&iter, "{&st}", &name, &value))
+    {
+      old = 0;
+      if (before)
+        g_variant_lookup (before, name, "t", &old);
+      if (value == old)
+        continue;
+
+      /* vg.poll.spawned is also counted as helper.show.spawned */
+      if (g_str_has_prefix (name, "helper.") && g_str_has_suffix (name, ".spawned"))
+        spawned += value - old;
+
+      g_string_append_printf (json, "\"%s\": %" G_GUINT64_FORMAT ", ", name, value - old);
+    }
+
+  g_string_append_printf (json, "\"helpers-spawned\": %" G_GUINT64_FORMAT " }", spawned);
+}
+
+static void
+add_sample (GArray *samples,
+            gint64 start,
+            gint64 end)
+{
+  gint64 elapsed = end - start;
+  g_array_append_val (samples, elapsed);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+bench_coldplug (Bench *bench,
+                GString *json)
+{
+  GVariant *counters;
+  gint64 start;
+  gint64 acquired;
+  gint64 settled;
+  GError *error = NULL;
+
+  start = g_get_monotonic_time ();
+  bench->daemon = testing_target_launch ("*Acquired*on the system message bus*",
+                                         BUILDDIR "/src/storaged",
+                                         "--resource-dir=" BUILDDIR "/src",
+                                         "--replace", "--debug",
+                                         NULL);
+  acquired = g_get_monotonic_time ();
+
+  bench->objman = g_dbus_object_manager_client_new_sync (bench->bus,
+                                                         G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_DO_NOT_AUTO_START,
+                                                         "com.redhat.storaged",
+                                                         "/org/freedesktop/UDisks2",
+                                                         NULL, NULL, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  g_signal_connect (bench->objman, "interface-added", G_CALLBACK (on_interface_added), bench);
+  g_signal_connect (bench->objman, "interface-removed", G_CALLBACK (on_interface_removed), bench);
+  count_present (bench);
+
+  settled = wait_for_present (bench, g_hash_table_size (bench->expected));
+  counters = fetch_counters (bench);
+
+  g_string_append_printf (json, "  \"coldplug\": { \"name-acquired\": %" G_GINT64_FORMAT
+                          ", \"settled\": %" G_GINT64_FORMAT ", \"logical-volumes\": %u, \"counters\": ",
+                          acquired - start, settled - start, bench->present);
+  append_counters (json, NULL, counters);
+  g_string_append (json, " },\n");
+
+  g_variant_unref (counters);
+}
+
+/*
+ * Change the volume group behind the daemon's back, and time how long
+ * it takes for the uevents of that change to show up in the model.  The
+ * LVM tools wait for udev to process their events, so these are all out
+ * by the time the command returns.
+ */
+static void
+bench_uevents (Bench *bench,
+               GString *json)
+{
+  const gchar *vgname = bench->vgnames->pdata[0];
+  GArray *commands;
+  GArray *added;
+  GArray *removed;
+  GVariant *before;
+  GVariant *after;
+  gchar *name;
+  gchar *full_name;
+  gint64 start;
+  gint64 done;
+  guint base;
+  gint i;
+
+  commands = g_array_new (FALSE, FALSE, sizeof (gint64));
+  added = g_array_new (FALSE, FALSE, sizeof (gint64));
+  removed = g_array_new (FALSE, FALSE, sizeof (gint64));
+  before = fetch_counters (bench);
+  base = bench->present;
+
+  for (i = 0; i < opt_samples; i++)
+    {
+      name = g_strdup_printf ("benchext%d", i);
+      full_name = g_strdup_printf ("%s/%s", vgname, name);
+      expect_logical_volume (bench, name);
+
+      start = g_get_monotonic_time ();
+      testing_target_execute (NULL, "lvcreate", vgname, "--name", name,
+                              "--size", "4m", "--zero", "n", NULL);
+      done = g_get_monotonic_time ();
+      add_sample (commands, start, done);
+      add_sample (added, done, wait_for_present (bench, base + 1));
+
+      testing_target_execute (NULL, "lvremove", "-f", full_name, NULL);
+      done = g_get_monotonic_time ();
+      add_sample (removed, done, wait_for_present (bench, base));
+
+      g_hash_table_remove (bench->expected, name);
+      g_free (full_name);
+      g_free (name);
+    }
+
+  after = fetch_counters (bench);
+
+  g_string_append (json, "  \"uevents\": { \"command\": ");
+  testing_append_samples (json, commands);
+  g_string_append (json, ", \"added\": ");
+  testing_append_samples (json, added);
+  g_string_append (json, ", \"removed\": ");
+  testing_append_samples (json, removed);
+  g_string_append (json, ", \"counters\": ");
+  append_counters (json, before, after);
+  g_string_append (json, " },\n");
+
+  g_variant_unref (before);
+  g_variant_unref (after);
+  g_array_free (commands, TRUE);
+  g_array_free (added, TRUE);
+  g_array_free (removed, TRUE);
+}
+
+static GDBusProxy *
+lookup_volume_group (Bench *bench,
+                     const gchar *vgname)
+{
+  GList *objects, *l;
+  GDBusInterface *interface;
+  GDBusProxy *volume_group = NULL;
+
+  objects = g_dbus_object_manager_get_objects (bench->objman);
+  for (l = objects; l != NULL && volume_group == NULL; l = g_list_next (l))
+    {
+      interface = g_dbus_object_get_interface (l->data, "com.redhat.lvm2.VolumeGroup");
+      if (interface && g_strcmp0 (testing_proxy_string (G_DBUS_PROXY (interface), "Name"), vgname) == 0)
+        volume_group = G_DBUS_PROXY (g_object_ref (interface));
+      g_clear_object (&interface);
+    }
+  g_list_free_full (objects, g_object_unref);
+
+  g_assert (volume_group != NULL);
+  return volume_group;
+}
+
+static GVariant *
+timed_call (GDBusProxy *proxy,
+            const gchar *method,
+            GVariant *parameters,
+            GArray *samples)
+{
+  GVariant *retval;
+  GError *error = NULL;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  retval = g_dbus_proxy_call_sync (proxy, method, parameters,
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   G_MAXINT, NULL, &error);
+  add_sample (samples, start, g_get_monotonic_time ());
+
+  g_assert_no_error (error);
+  return retval;
+}
+
+static GVariant *
+no_options (void)
+{
+  return g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0);
+}
+
+static void
+bench_methods (Bench *bench,
+               GString *json)
+{
+  GDBusProxy *volume_group;
+  GDBusProxy *logical_volume;
+  GArray *create;
+  GArray *resize;
+  GArray *delete;
+  GVariant *before;
+  GVariant *after;
+  GVariant *retval;
+  const gchar *path;
+  gchar *name;
+  guint base;
+  gint i;
+
+  create = g_array_new (FALSE, FALSE, sizeof (gint64));
+  resize = g_array_new (FALSE, FALSE, sizeof (gint64));
+  delete = g_array_new (FALSE, FALSE, sizeof (gint64));
+  volume_group = lookup_volume_group (bench, bench->vgnames->pdata[0]);
+  before = fetch_counters (bench);
+  base = bench->present;
+
+  for (i = 0; i < opt_samples; i++)
+    {
+      name = g_strdup_printf ("benchop%d", i);
+      expect_logical_volume (bench, name);
+
+      retval = timed_call (volume_group, "CreatePlainVolume",
+                           g_variant_new ("(st@a{sv})", name, 4 * MIB, no_options ()),
+                           create);
+      wait_for_present (bench, base + 1);
+
+      g_variant_get (retval, "(&o)", &path);
+      logical_volume = G_DBUS_PROXY (g_dbus_object_manager_get_interface (bench->objman, path,
+                                                                          "com.redhat.lvm2.LogicalVolume"));
+      g_assert (logical_volume != NULL);
+      g_variant_unref (retval);
+
+      retval = timed_call (logical_volume, "Resize",
+                           g_variant_new ("(t@a{sv})", 8 * MIB, no_options ()),
+                           resize);
+      g_variant_unref (retval);
+
+      retval = timed_call (logical_volume, "Delete",
+                           g_variant_new ("(@a{sv})", no_options ()),
+                           delete);
+      g_variant_unref (retval);
+      wait_for_present (bench, base);
+
+      g_object_unref (logical_volume);
+      g_hash_table_remove (bench->expected, name);
+      g_free (name);
+    }
+
+  after = fetch_counters (bench);
+
+  g_string_append (json, "  \"methods\": { \"create\": ");
+  testing_append_samples (json, create);
+  g_string_append (json, ", \"resize\": ");
+  testing_append_samples (json, resize);
+  g_string_append (json, ", \"delete\": ");
+  testing_append_samples (json, delete);
+  g_string_append (json, ", \"counters\": ");
+  append_counters (json, before, after);
+  g_string_append (json, " }\n");
+
+  g_object_unref (volume_group);
+  g_variant_unref (before);
+  g_variant_unref (after);
+  g_array_free (create, TRUE);
+  g_array_free (resize, TRUE);
+  g_array_free (delete, TRUE);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GString *json;
+  Bench bench = { NULL, };
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  context = g_option_context_new ("- measure storaged on a large LVM topology");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (opt_vgs < 1 || opt_lvs < 0 || opt_pools < 0 || opt_thins < 0 || opt_samples < 0 || opt_timeout < 1)
+    {
+      g_printerr ("%s: invalid topology\n", g_get_prgname ());
+      return 2;
+    }
+
+  /* Same exit code as a skipped automake test */
+  if (!testing_target_init ())
+    return 77;
+
+  bench.bus = testing_target_connect ();
+  bench.vgnames = g_ptr_array_new_with_free_func (g_free);
+  bench.devices = g_ptr_array_new_with_free_func (g_free);
+  bench.files = g_ptr_array_new_with_free_func (g_free);
+  bench.expected = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"topology\": { \"volume-groups\": %d, \"logical-volumes\": %d, "
+                          "\"thin-pools\": %d, \"thin-volumes\": %d, \"samples\": %d },\n",
+                          opt_vgs, opt_lvs, opt_pools, opt_thins, opt_samples);
+
+  build_topology (&bench);
+
+  bench_coldplug (&bench, json);
+  bench_uevents (&bench, json);
+  bench_methods (&bench, json);
+
+  g_string_append (json, "}\n");
+
+  g_clear_object (&bench.objman);
+  g_clear_object (&bench.bus);
+  testing_target_wait (bench.daemon);
+
+  destroy_topology (&bench);
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        {
+          g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+          g_error_free (error);
+          return 1;
+        }
+    }
+  else
+    {
+      fputs (json->str, stdout);
+    }
+
+  g_string_free (json, TRUE);
+  g_ptr_array_unref (bench.vgnames);
+  g_ptr_array_unref (bench.devices);
+  g_ptr_array_unref (bench.files);
+  g_hash_table_unref (bench.expected);
+  g_free (opt_output);
+  return 0;
+}
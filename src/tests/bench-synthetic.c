@@ -0,0 +1,529 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Runs the daemon on top of synthetic-lvm-helper, which makes up as
+ * many volume groups and logical volumes as asked for, and then makes
+ * the daemon read them again and again while they change.  Records the
+ * time, the CPU time and the memory that the daemon needs for this, and
+ * how many signals it emits.  The results are written as JSON, times
+ * in microseconds and memory in KiB.
+ *
+ * Like the tests, this only runs when $TEST_TARGET is set.
+ */
+
+#include "config.h"
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static gint opt_vgs = 4;
+static gint opt_lvs = 25000;
+static gint opt_pvs = 2;
+static gint opt_churn = 10;
+static gint opt_resize = 10;
+static gint opt_latency = 0;
+static gint opt_lock_wait = 0;
+static gint opt_lock_rate = 0;
+static gint opt_updates = 20;
+static gint opt_timeout = 600;
+static gchar *opt_output = NULL;
+
+static const GOptionEntry option_entries[] = {
+  { "vgs", 0, 0, G_OPTION_ARG_INT, &opt_vgs,
+    "Number of volume groups (default 4)", "N" },
+  { "lvs", 0, 0, G_OPTION_ARG_INT, &opt_lvs,
+    "Logical volumes per volume group (default 25000)", "N" },
+  { "pvs", 0, 0, G_OPTION_ARG_INT, &opt_pvs,
+    "Physical volumes per volume group (default 2)", "N" },
+  { "churn", 0, 0, G_OPTION_ARG_INT, &opt_churn,
+    "Logical volumes replaced per volume group and update (default 10)", "N" },
+  { "resize", 0, 0, G_OPTION_ARG_INT, &opt_resize,
+    "Logical volumes resized per volume group and update (default 10)", "N" },
+  { "latency", 0, 0, G_OPTION_ARG_INT, &opt_latency,
+    "Time every helper invocation takes (default 0)", "MSEC" },
+  { "lock-wait", 0, 0, G_OPTION_ARG_INT, &opt_lock_wait,
+    "Time spent waiting for a volume group lock (default 0)", "MSEC" },
+  { "lock-rate", 0, 0, G_OPTION_ARG_INT, &opt_lock_rate,
+    "Percentage of reads that find the volume group locked (default 0)", "PCT" },
+  { "updates", 0, 0, G_OPTION_ARG_INT, &opt_updates,
+    "Number of times to read all volume groups again (default 20)", "N" },
+  { "timeout", 0, 0, G_OPTION_ARG_INT, &opt_timeout,
+    "Seconds to wait for the daemon to settle (default 600)", "SECS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  GDBusConnection *bus;
+  gpointer daemon;
+  gchar *pid;
+  gchar *dir;
+
+  /* Object paths of logical volumes, and signals by member name */
+  GHashTable *logical_volumes;
+  GHashTable *signals;
+} Bench;
+
+typedef struct {
+  gint64 time;
+  guint64 cpu;
+  guint64 rss;
+  guint64 hwm;
+  guint64 shows;
+} Sample;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+track_interfaces_added (Bench *bench,
+                        const gchar *path,
+                        GVariant *interfaces)
+{
+  GVariant *props;
+
+  props = g_variant_lookup_value (interfaces, "com.redhat.lvm2.LogicalVolume", NULL);
+  if (props)
+    {
+      g_hash_table_add (bench->logical_volumes, g_strdup (path));
+      g_variant_unref (props);
+    }
+}
+
+static void
+on_signal (GDBusConnection *connection,
+           const gchar *sender_name,
+           const gchar *object_path,
+           const gchar *interface_name,
+           const gchar *signal_name,
+           GVariant *parameters,
+           gpointer user_data)
+{
+  Bench *bench = user_data;
+  GVariant *interfaces;
+  const gchar **names;
+  const gchar *path;
+  guint count;
+  guint i;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (bench->signals, signal_name));
+  g_hash_table_insert (bench->signals, g_strdup (signal_name), GUINT_TO_POINTER (count + 1));
+
+  if (g_str_equal (signal_name, "InterfacesAdded")
+      && g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oa{sa{sv}})")))
+    {
+      g_variant_get (parameters, "(&o@a{sa{sv}})", &path, &interfaces);
+      track_interfaces_added (bench, path, interfaces);
+      g_variant_unref (interfaces);
+    }
+  else if (g_str_equal (signal_name, "InterfacesRemoved")
+           && g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oas)")))
+    {
+      g_variant_get (parameters, "(&o^a&s)", &path, &names);
+      for (i = 0; names[i] != NULL; i++)
+        {
+          if (g_str_equal (names[i], "com.redhat.lvm2.LogicalVolume"))
+            g_hash_table_remove (bench->logical_volumes, path);
+        }
+      g_free (names);
+    }
+}
+
+/*
+ * The object manager client would make a proxy for every one of the
+ * many objects, which would cost us more than it costs the daemon.  So
+ * just keep track of the paths.
+ */
+static void
+fetch_logical_volumes (Bench *bench)
+{
+  GVariant *retval;
+  GVariant *interfaces;
+  GVariantIter *iter;
+  const gchar *path;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "com.redhat.storaged", "/org/freedesktop/UDisks2",
+                                        "org.freedesktop.DBus.ObjectManager", "GetManagedObjects",
+                                        NULL, G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                                        G_DBUS_CALL_FLAGS_NO_AUTO_START, G_MAXINT, NULL, &error);
+  g_assert_no_error (error);
+
+  g_variant_get (retval, "(a{oa{sa{sv}}})", &iter);
+  while (g_variant_iter_next (iter, "{&o@a{sa{sv}}}", &path, &interfaces))
+    {
+      track_interfaces_added (bench, path, interfaces);
+      g_variant_unref (interfaces);
+    }
+
+  g_variant_iter_free (iter);
+  g_variant_unref (retval);
+}
+
+static guint
+count_signals (Bench *bench)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint total = 0;
+
+  g_hash_table_iter_init (&iter, bench->signals);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    total += GPOINTER_TO_UINT (value);
+  return total;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static guint64
+fetch_shows (Bench *bench)
+{
+  GVariant *retval;
+  GVariant *histograms;
+  guint64 count = 0;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "com.redhat.storaged",
+                                        "/org/freedesktop/UDisks2/Manager",
+                                        "com.redhat.lvm2.Stats", "GetHistograms",
+                                        NULL, G_VARIANT_TYPE ("(a{s(tttat)})"),
+                                        G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                        -1, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Recorded when a helper has been reaped, right before its output is used */
+  histograms = g_variant_get_child_value (retval, 0);
+  g_variant_lookup (histograms, "helper.show", "(tttat)", &count, NULL, NULL, NULL);
+
+  g_variant_unref (histograms);
+  g_variant_unref (retval);
+  return count;
+}
+
+static gchar *
+fetch_daemon_pid (Bench *bench)
+{
+  GVariant *retval;
+  guint32 pid;
+  GError *error = NULL;
+
+  retval = g_dbus_connection_call_sync (bench->bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                        "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+                                        g_variant_new ("(s)", "com.redhat.storaged"),
+                                        G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE,
+                                        -1, NULL, &error);
+  g_assert_no_error (error);
+
+  g_variant_get (retval, "(u)", &pid);
+  g_variant_unref (retval);
+  return g_strdup_printf ("%u", pid);
+}
+
+static guint64
+parse_status_kib (const gchar *status,
+                  const gchar *field)
+{
+  const gchar *line;
+
+  line = strstr (status, field);
+  if (line == NULL)
+    return 0;
+  return g_ascii_strtoull (line + strlen (field), NULL, 10);
+}
+
+/* The daemon runs on the target, so ask there */
+static void
+take_sample (Bench *bench,
+             Sample *sample)
+{
+  gchar *path;
+  gchar *output;
+  gchar **fields;
+  gchar *end;
+
+  sample->time = g_get_monotonic_time ();
+  sample->shows = fetch_shows (bench);
+
+  path = g_strdup_printf ("/proc/%s/stat", bench->pid);
+  testing_target_execute (&output, "cat", path, NULL);
+  g_free (path);
+
+  /* utime and stime are the 14th and 15th field, counting after the command name */
+  end = strrchr (output, ')');
+  g_assert (end != NULL);
+  fields = g_strsplit (end + 2, " ", -1);
+  g_assert (g_strv_length (fields) > 12);
+  sample->cpu = (g_ascii_strtoull (fields[11], NULL, 10) + g_ascii_strtoull (fields[12], NULL, 10))
+                * G_USEC_PER_SEC / sysconf (_SC_CLK_TCK);
+  g_strfreev (fields);
+  g_free (output);
+
+  path = g_strdup_printf ("/proc/%s/status", bench->pid);
+  testing_target_execute (&output, "cat", path, NULL);
+  g_free (path);
+
+  sample->rss = parse_status_kib (output, "VmRSS:");
+  sample->hwm = parse_status_kib (output, "VmHWM:");
+  g_free (output);
+}
+
+/*
+ * Waits until the daemon has read the wanted number of volume groups
+ * in total, and the logical volumes are on the bus.
+ */
+static void
+wait_for_settled (Bench *bench,
+                  guint64 shows)
+{
+  gint64 deadline;
+  gboolean done;
+  guint want;
+
+  want = opt_vgs * opt_lvs;
+  deadline = g_get_monotonic_time () + opt_timeout * G_USEC_PER_SEC;
+
+  for (;;)
+    {
+      /* Signals sent before the reply to this are queued by then */
+      done = fetch_shows (bench) >= shows;
+      while (g_main_context_iteration (NULL, FALSE));
+      if (done && g_hash_table_size (bench->logical_volumes) == want)
+        break;
+
+      if (g_get_monotonic_time () > deadline)
+        g_error ("Timed out waiting for %u logical volumes, %u are there",
+                 want, g_hash_table_size (bench->logical_volumes));
+      g_usleep (20 * G_TIME_SPAN_MILLISECOND);
+    }
+}
+
+static void
+append_sample_delta (GString *json,
+                     const Sample *before,
+                     const Sample *after,
+                     guint signals)
+{
+  g_string_append_printf (json, "{ \"time\": %" G_GINT64_FORMAT ", \"cpu\": %" G_GUINT64_FORMAT
+                          ", \"rss\": %" G_GUINT64_FORMAT ", \"rss-peak\": %" G_GUINT64_FORMAT
+                          ", \"helper-shows\": %" G_GUINT64_FORMAT ", \"signals\": %u }",
+                          after->time - before->time, after->cpu - before->cpu,
+                          after->rss, after->hwm, after->shows - before->shows, signals);
+}
+
+static void
+append_signals (GString *json,
+                Bench *bench)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_string_append (json, "{ ");
+  g_hash_table_iter_init (&iter, bench->signals);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_string_append_printf (json, "\"%s\": %u, ", (gchar *)key, GPOINTER_TO_UINT (value));
+  g_string_append_printf (json, "\"total\": %u }", count_signals (bench));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+bench_coldplug (Bench *bench,
+                GString *json)
+{
+  gchar *config;
+  gchar *resource_dir;
+  Sample start = { 0, };
+  Sample settled;
+
+  config = g_strdup_printf ("STORAGED_SYNTHETIC_LVM=vgs=%d,lvs=%d,pvs=%d,churn=%d,resize=%d,"
+                            "latency=%d,lock-wait=%d,lock-rate=%d,state=%s",
+                            opt_vgs, opt_lvs, opt_pvs, opt_churn, opt_resize,
+                            opt_latency, opt_lock_wait, opt_lock_rate, bench->dir);
+  resource_dir = g_strdup_printf ("--resource-dir=%s", bench->dir);
+
+  g_dbus_connection_signal_subscribe (bench->bus, "com.redhat.storaged",
+                                      NULL, NULL, NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                      on_signal, bench, NULL);
+
+  start.time = g_get_monotonic_time ();
+  bench->daemon = testing_target_launch ("*Acquired*on the system message bus*",
+                                         "env", config, BUILDDIR "/src/storaged",
+                                         resource_dir, "--replace", "--debug",
+                                         NULL);
+
+  bench->pid = fetch_daemon_pid (bench);
+  fetch_logical_volumes (bench);
+
+  wait_for_settled (bench, opt_vgs);
+  take_sample (bench, &settled);
+
+  g_string_append (json, "  \"coldplug\": ");
+  append_sample_delta (json, &start, &settled, count_signals (bench));
+  g_string_append (json, ",\n");
+
+  g_free (resource_dir);
+  g_free (config);
+}
+
+static void
+bench_updates (Bench *bench,
+               GString *json)
+{
+  GArray *times;
+  GArray *cpus;
+  Sample first;
+  Sample before;
+  Sample after;
+  guint signals;
+  gint i;
+
+  times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  cpus = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  g_hash_table_remove_all (bench->signals);
+  take_sample (bench, &first);
+  before = first;
+
+  for (i = 0; i < opt_updates; i++)
+    {
+      before.time = g_get_monotonic_time ();
+      testing_target_execute (NULL, "kill", "-USR1", bench->pid, NULL);
+      wait_for_settled (bench, before.shows + opt_vgs);
+      take_sample (bench, &after);
+
+      after.time -= before.time;
+      after.cpu -= before.cpu;
+      g_array_append_val (times, after.time);
+      g_array_append_val (cpus, after.cpu);
+
+      take_sample (bench, &before);
+    }
+
+  signals = count_signals (bench);
+
+  g_string_append (json, "  \"updates\": { \"total\": ");
+  append_sample_delta (json, &first, &before, signals);
+  g_string_append (json, ", \"time\": ");
+  testing_append_samples (json, times);
+  g_string_append (json, ", \"cpu\": ");
+  testing_append_samples (json, cpus);
+  g_string_append (json, ", \"signals\": ");
+  append_signals (json, bench);
+  g_string_append (json, " }\n");
+
+  g_array_free (times, TRUE);
+  g_array_free (cpus, TRUE);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GString *json;
+  gchar *helper;
+  Bench bench = { NULL, };
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  context = g_option_context_new ("- measure storaged with many synthetic logical volumes");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (opt_vgs < 1 || opt_lvs < 0 || opt_pvs < 1 || opt_churn < 0 || opt_resize < 0
+      || opt_latency < 0 || opt_lock_wait < 0 || opt_lock_rate < 0 || opt_updates < 0 || opt_timeout < 1)
+    {
+      g_printerr ("%s: invalid settings\n", g_get_prgname ());
+      return 2;
+    }
+
+  /* Same exit code as a skipped automake test */
+  if (!testing_target_init ())
+    return 77;
+
+  bench.bus = testing_target_connect ();
+  bench.logical_volumes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  bench.signals = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* The helper is found as storaged-lvm-helper in the resource directory */
+  testing_target_execute (&bench.dir, "mktemp", "-d", "/tmp/storaged-synthetic.XXXXXX", NULL);
+  g_strstrip (bench.dir);
+  helper = g_build_filename (bench.dir, "storaged-lvm-helper", NULL);
+  testing_target_execute (NULL, "ln", "-s", BUILDDIR "/src/tests/synthetic-lvm-helper", helper, NULL);
+  g_free (helper);
+
+  /* Neither start from nor leave behind a snapshot of other volume groups */
+  testing_target_execute (NULL, "rm", "-f", "/run/storaged/snapshot", NULL);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"settings\": { \"volume-groups\": %d, \"logical-volumes\": %d, "
+                          "\"physical-volumes\": %d, \"churn\": %d, \"resize\": %d, \"latency\": %d, "
+                          "\"lock-wait\": %d, \"lock-rate\": %d, \"updates\": %d },\n",
+                          opt_vgs, opt_lvs, opt_pvs, opt_churn, opt_resize,
+                          opt_latency, opt_lock_wait, opt_lock_rate, opt_updates);
+
+  bench_coldplug (&bench, json);
+  bench_updates (&bench, json);
+
+  g_string_append (json, "}\n");
+
+  g_clear_object (&bench.bus);
+  testing_target_wait (bench.daemon);
+
+  testing_target_execute (NULL, "rm", "-rf", bench.dir, "/run/storaged/snapshot", NULL);
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        {
+          g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+          g_error_free (error);
+          return 1;
+        }
+    }
+  else
+    {
+      fputs (json->str, stdout);
+    }
+
+  g_string_free (json, TRUE);
+  g_hash_table_unref (bench.logical_volumes);
+  g_hash_table_unref (bench.signals);
+  g_free (bench.pid);
+  g_free (bench.dir);
+  g_free (opt_output);
+  return 0;
+}
@@ -0,0 +1,411 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* A stand-in for storaged-lvm-helper that makes up its volume groups.
+
+   Loop devices don't get us anywhere near the number of logical
+   volumes that some machines have, so this program reports as many as
+   we like, without LVM being involved at all.  Run storaged with a
+   --resource-dir that has this program as "storaged-lvm-helper".
+
+   It is configured with $STORAGED_SYNTHETIC_LVM, a comma separated list
+   of key=value pairs:
+
+     vgs=N          Number of volume groups, called synth0, synth1, ...
+     lvs=N          Logical volumes per volume group.
+     pvs=N          Physical volumes per volume group.
+     churn=N        Logical volumes that are replaced by new ones
+                    every time a volume group is shown.
+     resize=N       Logical volumes that change their size every time
+                    a volume group is shown.
+     latency=MSEC   Time every invocation takes.
+     lock-wait=MSEC Time spent waiting for a volume group lock...
+     lock-rate=PCT  ...in this percentage of "show" invocations.  With
+                    -f the helper doesn't wait, but reports the volume
+                    group as locked instead.
+     state=DIR      Where to count how often each volume group has
+                    been shown.  Without it, there is no churn.
+
+   The output has the same format as that of the real helper.
+*/
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#define EXTENT_SIZE (G_GUINT64_CONSTANT (4) * 1024 * 1024)
+
+static gboolean opt_binary = FALSE;
+static gboolean opt_no_lock = FALSE;
+
+static guint conf_vgs = 1;
+static guint conf_lvs = 100;
+static guint conf_pvs = 1;
+static guint conf_churn = 0;
+static guint conf_resize = 0;
+static guint conf_latency = 0;
+static guint conf_lock_wait = 0;
+static guint conf_lock_rate = 0;
+static const gchar *conf_state = NULL;
+
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: storaged-lvm-helper [-b] [-f] list\n");
+  fprintf (stderr, "       storaged-lvm-helper [-b] [-f] show VG\n");
+  exit (1);
+}
+
+static void
+parse_config (void)
+{
+  const gchar *env;
+  gchar **pairs;
+  gchar *value;
+  guint num;
+  gint i;
+
+  env = g_getenv ("STORAGED_SYNTHETIC_LVM");
+  if (env == NULL)
+    return;
+
+  pairs = g_strsplit (env, ",", -1);
+  for (i = 0; pairs[i] != NULL; i++)
+    {
+      value = strchr (pairs[i], '=');
+      if (value == NULL)
+        continue;
+      *(value++) = '\0';
+
+      if (g_str_equal (pairs[i], "state"))
+        {
+          conf_state = g_strdup (value);
+          continue;
+        }
+
+      num = strtoul (value, NULL, 10);
+      if (g_str_equal (pairs[i], "vgs"))
+        conf_vgs = num;
+      else if (g_str_equal (pairs[i], "lvs"))
+        conf_lvs = num;
+      else if (g_str_equal (pairs[i], "pvs"))
+        conf_pvs = MAX (num, 1);
+      else if (g_str_equal (pairs[i], "churn"))
+        conf_churn = num;
+      else if (g_str_equal (pairs[i], "resize"))
+        conf_resize = num;
+      else if (g_str_equal (pairs[i], "latency"))
+        conf_latency = num;
+      else if (g_str_equal (pairs[i], "lock-wait"))
+        conf_lock_wait = num;
+      else if (g_str_equal (pairs[i], "lock-rate"))
+        conf_lock_rate = num;
+      else
+        fprintf (stderr, "storaged-lvm-helper: unknown setting %s\n", pairs[i]);
+    }
+
+  g_strfreev (pairs);
+}
+
+static gboolean
+parse_volume_group (const gchar *name,
+                    guint *index)
+{
+  gchar *end;
+
+  if (!g_str_has_prefix (name, "synth"))
+    return FALSE;
+
+  *index = strtoul (name + 5, &end, 10);
+  return end != name + 5 && *end == '\0' && *index < conf_vgs;
+}
+
+/*
+ * Returns how often the volume group has been shown before, and counts
+ * this time.  Each showing is a new generation of the volume group.
+ */
+static guint64
+next_generation (const gchar *name)
+{
+  gchar *path;
+  gchar buf[32];
+  guint64 generation = 0;
+  gssize len;
+  gint fd;
+
+  if (conf_state == NULL)
+    return 0;
+
+  path = g_build_filename (conf_state, name, NULL);
+  fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      fprintf (stderr, "Couldn't open %s: %m\n", path);
+      exit (1);
+    }
+
+  /* Polls and updates of the same volume group can overlap */
+  flock (fd, LOCK_EX);
+
+  len = pread (fd, buf, sizeof (buf) - 1, 0);
+  if (len > 0)
+    {
+      buf[len] = '\0';
+      generation = g_ascii_strtoull (buf, NULL, 10);
+    }
+
+  len = g_snprintf (buf, sizeof (buf), "%" G_GUINT64_FORMAT "\n", generation + 1);
+  if (pwrite (fd, buf, len, 0) != len)
+    {
+      fprintf (stderr, "Couldn't write %s: %m\n", path);
+      exit (1);
+    }
+
+  close (fd);
+  g_free (path);
+  return generation;
+}
+
+static void
+add_string (GVariantBuilder *bob,
+            const gchar *key,
+            const gchar *val)
+{
+  g_variant_builder_add (bob, "{sv}", key, g_variant_new_string (val));
+}
+
+static void
+add_uint64 (GVariantBuilder *bob,
+            const gchar *key,
+            guint64 val)
+{
+  g_variant_builder_add (bob, "{sv}", key, g_variant_new_uint64 (val));
+}
+
+static GVariant *
+list_volume_groups (void)
+{
+  GVariantBuilder result;
+  gchar *name;
+  guint i;
+
+  g_variant_builder_init (&result, G_VARIANT_TYPE ("as"));
+  for (i = 0; i < conf_vgs; i++)
+    {
+      name = g_strdup_printf ("synth%u", i);
+      g_variant_builder_add (&result, "s", name);
+      g_free (name);
+    }
+
+  return g_variant_builder_end (&result);
+}
+
+static GVariant *
+show_logical_volume (guint vg,
+                     const gchar *vgname,
+                     guint64 lv,
+                     guint64 generation)
+{
+  GVariantBuilder result;
+  gchar *name;
+  gchar *uuid;
+  gchar *path;
+  guint64 extents = 1;
+
+  /* The first few of the current logical volumes grow and shrink */
+  if (lv - generation * conf_churn < conf_resize)
+    extents += (lv + generation) % 4;
+
+  name = g_strdup_printf ("lv%06" G_GUINT64_FORMAT, lv);
+  uuid = g_strdup_printf ("synth-%04u-%012" G_GUINT64_FORMAT, vg, lv);
+  path = g_strdup_printf ("/dev/%s/%s", vgname, name);
+
+  g_variant_builder_init (&result, G_VARIANT_TYPE ("a{sv}"));
+  add_string (&result, "name", name);
+  add_string (&result, "uuid", uuid);
+  add_uint64 (&result, "size", extents * EXTENT_SIZE);
+  add_string (&result, "lv_attr", "-wi-------");
+  add_string (&result, "lv_path", path);
+
+  g_free (name);
+  g_free (uuid);
+  g_free (path);
+  return g_variant_builder_end (&result);
+}
+
+static GVariant *
+show_physical_volume (guint vg,
+                      guint pv,
+                      guint64 size,
+                      guint64 free_size)
+{
+  GVariantBuilder result;
+  gchar *device;
+  gchar *uuid;
+
+  device = g_strdup_printf ("/dev/synthetic/vg%u-pv%u", vg, pv);
+  uuid = g_strdup_printf ("synth-pv-%04u-%04u", vg, pv);
+
+  g_variant_builder_init (&result, G_VARIANT_TYPE ("a{sv}"));
+  add_string (&result, "device", device);
+  add_string (&result, "uuid", uuid);
+  add_uint64 (&result, "size", size);
+  add_uint64 (&result, "free-size", free_size);
+
+  g_free (device);
+  g_free (uuid);
+  return g_variant_builder_end (&result);
+}
+
+static GVariant *
+show_volume_group (const char *name)
+{
+  GVariantBuilder result;
+  GVariantBuilder lvs;
+  GVariantBuilder pvs;
+  gboolean locked = FALSE;
+  guint64 generation;
+  guint64 first;
+  guint64 size;
+  guint64 pv_size;
+  guint64 lv;
+  gchar *uuid;
+  guint vg;
+  guint i;
+
+  if (!parse_volume_group (name, &vg))
+    exit (2);
+
+  if (conf_lock_rate > 0 && (guint)g_random_int_range (0, 100) < conf_lock_rate)
+    {
+      if (opt_no_lock)
+        locked = TRUE;
+      else
+        g_usleep (conf_lock_wait * G_TIME_SPAN_MILLISECOND);
+    }
+
+  generation = next_generation (name);
+  first = generation * conf_churn;
+
+  /* Room for every logical volume at its largest, and then some */
+  pv_size = ((guint64)conf_lvs * 4 / conf_pvs + 16) * EXTENT_SIZE;
+  size = pv_size * conf_pvs;
+  uuid = g_strdup_printf ("synth-vg-%04u", vg);
+
+  g_variant_builder_init (&result, G_VARIANT_TYPE ("a{sv}"));
+  add_string (&result, "name", name);
+  add_string (&result, "uuid", uuid);
+  add_uint64 (&result, "size", size);
+  add_uint64 (&result, "free-size", size / 2);
+  add_uint64 (&result, "extent-size", EXTENT_SIZE);
+  add_uint64 (&result, "seqno", generation + 1);
+
+  g_variant_builder_init (&lvs, G_VARIANT_TYPE ("aa{sv}"));
+  for (lv = first; lv < first + conf_lvs; lv++)
+    g_variant_builder_add (&lvs, "@a{sv}", show_logical_volume (vg, name, lv, generation));
+  g_variant_builder_add (&result, "{sv}", "lvs", g_variant_builder_end (&lvs));
+
+  g_variant_builder_init (&pvs, G_VARIANT_TYPE ("aa{sv}"));
+  for (i = 0; i < conf_pvs; i++)
+    g_variant_builder_add (&pvs, "@a{sv}", show_physical_volume (vg, i, pv_size, pv_size / 2));
+  g_variant_builder_add (&result, "{sv}", "pvs", g_variant_builder_end (&pvs));
+
+  if (opt_no_lock)
+    g_variant_builder_add (&result, "{sv}", "locked", g_variant_new_boolean (locked));
+
+  g_free (uuid);
+  return g_variant_builder_end (&result);
+}
+
+static void
+write_all (int fd,
+           const char *mem,
+           size_t size)
+{
+  while (size > 0)
+    {
+      int r = write (fd, mem, size);
+      if (r < 0)
+        {
+          fprintf (stderr, "Write error: %m\n");
+          exit (1);
+        }
+      size -= r;
+      mem += r;
+    }
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GVariant *result;
+
+  while (argv[1] && argv[1][0] == '-')
+    {
+      if (strcmp (argv[1], "-b") == 0)
+        opt_binary = TRUE;
+      else if (strcmp (argv[1], "-f") == 0)
+        opt_no_lock = TRUE;
+      else
+        usage ();
+      argv++;
+    }
+
+  parse_config ();
+
+  if (conf_latency > 0)
+    g_usleep (conf_latency * G_TIME_SPAN_MILLISECOND);
+
+  if (argv[1] && strcmp (argv[1], "list") == 0)
+    result = list_volume_groups ();
+  else if (argv[1] && strcmp (argv[1], "show") == 0)
+    {
+      if (argv[2])
+        result = show_volume_group (argv[2]);
+      else
+        usage ();
+    }
+  else
+    usage ();
+
+  if (opt_binary)
+    {
+      GVariant *normal = g_variant_get_normal_form (result);
+      gsize size = g_variant_get_size (normal);
+      gconstpointer data = g_variant_get_data (normal);
+      write_all (1, data, size);
+    }
+  else
+    {
+      gchar *text = g_variant_print (result, FALSE);
+      printf ("%s\n", text);
+      g_free (text);
+    }
+
+  exit (0);
+}
@@ -27,6 +27,7 @@ typedef struct {
   GDBusConnection *bus;
   gpointer daemon;
   GDBusObjectManager *objman;
+  gchar *device;
 } Test;
 
 static void
@@ -43,6 +44,100 @@ teardown_target (Test *test,
   testing_target_teardown (&test->bus, &test->objman, &test->daemon);
 }
 
+static gchar *
+find_free_loop_device (void)
+{
+  gchar *device;
+  gint i;
+
+  for (i = 0; i < 512; i++)
+    {
+      device = g_strdup_printf ("/dev/loop%d", i);
+      if (!g_file_test (device, G_FILE_TEST_EXISTS))
+        return device;
+      g_free (device);
+    }
+
+  return NULL;
+}
+
+/* A block device that has nothing to do with LVM, there before the daemon starts */
+static void
+setup_plain_device (Test *test,
+                    gconstpointer data)
+{
+  test->device = find_free_loop_device ();
+  g_assert (test->device != NULL);
+
+  testing_target_execute (NULL, "dd", "if=/dev/zero", "of=test-udisk-lvm-plain", "bs=10M", "count=1", "status=none", NULL);
+  testing_target_execute (NULL, "losetup", test->device, "test-udisk-lvm-plain", NULL);
+  testing_target_execute (NULL, "udevadm", "settle", NULL);
+
+  testing_target_setup (&test->bus, &test->objman, &test->daemon);
+}
+
+static void
+teardown_plain_device (Test *test,
+                       gconstpointer data)
+{
+  testing_target_teardown (&test->bus, &test->objman, &test->daemon);
+
+  testing_target_execute (NULL, "losetup", "-d", test->device, NULL);
+  testing_target_execute (NULL, "rm", "-f", "test-udisk-lvm-plain", NULL);
+  g_free (test->device);
+}
+
+static gboolean
+startup_phase_finished (Test *test,
+                        const gchar *phase)
+{
+  GVariant *retval;
+  GVariant *phases;
+  GError *error = NULL;
+  guint64 value;
+  gboolean ret;
+
+  retval = g_dbus_connection_call_sync (test->bus, "com.redhat.storaged",
+                                        "/org/freedesktop/UDisks2/Manager",
+                                        "org.freedesktop.DBus.Properties", "Get",
+                                        g_variant_new ("(ss)", "com.redhat.lvm2.Manager", "StartupPhases"),
+                                        G_VARIANT_TYPE ("(v)"), G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                        -1, NULL, &error);
+
+  /* Not there yet, or not anymore */
+  if (retval == NULL)
+    {
+      g_error_free (error);
+      return FALSE;
+    }
+
+  g_variant_get (retval, "(v)", &phases);
+  ret = g_variant_lookup (phases, phase, "t", &value);
+  g_variant_unref (phases);
+  g_variant_unref (retval);
+  return ret;
+}
+
+static void
+test_enumerate_plain (Test *test,
+                      gconstpointer data)
+{
+  gboolean finished = FALSE;
+  gint i;
+
+  /* The udev enumeration looks at every block device, including ours */
+  for (i = 0; i < testing_timeout * 10 && !finished; i++)
+    {
+      finished = startup_phase_finished (test, "udev");
+      if (!finished)
+        g_usleep (100 * 1000);
+    }
+  g_assert (finished);
+
+  /* And the daemon is still there afterwards */
+  g_assert (startup_phase_finished (test, "udev"));
+}
+
 static void
 test_objects (Test *test,
               gconstpointer data)
@@ -115,7 +210,6 @@ test_add_remove (Test *test,
   gchar *device;
   gchar *name;
   gchar *vgname;
-  gint i;
 
   vgname = testing_target_vgname ();
 
@@ -123,15 +217,7 @@ test_add_remove (Test *test,
                     G_CALLBACK (on_block_path_copy), &block_path);
 
   /* Find one that isn't in use */
-  for (i = 0; i < 512; i++)
-    {
-      device = g_strdup_printf ("/dev/loop%d", i);
-      if (!g_file_test (device, G_FILE_TEST_EXISTS))
-        break;
-      g_free (device);
-      device = NULL;
-    }
-
+  device = find_free_loop_device ();
   if (device == NULL)
     {
       g_critical ("couldn't find free loop device while testing");
@@ -192,6 +278,8 @@ main (int argc,
                   setup_target, test_objects, teardown_target);
       g_test_add ("/storaged/lvm/block-add-remove", Test, NULL,
                   setup_target, test_add_remove, teardown_target);
+      g_test_add ("/storaged/lvm/block-enumerate-plain", Test, NULL,
+                  setup_plain_device, test_enumerate_plain, teardown_plain_device);
     }
 
   return g_test_run ();
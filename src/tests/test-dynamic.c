@@ -243,6 +243,79 @@ test_vgreduce (Test *test,
   testing_wait_until (block == NULL);
 }
 
+static void
+test_snapshot_restore (Test *test,
+                       gconstpointer data)
+{
+  GError *error = NULL;
+  GDBusProxy *volume_group;
+  GDBusProxy *manager;
+  GVariant *stale;
+  gchar *volume_group_path;
+  gchar *resource_dir = NULL;
+  gchar *arg;
+  gchar *cmd;
+
+  volume_group_path = g_strdup (g_dbus_proxy_get_object_path (test->volume_group));
+
+  /* The daemon writes the snapshot a little while after a change */
+  cmd = g_strdup_printf ("for i in $(seq %d); do "
+                         "grep -qa %s /run/storaged/snapshot && exit 0; sleep 0.1; "
+                         "done; exit 1", testing_timeout * 10, test->vgname);
+  testing_target_execute (NULL, "/bin/sh", "-c", cmd, NULL);
+  g_free (cmd);
+
+  g_clear_object (&test->volume_group);
+  g_clear_object (&test->objman);
+  g_assert_cmpint (testing_target_wait (test->daemon), ==, 0);
+  test->daemon = NULL;
+
+  /*
+   * Restart with a helper that takes far longer than the test waits,
+   * so that anything that shows up must have come from the snapshot.
+   */
+  testing_target_execute (&resource_dir, "mktemp", "-d", "/tmp/storaged-snapshot.XXXXXX", NULL);
+  g_strstrip (resource_dir);
+  cmd = g_strdup_printf ("printf '#!/bin/sh\\nsleep %d\\nexec %s \"$@\"\\n' > %s/storaged-lvm-helper && "
+                         "chmod +x %s/storaged-lvm-helper",
+                         testing_timeout * 2, BUILDDIR "/src/storaged-lvm-helper",
+                         resource_dir, resource_dir);
+  testing_target_execute (NULL, "/bin/sh", "-c", cmd, NULL);
+  g_free (cmd);
+
+  arg = g_strdup_printf ("--resource-dir=%s", resource_dir);
+  test->daemon = testing_target_launch ("*Acquired*on the system message bus*",
+                                        BUILDDIR "/src/storaged", arg,
+                                        "--replace", "--debug", NULL);
+  g_free (arg);
+
+  test->objman = g_dbus_object_manager_client_new_sync (test->bus,
+                                                        G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_DO_NOT_AUTO_START,
+                                                        "com.redhat.storaged",
+                                                        "/org/freedesktop/UDisks2",
+                                                        NULL, NULL, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Published before the daemon took its name */
+  volume_group = lookup_interface (test, volume_group_path, "com.redhat.lvm2.VolumeGroup");
+  g_assert (volume_group != NULL);
+  g_assert_cmpstr (testing_proxy_string (volume_group, "Name"), ==, test->vgname);
+  g_object_unref (volume_group);
+
+  /* ... and known to not have been confirmed by LVM yet */
+  manager = lookup_interface (test, "/org/freedesktop/UDisks2/Manager", "com.redhat.lvm2.Manager");
+  g_assert (manager != NULL);
+  stale = g_dbus_proxy_get_cached_property (manager, "Stale");
+  g_assert (stale != NULL);
+  g_assert (g_variant_get_boolean (stale));
+  g_variant_unref (stale);
+  g_object_unref (manager);
+
+  testing_target_execute (NULL, "rm", "-rf", resource_dir, "/run/storaged/snapshot", NULL);
+  g_free (volume_group_path);
+  g_free (resource_dir);
+}
+
 int
 main (int argc,
       char **argv)
@@ -261,6 +334,8 @@ main (int argc,
                   setup_vgcreate, test_lvcreate_change_remove, teardown_vgremove);
       g_test_add ("/storaged/lvm/vgreduce", Test, NULL,
                   setup_vgcreate, test_vgreduce, teardown_vgremove);
+      g_test_add ("/storaged/lvm/snapshot-restore", Test, NULL,
+                  setup_vgcreate, test_snapshot_restore, teardown_vgremove);
     }
 
   return g_test_run ();
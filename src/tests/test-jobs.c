@@ -22,11 +22,13 @@
 #include "config.h"
 
 #include "daemon.h"
+#include "process.h"
 #include "spawnedjob.h"
 #include "threadedjob.h"
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -157,7 +159,7 @@ test_spawned_job_successful (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { "/bin/true", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_success), NULL);
   g_object_unref (job);
 }
@@ -170,7 +172,7 @@ test_spawned_job_failure (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { "/bin/false", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) "/bin/false exited with non-zero exit status 1");
   g_object_unref (job);
@@ -184,7 +186,7 @@ test_spawned_job_missing_program (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { "/path/to/unknown/file", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) "Error spawning command-line `/path/to/unknown/file': Failed to execute child process \"/path/to/unknown/file\" (No such file or directory) (g-exec-error-quark, 8)");
   g_object_unref (job);
@@ -201,7 +203,7 @@ test_spawned_job_cancelled_at_start (void)
 
   cancellable = g_cancellable_new ();
   g_cancellable_cancel (cancellable);
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), cancellable);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, cancellable);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) "Operation was cancelled (g-io-error-quark, 19)");
   g_object_unref (job);
@@ -227,7 +229,7 @@ test_spawned_job_cancelled_midway (void)
   const gchar *argv[] = { "/bin/sleep 0.5", NULL };
 
   cancellable = g_cancellable_new ();
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), cancellable);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, cancellable);
   g_timeout_add (10, on_timeout, cancellable); /* 10 msec */
   g_main_loop_run (loop);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
@@ -260,7 +262,7 @@ test_spawned_job_override_signal_handler (void)
   gboolean handler_ran;
   const gchar *argv[] = { "/path/to/unknown/file", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL /* GCancellable */);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL /* GCancellable */);
   handler_ran = FALSE;
   g_signal_connect (job, "spawned-job-completed", G_CALLBACK (on_spawned_job_completed), &handler_ran);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
@@ -277,7 +279,7 @@ test_spawned_job_premature_termination (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { "/bin/sleep", "1000", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL /* GCancellable */);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL /* GCancellable */);
   g_object_unref (job);
 }
 
@@ -307,7 +309,7 @@ test_spawned_job_read_stdout (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { BUILDDIR "/src/tests/frob-helper", "0", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (read_stdout_on_spawned_job_completed), NULL);
   g_object_unref (job);
 }
@@ -338,7 +340,7 @@ test_spawned_job_read_stderr (void)
   StorageSpawnedJob *job;
   const gchar *argv[] = { BUILDDIR "/src/tests/frob-helper", "1", NULL };
 
-  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (read_stderr_on_spawned_job_completed), NULL);
   g_object_unref (job);
 }
@@ -368,12 +370,12 @@ test_spawned_job_exit_status (void)
   const gchar *argv2[] = { BUILDDIR "/src/tests/frob-helper", "2", NULL };
   const gchar *argv3[] = { BUILDDIR "/src/tests/frob-helper", "3", NULL };
 
-  job = storage_spawned_job_new (argv2, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv2, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (exit_status_on_spawned_job_completed),
                           GINT_TO_POINTER (1));
   g_object_unref (job);
 
-  job = storage_spawned_job_new (argv3, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv3, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (exit_status_on_spawned_job_completed),
                           GINT_TO_POINTER (2));
   g_object_unref (job);
@@ -388,13 +390,13 @@ test_spawned_job_abnormal_termination (void)
   const gchar *argv4[] = { BUILDDIR "/src/tests/frob-helper", "4", NULL };
   const gchar *argv5[] = { BUILDDIR "/src/tests/frob-helper", "5", NULL };
 
-  job = storage_spawned_job_new (argv4, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv4, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) BUILDDIR "/src/tests/frob-helper was signaled with signal SIGSEGV (11): "
                           "OK, deliberately causing a segfault\n");
   g_object_unref (job);
 
-  job = storage_spawned_job_new (argv5, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv5, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                              (gpointer) BUILDDIR "/src/tests/frob-helper was signaled with signal SIGABRT (6): "
                                  "OK, deliberately abort()'ing\n");
@@ -433,7 +435,7 @@ test_spawned_job_binary_output (void)
   StorageSpawnedJob *job;
   const gchar *argv6[] = { BUILDDIR "/src/tests/frob-helper", "6", NULL };
 
-  job = storage_spawned_job_new (argv6, NULL, getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv6, NULL, getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (binary_output_on_spawned_job_completed), NULL);
   g_object_unref (job);
 }
@@ -462,15 +464,178 @@ test_spawned_job_input_string (void)
   StorageSpawnedJob *job;
   const gchar *argv7[] = { BUILDDIR "/src/tests/frob-helper", "7", NULL };
 
-  job = storage_spawned_job_new (argv7, "foobar", getuid (), geteuid (), NULL);
+  job = storage_spawned_job_new (argv7, "foobar", getuid (), geteuid (), NULL, NULL);
   assert_signal_received (job, "spawned-job-completed", G_CALLBACK (input_string_on_spawned_job_completed), NULL);
   g_object_unref (job);
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_output_line (StorageSpawnedJob *job,
+                const gchar *stream,
+                const gchar *line,
+                gpointer user_data)
+{
+  GString *lines = user_data;
+  g_string_append_printf (lines, "%s: %s\n", stream, line);
+}
+
+static void
+test_spawned_job_output_lines (void)
+{
+  StorageSpawnedJob *job;
+  GString *lines;
+  const gchar *argv[] = { "sh", "-c", "echo one; echo two; printf three", NULL };
+
+  lines = g_string_new (NULL);
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
+  g_signal_connect (job, "output-line", G_CALLBACK (on_output_line), lines);
+  assert_signal_received (job, "spawned-job-completed", NULL, NULL);
+  g_assert_cmpstr (lines->str, ==,
+                   "stdout: one\n"
+                   "stdout: two\n"
+                   "stdout: three\n");
+  g_object_unref (job);
+  g_string_free (lines, TRUE);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+bounded_output_on_spawned_job_completed (StorageSpawnedJob *job,
+                                         GError *error,
+                                         gint status,
+                                         GString *standard_output,
+                                         GString *standard_error,
+                                         gpointer user_data)
+{
+  g_assert_no_error (error);
+  g_assert (WIFEXITED (status));
+  g_assert (WEXITSTATUS (status) == 0);
+
+  /* The first and the last 64 KiB, and a note about the rest */
+  g_assert_cmpint (standard_output->len, >, 2 * 64 * 1024);
+  g_assert_cmpint (standard_output->len, <, 2 * 64 * 1024 + 100);
+  g_assert (strstr (standard_output->str, "[... 868928 bytes omitted ...]") != NULL);
+  return FALSE;
+}
+
+static void
+test_spawned_job_bounded_output (void)
+{
+  StorageSpawnedJob *job;
+  const gchar *argv[] = { "sh", "-c", "head -c 1000000 /dev/zero | tr '\\0' x", NULL };
+
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), NULL, NULL);
+  assert_signal_received (job, "spawned-job-completed", G_CALLBACK (bounded_output_on_spawned_job_completed), NULL);
+  g_object_unref (job);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+kill_on_process_exit (StorageProcess *process,
+                      gint status,
+                      gpointer user_data)
+{
+  gint *exit_status = user_data;
+  *exit_status = status;
+  g_main_loop_quit (loop);
+}
+
+static void
+test_process_kill (void)
+{
+  StorageProcess *process;
+  GError *error = NULL;
+  gint status = 0;
+  const gchar *argv[] = { "sleep", "1000", NULL };
+
+  process = storage_process_spawn (argv, STORAGE_PROCESS_NONE, NULL, NULL, NULL,
+                                   NULL, kill_on_process_exit, &status, &error);
+  g_assert_no_error (error);
+
+  g_assert (storage_process_kill (process, SIGTERM));
+  g_main_loop_run (loop);
+  g_assert (WIFSIGNALED (status));
+  g_assert_cmpint (WTERMSIG (status), ==, SIGTERM);
+
+  /* Reaped, so there is nothing left to signal */
+  g_assert (storage_process_has_exited (process));
+  g_assert (!storage_process_kill (process, SIGTERM));
+  storage_process_release (process, NULL, NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+policy_on_spawned_job_completed (StorageSpawnedJob *job,
+                                 GError *error,
+                                 gint status,
+                                 GString *standard_output,
+                                 GString *standard_error,
+                                 gpointer user_data)
+{
+  g_assert_no_error (error);
+  g_assert_cmpstr (standard_error->str, ==, "");
+  g_assert (WIFEXITED (status));
+  g_assert (WEXITSTATUS (status) == 0);
+  g_assert_cmpstr (standard_output->str, ==, "19\n");
+  return FALSE;
+}
+
+static void
+test_spawned_job_policy (void)
+{
+  StorageSpawnedJob *job;
+  StorageJobPolicy policy = { 0, };
+  const gchar *argv[] = { "nice", NULL };
+
+  /* Anyone may lower their own priority that far */
+  policy.set_nice = TRUE;
+  policy.nice = 19;
+
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), &policy, NULL);
+  assert_signal_received (job, "spawned-job-completed", G_CALLBACK (policy_on_spawned_job_completed), NULL);
+  g_object_unref (job);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+timeout_on_spawned_job_completed (StorageSpawnedJob *job,
+                                  GError *error,
+                                  gint status,
+                                  GString *standard_output,
+                                  GString *standard_error,
+                                  gpointer user_data)
+{
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+  return FALSE;
+}
+
+static void
+test_spawned_job_timeout (void)
+{
+  StorageSpawnedJob *job;
+  StorageJobPolicy policy = { 0, };
+  const gchar *argv[] = { "sh", "-c", "trap '' TERM; sleep 1000", NULL };
+
+  /* Ignores SIGTERM, so only SIGKILL stops it */
+  policy.timeout = 1;
+  policy.stop_timeout = 1;
+
+  job = storage_spawned_job_new (argv, NULL, getuid (), geteuid (), &policy, NULL);
+  assert_signal_received (job, "spawned-job-completed", G_CALLBACK (timeout_on_spawned_job_completed), NULL);
+  g_object_unref (job);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static gboolean
-threaded_job_successful_func (GCancellable *cancellable,
+threaded_job_successful_func (StorageThreadedJob *job,
+                              GCancellable *cancellable,
                               gpointer user_data,
                               GError **error)
 {
@@ -483,7 +648,7 @@ test_threaded_job_successful (void)
 {
   StorageThreadedJob *job;
 
-  job = storage_threaded_job_new (threaded_job_successful_func, NULL, NULL, NULL);
+  job = storage_threaded_job_new (threaded_job_successful_func, NULL, NULL, NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_success), NULL);
   g_object_unref (job);
 }
@@ -491,7 +656,8 @@ test_threaded_job_successful (void)
 /* ---------------------------------------------------------------------------------------------------- */
 
 static gboolean
-threaded_job_failure_func (GCancellable *cancellable,
+threaded_job_failure_func (StorageThreadedJob *job,
+                           GCancellable *cancellable,
                            gpointer user_data,
                            GError **error)
 {
@@ -508,7 +674,7 @@ test_threaded_job_failure (void)
 {
   StorageThreadedJob *job;
 
-  job = storage_threaded_job_new (threaded_job_failure_func, NULL, NULL, NULL);
+  job = storage_threaded_job_new (threaded_job_failure_func, NULL, NULL, NULL, NULL);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) "Threaded job failed with error: some error (g-key-file-error-quark, 5)");
   g_object_unref (job);
@@ -524,7 +690,7 @@ test_threaded_job_cancelled_at_start (void)
 
   cancellable = g_cancellable_new ();
   g_cancellable_cancel (cancellable);
-  job = storage_threaded_job_new (threaded_job_successful_func, NULL, NULL, cancellable);
+  job = storage_threaded_job_new (threaded_job_successful_func, NULL, NULL, NULL, cancellable);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
                           (gpointer) "Threaded job failed with error: Operation was cancelled (g-io-error-quark, 19)");
   g_object_unref (job);
@@ -534,7 +700,8 @@ test_threaded_job_cancelled_at_start (void)
 /* ---------------------------------------------------------------------------------------------------- */
 
 static gboolean
-threaded_job_sleep_until_cancelled (GCancellable *cancellable,
+threaded_job_sleep_until_cancelled (StorageThreadedJob *job,
+                                    GCancellable *cancellable,
                                     gpointer user_data,
                                     GError **error)
 {
@@ -562,7 +729,7 @@ test_threaded_job_cancelled_midway (void)
 
   cancellable = g_cancellable_new ();
   count = 0;
-  job = storage_threaded_job_new (threaded_job_sleep_until_cancelled, &count, NULL, cancellable);
+  job = storage_threaded_job_new (threaded_job_sleep_until_cancelled, &count, NULL, NULL, cancellable);
   g_timeout_add (10, on_timeout, cancellable); /* 10 msec */
   g_main_loop_run (loop);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
@@ -595,7 +762,7 @@ test_threaded_job_override_signal_handler (void)
   StorageThreadedJob *job;
   gboolean handler_ran;
 
-  job = storage_threaded_job_new (threaded_job_failure_func, NULL, NULL, NULL);
+  job = storage_threaded_job_new (threaded_job_failure_func, NULL, NULL, NULL, NULL);
   handler_ran = FALSE;
   g_signal_connect (job, "threaded-job-completed", G_CALLBACK (on_threaded_job_completed), &handler_ran);
   assert_signal_received (job, "completed", G_CALLBACK (on_completed_expect_failure),
@@ -634,6 +801,11 @@ main (int    argc,
   g_test_add_func ("/storaged/spawned-job/abnormal-termination", test_spawned_job_abnormal_termination);
   g_test_add_func ("/storaged/spawned-job/binary-output", test_spawned_job_binary_output);
   g_test_add_func ("/storaged/spawned-job/input-string", test_spawned_job_input_string);
+  g_test_add_func ("/storaged/spawned-job/policy", test_spawned_job_policy);
+  g_test_add_func ("/storaged/spawned-job/timeout", test_spawned_job_timeout);
+  g_test_add_func ("/storaged/spawned-job/output-lines", test_spawned_job_output_lines);
+  g_test_add_func ("/storaged/spawned-job/bounded-output", test_spawned_job_bounded_output);
+  g_test_add_func ("/storaged/process/kill", test_process_kill);
   g_test_add_func ("/storaged/threaded-job/successful", test_threaded_job_successful);
   g_test_add_func ("/storaged/threaded-job/failure", test_threaded_job_failure);
   g_test_add_func ("/storaged/threaded-job/cancelled-at-start", test_threaded_job_cancelled_at_start);
@@ -95,12 +95,31 @@ lookup_interface (Test *test,
   return proxy;
 }
 
+/*
+ * Makes BLKDISCARD fail with EOPNOTSUPP on the loop devices, and on
+ * anything stacked on them later, so that discarding falls back to
+ * zeroing.
+ */
 static void
-setup_vgcreate (Test *test,
-                gconstpointer data)
+disable_discard (Test *test)
 {
-  setup_target (test, data);
+  gchar *base;
+  gchar *cmd;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (test->blocks); i++)
+    {
+      base = g_path_get_basename (test->blocks[i].device);
+      cmd = g_strdup_printf ("echo 0 > /sys/block/%s/queue/discard_max_bytes", base);
+      testing_target_execute (NULL, "/bin/sh", "-c", cmd, NULL);
+      g_free (base);
+      g_free (cmd);
+    }
+}
 
+static void
+create_volume_group (Test *test)
+{
   testing_want_added (test->objman, "com.redhat.lvm2.VolumeGroup",
                       test->vgname, &test->volume_group);
 
@@ -110,6 +129,23 @@ setup_vgcreate (Test *test,
   testing_wait_until (test->volume_group != NULL);
 }
 
+static void
+setup_vgcreate (Test *test,
+                gconstpointer data)
+{
+  setup_target (test, data);
+  create_volume_group (test);
+}
+
+static void
+setup_vgcreate_no_discard (Test *test,
+                           gconstpointer data)
+{
+  setup_target (test, data);
+  disable_discard (test);
+  create_volume_group (test);
+}
+
 static void
 teardown_vgremove (Test *test,
                    gconstpointer data)
@@ -120,22 +156,36 @@ teardown_vgremove (Test *test,
 }
 
 static void
-setup_vgcreate_lvcreate (Test *test,
-                         gconstpointer data)
+create_logical_volume (Test *test,
+                       const gchar *lvname)
 {
-  const gchar *lvname = data;
-
-  setup_vgcreate (test, data);
-
   testing_want_added (test->objman, "com.redhat.lvm2.LogicalVolume",
                       lvname, &test->logical_volume);
 
+  /* All on the first device, so that tests know where to look for it */
   testing_target_execute (NULL, "lvcreate", test->vgname, "--name", lvname,
-                          "--size", "20m", "--activate", "n", "--zero", "n", NULL);
+                          "--size", "20m", "--activate", "n", "--zero", "n",
+                          test->blocks[0].device, NULL);
 
   testing_wait_until (test->logical_volume != NULL);
 }
 
+static void
+setup_vgcreate_lvcreate (Test *test,
+                         gconstpointer data)
+{
+  setup_vgcreate (test, data);
+  create_logical_volume (test, data);
+}
+
+static void
+setup_vgcreate_lvcreate_no_discard (Test *test,
+                                    gconstpointer data)
+{
+  setup_vgcreate_no_discard (test, data);
+  create_logical_volume (test, data);
+}
+
 static void
 teardown_lvremove_vgremove (Test *test,
                             gconstpointer data)
@@ -191,6 +241,112 @@ test_volume_group_create (Test *test,
   g_variant_unref (retval);
 }
 
+static GVariant *
+call_stats (Test *test,
+            const gchar *method)
+{
+  GDBusProxy *stats;
+  GVariant *retval;
+  GVariant *result;
+  GError *error = NULL;
+
+  stats = lookup_interface (test, "/org/freedesktop/UDisks2/Manager", "com.redhat.lvm2.Stats");
+  g_assert (stats != NULL);
+
+  retval = g_dbus_proxy_call_sync (stats, method, NULL,
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+
+  result = g_variant_get_child_value (retval, 0);
+  g_variant_unref (retval);
+  g_object_unref (stats);
+  return result;
+}
+
+static guint64
+lookup_counter (Test *test,
+                const gchar *name)
+{
+  GVariant *counters;
+  guint64 value = 0;
+
+  counters = call_stats (test, "GetCounters");
+  g_variant_lookup (counters, name, "t", &value);
+  g_variant_unref (counters);
+  return value;
+}
+
+static guint64
+lookup_histogram_count (Test *test,
+                        const gchar *name)
+{
+  GVariant *histograms;
+  guint64 count = 0;
+
+  histograms = call_stats (test, "GetHistograms");
+  g_variant_lookup (histograms, name, "(tttat)", &count, NULL, NULL, NULL);
+  g_variant_unref (histograms);
+  return count;
+}
+
+static void
+test_stats (Test *test,
+            gconstpointer data)
+{
+  GDBusProxy *volume_group = NULL;
+  GDBusProxy *manager;
+  GVariant *blocks[2];
+  GVariant *retval;
+  GError *error = NULL;
+  gchar *counter;
+  gchar *output = NULL;
+
+  /* Each test gets a fresh daemon, which hasn't seen this group yet */
+  counter = g_strdup_printf ("vg.refresh.%s", test->vgname);
+  g_assert_cmpuint (lookup_counter (test, counter), ==, 0);
+  g_assert_cmpuint (lookup_histogram_count (test, "job.lvm-vg-create"), ==, 0);
+
+  manager = lookup_interface (test, "/org/freedesktop/UDisks2/Manager", "com.redhat.lvm2.Manager");
+  g_assert (manager != NULL);
+
+  testing_want_added (test->objman, "com.redhat.lvm2.VolumeGroup",
+                      test->vgname, &volume_group);
+
+  blocks[0] = g_variant_new_object_path (test->blocks[0].object_path);
+  blocks[1] = g_variant_new_object_path (test->blocks[1].object_path);
+  retval = g_dbus_proxy_call_sync (manager, "VolumeGroupCreate",
+                                   g_variant_new ("(s@ao@a{sv})",
+                                                  test->vgname,
+                                                  g_variant_new_array (G_VARIANT_TYPE_OBJECT_PATH, blocks, 2),
+                                                  g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+
+  testing_wait_until (volume_group != NULL);
+
+  /* One job and one call, and the group was read at least once */
+  g_assert_cmpuint (lookup_counter (test, counter), >=, 1);
+  testing_wait_until (lookup_histogram_count (test, "job.lvm-vg-create") == 1);
+  g_assert_cmpuint (lookup_histogram_count (test, "call.com.redhat.lvm2.Manager.VolumeGroupCreate"), ==, 1);
+
+  /* Reading them needs the manage-lvm action, which nobody doesn't have */
+  testing_target_execute (&output, "/bin/sh", "-c",
+                          "runuser -u nobody -- dbus-send --system --print-reply "
+                          "--dest=com.redhat.storaged /org/freedesktop/UDisks2/Manager "
+                          "com.redhat.lvm2.Stats.GetCounters 2>&1; true", NULL);
+  g_assert_str_contains (output, "NotAuthorized");
+
+  testing_target_execute (NULL, "vgremove", "-f", test->vgname, NULL);
+
+  g_object_unref (volume_group);
+  g_object_unref (manager);
+  g_free (counter);
+  g_free (output);
+}
+
 static void
 test_volume_group_delete (Test *test,
                           gconstpointer data)
@@ -216,6 +372,45 @@ test_volume_group_delete (Test *test,
   g_variant_unref (retval);
 }
 
+static void
+test_volume_group_delete_discard (Test *test,
+                                  gconstpointer data)
+{
+  GVariantBuilder options;
+  GVariant *retval;
+  GError *error = NULL;
+  gchar *arg;
+  guint i;
+
+  /* Scribble over the physical volumes, past the metadata */
+  for (i = 0; i < G_N_ELEMENTS (test->blocks); i++)
+    {
+      arg = g_strdup_printf ("of=%s", test->blocks[i].device);
+      testing_target_execute (NULL, "dd", "if=/dev/urandom", arg, "bs=1M", "seek=1",
+                              "count=40", "oflag=direct", "status=none", NULL);
+      g_free (arg);
+    }
+
+  testing_want_removed (test->objman, &test->volume_group);
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&options, "{sv}", "discard", g_variant_new_boolean (TRUE));
+  retval = g_dbus_proxy_call_sync (test->volume_group, "Delete",
+                                   g_variant_new ("(b@a{sv})",
+                                                  FALSE,
+                                                  g_variant_builder_end (&options)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+
+  testing_wait_until (test->volume_group == NULL);
+
+  /* Discarding isn't supported, so all of it should have been zeroed */
+  for (i = 0; i < G_N_ELEMENTS (test->blocks); i++)
+    testing_target_execute (NULL, "cmp", "-n", "52428800", test->blocks[i].device, "/dev/zero", NULL);
+}
+
 static void
 test_logical_volume_create (Test *test,
                             gconstpointer data)
@@ -274,6 +469,64 @@ test_logical_volume_delete (Test *test,
   g_variant_unref (retval);
 }
 
+static void
+test_logical_volume_delete_discard (Test *test,
+                                    gconstpointer data)
+{
+  const gchar *lvname = data;
+  GVariantBuilder options;
+  GVariant *retval;
+  GError *error = NULL;
+  gchar *pe_start = NULL;
+  gchar *device;
+  gchar *skip;
+  gchar *arg;
+
+  /* Only active volumes can be discarded */
+  retval = g_dbus_proxy_call_sync (test->logical_volume, "Activate",
+                                   g_variant_new ("(@a{sv})",
+                                                  g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+  testing_wait_idle ();
+
+  device = g_strdup_printf ("/dev/%s/%s", test->vgname, lvname);
+  arg = g_strdup_printf ("of=%s", device);
+  testing_target_execute (NULL, "dd", "if=/dev/urandom", arg, "bs=1M", "count=20",
+                          "oflag=direct", "status=none", NULL);
+
+  testing_want_removed (test->objman, &test->logical_volume);
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&options, "{sv}", "discard", g_variant_new_boolean (TRUE));
+  retval = g_dbus_proxy_call_sync (test->logical_volume, "Delete",
+                                   g_variant_new ("(@a{sv})", g_variant_builder_end (&options)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+
+  testing_wait_until (test->logical_volume == NULL);
+
+  /*
+   * Discarding isn't supported, so the extents the volume had at the
+   * start of the first device should have been zeroed instead.
+   */
+  testing_target_execute (&pe_start, "pvs", "--noheadings", "--nosuffix", "--units", "b",
+                          "-o", "pe_start", test->blocks[0].device, NULL);
+  g_strstrip (pe_start);
+  skip = g_strdup_printf ("--ignore-initial=%s:0", pe_start);
+  testing_target_execute (NULL, "cmp", skip, "-n", "20971520",
+                          test->blocks[0].device, "/dev/zero", NULL);
+
+  g_free (pe_start);
+  g_free (device);
+  g_free (skip);
+  g_free (arg);
+}
+
 static void
 test_logical_volume_activate (Test *test,
                               gconstpointer data)
@@ -317,6 +570,74 @@ test_logical_volume_activate (Test *test,
   testing_wait_until (block == NULL);
 }
 
+static void
+test_logical_volume_zero (Test *test,
+                          gconstpointer data)
+{
+  const gchar *lvname = data;
+  GVariant *retval;
+  GError *error = NULL;
+  gchar *device;
+  gchar *arg;
+
+  retval = g_dbus_proxy_call_sync (test->logical_volume, "Activate",
+                                   g_variant_new ("(@a{sv})",
+                                                  g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+  testing_wait_idle ();
+
+  /* Scribble over it, then zero it */
+  device = g_strdup_printf ("/dev/%s/%s", test->vgname, lvname);
+  arg = g_strdup_printf ("of=%s", device);
+  testing_target_execute (NULL, "dd", "if=/dev/urandom", arg, "bs=1M", "count=20",
+                          "oflag=direct", "status=none", NULL);
+
+  retval = g_dbus_proxy_call_sync (test->logical_volume, "Zero",
+                                   g_variant_new ("(@a{sv})",
+                                                  g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+
+  testing_target_execute (NULL, "cmp", "-n", "20971520", device, "/dev/zero", NULL);
+
+  g_free (device);
+  g_free (arg);
+}
+
+static void
+test_volume_group_empty_device_parallel (Test *test,
+                                         gconstpointer data)
+{
+  GVariantBuilder options;
+  GVariant *retval;
+  GError *error = NULL;
+
+  testing_target_execute (NULL, "lvcreate", test->vgname, "--name", "one",
+                          "--size", "8m", "--zero", "n", test->blocks[0].device, NULL);
+  testing_target_execute (NULL, "lvcreate", test->vgname, "--name", "two",
+                          "--size", "8m", "--zero", "n", test->blocks[0].device, NULL);
+  testing_wait_idle ();
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&options, "{sv}", "parallel", g_variant_new_uint32 (2));
+  retval = g_dbus_proxy_call_sync (test->volume_group, "EmptyDevice",
+                                   g_variant_new ("(o@a{sv})",
+                                                  test->blocks[0].object_path,
+                                                  g_variant_builder_end (&options)),
+                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_unref (retval);
+
+  /* Only succeeds when nothing is left on the device */
+  testing_target_execute (NULL, "vgreduce", test->vgname, test->blocks[0].device, NULL);
+}
+
 int
 main (int argc,
       char **argv)
@@ -331,15 +652,25 @@ main (int argc,
     {
       g_test_add ("/storaged/lvm/volume-group/create", Test, NULL,
                   setup_target, test_volume_group_create, teardown_target);
+      g_test_add ("/storaged/lvm/stats", Test, NULL,
+                  setup_target, test_stats, teardown_target);
       g_test_add ("/storaged/lvm/volume-group/delete", Test, NULL,
                   setup_vgcreate, test_volume_group_delete, teardown_target);
+      g_test_add ("/storaged/lvm/volume-group/delete-discard", Test, NULL,
+                  setup_vgcreate_no_discard, test_volume_group_delete_discard, teardown_target);
+      g_test_add ("/storaged/lvm/volume-group/empty-device-parallel", Test, NULL,
+                  setup_vgcreate, test_volume_group_empty_device_parallel, teardown_vgremove);
 
       g_test_add ("/storaged/lvm/logical-volume/create", Test, "volone",
                   setup_vgcreate, test_logical_volume_create, teardown_lvremove_vgremove);
       g_test_add ("/storaged/lvm/logical-volume/delete", Test, "volone",
                   setup_vgcreate_lvcreate, test_logical_volume_delete, teardown_vgremove);
+      g_test_add ("/storaged/lvm/logical-volume/delete-discard", Test, "volone",
+                  setup_vgcreate_lvcreate_no_discard, test_logical_volume_delete_discard, teardown_vgremove);
       g_test_add ("/storaged/lvm/logical-volume/activate", Test, "volone",
                   setup_vgcreate_lvcreate, test_logical_volume_activate, teardown_lvremove_vgremove);
+      g_test_add ("/storaged/lvm/logical-volume/zero", Test, "volone",
+                  setup_vgcreate_lvcreate, test_logical_volume_zero, teardown_lvremove_vgremove);
     }
 
   return g_test_run ();
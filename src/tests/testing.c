@@ -835,6 +835,73 @@ testing_proxy_string (GDBusProxy *proxy,
 }
 
 
+static gint
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * testing_percentile:
+ * @sorted: A sorted #GArray of gint64, not empty.
+ * @permille: Which percentile, in tenths of a percent.
+ *
+ * Returns: The nearest rank percentile of @sorted, for example the
+ *   median for a @permille of 500.
+ */
+gint64
+testing_percentile (GArray *sorted,
+                    guint permille)
+{
+  guint rank;
+
+  g_assert (sorted->len > 0);
+
+  rank = (sorted->len * permille + 999) / 1000;
+  return g_array_index (sorted, gint64, MAX (rank, 1) - 1);
+}
+
+/**
+ * testing_append_samples:
+ * @json: Where to append.
+ * @samples: A #GArray of gint64, sorted by this call.
+ *
+ * Appends a JSON object with the count, mean, minimum, median, 90th,
+ * 99th and 99.9th percentile, and maximum of @samples, for the
+ * benchmark reports.
+ */
+void
+testing_append_samples (GString *json,
+                        GArray *samples)
+{
+  gint64 sum = 0;
+  guint i;
+
+  if (samples->len == 0)
+    {
+      g_string_append (json, "{ \"count\": 0 }");
+      return;
+    }
+
+  g_array_sort (samples, compare_samples);
+  for (i = 0; i < samples->len; i++)
+    sum += g_array_index (samples, gint64, i);
+
+  g_string_append_printf (json, "{ \"count\": %u, \"mean\": %" G_GINT64_FORMAT
+                          ", \"min\": %" G_GINT64_FORMAT ", \"p50\": %" G_GINT64_FORMAT
+                          ", \"p90\": %" G_GINT64_FORMAT ", \"p99\": %" G_GINT64_FORMAT
+                          ", \"p999\": %" G_GINT64_FORMAT ", \"max\": %" G_GINT64_FORMAT " }",
+                          samples->len, sum / samples->len,
+                          g_array_index (samples, gint64, 0),
+                          testing_percentile (samples, 500), testing_percentile (samples, 900),
+                          testing_percentile (samples, 990), testing_percentile (samples, 999),
+                          g_array_index (samples, gint64, samples->len - 1));
+}
+
+
 struct _TestingIOStream {
   GIOStream parent;
   GInputStream *input_stream;
@@ -134,4 +134,10 @@ void             testing_want_added               (GDBusObjectManager *objman,
 void             testing_want_removed             (GDBusObjectManager *objman,
                                                    GDBusProxy **proxy);
 
+gint64           testing_percentile               (GArray *sorted,
+                                                   guint permille);
+
+void             testing_append_samples           (GString *json,
+                                                   GArray *samples);
+
 #endif /* __TESTING_IO_STREAM_H__ */
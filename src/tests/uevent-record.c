@@ -0,0 +1,170 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Records the uevents that storaged listens to, with all their udev
+ * properties, for replaying them later with storaged --replay-uevents.
+ * See ueventreplay.c for the format.  Records until interrupted, or
+ * for --duration seconds.
+ */
+
+#include "config.h"
+
+#include "ueventreplay.h"
+
+#include <gudev/gudev.h>
+#include <glib-unix.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+static gint opt_duration = 0;
+static gchar *opt_output = NULL;
+
+static const GOptionEntry option_entries[] = {
+  { "duration", 0, 0, G_OPTION_ARG_INT, &opt_duration,
+    "Stop after this many seconds", "SECS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  FILE *out;
+  gint64 first;
+  guint count;
+} Recorder;
+
+static void
+on_uevent (GUdevClient *client,
+           const gchar *action,
+           GUdevDevice *device,
+           gpointer user_data)
+{
+  Recorder *recorder = user_data;
+  const gchar * const *keys;
+  GVariantBuilder properties;
+  GVariant *record;
+  gchar *text;
+  gint64 now;
+  guint i;
+
+  now = g_get_monotonic_time ();
+  if (recorder->count == 0)
+    recorder->first = now;
+
+  g_variant_builder_init (&properties, G_VARIANT_TYPE ("a{ss}"));
+  keys = g_udev_device_get_property_keys (device);
+  for (i = 0; keys && keys[i] != NULL; i++)
+    {
+      g_variant_builder_add (&properties, "{ss}", keys[i],
+                             g_udev_device_get_property (device, keys[i]));
+    }
+
+  record = g_variant_new ("(tsst@a{ss})", (guint64)(now - recorder->first), action,
+                          g_udev_device_get_name (device),
+                          (guint64)g_udev_device_get_device_number (device),
+                          g_variant_builder_end (&properties));
+  g_variant_ref_sink (record);
+
+  text = g_variant_print (record, FALSE);
+  fprintf (recorder->out, "%s\n", text);
+  fflush (recorder->out);
+  recorder->count++;
+
+  g_free (text);
+  g_variant_unref (record);
+}
+
+static gboolean
+on_stop (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  /* The same subsystems that the daemon listens to */
+  const gchar *subsystems[] = {
+      "block",
+      "iscsi_connection",
+      "scsi",
+      NULL
+  };
+
+  GOptionContext *context;
+  GError *error = NULL;
+  GUdevClient *client;
+  GMainLoop *loop;
+  Recorder recorder = { NULL, };
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  context = g_option_context_new ("- record uevents for storaged --replay-uevents");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  recorder.out = stdout;
+  if (opt_output)
+    {
+      recorder.out = fopen (opt_output, "w");
+      if (recorder.out == NULL)
+        {
+          g_printerr ("%s: %s: %s\n", g_get_prgname (), opt_output, g_strerror (errno));
+          return 1;
+        }
+    }
+
+  fprintf (recorder.out, "# %s\n", STORAGE_UEVENT_RECORD_TYPE);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  client = g_udev_client_new (subsystems);
+  g_signal_connect (client, "uevent", G_CALLBACK (on_uevent), &recorder);
+
+  g_unix_signal_add (SIGINT, on_stop, loop);
+  g_unix_signal_add (SIGTERM, on_stop, loop);
+  if (opt_duration > 0)
+    g_timeout_add_seconds (opt_duration, on_stop, loop);
+
+  g_main_loop_run (loop);
+
+  g_printerr ("%s: recorded %u uevents\n", g_get_prgname (), recorder.count);
+
+  g_object_unref (client);
+  g_main_loop_unref (loop);
+  if (recorder.out != stdout)
+    fclose (recorder.out);
+  g_free (opt_output);
+  return 0;
+}
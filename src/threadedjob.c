@@ -192,19 +192,28 @@ run_io_scheduler_job (GIOSchedulerJob *io_scheduler_job,
                       gpointer user_data)
 {
   StorageThreadedJob *job = STORAGE_THREADED_JOB (user_data);
+  const StorageJobPolicy *policy;
+  StorageJobPolicySaved saved;
 
   /* TODO: probably want to create a GMainContext dedicated to the thread */
 
   g_assert (!job->job_result);
   g_assert_no_error (job->job_error);
 
+  /* the thread belongs to a pool, so it gets its scheduling back afterwards */
+  policy = storage_job_get_policy (STORAGE_JOB (job));
+  storage_job_policy_enter_thread (policy, &saved);
+
   if (!g_cancellable_set_error_if_cancelled (cancellable, &job->job_error))
     {
-      job->job_result = job->job_func (cancellable,
+      job->job_result = job->job_func (job,
+                                       cancellable,
                                        job->user_data,
                                        &job->job_error);
     }
 
+  storage_job_policy_leave_thread (policy, &saved);
+
   g_io_scheduler_job_send_to_mainloop (io_scheduler_job,
                                        job_complete,
                                        job,
@@ -228,6 +237,79 @@ storage_threaded_job_constructed (GObject *object)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+typedef struct {
+  StorageThreadedJob *job;
+  gdouble progress;
+  guint64 bytes;
+} ProgressData;
+
+static gboolean
+on_invoke_set_progress (gpointer user_data)
+{
+  ProgressData *data = user_data;
+  udisks_job_set_progress_valid (UDISKS_JOB (data->job), TRUE);
+  udisks_job_set_progress (UDISKS_JOB (data->job), data->progress);
+  g_object_unref (data->job);
+  g_free (data);
+  return FALSE;
+}
+
+static gboolean
+on_invoke_set_bytes (gpointer user_data)
+{
+  ProgressData *data = user_data;
+  udisks_job_set_bytes (UDISKS_JOB (data->job), data->bytes);
+  g_object_unref (data->job);
+  g_free (data);
+  return FALSE;
+}
+
+/**
+ * storage_threaded_job_set_progress:
+ * @job: A #StorageThreadedJob.
+ * @progress: Progress between 0.0 and 1.0.
+ *
+ * Updates the progress of @job from its job function, or any other
+ * thread. The property changes in the main context.
+ */
+void
+storage_threaded_job_set_progress (StorageThreadedJob *job,
+                                   gdouble progress)
+{
+  ProgressData *data;
+
+  g_return_if_fail (STORAGE_IS_THREADED_JOB (job));
+
+  data = g_new0 (ProgressData, 1);
+  data->job = g_object_ref (job);
+  data->progress = CLAMP (progress, 0.0, 1.0);
+  g_main_context_invoke (NULL, on_invoke_set_progress, data);
+}
+
+/**
+ * storage_threaded_job_set_bytes:
+ * @job: A #StorageThreadedJob.
+ * @bytes: The number of bytes the job works on.
+ *
+ * Like storage_threaded_job_set_progress(), for the size of the job.
+ * Together with auto-estimation this gives the job a rate.
+ */
+void
+storage_threaded_job_set_bytes (StorageThreadedJob *job,
+                                guint64 bytes)
+{
+  ProgressData *data;
+
+  g_return_if_fail (STORAGE_IS_THREADED_JOB (job));
+
+  data = g_new0 (ProgressData, 1);
+  data->job = g_object_ref (job);
+  data->bytes = bytes;
+  g_main_context_invoke (NULL, on_invoke_set_bytes, data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 storage_threaded_job_init (StorageThreadedJob *job)
 {
@@ -331,6 +413,7 @@ storage_threaded_job_class_init (StorageThreadedJobClass *klass)
  * @job_func: The function to run in another thread.
  * @user_data: User data to pass to @job_func.
  * @user_data_free_func: Function to free @user_data with or %NULL.
+ * @policy: (allow-none): The #StorageJobPolicy to run @job_func with.
  * @cancellable: A #GCancellable or %NULL.
  *
  * Creates a new #StorageThreadedJob instance.
@@ -345,6 +428,7 @@ StorageThreadedJob *
 storage_threaded_job_new (StorageJobFunc job_func,
                           gpointer user_data,
                           GDestroyNotify user_data_free_func,
+                          const StorageJobPolicy *policy,
                           GCancellable *cancellable)
 {
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
@@ -353,6 +437,7 @@ storage_threaded_job_new (StorageJobFunc job_func,
                        "job-func", job_func,
                        "user-data", user_data,
                        "user-data-free-func", user_data_free_func,
+                       "policy", policy,
                        "cancellable", cancellable,
                        NULL);
 }
@@ -36,10 +36,17 @@ GType                 storage_threaded_job_get_type       (void) G_GNUC_CONST;
 StorageThreadedJob *  storage_threaded_job_new            (StorageJobFunc job_func,
                                                            gpointer user_data,
                                                            GDestroyNotify user_data_free_func,
+                                                           const StorageJobPolicy *policy,
                                                            GCancellable *cancellable);
 
 gpointer              storage_threaded_job_get_user_data  (StorageThreadedJob *job);
 
+void                  storage_threaded_job_set_progress   (StorageThreadedJob *job,
+                                                           gdouble progress);
+
+void                  storage_threaded_job_set_bytes      (StorageThreadedJob *job,
+                                                           guint64 bytes);
+
 G_END_DECLS
 
 #endif /* __STORAGE_THREADED_JOB_H__ */
@@ -34,6 +34,7 @@ typedef struct _StorageDaemon         StorageDaemon;
 typedef struct _StorageManager        StorageManager;
 typedef struct _StorageJob            StorageJob;
 typedef struct _StorageSpawnedJob     StorageSpawnedJob;
+typedef struct _StorageStats          StorageStats;
 typedef struct _StorageThreadedJob    StorageThreadedJob;
 
 G_END_DECLS
@@ -0,0 +1,242 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "ueventreplay.h"
+#include "stats.h"
+
+#include <gio/gio.h>
+
+/**
+ * SECTION:storageueventreplay
+ * @title: StorageUeventReplay
+ * @short_description: Feeding recorded uevents to the daemon
+ *
+ * The daemon's handling of uevent storms is hard to test, since the
+ * storms are hard to make on purpose.  Instead, uevents can be
+ * recorded on a machine that has them, with the uevent-record program
+ * from the tests, and replayed into the daemon with its
+ * --replay-uevents option, which then doesn't listen to udev.
+ *
+ * A recording is a text file with one #GVariant of type
+ * %STORAGE_UEVENT_RECORD_TYPE per line.  Empty lines and lines that
+ * start with '#' are ignored.
+ *
+ * The replay keeps the original spacing between the uevents, divided
+ * by the speed.  With a speed of 0, all uevents are replayed as fast
+ * as possible.
+ */
+
+typedef struct {
+  guint64 offset;
+  gchar *action;
+  gchar *name;
+  guint64 device_number;
+  GVariant *properties;
+} Uevent;
+
+struct _StorageUeventReplay {
+  GArray *uevents;
+  gdouble speed;
+  guint next;
+
+  gint64 start;
+  guint timeout_id;
+
+  StorageUeventFunc func;
+  gpointer user_data;
+};
+
+/**
+ * storage_uevent_replay_new:
+ * @path: The recording to replay.
+ * @speed: How much faster than recorded to replay, or 0.
+ * @error: Return location for error.
+ *
+ * Reads the recording at @path.
+ *
+ * Returns: A new #StorageUeventReplay, or %NULL with @error set.
+ */
+StorageUeventReplay *
+storage_uevent_replay_new (const gchar *path,
+                           gdouble speed,
+                           GError **error)
+{
+  StorageUeventReplay *replay;
+  gchar *contents;
+  gchar **lines;
+  GVariant *record;
+  GError *local_error = NULL;
+  Uevent uevent;
+  guint i;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (speed >= 0, NULL);
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  replay = g_new0 (StorageUeventReplay, 1);
+  replay->uevents = g_array_new (FALSE, FALSE, sizeof (Uevent));
+  replay->speed = speed;
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      g_strstrip (lines[i]);
+      if (lines[i][0] == '\0' || lines[i][0] == '#')
+        continue;
+
+      record = g_variant_parse (G_VARIANT_TYPE (STORAGE_UEVENT_RECORD_TYPE),
+                                lines[i], NULL, NULL, &local_error);
+      if (record == NULL)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "%s:%u: %s", path, i + 1, local_error->message);
+          g_error_free (local_error);
+          g_strfreev (lines);
+          storage_uevent_replay_free (replay);
+          return NULL;
+        }
+
+      g_variant_get (record, "(tsst@a{ss})", &uevent.offset, &uevent.action,
+                     &uevent.name, &uevent.device_number, &uevent.properties);
+      g_array_append_val (replay->uevents, uevent);
+      g_variant_unref (record);
+    }
+
+  g_strfreev (lines);
+  return replay;
+}
+
+/**
+ * storage_uevent_replay_get_length:
+ * @replay: A #StorageUeventReplay.
+ *
+ * Returns: The number of uevents in the recording.
+ */
+guint
+storage_uevent_replay_get_length (StorageUeventReplay *replay)
+{
+  return replay->uevents->len;
+}
+
+static gint64
+uevent_due (StorageUeventReplay *replay,
+            Uevent *uevent)
+{
+  if (replay->speed == 0)
+    return replay->start;
+  return replay->start + (gint64)(uevent->offset / replay->speed);
+}
+
+static gboolean
+on_replay_timeout (gpointer user_data)
+{
+  StorageUeventReplay *replay = user_data;
+  Uevent *uevent;
+  gint64 now;
+  gint64 delay;
+
+  replay->timeout_id = 0;
+  now = g_get_monotonic_time ();
+
+  /* Everything that is due, which can be a lot at high speeds */
+  while (replay->next < replay->uevents->len)
+    {
+      uevent = &g_array_index (replay->uevents, Uevent, replay->next);
+      if (uevent_due (replay, uevent) > now)
+        break;
+
+      replay->next++;
+      storage_stats_count ("uevent.replayed", 1);
+      replay->func (uevent->action, uevent->name, uevent->device_number,
+                    uevent->properties, replay->user_data);
+    }
+
+  if (replay->next < replay->uevents->len)
+    {
+      uevent = &g_array_index (replay->uevents, Uevent, replay->next);
+      delay = uevent_due (replay, uevent) - now;
+      replay->timeout_id = g_timeout_add (MAX (delay / 1000, 1), on_replay_timeout, replay);
+    }
+  else
+    {
+      g_info ("Replayed %u uevents in %" G_GINT64_FORMAT " ms", replay->uevents->len,
+              (now - replay->start) / 1000);
+    }
+
+  return FALSE;
+}
+
+/**
+ * storage_uevent_replay_start:
+ * @replay: A #StorageUeventReplay.
+ * @func: Called for every uevent.
+ * @user_data: Data to pass to @func.
+ *
+ * Starts replaying the recording from the beginning, from the main
+ * loop.
+ */
+void
+storage_uevent_replay_start (StorageUeventReplay *replay,
+                             StorageUeventFunc func,
+                             gpointer user_data)
+{
+  g_return_if_fail (replay->timeout_id == 0);
+
+  replay->func = func;
+  replay->user_data = user_data;
+  replay->next = 0;
+  replay->start = g_get_monotonic_time ();
+
+  g_info ("Replaying %u uevents", replay->uevents->len);
+  replay->timeout_id = g_idle_add (on_replay_timeout, replay);
+}
+
+/**
+ * storage_uevent_replay_free:
+ * @replay: A #StorageUeventReplay.
+ *
+ * Stops the replay and frees it.
+ */
+void
+storage_uevent_replay_free (StorageUeventReplay *replay)
+{
+  Uevent *uevent;
+  guint i;
+
+  if (replay->timeout_id)
+    g_source_remove (replay->timeout_id);
+
+  for (i = 0; i < replay->uevents->len; i++)
+    {
+      uevent = &g_array_index (replay->uevents, Uevent, i);
+      g_free (uevent->action);
+      g_free (uevent->name);
+      g_variant_unref (uevent->properties);
+    }
+  g_array_free (replay->uevents, TRUE);
+  g_free (replay);
+}
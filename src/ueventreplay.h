@@ -0,0 +1,71 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __STORAGE_UEVENT_REPLAY_H__
+#define __STORAGE_UEVENT_REPLAY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * STORAGE_UEVENT_RECORD_TYPE:
+ *
+ * The type of one line of a uevent recording: the time since the
+ * first uevent in microseconds, the action, the kernel name of the
+ * device, its device number and its udev properties.
+ */
+#define STORAGE_UEVENT_RECORD_TYPE "(tssta{ss})"
+
+typedef struct _StorageUeventReplay StorageUeventReplay;
+
+/**
+ * StorageUeventFunc:
+ * @action: The action, such as "add" or "change".
+ * @name: The kernel name of the device, such as "dm-0".
+ * @device_number: The device number, or 0.
+ * @properties: The udev properties of the device, as a{ss}.
+ * @user_data: The data passed to storage_uevent_replay_start().
+ *
+ * Called for every replayed uevent, in place of the "uevent" signal
+ * of #GUdevClient.
+ */
+typedef void (* StorageUeventFunc) (const gchar *action,
+                                    const gchar *name,
+                                    guint64 device_number,
+                                    GVariant *properties,
+                                    gpointer user_data);
+
+StorageUeventReplay *  storage_uevent_replay_new    (const gchar *path,
+                                                     gdouble speed,
+                                                     GError **error);
+
+guint                  storage_uevent_replay_get_length (StorageUeventReplay *replay);
+
+void                   storage_uevent_replay_start  (StorageUeventReplay *replay,
+                                                     StorageUeventFunc func,
+                                                     gpointer user_data);
+
+void                   storage_uevent_replay_free   (StorageUeventReplay *replay);
+
+G_END_DECLS
+
+#endif /* __STORAGE_UEVENT_REPLAY_H__ */
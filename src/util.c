@@ -21,20 +21,28 @@
 
 #include "config.h"
 
+#include "lvmconfig.h"
 #include "util.h"
 
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <linux/fs.h>
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <udisks/udisks.h>
 
+#include <blkid/blkid.h>
+
 /*
  * safe_append_to_object_path:
  * @str: A #GString to append to.
@@ -113,6 +121,145 @@ storage_util_lvm_name_is_reserved (const gchar *name)
           || g_str_has_prefix (name, "snapshot"));
 }
 
+/**
+ * storage_util_device_is_unused:
+ * @device_file: A block device.
+ * @error: Return location for error.
+ *
+ * Checks that nobody else has @device_file open, by opening it
+ * exclusively. This does I/O, so don't call it from the main loop.
+ *
+ * Returns: %TRUE if the device is unused, otherwise %FALSE with @error set.
+ */
+gboolean
+storage_util_device_is_unused (const gchar *device_file,
+                               GError **error)
+{
+  int fd;
+
+  fd = open (device_file, O_RDONLY | O_EXCL);
+  if (fd < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m",
+                   device_file);
+      return FALSE;
+    }
+  close (fd);
+  return TRUE;
+}
+
+#define LVMETAD_SOCKET "/run/lvm/lvmetad.socket"
+
+static gboolean
+lvmetad_is_running (void)
+{
+  struct sockaddr_un addr;
+  const gchar *path;
+  gboolean ret;
+  int fd;
+
+  path = g_getenv ("LVM_LVMETAD_SOCKET");
+  if (path == NULL)
+    path = LVMETAD_SOCKET;
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return FALSE;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy (addr.sun_path, path, sizeof (addr.sun_path));
+
+  ret = (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) == 0);
+  close (fd);
+  return ret;
+}
+
+static gboolean
+wipe_signatures (int fd,
+                 const gchar *device_file,
+                 GError **error)
+{
+  blkid_probe probe;
+  gboolean ret = FALSE;
+
+  probe = blkid_new_probe ();
+  if (probe == NULL)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error probing device %s: %m", device_file);
+      return FALSE;
+    }
+
+  if (blkid_probe_set_device (probe, fd, 0, 0) < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error probing device %s: %m", device_file);
+      goto out;
+    }
+
+  /* The same signatures as "wipefs -a", found in one pass */
+  blkid_probe_enable_superblocks (probe, 1);
+  blkid_probe_set_superblocks_flags (probe, BLKID_SUBLKS_MAGIC | BLKID_SUBLKS_BADCSUM);
+  blkid_probe_enable_partitions (probe, 1);
+  blkid_probe_set_partitions_flags (probe, BLKID_PARTS_MAGIC | BLKID_PARTS_FORCE_GPT);
+
+  /* blkid_do_wipe() steps back, so the same spot is probed again */
+  while (blkid_do_probe (probe) == 0)
+    {
+      if (blkid_do_wipe (probe, FALSE) < 0)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error wiping signatures on %s: %m", device_file);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+
+out:
+  blkid_free_probe (probe);
+  return ret;
+}
+
+/**
+ * storage_util_wipe_signatures:
+ * @device_file: A block device.
+ * @error: Return location for error.
+ *
+ * Erases all filesystem, RAID and partition table signatures from
+ * @device_file, like "wipefs -a" does.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ */
+gboolean
+storage_util_wipe_signatures (const gchar *device_file,
+                              GError **error)
+{
+  gboolean ret;
+  int fd;
+
+  fd = open (device_file, O_RDWR | O_EXCL | O_CLOEXEC);
+  if (fd < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m", device_file);
+      return FALSE;
+    }
+
+  ret = wipe_signatures (fd, device_file, error);
+  if (fsync (fd) < 0 && ret)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error syncing device %s: %m", device_file);
+      ret = FALSE;
+    }
+
+  close (fd);
+  return ret;
+}
+
 gboolean
 storage_util_wipe_block (const gchar *device_file,
                          GError **error)
@@ -124,12 +271,10 @@ storage_util_wipe_block (const gchar *device_file,
   gint exit_status;
   GError *local_error = NULL;
 
-  const gchar *wipe_argv[] = { "wipefs", "-a", device_file, NULL };
   const gchar *pvscan_argv[] = { "pvscan", "--cache", device_file, NULL };
 
-  /* Remove partition table */
   memset (zeroes, 0, 512);
-  fd = open (device_file, O_RDWR | O_EXCL);
+  fd = open (device_file, O_RDWR | O_EXCL | O_CLOEXEC);
   if (fd < 0)
     {
       g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
@@ -137,7 +282,15 @@ storage_util_wipe_block (const gchar *device_file,
       return FALSE;
     }
 
-  if (write (fd, zeroes, 512) != 512)
+  /* Wipe all labels */
+  if (!wipe_signatures (fd, device_file, error))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  /* Remove partition table */
+  if (pwrite (fd, zeroes, 512, 0) != 512 || fsync (fd) < 0)
     {
       g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
                    "Error erasing device %s: %m", device_file);
@@ -159,41 +312,23 @@ storage_util_wipe_block (const gchar *device_file,
 
   close (fd);
 
-  /* wipe other labels */
-  if (!g_spawn_sync (NULL,
-                     (gchar **)wipe_argv,
-                     NULL,
-                     G_SPAWN_SEARCH_PATH,
-                     NULL,
-                     NULL,
-                     &standard_output,
-                     &standard_error,
-                     &exit_status,
-                     error))
-    return FALSE;
-
-  if (!g_spawn_check_exit_status (exit_status, error))
-    {
-      g_prefix_error (error, "stdout: '%s', stderr: '%s', ", standard_output, standard_error);
-      g_free (standard_output);
-      g_free (standard_error);
-      return FALSE;
-    }
-
-  g_free (standard_output);
-  g_free (standard_error);
-
-  standard_output = NULL;
-  standard_error = NULL;
-
   /* Make sure lvmetad knows about all this.
    *
    * XXX - We need to do this because of a bug in the LVM udev rules
    * which often fail to run pvscan on "change" events.
    *
    * https://bugzilla.redhat.com/show_bug.cgi?id=1063813
+   *
+   * Without lvmetad, LVM scans the devices itself and there is nobody
+   * to tell.
    */
 
+  if (!lvmetad_is_running ())
+    return TRUE;
+
+  standard_output = NULL;
+  standard_error = NULL;
+
   if (!g_spawn_sync (NULL,
                      (gchar **)pvscan_argv,
                      NULL,
@@ -309,6 +444,94 @@ storage_util_check_status_and_output (const gchar *cmd,
   return FALSE;
 }
 
+/* Big enough to not matter, small enough to cancel and report progress */
+#define DISCARD_CHUNK (1024 * 1024 * 1024)
+
+/**
+ * storage_util_discard_device:
+ * @device_file: A block device.
+ * @cancellable: A #GCancellable or %NULL.
+ * @progress_func: Called with the progress between 0.0 and 1.0, or %NULL.
+ * @progress_data: Data for @progress_func.
+ * @error: Return location for error.
+ *
+ * Tells the device that all of its blocks are unused with BLKDISCARD,
+ * so that SSDs and thin provisioned storage can release them. Devices
+ * that don't support discarding are zeroed with BLKZEROOUT instead.
+ * Either is done in chunks, so that it can be cancelled in between.
+ *
+ * This takes a while, so only call it from a thread.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ */
+gboolean
+storage_util_discard_device (const gchar *device_file,
+                             GCancellable *cancellable,
+                             StorageProgressFunc progress_func,
+                             gpointer progress_data,
+                             GError **error)
+{
+  gboolean discard = TRUE;
+  gboolean ret = FALSE;
+  guint64 range[2];
+  guint64 offset;
+  guint64 size;
+  int fd;
+
+  fd = open (device_file, O_RDWR | O_EXCL | O_CLOEXEC);
+  if (fd < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m", device_file);
+      return FALSE;
+    }
+
+  if (ioctl (fd, BLKGETSIZE64, &size) < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error getting size of %s: %m", device_file);
+      goto out;
+    }
+
+  for (offset = 0; offset < size; offset += range[1])
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      range[0] = offset;
+      range[1] = MIN (DISCARD_CHUNK, size - offset);
+
+      if (discard && ioctl (fd, BLKDISCARD, range) < 0)
+        {
+          if (errno != EOPNOTSUPP)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "Error discarding %s: %m", device_file);
+              goto out;
+            }
+
+          g_debug ("%s doesn't support discard, zeroing it", device_file);
+          discard = FALSE;
+        }
+
+      if (!discard && ioctl (fd, BLKZEROOUT, range) < 0)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error zeroing %s: %m", device_file);
+          goto out;
+        }
+
+      if (progress_func)
+        (progress_func) ((gdouble)(offset + range[1]) / size, progress_data);
+    }
+
+  ret = TRUE;
+
+out:
+  close (fd);
+  return ret;
+}
+
 void
 storage_util_trigger_udev (const gchar *device_file)
 {
@@ -316,3 +539,99 @@ storage_util_trigger_udev (const gchar *device_file)
   if (fd >= 0)
     close (fd);
 }
+
+static gchar *
+process_command_line (gint pid)
+{
+  gchar *path;
+  gchar *contents = NULL;
+  gsize len = 0;
+  gsize i;
+
+  path = g_strdup_printf ("/proc/%d/cmdline", pid);
+  if (!g_file_get_contents (path, &contents, &len, NULL) || len == 0)
+    {
+      g_free (contents);
+      contents = g_strdup ("?");
+      len = 0;
+    }
+  g_free (path);
+
+  /* The arguments are separated by NUL characters */
+  for (i = 0; i + 1 < len; i++)
+    {
+      if (contents[i] == '\0')
+        contents[i] = ' ';
+    }
+  return contents;
+}
+
+/**
+ * storage_util_lvm_lock_holders:
+ *
+ * Finds out who holds the LVM locks, such as V_vg0 for the volume group
+ * vg0, by matching the lock files against /proc/locks. This is meant
+ * for messages about commands that are stuck.
+ *
+ * Returns: A description like "V_vg0 held by 1234 (lvcreate ...)", or
+ * %NULL if no lock is held. Free with g_free().
+ */
+gchar *
+storage_util_lvm_lock_holders (void)
+{
+  GString *result;
+  GDir *dir;
+  const gchar *name;
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  struct stat st;
+  gchar *path;
+  gchar *cmd;
+  guint major_nr, minor_nr;
+  guint64 inode;
+  gint pid;
+  gint i;
+
+  dir = g_dir_open (LVM_LOCKING_DIR, 0, NULL);
+  if (dir == NULL)
+    return NULL;
+
+  result = g_string_new (NULL);
+  if (!g_file_get_contents ("/proc/locks", &contents, NULL, NULL))
+    goto out;
+
+  lines = g_strsplit (contents, "\n", -1);
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      path = g_build_filename (LVM_LOCKING_DIR, name, NULL);
+      if (stat (path, &st) < 0)
+        {
+          g_free (path);
+          continue;
+        }
+      g_free (path);
+
+      /* "1: FLOCK  ADVISORY  WRITE 1234 fd:00:5678 0 EOF", waiters have a "->" */
+      for (i = 0; lines[i] != NULL; i++)
+        {
+          if (strstr (lines[i], "->") != NULL ||
+              sscanf (lines[i], "%*d: %*s %*s %*s %d %x:%x:%" G_GUINT64_FORMAT,
+                      &pid, &major_nr, &minor_nr, &inode) != 4)
+            continue;
+
+          if (inode != st.st_ino || major_nr != major (st.st_dev) || minor_nr != minor (st.st_dev))
+            continue;
+
+          cmd = process_command_line (pid);
+          g_string_append_printf (result, "%s%s held by %d (%s)",
+                                  result->len > 0 ? ", " : "", name, pid, cmd);
+          g_free (cmd);
+        }
+    }
+
+out:
+  g_dir_close (dir);
+  g_strfreev (lines);
+  g_free (contents);
+  return g_string_free (result, result->len == 0);
+}
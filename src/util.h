@@ -22,16 +22,25 @@
 #ifndef __STORAGE_UTIL_H__
 #define __STORAGE_UTIL_H__
 
-#include <glib.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
+typedef void (* StorageProgressFunc) (gdouble progress,
+                                      gpointer user_data);
+
 gchar *             storage_util_build_object_path       (const gchar *base,
                                                           const gchar *part,
                                                           ...) G_GNUC_NULL_TERMINATED;
 
 gboolean            storage_util_lvm_name_is_reserved    (const gchar *name);
 
+gboolean            storage_util_device_is_unused        (const gchar *device_file,
+                                                          GError **error);
+
+gboolean            storage_util_wipe_signatures         (const gchar *device_file,
+                                                          GError **error);
+
 gboolean            storage_util_wipe_block              (const gchar *device_file,
                                                           GError **error);
 
@@ -41,8 +50,16 @@ gboolean            storage_util_check_status_and_output (const gchar *cmd,
                                                           const gchar *standard_error,
                                                           GError **error);
 
+gboolean            storage_util_discard_device          (const gchar *device_file,
+                                                          GCancellable *cancellable,
+                                                          StorageProgressFunc progress_func,
+                                                          gpointer progress_data,
+                                                          GError **error);
+
 void                storage_util_trigger_udev            (const gchar *device_file);
 
+gchar *             storage_util_lvm_lock_holders        (void);
+
 
 /*
  * GLib doesn't have g_info() yet:
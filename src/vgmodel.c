@@ -0,0 +1,529 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "vgmodel.h"
+#include "intern.h"
+
+#include <string.h>
+
+/**
+ * SECTION:storagevgmodel
+ * @title: StorageVgModel
+ * @short_description: Decoded output of storaged-lvm-helper
+ *
+ * The helper describes a volume group as a #GVariant with a
+ * dictionary per logical and physical volume.  Keeping that around
+ * costs about as much memory again as the D-Bus objects made from it,
+ * so it is decoded into fixed-size records with interned strings
+ * instead, and the report itself is dropped.
+ *
+ * The model carries a hash of all of its contents, so that an update
+ * that changes something can be told from one that doesn't without
+ * looking further.  Equal hashes might still be a collision, so
+ * storage_vg_model_equal() then compares the records themselves, as
+ * does storage_lv_record_compare() for the logical volumes.
+ *
+ * Keys that the daemon doesn't use are not kept.  The model can be
+ * turned back into a report with storage_vg_model_to_variant(), for
+ * the warm-start snapshot.
+ */
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* FNV-1a, 64 bit */
+#define HASH_INIT   G_GUINT64_CONSTANT (14695981039346656037)
+#define HASH_PRIME  G_GUINT64_CONSTANT (1099511628211)
+
+static guint64
+hash_bytes (guint64 hash,
+            gconstpointer data,
+            gsize len)
+{
+  const guchar *p = data;
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash ^= p[i];
+      hash *= HASH_PRIME;
+    }
+  return hash;
+}
+
+static guint64
+hash_string (guint64 hash,
+             const gchar *str)
+{
+  /* Tell NULL from "", and "ab" "c" from "a" "bc" */
+  if (str == NULL)
+    return hash_bytes (hash, "\xff", 1);
+  return hash_bytes (hash, str, strlen (str) + 1);
+}
+
+static guint64
+hash_uint64 (guint64 hash,
+             guint64 num)
+{
+  return hash_bytes (hash, &num, sizeof (num));
+}
+
+static const gchar *
+lookup_string (GVariant *dict,
+               const gchar *key)
+{
+  const gchar *str;
+
+  if (g_variant_lookup (dict, key, "&s", &str))
+    return storage_intern (str);
+  return NULL;
+}
+
+static guint64
+lookup_uint64 (GVariant *dict,
+               const gchar *key,
+               StorageModelFlags flag,
+               StorageModelFlags *flags)
+{
+  guint64 num;
+
+  if (g_variant_lookup (dict, key, "t", &num))
+    {
+      *flags |= flag;
+      return num;
+    }
+  return 0;
+}
+
+/* Returns @hash with the contents of @lv folded in */
+static guint64
+decode_lv (StorageLvRecord *lv,
+           GVariant *dict,
+           guint64 hash)
+{
+  lv->name = lookup_string (dict, "name");
+  lv->uuid = lookup_string (dict, "uuid");
+  lv->size = lookup_uint64 (dict, "size", STORAGE_MODEL_HAS_SIZE, &lv->flags);
+  lv->lv_attr = lookup_string (dict, "lv_attr");
+  lv->lv_path = lookup_string (dict, "lv_path");
+  lv->move_pv = lookup_string (dict, "move_pv");
+  lv->pool_lv = lookup_string (dict, "pool_lv");
+  lv->origin = lookup_string (dict, "origin");
+  lv->data_percent = lookup_uint64 (dict, "data_percent", STORAGE_MODEL_HAS_DATA_PERCENT, &lv->flags);
+  lv->metadata_percent = lookup_uint64 (dict, "metadata_percent", STORAGE_MODEL_HAS_METADATA_PERCENT, &lv->flags);
+  lv->copy_percent = lookup_uint64 (dict, "copy_percent", STORAGE_MODEL_HAS_COPY_PERCENT, &lv->flags);
+
+  hash = hash_string (hash, lv->name);
+  hash = hash_string (hash, lv->uuid);
+  hash = hash_string (hash, lv->lv_attr);
+  hash = hash_string (hash, lv->lv_path);
+  hash = hash_string (hash, lv->move_pv);
+  hash = hash_string (hash, lv->pool_lv);
+  hash = hash_string (hash, lv->origin);
+  hash = hash_uint64 (hash, lv->size);
+  hash = hash_uint64 (hash, lv->data_percent);
+  hash = hash_uint64 (hash, lv->metadata_percent);
+  hash = hash_uint64 (hash, lv->copy_percent);
+  return hash_uint64 (hash, lv->flags);
+}
+
+/* Returns @hash with the contents of @pv folded in */
+static guint64
+decode_pv (StoragePvRecord *pv,
+           GVariant *dict,
+           guint64 hash)
+{
+  pv->device = lookup_string (dict, "device");
+  pv->uuid = lookup_string (dict, "uuid");
+  pv->size = lookup_uint64 (dict, "size", STORAGE_MODEL_HAS_SIZE, &pv->flags);
+  pv->free_size = lookup_uint64 (dict, "free-size", STORAGE_MODEL_HAS_FREE_SIZE, &pv->flags);
+
+  hash = hash_string (hash, pv->device);
+  hash = hash_string (hash, pv->uuid);
+  hash = hash_uint64 (hash, pv->size);
+  hash = hash_uint64 (hash, pv->free_size);
+  return hash_uint64 (hash, pv->flags);
+}
+
+/**
+ * storage_vg_model_new:
+ * @info: The output of "storaged-lvm-helper show", of type a{sv}.
+ *
+ * Decodes @info.  Thread-safe.
+ *
+ * Returns: A new #StorageVgModel. Free with storage_vg_model_unref().
+ */
+StorageVgModel *
+storage_vg_model_new (GVariant *info)
+{
+  StorageVgModel *model;
+  GVariant *list;
+  GVariant *child;
+  gboolean locked;
+  guint64 hash = HASH_INIT;
+  guint i;
+
+  g_return_val_if_fail (g_variant_is_of_type (info, G_VARIANT_TYPE ("a{sv}")), NULL);
+
+  model = g_new0 (StorageVgModel, 1);
+  model->ref_count = 1;
+
+  model->name = lookup_string (info, "name");
+  model->uuid = lookup_string (info, "uuid");
+  model->size = lookup_uint64 (info, "size", STORAGE_MODEL_HAS_SIZE, &model->flags);
+  model->free_size = lookup_uint64 (info, "free-size", STORAGE_MODEL_HAS_FREE_SIZE, &model->flags);
+  model->extent_size = lookup_uint64 (info, "extent-size", STORAGE_MODEL_HAS_EXTENT_SIZE, &model->flags);
+  model->seqno = lookup_uint64 (info, "seqno", STORAGE_MODEL_HAS_SEQNO, &model->flags);
+  if (g_variant_lookup (info, "locked", "b", &locked))
+    model->flags |= STORAGE_MODEL_HAS_LOCKED | (locked ? STORAGE_MODEL_LOCKED : 0);
+
+  hash = hash_string (hash, model->name);
+  hash = hash_string (hash, model->uuid);
+  hash = hash_uint64 (hash, model->size);
+  hash = hash_uint64 (hash, model->free_size);
+  hash = hash_uint64 (hash, model->extent_size);
+  hash = hash_uint64 (hash, model->seqno);
+  hash = hash_uint64 (hash, model->flags);
+
+  list = g_variant_lookup_value (info, "lvs", G_VARIANT_TYPE ("aa{sv}"));
+  if (list)
+    {
+      model->n_lvs = g_variant_n_children (list);
+      model->lvs = g_new0 (StorageLvRecord, model->n_lvs);
+      for (i = 0; i < model->n_lvs; i++)
+        {
+          child = g_variant_get_child_value (list, i);
+          hash = decode_lv (&model->lvs[i], child, hash);
+          g_variant_unref (child);
+        }
+      g_variant_unref (list);
+    }
+
+  /* Distinguish "no lvs" from "lvs": [] */
+  hash = hash_uint64 (hash, model->lvs ? model->n_lvs : G_MAXUINT64);
+
+  list = g_variant_lookup_value (info, "pvs", G_VARIANT_TYPE ("aa{sv}"));
+  if (list)
+    {
+      model->n_pvs = g_variant_n_children (list);
+      model->pvs = g_new0 (StoragePvRecord, model->n_pvs);
+      for (i = 0; i < model->n_pvs; i++)
+        {
+          child = g_variant_get_child_value (list, i);
+          hash = decode_pv (&model->pvs[i], child, hash);
+          g_variant_unref (child);
+        }
+      g_variant_unref (list);
+    }
+
+  model->hash = hash_uint64 (hash, model->pvs ? model->n_pvs : G_MAXUINT64);
+  return model;
+}
+
+/**
+ * storage_vg_model_ref:
+ * @model: A #StorageVgModel.
+ *
+ * Returns: @model, with another reference. Thread-safe.
+ */
+StorageVgModel *
+storage_vg_model_ref (StorageVgModel *model)
+{
+  g_atomic_int_inc (&model->ref_count);
+  return model;
+}
+
+/**
+ * storage_vg_model_unref:
+ * @model: A #StorageVgModel.
+ *
+ * Gives up a reference to @model. Thread-safe.
+ */
+void
+storage_vg_model_unref (StorageVgModel *model)
+{
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&model->ref_count))
+    return;
+
+  for (i = 0; i < model->n_lvs; i++)
+    {
+      storage_intern_unref (model->lvs[i].name);
+      storage_intern_unref (model->lvs[i].uuid);
+      storage_intern_unref (model->lvs[i].lv_attr);
+      storage_intern_unref (model->lvs[i].lv_path);
+      storage_intern_unref (model->lvs[i].move_pv);
+      storage_intern_unref (model->lvs[i].pool_lv);
+      storage_intern_unref (model->lvs[i].origin);
+    }
+  for (i = 0; i < model->n_pvs; i++)
+    {
+      storage_intern_unref (model->pvs[i].device);
+      storage_intern_unref (model->pvs[i].uuid);
+    }
+
+  storage_intern_unref (model->name);
+  storage_intern_unref (model->uuid);
+  g_free (model->lvs);
+  g_free (model->pvs);
+  g_free (model);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+add_string (GVariantBuilder *bob,
+            const gchar *key,
+            const gchar *val)
+{
+  if (val)
+    g_variant_builder_add (bob, "{sv}", key, g_variant_new_string (val));
+}
+
+static void
+add_uint64 (GVariantBuilder *bob,
+            const gchar *key,
+            guint64 val,
+            gboolean present)
+{
+  if (present)
+    g_variant_builder_add (bob, "{sv}", key, g_variant_new_uint64 (val));
+}
+
+/**
+ * storage_vg_model_to_variant:
+ * @model: A #StorageVgModel.
+ *
+ * Encodes @model the way storaged-lvm-helper would have reported it,
+ * with the keys that the model keeps.
+ *
+ * Returns: (transfer full): A #GVariant of type a{sv}.
+ */
+GVariant *
+storage_vg_model_to_variant (StorageVgModel *model)
+{
+  GVariantBuilder result;
+  GVariantBuilder list;
+  GVariantBuilder bob;
+  StorageLvRecord *lv;
+  StoragePvRecord *pv;
+  guint i;
+
+  g_variant_builder_init (&result, G_VARIANT_TYPE ("a{sv}"));
+  add_string (&result, "name", model->name);
+  add_string (&result, "uuid", model->uuid);
+  add_uint64 (&result, "size", model->size, model->flags & STORAGE_MODEL_HAS_SIZE);
+  add_uint64 (&result, "free-size", model->free_size, model->flags & STORAGE_MODEL_HAS_FREE_SIZE);
+  add_uint64 (&result, "extent-size", model->extent_size, model->flags & STORAGE_MODEL_HAS_EXTENT_SIZE);
+  add_uint64 (&result, "seqno", model->seqno, model->flags & STORAGE_MODEL_HAS_SEQNO);
+
+  if (model->lvs)
+    {
+      g_variant_builder_init (&list, G_VARIANT_TYPE ("aa{sv}"));
+      for (i = 0; i < model->n_lvs; i++)
+        {
+          lv = &model->lvs[i];
+          g_variant_builder_init (&bob, G_VARIANT_TYPE ("a{sv}"));
+          add_string (&bob, "name", lv->name);
+          add_string (&bob, "uuid", lv->uuid);
+          add_uint64 (&bob, "size", lv->size, lv->flags & STORAGE_MODEL_HAS_SIZE);
+          add_string (&bob, "lv_attr", lv->lv_attr);
+          add_string (&bob, "lv_path", lv->lv_path);
+          add_string (&bob, "move_pv", lv->move_pv);
+          add_string (&bob, "pool_lv", lv->pool_lv);
+          add_string (&bob, "origin", lv->origin);
+          add_uint64 (&bob, "data_percent", lv->data_percent, lv->flags & STORAGE_MODEL_HAS_DATA_PERCENT);
+          add_uint64 (&bob, "metadata_percent", lv->metadata_percent,
+                      lv->flags & STORAGE_MODEL_HAS_METADATA_PERCENT);
+          add_uint64 (&bob, "copy_percent", lv->copy_percent, lv->flags & STORAGE_MODEL_HAS_COPY_PERCENT);
+          g_variant_builder_add (&list, "@a{sv}", g_variant_builder_end (&bob));
+        }
+      g_variant_builder_add (&result, "{sv}", "lvs", g_variant_builder_end (&list));
+    }
+
+  if (model->pvs)
+    {
+      g_variant_builder_init (&list, G_VARIANT_TYPE ("aa{sv}"));
+      for (i = 0; i < model->n_pvs; i++)
+        {
+          pv = &model->pvs[i];
+          g_variant_builder_init (&bob, G_VARIANT_TYPE ("a{sv}"));
+          add_string (&bob, "device", pv->device);
+          add_string (&bob, "uuid", pv->uuid);
+          add_uint64 (&bob, "size", pv->size, pv->flags & STORAGE_MODEL_HAS_SIZE);
+          add_uint64 (&bob, "free-size", pv->free_size, pv->flags & STORAGE_MODEL_HAS_FREE_SIZE);
+          g_variant_builder_add (&list, "@a{sv}", g_variant_builder_end (&bob));
+        }
+      g_variant_builder_add (&result, "{sv}", "pvs", g_variant_builder_end (&list));
+    }
+
+  if (model->flags & STORAGE_MODEL_HAS_LOCKED)
+    g_variant_builder_add (&result, "{sv}", "locked",
+                           g_variant_new_boolean ((model->flags & STORAGE_MODEL_LOCKED) != 0));
+
+  return g_variant_ref_sink (g_variant_builder_end (&result));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * storage_vg_model_find_pv:
+ * @model: A #StorageVgModel.
+ * @device: A device file, such as /dev/sda.
+ *
+ * Returns: The physical volume on @device, or %NULL.
+ */
+const StoragePvRecord *
+storage_vg_model_find_pv (StorageVgModel *model,
+                          const gchar *device)
+{
+  guint i;
+
+  /* There are only ever a few */
+  for (i = 0; i < model->n_pvs; i++)
+    {
+      if (g_strcmp0 (model->pvs[i].device, device) == 0)
+        return &model->pvs[i];
+    }
+  return NULL;
+}
+
+/**
+ * storage_lv_record_needs_polling:
+ * @lv: A #StorageLvRecord.
+ *
+ * Returns: %TRUE if @lv is a thin pool or thin volume, whose usage
+ *   changes without LVM telling us.
+ */
+gboolean
+storage_lv_record_needs_polling (const StorageLvRecord *lv)
+{
+  return lv->lv_attr && strlen (lv->lv_attr) > 6 && lv->lv_attr[6] == 't';
+}
+
+static gboolean
+number_differs (const StorageLvRecord *a,
+                const StorageLvRecord *b,
+                guint64 num_a,
+                guint64 num_b,
+                StorageModelFlags flag)
+{
+  return (a->flags & flag) != (b->flags & flag) || num_a != num_b;
+}
+
+/**
+ * storage_lv_record_compare:
+ * @a: A #StorageLvRecord.
+ * @b: Another #StorageLvRecord.
+ *
+ * Returns: The fields that differ between @a and @b, 0 if none.
+ */
+StorageLvFields
+storage_lv_record_compare (const StorageLvRecord *a,
+                           const StorageLvRecord *b)
+{
+  StorageLvFields fields = 0;
+
+  /* Interned, so equal strings are the same pointer */
+  if (a->uuid != b->uuid)
+    fields |= STORAGE_LV_FIELD_UUID;
+  if (number_differs (a, b, a->size, b->size, STORAGE_MODEL_HAS_SIZE))
+    fields |= STORAGE_LV_FIELD_SIZE;
+  if (a->lv_attr != b->lv_attr)
+    fields |= STORAGE_LV_FIELD_ATTR;
+  if (a->lv_path != b->lv_path)
+    fields |= STORAGE_LV_FIELD_PATH;
+  if (a->move_pv != b->move_pv)
+    fields |= STORAGE_LV_FIELD_MOVE_PV;
+  if (a->pool_lv != b->pool_lv)
+    fields |= STORAGE_LV_FIELD_POOL;
+  if (a->origin != b->origin)
+    fields |= STORAGE_LV_FIELD_ORIGIN;
+  if (number_differs (a, b, a->data_percent, b->data_percent, STORAGE_MODEL_HAS_DATA_PERCENT))
+    fields |= STORAGE_LV_FIELD_DATA_PERCENT;
+  if (number_differs (a, b, a->metadata_percent, b->metadata_percent, STORAGE_MODEL_HAS_METADATA_PERCENT))
+    fields |= STORAGE_LV_FIELD_METADATA_PERCENT;
+  if (number_differs (a, b, a->copy_percent, b->copy_percent, STORAGE_MODEL_HAS_COPY_PERCENT))
+    fields |= STORAGE_LV_FIELD_COPY_PERCENT;
+
+  return fields;
+}
+
+static gboolean
+pv_record_equal (const StoragePvRecord *a,
+                 const StoragePvRecord *b)
+{
+  return (a->device == b->device
+          && a->uuid == b->uuid
+          && a->size == b->size
+          && a->free_size == b->free_size
+          && a->flags == b->flags);
+}
+
+/**
+ * storage_vg_model_equal:
+ * @a: A #StorageVgModel.
+ * @b: Another #StorageVgModel.
+ *
+ * Compares every field of @a and @b. Models with different hashes are
+ * known to differ, but equal hashes might still be a collision.
+ *
+ * Returns: %TRUE if @a and @b describe the same volume group.
+ */
+gboolean
+storage_vg_model_equal (StorageVgModel *a,
+                        StorageVgModel *b)
+{
+  guint i;
+
+  if (a == b)
+    return TRUE;
+
+  if (a->hash != b->hash
+      || a->name != b->name
+      || a->uuid != b->uuid
+      || a->size != b->size
+      || a->free_size != b->free_size
+      || a->extent_size != b->extent_size
+      || a->seqno != b->seqno
+      || a->flags != b->flags
+      || a->n_lvs != b->n_lvs
+      || a->n_pvs != b->n_pvs)
+    return FALSE;
+
+  for (i = 0; i < a->n_lvs; i++)
+    {
+      if (a->lvs[i].name != b->lvs[i].name
+          || a->lvs[i].flags != b->lvs[i].flags
+          || storage_lv_record_compare (&a->lvs[i], &b->lvs[i]) != 0)
+        return FALSE;
+    }
+
+  for (i = 0; i < a->n_pvs; i++)
+    {
+      if (!pv_record_equal (&a->pvs[i], &b->pvs[i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,165 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __STORAGE_VG_MODEL_H__
+#define __STORAGE_VG_MODEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * StorageModelFlags:
+ * @STORAGE_MODEL_HAS_SIZE: The size is known.
+ * @STORAGE_MODEL_HAS_FREE_SIZE: The free size is known.
+ * @STORAGE_MODEL_HAS_EXTENT_SIZE: The extent size is known.
+ * @STORAGE_MODEL_HAS_SEQNO: The sequence number is known.
+ * @STORAGE_MODEL_HAS_LOCKED: Whether the volume group was locked is known.
+ * @STORAGE_MODEL_LOCKED: The volume group was locked while it was read.
+ * @STORAGE_MODEL_HAS_DATA_PERCENT: The data usage is known.
+ * @STORAGE_MODEL_HAS_METADATA_PERCENT: The metadata usage is known.
+ * @STORAGE_MODEL_HAS_COPY_PERCENT: The copy progress is known.
+ *
+ * Which of the numbers in a record were in the helper output.
+ */
+typedef enum {
+  STORAGE_MODEL_HAS_SIZE             = 1 << 0,
+  STORAGE_MODEL_HAS_FREE_SIZE        = 1 << 1,
+  STORAGE_MODEL_HAS_EXTENT_SIZE      = 1 << 2,
+  STORAGE_MODEL_HAS_SEQNO            = 1 << 3,
+  STORAGE_MODEL_HAS_LOCKED           = 1 << 4,
+  STORAGE_MODEL_LOCKED               = 1 << 5,
+  STORAGE_MODEL_HAS_DATA_PERCENT     = 1 << 6,
+  STORAGE_MODEL_HAS_METADATA_PERCENT = 1 << 7,
+  STORAGE_MODEL_HAS_COPY_PERCENT     = 1 << 8,
+} StorageModelFlags;
+
+/**
+ * StorageLvFields:
+ * @STORAGE_LV_FIELD_UUID: The uuid.
+ * @STORAGE_LV_FIELD_SIZE: The size.
+ * @STORAGE_LV_FIELD_ATTR: The attributes, and so the type and state.
+ * @STORAGE_LV_FIELD_PATH: The device file.
+ * @STORAGE_LV_FIELD_MOVE_PV: The physical volume that is being moved.
+ * @STORAGE_LV_FIELD_POOL: The thin pool.
+ * @STORAGE_LV_FIELD_ORIGIN: The origin of a snapshot.
+ * @STORAGE_LV_FIELD_DATA_PERCENT: The data usage.
+ * @STORAGE_LV_FIELD_METADATA_PERCENT: The metadata usage.
+ * @STORAGE_LV_FIELD_COPY_PERCENT: The copy progress.
+ * @STORAGE_LV_FIELD_ALL: All of them.
+ *
+ * The fields in which two #StorageLvRecord differ.
+ */
+typedef enum {
+  STORAGE_LV_FIELD_UUID              = 1 << 0,
+  STORAGE_LV_FIELD_SIZE              = 1 << 1,
+  STORAGE_LV_FIELD_ATTR              = 1 << 2,
+  STORAGE_LV_FIELD_PATH              = 1 << 3,
+  STORAGE_LV_FIELD_MOVE_PV           = 1 << 4,
+  STORAGE_LV_FIELD_POOL              = 1 << 5,
+  STORAGE_LV_FIELD_ORIGIN            = 1 << 6,
+  STORAGE_LV_FIELD_DATA_PERCENT      = 1 << 7,
+  STORAGE_LV_FIELD_METADATA_PERCENT  = 1 << 8,
+  STORAGE_LV_FIELD_COPY_PERCENT      = 1 << 9,
+  STORAGE_LV_FIELD_ALL               = (1 << 10) - 1,
+} StorageLvFields;
+
+/**
+ * StorageLvRecord:
+ *
+ * One logical volume as reported by storaged-lvm-helper.  The strings
+ * are interned, and %NULL when they weren't reported.
+ */
+typedef struct {
+  const gchar *name;
+  const gchar *uuid;
+  const gchar *lv_attr;
+  const gchar *lv_path;
+  const gchar *move_pv;
+  const gchar *pool_lv;
+  const gchar *origin;
+  guint64 size;
+  guint64 data_percent;
+  guint64 metadata_percent;
+  guint64 copy_percent;
+  StorageModelFlags flags;
+} StorageLvRecord;
+
+/**
+ * StoragePvRecord:
+ *
+ * One physical volume as reported by storaged-lvm-helper.
+ */
+typedef struct {
+  const gchar *device;
+  const gchar *uuid;
+  guint64 size;
+  guint64 free_size;
+  StorageModelFlags flags;
+} StoragePvRecord;
+
+/**
+ * StorageVgModel:
+ * @hash: Changes whenever anything else does.
+ *
+ * A volume group as reported by storaged-lvm-helper, decoded.  It is
+ * never changed once made, and so can be passed between threads.
+ */
+typedef struct {
+  gint ref_count;
+  guint64 hash;
+  const gchar *name;
+  const gchar *uuid;
+  guint64 size;
+  guint64 free_size;
+  guint64 extent_size;
+  guint64 seqno;
+  StorageModelFlags flags;
+
+  guint n_lvs;
+  StorageLvRecord *lvs;
+  guint n_pvs;
+  StoragePvRecord *pvs;
+} StorageVgModel;
+
+StorageVgModel *       storage_vg_model_new            (GVariant *info);
+
+StorageVgModel *       storage_vg_model_ref            (StorageVgModel *model);
+
+void                   storage_vg_model_unref          (StorageVgModel *model);
+
+GVariant *             storage_vg_model_to_variant     (StorageVgModel *model);
+
+gboolean               storage_vg_model_equal          (StorageVgModel *a,
+                                                        StorageVgModel *b);
+
+const StoragePvRecord *storage_vg_model_find_pv        (StorageVgModel *model,
+                                                        const gchar *device);
+
+gboolean               storage_lv_record_needs_polling (const StorageLvRecord *lv);
+
+StorageLvFields        storage_lv_record_compare       (const StorageLvRecord *a,
+                                                        const StorageLvRecord *b);
+
+G_END_DECLS
+
+#endif /* __STORAGE_VG_MODEL_H__ */
@@ -25,15 +25,26 @@
 
 #include "block.h"
 #include "daemon.h"
+#include "intern.h"
 #include "invocation.h"
+#include "jobpolicy.h"
 #include "logicalvolume.h"
 #include "manager.h"
+#include "process.h"
+#include "stats.h"
+#include "threadedjob.h"
 #include "util.h"
+#include "vgmodel.h"
 
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
 
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
 #include <string.h>
@@ -64,14 +75,21 @@ struct _StorageVolumeGroup
 
   StorageManager *manager;
 
-  gchar *name;
+  const gchar *name;
   gboolean need_publish;
 
-  GVariant *info;                 // output of storaged-lvm-helper
-  GHashTable *logical_volumes;    // lv name -> StorageLogicalVolume
-  GHashTable *physical_volumes;   // device path -> GVariant *, output of storaged-lvm-helper
+  StorageVgModel *model;          // decoded output of storaged-lvm-helper
+  GVariant *report;               // the output itself, only with keep_reports
+  gboolean incomplete;            // model doesn't match logical_volumes after a poll
+  GHashTable *logical_volumes;    // interned lv name -> StorageLogicalVolume
+
+  GQueue reports;                 // struct ReportData, waiting to be decoded
+  gboolean decoding;
+
+  gboolean possibly_stale;        // last update ignored locks and wasn't verified
 
   GPid poll_pid;
+  gint64 poll_start;
   guint poll_timeout_id;
   gboolean poll_requested;
 };
@@ -94,15 +112,18 @@ G_DEFINE_TYPE_WITH_CODE (StorageVolumeGroup, storage_volume_group, LVM_TYPE_VOLU
                          G_IMPLEMENT_INTERFACE (LVM_TYPE_VOLUME_GROUP, volume_group_iface_init)
 );
 
+/* See storage_volume_group_set_keep_reports() */
+static gboolean keep_reports = FALSE;
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
 storage_volume_group_init (StorageVolumeGroup *self)
 {
-  self->logical_volumes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+  self->logical_volumes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 (GDestroyNotify) storage_intern_unref,
                                                  (GDestroyNotify) g_object_unref);
-  self->physical_volumes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-                                                  (GDestroyNotify) g_variant_unref);
+  g_queue_init (&self->reports);
   self->need_publish = TRUE;
 }
 
@@ -123,12 +144,16 @@ storage_volume_group_dispose (GObject *obj)
   while (g_hash_table_iter_next (&iter, NULL, &value))
       g_object_run_dispose (value);
   g_hash_table_remove_all (self->logical_volumes);
-  g_hash_table_remove_all (self->physical_volumes);
 
-  if (self->info)
+  if (self->model)
     {
-      g_variant_unref (self->info);
-      self->info = NULL;
+      storage_vg_model_unref (self->model);
+      self->model = NULL;
+    }
+  if (self->report)
+    {
+      g_variant_unref (self->report);
+      self->report = NULL;
     }
 
   update_all_blocks (self);
@@ -146,7 +171,7 @@ storage_volume_group_finalize (GObject *obj)
   StorageVolumeGroup *self = STORAGE_VOLUME_GROUP (obj);
 
   g_hash_table_unref (self->logical_volumes);
-  g_free (self->name);
+  storage_intern_unref (self->name);
 
   G_OBJECT_CLASS (storage_volume_group_parent_class)->finalize (obj);
 }
@@ -186,8 +211,8 @@ storage_volume_group_set_property (GObject *obj,
   switch (prop_id)
     {
     case PROP_NAME:
-      g_free (self->name);
-      self->name = g_value_dup_string (value);
+      storage_intern_unref (self->name);
+      self->name = storage_intern (g_value_get_string (value));
       break;
 
     case PROP_MANAGER:
@@ -270,24 +295,21 @@ storage_volume_group_new (StorageManager *manager,
  */
 static void
 volume_group_update_props (StorageVolumeGroup *self,
-                           GVariant *info,
-                           gboolean *needs_polling_ret)
+                           StorageVgModel *model)
 {
   LvmVolumeGroup *iface = LVM_VOLUME_GROUP (self);
-  const gchar *str;
-  guint64 num;
 
-  if (g_variant_lookup (info, "uuid", "&s", &str))
-    lvm_volume_group_set_uuid (iface, str);
+  if (model->uuid)
+    lvm_volume_group_set_uuid (iface, model->uuid);
 
-  if (g_variant_lookup (info, "size", "t", &num))
-    lvm_volume_group_set_size (iface, num);
+  if (model->flags & STORAGE_MODEL_HAS_SIZE)
+    lvm_volume_group_set_size (iface, model->size);
 
-  if (g_variant_lookup (info, "free-size", "t", &num))
-    lvm_volume_group_set_free_size (iface, num);
+  if (model->flags & STORAGE_MODEL_HAS_FREE_SIZE)
+    lvm_volume_group_set_free_size (iface, model->free_size);
 
-  if (g_variant_lookup (info, "extent-size", "t", &num))
-    lvm_volume_group_set_extent_size (iface, num);
+  if (model->flags & STORAGE_MODEL_HAS_EXTENT_SIZE)
+    lvm_volume_group_set_extent_size (iface, model->extent_size);
 }
 
 static gboolean
@@ -302,6 +324,43 @@ lv_is_visible (const gchar *name)
   return name && !storage_util_lvm_name_is_reserved (name);
 }
 
+/*
+ * EmptyDevice can move the logical volumes off a physical volume one
+ * at a time with "pvmove -n", several of them concurrently. Each of
+ * those has a pvmove volume of its own, and the progress that polling
+ * finds for them is combined here into the progress of the one job.
+ */
+typedef struct {
+  gchar *device;
+  guint parallel;
+
+  GMutex mutex;
+  guint64 total;      /* extents in use when we started */
+  guint64 done;       /* extents of the volumes that have been moved */
+  guint64 running;    /* extents of the volumes being moved right now */
+  gdouble progress;
+} VolumeGroupEmptyJobData;
+
+static gdouble
+volume_group_empty_job_progress (VolumeGroupEmptyJobData *data,
+                                 gdouble moving)
+{
+  gdouble progress;
+
+  g_mutex_lock (&data->mutex);
+  if (data->total > 0)
+    progress = (data->done + data->running * moving) / (gdouble) data->total;
+  else
+    progress = moving;
+
+  /* pvmove volumes come and go, don't let that show as going backwards */
+  data->progress = MAX (data->progress, MIN (progress, 1.0));
+  progress = data->progress;
+  g_mutex_unlock (&data->mutex);
+
+  return progress;
+}
+
 static void
 update_progress_for_device (const gchar *operation,
                             const gchar *dev,
@@ -356,7 +415,14 @@ update_progress_for_device (const gchar *operation,
 
           if (found)
             {
-              udisks_job_set_progress (job, progress);
+              VolumeGroupEmptyJobData *empty;
+              gdouble job_progress = progress;
+
+              empty = g_object_get_data (G_OBJECT (job), "storage-empty-job-data");
+              if (empty != NULL)
+                job_progress = volume_group_empty_job_progress (empty, progress);
+
+              udisks_job_set_progress (job, job_progress);
               udisks_job_set_progress_valid (job, TRUE);
             }
         }
@@ -365,25 +431,46 @@ update_progress_for_device (const gchar *operation,
   g_list_free_full (jobs, g_object_unref);
 }
 
+typedef struct {
+  gdouble sum;
+  guint count;
+} MoveProgress;
+
 static void
-update_operations (const gchar *lv_name,
-                   GVariant *lv_info,
-                   gboolean *needs_polling_ret)
+update_operations (GHashTable *moves,
+                   const StorageLvRecord *lv)
 {
-  const gchar *move_pv;
-  guint64 copy_percent;
+  MoveProgress *move;
 
-  if (lv_is_pvmove_volume (lv_name)
-      && g_variant_lookup (lv_info, "move_pv", "&s", &move_pv)
-      && g_variant_lookup (lv_info, "copy_percent", "t", &copy_percent))
+  if (lv_is_pvmove_volume (lv->name)
+      && lv->move_pv
+      && (lv->flags & STORAGE_MODEL_HAS_COPY_PERCENT))
     {
-      update_progress_for_device ("lvm-vg-empty-device",
-                                  move_pv,
-                                  copy_percent/100000000.0);
-      *needs_polling_ret = TRUE;
+      /* There is more than one pvmove volume per device when moving in parallel */
+      move = g_hash_table_lookup (moves, lv->move_pv);
+      if (move == NULL)
+        {
+          move = g_new0 (MoveProgress, 1);
+          g_hash_table_insert (moves, g_strdup (lv->move_pv), move);
+        }
+      move->sum += lv->copy_percent/100000000.0;
+      move->count++;
     }
 }
 
+static void
+update_operations_finish (GHashTable *moves)
+{
+  GHashTableIter iter;
+  MoveProgress *move;
+  const gchar *dev;
+
+  g_hash_table_iter_init (&iter, moves);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&dev, (gpointer *)&move))
+    update_progress_for_device ("lvm-vg-empty-device", dev, move->sum / move->count);
+  g_hash_table_unref (moves);
+}
+
 
 void
 storage_volume_group_update_block (StorageVolumeGroup *self,
@@ -394,7 +481,7 @@ storage_volume_group_update_block (StorageVolumeGroup *self,
   StorageLogicalVolume *volume;
   const gchar *block_vg_name;
   const gchar *block_lv_name;
-  GVariant *pv_info;
+  const StoragePvRecord *pv = NULL;
 
   device = storage_block_get_udev (block);
   if (device)
@@ -410,23 +497,24 @@ storage_volume_group_update_block (StorageVolumeGroup *self,
       g_object_unref (device);
     }
 
-  pv_info = g_hash_table_lookup (self->physical_volumes, storage_block_get_device (block));
-  if (!pv_info)
+  if (self->model)
+    pv = storage_vg_model_find_pv (self->model, storage_block_get_device (block));
+  if (self->model && !pv)
     {
       const gchar *const *symlinks;
       int i;
       symlinks = storage_block_get_symlinks (block);
       for (i = 0; symlinks[i]; i++)
         {
-          pv_info = g_hash_table_lookup (self->physical_volumes, symlinks[i]);
-          if (pv_info)
+          pv = storage_vg_model_find_pv (self->model, symlinks[i]);
+          if (pv)
             break;
         }
     }
 
-  if (pv_info)
+  if (pv)
     {
-      storage_block_update_pv (block, self, pv_info);
+      storage_block_update_pv (block, self, pv);
     }
   else
     {
@@ -448,32 +536,340 @@ update_all_blocks (StorageVolumeGroup *self)
   g_list_free_full (blocks, g_object_unref);
 }
 
-struct UpdateData {
+static void
+update_check_consistency (StorageVolumeGroup *self,
+                          gboolean ignore_locks,
+                          StorageVgModel *model,
+                          GError *error)
+{
+  guint64 seqno = 0;
+
+  if (model)
+    seqno = model->seqno;
+
+  /* Data read while ignoring locks is only trustworthy if the helper
+     could verify that nobody was writing to the volume group at the
+     time.  An older helper doesn't tell us, so assume the worst.
+  */
+  if (ignore_locks)
+    {
+      self->possibly_stale = (error != NULL
+                              || !(model->flags & STORAGE_MODEL_HAS_LOCKED)
+                              || (model->flags & STORAGE_MODEL_LOCKED));
+    }
+  else if (error == NULL)
+    {
+      self->possibly_stale = FALSE;
+    }
+
+  if (self->possibly_stale)
+    g_debug ("%s might be stale (seqno %" G_GUINT64_FORMAT ")", self->name, seqno);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/*
+ * Decoding a report of the helper and comparing it with the current
+ * model takes time in proportion to the size of the volume group, and
+ * would hold up D-Bus for a large one.  So that happens in a worker
+ * thread, which produces a VolumeGroupChanges.  The main thread then
+ * only applies those to the logical volumes, in time proportional to
+ * the number of changes.
+ *
+ * Reports are decoded one at a time per volume group and in the order
+ * they arrive, so that the model that the worker compared with is still
+ * the current one when the changes are applied.
+ */
+
+/* What a StorageLogicalVolume shows; the others only matter for jobs */
+#define LV_OBJECT_FIELDS  (STORAGE_LV_FIELD_ALL & ~(STORAGE_LV_FIELD_MOVE_PV | STORAGE_LV_FIELD_COPY_PERCENT))
+
+typedef struct {
+  guint index;                    // into model->lvs
+  StorageLvFields fields;         // those that differ from the old model
+} LvChange;
+
+typedef struct {
+  StorageVgModel *model;
+  gboolean full;                  // nothing to compare with, all visible lvs are added
+  GArray *added;                  // LvChange, visible lvs that are new
+  GArray *changed;                // LvChange
+  GPtrArray *removed;             // interned names of visible lvs that are gone
+  GArray *relinked;               // guint, lvs whose thin pool or origin is added
+  GArray *moves;                  // guint, pvmove volumes
+  gboolean needs_polling;
+} VolumeGroupChanges;
+
+struct ReportData {
   StorageVolumeGroup *self;
+  GVariant *info;
+  GError *error;
+  gboolean complete;              // an update, not a poll
+  gboolean ignore_locks;
+  gboolean from_snapshot;
   StorageVolumeGroupCallback *done;
   gpointer done_user_data;
+
+  StorageVgModel *base;           // the model to compare with, or NULL
+  VolumeGroupChanges *changes;
 };
 
 static void
-update_with_variant (GPid pid,
-                     GVariant *info,
-                     GError *error,
-                     gpointer user_data)
+volume_group_changes_free (VolumeGroupChanges *changes)
 {
-  struct UpdateData *data = user_data;
-  StorageVolumeGroup *self = data->self;
-  GVariantIter *iter;
+  storage_vg_model_unref (changes->model);
+  g_array_unref (changes->added);
+  g_array_unref (changes->changed);
+  g_ptr_array_unref (changes->removed);
+  g_array_unref (changes->relinked);
+  g_array_unref (changes->moves);
+  g_free (changes);
+}
+
+static void
+report_data_free (struct ReportData *data)
+{
+  if (data->info)
+    g_variant_unref (data->info);
+  if (data->error)
+    g_error_free (data->error);
+  if (data->base)
+    storage_vg_model_unref (data->base);
+  if (data->changes)
+    volume_group_changes_free (data->changes);
+  g_object_unref (data->self);
+  g_free (data);
+}
+
+/* Runs in a worker thread, or for a snapshot on the main one, and must only look at its arguments */
+static VolumeGroupChanges *
+volume_group_changes_new (StorageVgModel *base,
+                          GVariant *info)
+{
+  VolumeGroupChanges *changes;
+  StorageVgModel *model;
+  GHashTable *old_records;
+  GHashTable *new_names;
+  GHashTable *added_names;
+  const StorageLvRecord *lv;
+  const StorageLvRecord *old;
+  LvChange change;
+  guint i;
+
+  model = storage_vg_model_new (info);
+
+  changes = g_new0 (VolumeGroupChanges, 1);
+  changes->model = model;
+  changes->full = (base == NULL);
+  changes->added = g_array_new (FALSE, FALSE, sizeof (LvChange));
+  changes->changed = g_array_new (FALSE, FALSE, sizeof (LvChange));
+  changes->removed = g_ptr_array_new_with_free_func ((GDestroyNotify) storage_intern_unref);
+  changes->relinked = g_array_new (FALSE, FALSE, sizeof (guint));
+  changes->moves = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  old_records = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; base && i < base->n_lvs; i++)
+    {
+      if (base->lvs[i].name)
+        g_hash_table_insert (old_records, (gchar *)base->lvs[i].name, &base->lvs[i]);
+    }
+
+  new_names = g_hash_table_new (g_str_hash, g_str_equal);
+  added_names = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < model->n_lvs; i++)
+    {
+      lv = &model->lvs[i];
+
+      if (lv_is_pvmove_volume (lv->name))
+        {
+          changes->needs_polling = TRUE;
+          g_array_append_val (changes->moves, i);
+        }
+
+      if (!lv_is_visible (lv->name))
+        continue;
+
+      /* Even when the logical volume itself doesn't change */
+      if (storage_lv_record_needs_polling (lv))
+        changes->needs_polling = TRUE;
+
+      g_hash_table_add (new_names, (gchar *)lv->name);
+
+      change.index = i;
+      old = g_hash_table_lookup (old_records, lv->name);
+      if (old == NULL)
+        {
+          change.fields = STORAGE_LV_FIELD_ALL;
+          g_array_append_val (changes->added, change);
+          g_hash_table_add (added_names, (gchar *)lv->name);
+        }
+      else
+        {
+          change.fields = storage_lv_record_compare (old, lv);
+          if (change.fields & LV_OBJECT_FIELDS)
+            g_array_append_val (changes->changed, change);
+        }
+    }
+
+  /* Thin volumes and snapshots that may be added before their pool or origin */
+  for (i = 0; g_hash_table_size (added_names) > 0 && i < model->n_lvs; i++)
+    {
+      lv = &model->lvs[i];
+      if (lv_is_visible (lv->name)
+          && ((lv->pool_lv && g_hash_table_contains (added_names, lv->pool_lv))
+              || (lv->origin && g_hash_table_contains (added_names, lv->origin))))
+        g_array_append_val (changes->relinked, i);
+    }
+
+  for (i = 0; base && i < base->n_lvs; i++)
+    {
+      lv = &base->lvs[i];
+      if (lv_is_visible (lv->name) && !g_hash_table_contains (new_names, lv->name))
+        g_ptr_array_add (changes->removed, (gchar *)storage_intern_ref (lv->name));
+    }
+
+  g_hash_table_unref (old_records);
+  g_hash_table_unref (new_names);
+  g_hash_table_unref (added_names);
+  return changes;
+}
+
+static void
+apply_lv_record (StorageVolumeGroup *self,
+                 const StorageLvRecord *lv,
+                 gboolean complete,
+                 gboolean *incomplete_ret)
+{
+  StorageLogicalVolume *volume;
+
+  volume = g_hash_table_lookup (self->logical_volumes, lv->name);
+  if (volume)
+    {
+      storage_logical_volume_update (volume, self, lv);
+    }
+  else if (complete)
+    {
+      volume = storage_logical_volume_new (self, lv->name);
+      storage_logical_volume_update (volume, self, lv);
+
+      g_hash_table_insert (self->logical_volumes,
+                           (gchar *)storage_intern_ref (storage_logical_volume_get_name (volume)),
+                           g_object_ref (volume));
+    }
+  else
+    {
+      /* A poll doesn't add logical volumes, the next update will */
+      *incomplete_ret = TRUE;
+    }
+}
+
+/*
+ * Brings the logical volumes in line with @changes.  With @complete,
+ * logical volumes are also added and removed, a poll only updates those
+ * that are there.  Returns whether the logical volumes don't match the
+ * model of @changes afterwards.
+ */
+static gboolean
+apply_changes (StorageVolumeGroup *self,
+               VolumeGroupChanges *changes,
+               gboolean complete)
+{
+  StorageVgModel *model = changes->model;
   GHashTableIter volume_iter;
   gpointer key, value;
-  GHashTable *new_lvs;
-  gboolean needs_polling = FALSE;
+  GHashTable *moves;
+  GHashTable *names;
+  StorageLogicalVolume *volume;
+  gboolean incomplete = FALSE;
+  guint i;
+
+  moves = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  for (i = 0; i < changes->moves->len; i++)
+    update_operations (moves, &model->lvs[g_array_index (changes->moves, guint, i)]);
+  update_operations_finish (moves);
+
+  for (i = 0; i < changes->added->len; i++)
+    apply_lv_record (self, &model->lvs[g_array_index (changes->added, LvChange, i).index],
+                     complete, &incomplete);
+
+  for (i = 0; i < changes->changed->len; i++)
+    apply_lv_record (self, &model->lvs[g_array_index (changes->changed, LvChange, i).index],
+                     complete, &incomplete);
+
+  for (i = 0; i < changes->relinked->len; i++)
+    apply_lv_record (self, &model->lvs[g_array_index (changes->relinked, guint, i)],
+                     complete, &incomplete);
+
+  if (!complete)
+    {
+      if (changes->full || changes->removed->len > 0)
+        incomplete = TRUE;
+    }
+  else if (changes->full)
+    {
+      /* Nothing to compare with, so look at every logical volume */
+      names = g_hash_table_new (g_str_hash, g_str_equal);
+      for (i = 0; i < changes->added->len; i++)
+        g_hash_table_add (names, (gchar *)model->lvs[g_array_index (changes->added, LvChange, i).index].name);
+
+      g_hash_table_iter_init (&volume_iter, self->logical_volumes);
+      while (g_hash_table_iter_next (&volume_iter, &key, &value))
+        {
+          if (!g_hash_table_contains (names, key))
+            {
+              /* Volume unpublishes itself */
+              g_object_run_dispose (G_OBJECT (value));
+              g_hash_table_iter_remove (&volume_iter);
+            }
+        }
+      g_hash_table_unref (names);
+    }
+  else
+    {
+      for (i = 0; i < changes->removed->len; i++)
+        {
+          volume = g_hash_table_lookup (self->logical_volumes, g_ptr_array_index (changes->removed, i));
+          if (volume)
+            {
+              g_object_run_dispose (G_OBJECT (volume));
+              g_hash_table_remove (self->logical_volumes, g_ptr_array_index (changes->removed, i));
+            }
+        }
+    }
+
+  return incomplete;
+}
+
+static void
+replace_model (StorageVolumeGroup *self,
+               StorageVgModel *model)
+{
+  if (self->model)
+    storage_vg_model_unref (self->model);
+  self->model = storage_vg_model_ref (model);
+}
+
+static void
+apply_update (StorageVolumeGroup *self,
+              struct ReportData *data)
+{
+  VolumeGroupChanges *changes = data->changes;
+  StorageVgModel *model = NULL;
   StorageDaemon *daemon;
   gchar *path;
 
   daemon = storage_daemon_get ();
 
-  if (!error)
-      volume_group_update_props (self, info, &needs_polling);
+  if (changes)
+    model = changes->model;
+
+  update_check_consistency (self, data->ignore_locks, model, data->error);
+  if (data->from_snapshot)
+    self->possibly_stale = TRUE;
+
+  if (model)
+      volume_group_update_props (self, model);
 
   /* After basic props, publish group, if not already done */
   if (self->need_publish)
@@ -485,103 +881,145 @@ update_with_variant (GPid pid,
       g_free (path);
     }
 
-  if (error)
+  if (data->error)
     {
       g_message ("Failed to update LVM volume group %s: %s",
-                 storage_volume_group_get_name (self), error->message);
-      g_object_unref (self);
+                 storage_volume_group_get_name (self), data->error->message);
       return;
     }
 
-  if (self->info && g_variant_equal (self->info, info))
+  if (keep_reports)
+    {
+      if (self->report)
+        g_variant_unref (self->report);
+      self->report = g_variant_ref (data->info);
+    }
+
+  /* The hash only tells quickly that something changed, not that nothing did */
+  if (data->base && storage_vg_model_equal (data->base, model))
     {
       g_debug ("%s updated without changes", self->name);
-      g_object_unref (self);
       return;
     }
 
-  if (self->info)
-    g_variant_unref (self->info);
-  self->info = g_variant_ref (info);
+  if (!data->from_snapshot)
+    storage_manager_schedule_snapshot (self->manager);
 
-  new_lvs = g_hash_table_new (g_str_hash, g_str_equal);
+  apply_changes (self, changes, TRUE);
+  lvm_volume_group_set_needs_polling (LVM_VOLUME_GROUP (self), changes->needs_polling);
 
-  if (g_variant_lookup (info, "lvs", "aa{sv}", &iter))
-    {
-      GVariant *lv_info = NULL;
-      while (g_variant_iter_loop (iter, "@a{sv}", &lv_info))
-        {
-          const gchar *name;
-          StorageLogicalVolume *volume;
-
-          g_variant_lookup (lv_info, "name", "&s", &name);
+  replace_model (self, model);
+  self->incomplete = FALSE;
 
-          update_operations (name, lv_info, &needs_polling);
+  /* Make sure above is published before updating blocks to point at volume group */
+  update_all_blocks (self);
+}
 
-          if (lv_is_pvmove_volume (name))
-            needs_polling = TRUE;
+static void
+apply_poll (StorageVolumeGroup *self,
+            struct ReportData *data)
+{
+  VolumeGroupChanges *changes = data->changes;
 
-          if (!lv_is_visible (name))
-            continue;
+  volume_group_update_props (self, changes->model);
 
-          volume = g_hash_table_lookup (self->logical_volumes, name);
-          if (volume == NULL)
-            {
-              volume = storage_logical_volume_new (self, name);
-              storage_logical_volume_update (volume, self, lv_info, &needs_polling);
+  /* What the logical volumes show now, for comparing the next update with */
+  self->incomplete = apply_changes (self, changes, FALSE);
+  replace_model (self, changes->model);
+}
 
-              g_hash_table_insert (self->logical_volumes, g_strdup (name), g_object_ref (volume));
-            }
-          else
-            storage_logical_volume_update (volume, self, lv_info, &needs_polling);
+static void   decode_next_report  (StorageVolumeGroup *self);
 
-          g_hash_table_insert (new_lvs, (gchar *)name, volume);
-        }
-      g_variant_iter_free (iter);
-    }
+static void
+decode_in_thread (GTask *task,
+                  gpointer source_object,
+                  gpointer task_data,
+                  GCancellable *cancellable)
+{
+  struct ReportData *data = task_data;
+  gint64 start;
 
-  g_hash_table_iter_init (&volume_iter, self->logical_volumes);
-  while (g_hash_table_iter_next (&volume_iter, &key, &value))
+  if (data->info)
     {
-      const gchar *name = key;
-      StorageLogicalVolume *volume = value;
-
-      if (!g_hash_table_contains (new_lvs, name))
-        {
-          /* Volume unpublishes itself */
-          g_object_run_dispose (G_OBJECT (volume));
-          g_hash_table_iter_remove (&volume_iter);
-        }
+      start = g_get_monotonic_time ();
+      data->changes = volume_group_changes_new (data->base, data->info);
+      storage_stats_record_since ("vg.decode", start);
     }
 
-  lvm_volume_group_set_needs_polling (LVM_VOLUME_GROUP (self), needs_polling);
+  g_task_return_boolean (task, TRUE);
+}
 
-  /* Update physical volumes. */
+static void
+on_report_decoded (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+  struct ReportData *data = g_task_get_task_data (G_TASK (result));
+  StorageVolumeGroup *self = data->self;
+  gint64 start;
 
-  g_hash_table_remove_all (self->physical_volumes);
+  start = g_get_monotonic_time ();
 
-  if (g_variant_lookup (info, "pvs", "aa{sv}", &iter))
-    {
-      const gchar *name;
-      GVariant *pv_info;
-      while (g_variant_iter_next (iter, "@a{sv}", &pv_info))
-        {
-          if (g_variant_lookup (pv_info, "device", "&s", &name))
-            g_hash_table_insert (self->physical_volumes, g_strdup (name), pv_info);
-          else
-            g_variant_unref (pv_info);
-        }
-    }
+  if (data->complete)
+    apply_update (self, data);
+  else if (data->changes)
+    apply_poll (self, data);
 
-  /* Make sure above is published before updating blocks to point at volume group */
-  update_all_blocks (self);
+  storage_stats_record_since ("vg.apply", start);
 
   if (data->done)
     data->done (self, data->done_user_data);
 
-  g_hash_table_destroy (new_lvs);
-  g_object_unref (self);
-  g_free (data);
+  self->decoding = FALSE;
+  decode_next_report (self);
+}
+
+static void
+decode_next_report (StorageVolumeGroup *self)
+{
+  struct ReportData *data;
+  GTask *task;
+
+  if (self->decoding)
+    return;
+
+  data = g_queue_pop_head (&self->reports);
+  if (data == NULL)
+    return;
+
+  /* After a poll that skipped some, compare with nothing and look at everything */
+  if (self->model && !self->incomplete)
+    data->base = storage_vg_model_ref (self->model);
+
+  self->decoding = TRUE;
+  task = g_task_new (NULL, NULL, on_report_decoded, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify) report_data_free);
+  g_task_run_in_thread (task, decode_in_thread);
+  g_object_unref (task);
+}
+
+static void
+queue_report (StorageVolumeGroup *self,
+              struct ReportData *data)
+{
+  g_queue_push_tail (&self->reports, data);
+  decode_next_report (self);
+}
+
+static void
+update_with_variant (GPid pid,
+                     GVariant *info,
+                     GError *error,
+                     gpointer user_data)
+{
+  struct ReportData *data = user_data;
+
+  if (error)
+    data->error = g_error_copy (error);
+  else
+    data->info = g_variant_ref (info);
+
+  queue_report (data->self, data);
 }
 
 void
@@ -590,10 +1028,15 @@ storage_volume_group_update (StorageVolumeGroup *self,
                              StorageVolumeGroupCallback *done,
                              gpointer done_user_data)
 {
-  struct UpdateData *data;
+  struct ReportData *data;
   const gchar *args[6];
+  gchar *counter;
   int i;
 
+  counter = g_strdup_printf ("vg.refresh.%s", self->name);
+  storage_stats_count (counter, 1);
+  g_free (counter);
+
   i = 0;
   args[i++] = "storaged-lvm-helper";
   args[i++] = "-b";
@@ -603,8 +1046,10 @@ storage_volume_group_update (StorageVolumeGroup *self,
   args[i++] = self->name;
   args[i++] = NULL;
 
-  data = g_new0 (struct UpdateData, 1);
+  data = g_new0 (struct ReportData, 1);
   data->self = g_object_ref (self);
+  data->complete = TRUE;
+  data->ignore_locks = ignore_locks;
   data->done = done;
   data->done_user_data = done_user_data;
 
@@ -612,6 +1057,98 @@ storage_volume_group_update (StorageVolumeGroup *self,
                                     update_with_variant, data);
 }
 
+/**
+ * storage_volume_group_update_from_snapshot:
+ * @self: A #StorageVolumeGroup.
+ * @info: The helper output recorded in the snapshot.
+ *
+ * Publishes the volume group as described by @info right away,
+ * without asking LVM. The volume group counts as possibly
+ * stale until a real update confirms it.
+ */
+void
+storage_volume_group_update_from_snapshot (StorageVolumeGroup *self,
+                                           GVariant *info)
+{
+  struct ReportData *data;
+  gint64 start;
+
+  data = g_new0 (struct ReportData, 1);
+  data->self = g_object_ref (self);
+  data->complete = TRUE;
+  data->ignore_locks = TRUE;
+  data->from_snapshot = TRUE;
+  data->info = g_variant_ref (info);
+
+  /*
+   * Decode and apply this right here on the main thread rather than in
+   * the worker, so that everything in the snapshot is published by the
+   * time the manager says it's ready.
+   */
+  self->possibly_stale = TRUE;
+  if (self->decoding || !g_queue_is_empty (&self->reports))
+    {
+      queue_report (self, data);
+      return;
+    }
+
+  start = g_get_monotonic_time ();
+  data->changes = volume_group_changes_new (NULL, data->info);
+  storage_stats_record_since ("vg.decode", start);
+
+  start = g_get_monotonic_time ();
+  apply_update (self, data);
+  storage_stats_record_since ("vg.apply", start);
+
+  report_data_free (data);
+}
+
+/**
+ * storage_volume_group_get_info:
+ * @self: A #StorageVolumeGroup.
+ *
+ * Returns: (transfer full): The last helper output for this volume
+ * group, as far as the daemon keeps it, or %NULL if it hasn't been
+ * read yet. Free with g_variant_unref().
+ */
+GVariant *
+storage_volume_group_get_info (StorageVolumeGroup *self)
+{
+  if (self->report)
+    return g_variant_ref (self->report);
+  if (self->model)
+    return storage_vg_model_to_variant (self->model);
+  return NULL;
+}
+
+/**
+ * storage_volume_group_set_keep_reports:
+ * @keep: Whether to keep the helper output.
+ *
+ * For debugging: makes volume groups keep the complete output of the
+ * helper from their last update, and storage_volume_group_get_info()
+ * return it, instead of only the decoded #StorageVgModel.  This costs
+ * about as much memory again as the model.
+ */
+void
+storage_volume_group_set_keep_reports (gboolean keep)
+{
+  keep_reports = keep;
+}
+
+/**
+ * storage_volume_group_is_possibly_stale:
+ * @self: A #StorageVolumeGroup.
+ *
+ * Returns: %TRUE if the last update ignored locks and the helper could
+ * not verify that the volume group was read consistently.
+ */
+gboolean
+storage_volume_group_is_possibly_stale (StorageVolumeGroup *self)
+{
+  return self->possibly_stale;
+}
+
 static void
 poll_with_variant (GPid pid,
                    GVariant *info,
@@ -619,8 +1156,7 @@ poll_with_variant (GPid pid,
                    gpointer user_data)
 {
   StorageVolumeGroup *self = user_data;
-  GVariantIter *iter;
-  gboolean needs_polling;
+  struct ReportData *data;
 
   if (pid != self->poll_pid)
     {
@@ -629,6 +1165,7 @@ poll_with_variant (GPid pid,
     }
 
   self->poll_pid = 0;
+  storage_stats_record_since ("vg.poll", self->poll_start);
 
   if (error)
     {
@@ -638,26 +1175,10 @@ poll_with_variant (GPid pid,
       return;
     }
 
-  volume_group_update_props (self, info, &needs_polling);
-
-  if (g_variant_lookup (info, "lvs", "aa{sv}", &iter))
-    {
-      GVariant *lv_info = NULL;
-      while (g_variant_iter_loop (iter, "@a{sv}", &lv_info))
-        {
-          const gchar *name;
-          StorageLogicalVolume *volume;
-
-          g_variant_lookup (lv_info, "name", "&s", &name);
-          update_operations (name, lv_info, &needs_polling);
-          volume = g_hash_table_lookup (self->logical_volumes, name);
-          if (volume)
-            storage_logical_volume_update (volume, self, lv_info, &needs_polling);
-        }
-      g_variant_iter_free (iter);
-    }
-
-  g_object_unref (self);
+  data = g_new0 (struct ReportData, 1);
+  data->self = self;
+  data->info = g_variant_ref (info);
+  queue_report (self, data);
 }
 
 static void   poll_now  (StorageVolumeGroup *self);
@@ -701,9 +1222,13 @@ poll_now (StorageVolumeGroup *self)
   };
 
   self->poll_timeout_id = g_timeout_add (5000, poll_timeout, g_object_ref (self));
+  g_source_set_name_by_id (self->poll_timeout_id, "volume group poll");
 
   if (self->poll_pid)
-    kill (self->poll_pid, SIGINT);
+    storage_daemon_kill_spawned (storage_daemon_get (), self->poll_pid, SIGINT);
+
+  storage_stats_count ("vg.poll.spawned", 1);
+  self->poll_start = g_get_monotonic_time ();
 
   self->poll_pid = storage_daemon_spawn_for_variant (storage_daemon_get (), args, G_VARIANT_TYPE ("a{sv}"),
                                                      poll_with_variant, g_object_ref (self));
@@ -743,9 +1268,26 @@ complete_closure_free (gpointer data,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Progress of discarding one of several devices */
+typedef struct {
+  StorageThreadedJob *job;
+  guint step;
+  guint n_steps;
+} DiscardProgress;
+
+static void
+on_discard_progress (gdouble progress,
+                     gpointer user_data)
+{
+  DiscardProgress *dp = user_data;
+  storage_threaded_job_set_progress (dp->job, (dp->step + progress) / dp->n_steps);
+}
+
 typedef struct {
   gchar **devices;
   gchar *vgname;
+  gboolean wipe;
+  gboolean discard;
 } VolumeGroupDeleteJobData;
 
 static void
@@ -758,7 +1300,8 @@ volume_group_delete_job_free (gpointer user_data)
 }
 
 static gboolean
-volume_group_delete_job_thread (GCancellable *cancellable,
+volume_group_delete_job_thread (StorageThreadedJob *job,
+                                GCancellable *cancellable,
                                 gpointer user_data,
                                 GError **error)
 {
@@ -786,15 +1329,23 @@ volume_group_delete_job_thread (GCancellable *cancellable,
   g_free (standard_output);
   g_free (standard_error);
 
-  if (ret)
+  if (ret && data->devices)
     {
-      for (i = 0; data->devices && data->devices[i] != NULL; i++)
+      DiscardProgress dp = { job, 0, g_strv_length (data->devices) };
+
+      /*
+       * Discarding whole devices only works once they are no longer
+       * physical volumes of the group, but it also releases the space
+       * of the metadata and of free extents.
+       */
+      for (i = 0; ret && data->devices[i] != NULL; i++)
         {
-          if (!storage_util_wipe_block (data->devices[i], error))
-            {
-              ret = FALSE;
-              break;
-            }
+          dp.step = i;
+          if (data->discard)
+            ret = storage_util_discard_device (data->devices[i], cancellable,
+                                               on_discard_progress, &dp, error);
+          if (ret && data->wipe)
+            ret = storage_util_wipe_block (data->devices[i], error);
         }
     }
 
@@ -835,9 +1386,11 @@ handle_delete (LvmVolumeGroup *group,
 
   data = g_new0 (VolumeGroupDeleteJobData, 1);
   data->vgname = g_strdup (storage_volume_group_get_name (self));
+  data->wipe = arg_wipe;
+  g_variant_lookup (arg_options, "discard", "b", &data->discard);
 
-  /* Find physical volumes to wipe. */
-  if (arg_wipe)
+  /* Find physical volumes to wipe or discard. */
+  if (data->wipe || data->discard)
     {
       GPtrArray *devices = g_ptr_array_new ();
       GList *blocks = storage_manager_get_blocks (storage_daemon_get_manager (daemon));
@@ -963,6 +1516,54 @@ on_adddev_complete (UDisksJob *job,
     }
 }
 
+typedef struct {
+  StorageVolumeGroup *self;
+  gchar *device;
+  uid_t caller_uid;
+} AddDeviceData;
+
+static void
+add_device_data_free (gpointer user_data)
+{
+  AddDeviceData *data = user_data;
+  g_object_unref (data->self);
+  g_free (data->device);
+  g_free (data);
+}
+
+static gboolean
+add_device_check (gpointer user_data,
+                  GError **error)
+{
+  AddDeviceData *data = user_data;
+
+  return storage_util_device_is_unused (data->device, error) &&
+         storage_util_wipe_block (data->device, error);
+}
+
+static void
+add_device_ready (GDBusMethodInvocation *invocation,
+                  gpointer user_data)
+{
+  AddDeviceData *data = user_data;
+  StorageJob *job;
+
+  job = storage_daemon_launch_spawned_job (storage_daemon_get (), data->self,
+                                           "lvm-vg-add-device",
+                                           data->caller_uid,
+                                           NULL, /* GCancellable */
+                                           0,    /* uid_t run_as_uid */
+                                           0,    /* uid_t run_as_euid */
+                                           NULL,  /* input_string */
+                                           "vgextend",
+                                           storage_volume_group_get_name (data->self),
+                                           data->device,
+                                           NULL);
+
+  g_signal_connect_data (job, "completed", G_CALLBACK (on_adddev_complete),
+                         g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
+}
+
 static gboolean
 handle_add_device (LvmVolumeGroup *group,
                    GDBusMethodInvocation  *invocation,
@@ -970,14 +1571,11 @@ handle_add_device (LvmVolumeGroup *group,
                    GVariant *options)
 {
   StorageVolumeGroup *self = STORAGE_VOLUME_GROUP (group);
-  StorageJob *job;
-  StorageDaemon *daemon;
   StorageManager *manager;
-  GError *error = NULL;
   StorageBlock *new_member_device = NULL;
+  AddDeviceData *data;
 
-  daemon = storage_daemon_get ();
-  manager = storage_daemon_get_manager (daemon);
+  manager = storage_daemon_get_manager (storage_daemon_get ());
 
   new_member_device = storage_manager_find_block (manager, new_member_device_objpath);
   if (new_member_device == NULL)
@@ -985,30 +1583,16 @@ handle_add_device (LvmVolumeGroup *group,
       g_dbus_method_invocation_return_error (invocation, UDISKS_ERROR, UDISKS_ERROR_FAILED,
                                              "The given object is not a valid block");
     }
-  else if (!storage_block_is_unused (new_member_device, &error))
-    {
-      g_dbus_method_invocation_take_error (invocation, error);
-    }
-  else if (!storage_util_wipe_block (storage_block_get_device (new_member_device), &error))
-    {
-      g_dbus_method_invocation_take_error (invocation, error);
-    }
   else
     {
-      job = storage_daemon_launch_spawned_job (daemon, self,
-                                               "lvm-vg-add-device",
-                                               storage_invocation_get_caller_uid (invocation),
-                                               NULL, /* GCancellable */
-                                               0,    /* uid_t run_as_uid */
-                                               0,    /* uid_t run_as_euid */
-                                               NULL,  /* input_string */
-                                               "vgextend",
-                                               storage_volume_group_get_name (self),
-                                               storage_block_get_device (new_member_device),
-                                               NULL);
-
-      g_signal_connect_data (job, "completed", G_CALLBACK (on_adddev_complete),
-                             g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
+      data = g_new0 (AddDeviceData, 1);
+      data->self = g_object_ref (self);
+      data->device = g_strdup (storage_block_get_device (new_member_device));
+      data->caller_uid = storage_invocation_get_caller_uid (invocation);
+
+      /* Checking and wiping the device does I/O, keep it off the main loop */
+      storage_invocation_check_in_thread (invocation, add_device_check, add_device_ready,
+                                          data, add_device_data_free);
     }
 
   g_clear_object (&new_member_device);
@@ -1021,6 +1605,7 @@ typedef struct {
   gchar *vgname;
   gchar *pvname;
   gboolean wipe;
+  gboolean discard;
 } VolumeGroupRemdevJobData;
 
 static void
@@ -1033,7 +1618,8 @@ volume_group_remdev_job_free (gpointer user_data)
 }
 
 static gboolean
-volume_group_remdev_job_thread (GCancellable *cancellable,
+volume_group_remdev_job_thread (StorageThreadedJob *job,
+                                GCancellable *cancellable,
                                 gpointer user_data,
                                 GError **error)
 {
@@ -1060,26 +1646,16 @@ volume_group_remdev_job_thread (GCancellable *cancellable,
   g_free (standard_output);
   g_free (standard_error);
 
-  if (ret && data->wipe)
+  if (ret && data->discard)
     {
-      const gchar *wipefs[] = { "wipefs", "-a", data->pvname, NULL };
-
-      ret = g_spawn_sync (NULL, (gchar **)wipefs, NULL,
-                          G_SPAWN_SEARCH_PATH, NULL, NULL,
-                          &standard_output, &standard_error,
-                          &exit_status, error);
-
-      if (ret)
-        {
-          ret = storage_util_check_status_and_output ("wipefs",
-                                                      exit_status, standard_output,
-                                                      standard_error, error);
-        }
-
-      g_free (standard_output);
-      g_free (standard_error);
+      DiscardProgress dp = { job, 0, 1 };
+      ret = storage_util_discard_device (data->pvname, cancellable,
+                                         on_discard_progress, &dp, error);
     }
 
+  if (ret && data->wipe)
+    ret = storage_util_wipe_signatures (data->pvname, error);
+
   return ret;
 }
 
@@ -1128,6 +1704,7 @@ handle_remove_device (LvmVolumeGroup *group,
 
   data = g_new0 (VolumeGroupRemdevJobData, 1);
   data->wipe = wipe;
+  g_variant_lookup (options, "discard", "b", &data->discard);
   data->vgname = g_strdup (storage_volume_group_get_name (self));
   data->pvname = g_strdup (storage_block_get_device (member_device));
 
@@ -1148,6 +1725,450 @@ handle_remove_device (LvmVolumeGroup *group,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Seconds between SIGTERM and SIGKILL, unless the job policy says otherwise */
+#define EMPTY_STOP_TIMEOUT_DEFAULT  10
+
+/* How much longer than that to wait for a killed pvmove to be reaped */
+#define EMPTY_REAP_MARGIN           5
+
+typedef struct {
+  gchar *lv_name;
+  guint64 extents;
+  StorageProcess *process;
+  GSource *timeout_source;
+  GString *standard_error;
+  gboolean exited;
+  gboolean timed_out;
+  gint status;
+} EmptyMove;
+
+static void
+empty_move_free (gpointer user_data)
+{
+  EmptyMove *move = user_data;
+  g_free (move->lv_name);
+  if (move->standard_error)
+    g_string_free (move->standard_error, TRUE);
+  g_free (move);
+}
+
+static void
+volume_group_empty_job_free (gpointer user_data)
+{
+  VolumeGroupEmptyJobData *data = user_data;
+  g_free (data->device);
+  g_mutex_clear (&data->mutex);
+  g_free (data);
+}
+
+/* The logical volumes with extents on @device, biggest first */
+static GPtrArray *
+list_volumes_on_device (const gchar *device,
+                        guint64 *total,
+                        GError **error)
+{
+  const gchar *argv[] = { "pvs", "--noheadings", "--nosuffix", "--segments",
+                          "--separator", ":", "-o", "lv_name,pvseg_size",
+                          device, NULL };
+  GPtrArray *moves = NULL;
+  GHashTable *by_name;
+  gchar *standard_output;
+  gchar *standard_error;
+  gint exit_status;
+  gchar **lines;
+  gchar *name;
+  gchar *colon;
+  EmptyMove *move;
+  guint i;
+
+  if (!g_spawn_sync (NULL, (gchar **)argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                     &standard_output, &standard_error, &exit_status, error))
+    return NULL;
+
+  if (!storage_util_check_status_and_output ("pvs", exit_status, standard_output,
+                                             standard_error, error))
+    goto out;
+
+  moves = g_ptr_array_new_with_free_func (empty_move_free);
+  by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  *total = 0;
+
+  lines = g_strsplit (standard_output, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      name = g_strstrip (lines[i]);
+      colon = strrchr (name, ':');
+      if (colon == NULL)
+        continue;
+      *colon = '\0';
+
+      /* Free space has no volume, hidden volumes are in brackets */
+      if (name[0] == '\0')
+        continue;
+      if (name[0] == '[' && g_str_has_suffix (name, "]"))
+        {
+          name[strlen (name) - 1] = '\0';
+          name++;
+        }
+
+      move = g_hash_table_lookup (by_name, name);
+      if (move == NULL)
+        {
+          move = g_new0 (EmptyMove, 1);
+          move->lv_name = g_strdup (name);
+          g_hash_table_insert (by_name, move->lv_name, move);
+          g_ptr_array_add (moves, move);
+        }
+      move->extents += g_ascii_strtoull (colon + 1, NULL, 10);
+      *total += g_ascii_strtoull (colon + 1, NULL, 10);
+    }
+
+  g_strfreev (lines);
+  g_hash_table_unref (by_name);
+
+out:
+  g_free (standard_output);
+  g_free (standard_error);
+  return moves;
+}
+
+static gint
+compare_moves_by_size (gconstpointer a,
+                       gconstpointer b)
+{
+  const EmptyMove *move_a = *(EmptyMove **)a;
+  const EmptyMove *move_b = *(EmptyMove **)b;
+
+  if (move_a->extents == move_b->extents)
+    return 0;
+  return move_a->extents > move_b->extents ? -1 : 1;
+}
+
+/* Shared by the pvmove processes of one EmptyDevice job */
+typedef struct {
+  const gchar *device;
+  const StorageJobPolicy *policy;
+  guint stop_timeout;
+  GMainContext *context;
+  gint cgroup_procs_fd;
+  gchar *cgroup_path;
+  guint unreaped;
+} EmptyRun;
+
+/* careful, this is in the fork()'ed child */
+static void
+empty_move_child_setup (gpointer user_data)
+{
+  EmptyRun *run = user_data;
+  storage_job_policy_apply_in_child (run->policy, run->cgroup_procs_fd);
+}
+
+static void
+on_empty_move_output (StorageProcess *process,
+                      gint fd,
+                      const gchar *data,
+                      gsize len,
+                      gpointer user_data)
+{
+  EmptyMove *move = user_data;
+
+  /* pvmove only writes progress to stdout, which the polling already has */
+  if (fd == 2)
+    g_string_append_len (move->standard_error, data, len);
+}
+
+static void
+on_empty_move_exit (StorageProcess *process,
+                    gint status,
+                    gpointer user_data)
+{
+  EmptyMove *move = user_data;
+
+  move->exited = TRUE;
+  move->status = status;
+
+  if (move->timeout_source)
+    {
+      g_source_destroy (move->timeout_source);
+      move->timeout_source = NULL;
+    }
+
+  storage_process_release (move->process, NULL, NULL);
+  move->process = NULL;
+}
+
+typedef struct {
+  EmptyMove *move;
+  EmptyRun *run;
+} EmptyMoveTimeout;
+
+static gboolean
+on_empty_move_timeout (gpointer user_data)
+{
+  EmptyMoveTimeout *timeout = user_data;
+
+  timeout->move->timeout_source = NULL;
+  timeout->move->timed_out = TRUE;
+  storage_process_terminate (timeout->move->process, timeout->run->stop_timeout);
+  return FALSE;
+}
+
+static gboolean
+empty_move_start (EmptyMove *move,
+                  EmptyRun *run,
+                  GError **error)
+{
+  const gchar *argv[] = { "pvmove", "-n", move->lv_name, run->device, NULL };
+  EmptyMoveTimeout *timeout;
+  gboolean needs_setup;
+
+  move->standard_error = g_string_new (NULL);
+
+  /* Only fork when something needs to happen in the child */
+  needs_setup = (storage_job_policy_needs_child (run->policy) || run->cgroup_procs_fd != -1);
+
+  /* A group of its own, so that stopping it stops everything it started */
+  move->process = storage_process_spawn (argv, STORAGE_PROCESS_NEW_GROUP,
+                                         needs_setup ? empty_move_child_setup : NULL, run,
+                                         NULL, on_empty_move_output, on_empty_move_exit,
+                                         move, error);
+  if (move->process == NULL)
+    {
+      g_prefix_error (error, "Error moving %s: ", move->lv_name);
+      return FALSE;
+    }
+
+  if (run->policy != NULL && run->policy->timeout > 0)
+    {
+      timeout = g_new0 (EmptyMoveTimeout, 1);
+      timeout->move = move;
+      timeout->run = run;
+      move->timeout_source = g_timeout_source_new_seconds (run->policy->timeout);
+      g_source_set_callback (move->timeout_source, on_empty_move_timeout, timeout, g_free);
+      g_source_attach (move->timeout_source, run->context);
+      g_source_unref (move->timeout_source);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+on_empty_wakeup (gpointer user_data)
+{
+  /* Only there to make g_main_context_iteration() return */
+  return FALSE;
+}
+
+static void
+on_empty_move_reaped (gpointer user_data)
+{
+  EmptyRun *run = user_data;
+  run->unreaped--;
+}
+
+static gpointer
+empty_reaper_thread (gpointer user_data)
+{
+  EmptyRun *run = user_data;
+
+  while (run->unreaped > 0)
+    g_main_context_iteration (run->context, TRUE);
+
+  storage_job_policy_remove_cgroup (run->cgroup_path);
+  g_free (run->cgroup_path);
+  g_main_context_unref (run->context);
+  g_free (run);
+  return NULL;
+}
+
+/*
+ * Gives up waiting for pvmove processes that even SIGKILL didn't stop,
+ * usually because they are stuck in the kernel.  They are reaped by a
+ * thread of their own whenever they do exit, so that the job doesn't
+ * hang.
+ */
+static void
+empty_run_finish (EmptyRun *run,
+                  GPtrArray *running)
+{
+  EmptyMove *move;
+  guint i;
+
+  g_main_context_pop_thread_default (run->context);
+
+  for (i = 0; i < running->len; i++)
+    {
+      move = running->pdata[i];
+      g_message ("Gave up waiting for pvmove -n %s to exit", move->lv_name);
+      if (move->timeout_source)
+        g_source_destroy (move->timeout_source);
+      storage_process_release (move->process, on_empty_move_reaped, run);
+      run->unreaped++;
+    }
+
+  if (run->cgroup_procs_fd != -1)
+    close (run->cgroup_procs_fd);
+
+  if (run->unreaped > 0)
+    {
+      g_thread_unref (g_thread_new ("pvmove-reaper", empty_reaper_thread, run));
+      return;
+    }
+
+  storage_job_policy_remove_cgroup (run->cgroup_path);
+  g_free (run->cgroup_path);
+  g_main_context_unref (run->context);
+  g_free (run);
+}
+
+static gboolean
+volume_group_empty_job_thread (StorageThreadedJob *job,
+                               GCancellable *cancellable,
+                               gpointer user_data,
+                               GError **error)
+{
+  VolumeGroupEmptyJobData *data = user_data;
+  const gchar *abort_argv[] = { "pvmove", "--abort", data->device, NULL };
+  GPtrArray *running;
+  GPtrArray *moves;
+  GSource *source;
+  EmptyRun *run;
+  gboolean cancelled = FALSE;
+  gboolean interrupted = FALSE;
+  gboolean ret = TRUE;
+  EmptyMove *move;
+  gint64 deadline = 0;
+  guint64 total;
+  gchar *cmd;
+  gint status;
+  guint next;
+  guint i;
+
+  moves = list_volumes_on_device (data->device, &total, error);
+  if (moves == NULL)
+    return FALSE;
+
+  /* Start the big ones first, so that they don't end up running alone */
+  g_ptr_array_sort (moves, compare_moves_by_size);
+
+  g_mutex_lock (&data->mutex);
+  data->total = total;
+  g_mutex_unlock (&data->mutex);
+
+  /* The pvmove processes are watched from a main context of this thread */
+  run = g_new0 (EmptyRun, 1);
+  run->device = data->device;
+  run->policy = storage_job_get_policy (STORAGE_JOB (job));
+  run->stop_timeout = (run->policy != NULL && run->policy->stop_timeout > 0 ?
+                       run->policy->stop_timeout : EMPTY_STOP_TIMEOUT_DEFAULT);
+  run->context = g_main_context_new ();
+  run->cgroup_procs_fd = storage_job_policy_create_cgroup (run->policy, &run->cgroup_path);
+  g_main_context_push_thread_default (run->context);
+
+  source = g_cancellable_source_new (cancellable);
+  g_source_set_callback (source, on_empty_wakeup, NULL, NULL);
+  g_source_attach (source, run->context);
+  g_source_unref (source);
+
+  running = g_ptr_array_new ();
+  next = 0;
+
+  for (;;)
+    {
+      if (!cancelled && g_cancellable_is_cancelled (cancellable))
+        {
+          /* The mirrors keep going without pvmove, they are aborted below */
+          cancelled = TRUE;
+          interrupted = running->len > 0;
+          for (i = 0; i < running->len; i++)
+            storage_process_terminate (((EmptyMove *)running->pdata[i])->process, run->stop_timeout);
+
+          deadline = g_get_monotonic_time () + (run->stop_timeout + EMPTY_REAP_MARGIN) * G_USEC_PER_SEC;
+          source = g_timeout_source_new_seconds (run->stop_timeout + EMPTY_REAP_MARGIN);
+          g_source_set_callback (source, on_empty_wakeup, NULL, NULL);
+          g_source_attach (source, run->context);
+          g_source_unref (source);
+        }
+
+      /* After a failure the running ones are still left to finish */
+      while (ret && !cancelled && next < moves->len && running->len < data->parallel)
+        {
+          move = moves->pdata[next++];
+          if (!empty_move_start (move, run, error))
+            {
+              ret = FALSE;
+              break;
+            }
+          g_ptr_array_add (running, move);
+
+          g_mutex_lock (&data->mutex);
+          data->running += move->extents;
+          g_mutex_unlock (&data->mutex);
+        }
+
+      for (i = 0; i < running->len; )
+        {
+          move = running->pdata[i];
+          if (!move->exited)
+            {
+              i++;
+              continue;
+            }
+
+          g_ptr_array_remove_index (running, i);
+
+          g_mutex_lock (&data->mutex);
+          data->running -= move->extents;
+          if (WIFEXITED (move->status) && WEXITSTATUS (move->status) == 0)
+            data->done += move->extents;
+          g_mutex_unlock (&data->mutex);
+
+          if (ret && !cancelled && move->timed_out)
+            {
+              g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                           "pvmove -n %s was stopped after %u seconds",
+                           move->lv_name, run->policy->timeout);
+              ret = FALSE;
+            }
+          else if (ret && !cancelled)
+            {
+              cmd = g_strdup_printf ("pvmove -n %s", move->lv_name);
+              ret = storage_util_check_status_and_output (cmd, move->status, NULL,
+                                                          move->standard_error->str,
+                                                          error);
+              g_free (cmd);
+            }
+        }
+
+      if (running->len == 0)
+        break;
+      if (cancelled && g_get_monotonic_time () >= deadline)
+        break;
+
+      g_main_context_iteration (run->context, TRUE);
+    }
+
+  /* Whatever is still running now didn't react to SIGKILL */
+  empty_run_finish (run, running);
+
+  if (interrupted)
+    {
+      /* Puts back whatever hadn't been moved completely */
+      if (!g_spawn_sync (NULL, (gchar **)abort_argv, NULL,
+                         G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                         NULL, NULL, NULL, NULL, &status, NULL) ||
+          !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        g_message ("Couldn't abort moving extents off %s", data->device);
+    }
+
+  if (cancelled && ret)
+    ret = !g_cancellable_set_error_if_cancelled (cancellable, error);
+
+  g_ptr_array_unref (running);
+  g_ptr_array_unref (moves);
+  return ret;
+}
+
 static void
 on_empty_complete (UDisksJob *job,
                    gboolean success,
@@ -1177,6 +2198,8 @@ handle_empty_device (LvmVolumeGroup *group,
   StorageManager *manager;
   const gchar *member_device_file = NULL;
   StorageBlock *member_device = NULL;
+  VolumeGroupEmptyJobData *data;
+  guint parallel = 0;
 
   daemon = storage_daemon_get ();
   manager = storage_daemon_get_manager (daemon);
@@ -1191,15 +2214,37 @@ handle_empty_device (LvmVolumeGroup *group,
 
   member_device_file = storage_block_get_device (member_device);
 
-  job = storage_daemon_launch_spawned_job (daemon, member_device,
-                                           "lvm-vg-empty-device",
-                                           storage_invocation_get_caller_uid (invocation),
-                                           NULL, /* GCancellable */
-                                           0,    /* uid_t run_as_uid */
-                                           0,    /* uid_t run_as_euid */
-                                           NULL,  /* input_string */
-                                           "pvmove", member_device_file,
-                                           NULL);
+  g_variant_lookup (options, "parallel", "u", &parallel);
+  if (parallel > 0)
+    {
+      data = g_new0 (VolumeGroupEmptyJobData, 1);
+      data->device = g_strdup (member_device_file);
+      data->parallel = parallel;
+      g_mutex_init (&data->mutex);
+
+      job = storage_daemon_launch_threaded_job (daemon, member_device,
+                                                "lvm-vg-empty-device",
+                                                storage_invocation_get_caller_uid (invocation),
+                                                volume_group_empty_job_thread,
+                                                data,
+                                                volume_group_empty_job_free,
+                                                NULL);
+
+      /* For update_progress_for_device(), the data lives as long as the job */
+      g_object_set_data (G_OBJECT (job), "storage-empty-job-data", data);
+    }
+  else
+    {
+      job = storage_daemon_launch_spawned_job (daemon, member_device,
+                                               "lvm-vg-empty-device",
+                                               storage_invocation_get_caller_uid (invocation),
+                                               NULL, /* GCancellable */
+                                               0,    /* uid_t run_as_uid */
+                                               0,    /* uid_t run_as_euid */
+                                               NULL,  /* input_string */
+                                               "pvmove", member_device_file,
+                                               NULL);
+    }
 
   g_signal_connect_data (job, "completed", G_CALLBACK (on_empty_complete),
                          g_object_ref (invocation), (GClosureNotify)g_object_unref, 0);
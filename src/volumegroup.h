@@ -46,6 +46,15 @@ void                    storage_volume_group_update              (StorageVolumeG
                                                                   StorageVolumeGroupCallback *done,
                                                                   gpointer done_user_data);
 
+void                    storage_volume_group_update_from_snapshot (StorageVolumeGroup *self,
+                                                                   GVariant *info);
+
+GVariant *              storage_volume_group_get_info            (StorageVolumeGroup *self);
+
+void                    storage_volume_group_set_keep_reports    (gboolean keep);
+
+gboolean                storage_volume_group_is_possibly_stale   (StorageVolumeGroup *self);
+
 void                    storage_volume_group_poll                (StorageVolumeGroup *self);
 
 StorageLogicalVolume *  storage_volume_group_find_logical_volume (StorageVolumeGroup *self,
@@ -0,0 +1,317 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "watchdog.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+/*
+ * Everything in the daemon runs in the default main context, so a
+ * single slow callback holds up every client.  The watchdog is a thread
+ * that notices when the main loop has been dispatching for longer than
+ * the threshold, and logs that, at most once per REPORT_INTERVAL.  A
+ * stall that goes on, such as on a hung disk, is logged again every
+ * REPORT_INTERVAL with how long it has lasted so far.
+ *
+ * With --debug the watchdog also asks the main thread for a backtrace,
+ * by sending it a signal.  backtrace() isn't promised to be
+ * async-signal-safe, so this is only for debugging.  A main thread that
+ * is stuck in the kernel doesn't take the signal; the stall is logged
+ * without a backtrace then.
+ *
+ * Every stall is counted as "mainloop.stalled" when it's noticed, and
+ * recorded in the "mainloop.stall" histogram when it's over, including
+ * those that were too short for the watchdog to notice.
+ */
+
+/* Reports that are logged, the others are only counted */
+#define REPORT_INTERVAL   (60 * G_USEC_PER_SEC)
+
+/* How long to wait for the main thread to take the backtrace */
+#define CAPTURE_TIMEOUT   (100 * 1000)
+
+#define MAX_FRAMES        64
+
+#define WATCHDOG_SIGNAL   (SIGRTMIN + 1)
+
+static struct {
+  GMutex mutex;
+  gboolean running;
+  gboolean backtraces;
+  gint64 threshold;
+  pthread_t main_thread;
+
+  /* Protected by the mutex; dispatch_begin is 0 while polling */
+  gint64 dispatch_begin;
+  guint64 dispatches;
+
+  /* Only used by the watchdog thread */
+  guint64 noticed;
+  gint64 last_report;
+  guint suppressed;
+} watchdog;
+
+/* Filled in by the main thread, in the signal handler */
+static struct {
+  volatile gint done;
+  void *frames[MAX_FRAMES];
+  gint n_frames;
+} capture;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_capture_signal (int signo)
+{
+  /*
+   * Only installed with --debug: backtrace() isn't promised to be
+   * async-signal-safe, although it was called once before so that its
+   * library is loaded.
+   */
+#ifdef HAVE_EXECINFO_H
+  capture.n_frames = backtrace (capture.frames, MAX_FRAMES);
+#endif
+
+  g_atomic_int_set (&capture.done, 1);
+}
+
+static gboolean
+capture_main_thread (void)
+{
+  gint64 deadline;
+
+  capture.n_frames = 0;
+  g_atomic_int_set (&capture.done, 0);
+
+  if (pthread_kill (watchdog.main_thread, WATCHDOG_SIGNAL) != 0)
+    return FALSE;
+
+  deadline = g_get_monotonic_time () + CAPTURE_TIMEOUT;
+  while (!g_atomic_int_get (&capture.done))
+    {
+      if (g_get_monotonic_time () > deadline)
+        return FALSE;
+      g_usleep (1000);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+is_still_stalled (guint64 dispatches)
+{
+  gboolean ret;
+
+  g_mutex_lock (&watchdog.mutex);
+  ret = (watchdog.dispatches == dispatches && watchdog.dispatch_begin != 0);
+  g_mutex_unlock (&watchdog.mutex);
+  return ret;
+}
+
+static void
+report_stall (gint64 stalled,
+              guint64 dispatches,
+              gboolean ongoing)
+{
+  GString *message;
+#ifdef HAVE_EXECINFO_H
+  gchar **symbols;
+  gint i;
+#endif
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+  if (watchdog.last_report && now - watchdog.last_report < REPORT_INTERVAL)
+    {
+      if (!ongoing)
+        watchdog.suppressed++;
+      return;
+    }
+
+  watchdog.last_report = now;
+
+  message = g_string_new (NULL);
+  if (ongoing)
+    g_string_append_printf (message, "Main loop still stalled after %" G_GINT64_FORMAT " ms",
+                            stalled / 1000);
+  else
+    g_string_append_printf (message, "Main loop stalled for %" G_GINT64_FORMAT " ms",
+                            stalled / 1000);
+  if (watchdog.suppressed)
+    g_string_append_printf (message, " (and %u more stalls since the last report)", watchdog.suppressed);
+  watchdog.suppressed = 0;
+
+  /* The backtrace is only worth it if it's of the stall */
+  if (watchdog.backtraces && !ongoing
+      && capture_main_thread () && is_still_stalled (dispatches))
+    {
+#ifdef HAVE_EXECINFO_H
+      /* The first frames are those of the signal handler */
+      symbols = backtrace_symbols (capture.frames, capture.n_frames);
+      if (symbols != NULL)
+        {
+          for (i = 0; i < capture.n_frames; i++)
+            g_string_append_printf (message, "\n  #%d %s", i, symbols[i]);
+          free (symbols);
+        }
+#endif
+    }
+
+  /* Not g_warning(), which is fatal with --debug */
+  g_message ("%s", message->str);
+  g_string_free (message, TRUE);
+}
+
+static gpointer
+watchdog_thread (gpointer user_data)
+{
+  gint64 begin;
+  guint64 dispatches;
+  gint64 now;
+
+  for (;;)
+    {
+      g_usleep (watchdog.threshold / 4);
+
+      g_mutex_lock (&watchdog.mutex);
+      begin = watchdog.dispatch_begin;
+      dispatches = watchdog.dispatches;
+      g_mutex_unlock (&watchdog.mutex);
+
+      now = g_get_monotonic_time ();
+      if (begin == 0 || now - begin < watchdog.threshold)
+        continue;
+
+      /* Each stall is counted once, and reported again while it lasts */
+      if (dispatches != watchdog.noticed)
+        {
+          watchdog.noticed = dispatches;
+          storage_stats_count ("mainloop.stalled", 1);
+          report_stall (now - begin, dispatches, FALSE);
+        }
+      else
+        {
+          report_stall (now - begin, dispatches, TRUE);
+        }
+    }
+
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * storage_watchdog_start:
+ * @threshold_msec: How long the main loop may dispatch without
+ *   returning to poll.
+ * @backtraces: Whether to log a backtrace of the main thread with
+ *   stalls, see above.
+ *
+ * Starts watching the default main context for stalls.  Call from the
+ * main thread, before storage_stats_initialize() installs the poll
+ * function that tells the watchdog about dispatching.
+ */
+void
+storage_watchdog_start (guint threshold_msec,
+                        gboolean backtraces)
+{
+  struct sigaction sa;
+#ifdef HAVE_EXECINFO_H
+  void *frame;
+#endif
+
+  g_return_if_fail (threshold_msec > 0);
+  g_return_if_fail (!watchdog.running);
+
+  if (backtraces)
+    {
+#ifdef HAVE_EXECINFO_H
+      /* Loads libgcc, which must not happen inside the signal handler */
+      backtrace (&frame, 1);
+#endif
+
+      memset (&sa, 0, sizeof (sa));
+      sa.sa_handler = on_capture_signal;
+      sa.sa_flags = SA_RESTART;
+      sigemptyset (&sa.sa_mask);
+      sigaction (WATCHDOG_SIGNAL, &sa, NULL);
+    }
+
+  watchdog.threshold = (gint64)threshold_msec * 1000;
+  watchdog.backtraces = backtraces;
+  watchdog.main_thread = pthread_self ();
+  watchdog.running = TRUE;
+
+  g_thread_unref (g_thread_new ("watchdog", watchdog_thread, NULL));
+}
+
+/**
+ * storage_watchdog_dispatch_begin:
+ *
+ * Called by the poll function of the default main context when poll
+ * returns.
+ */
+void
+storage_watchdog_dispatch_begin (void)
+{
+  if (!watchdog.running)
+    return;
+
+  g_mutex_lock (&watchdog.mutex);
+  watchdog.dispatch_begin = g_get_monotonic_time ();
+  watchdog.dispatches++;
+  g_mutex_unlock (&watchdog.mutex);
+}
+
+/**
+ * storage_watchdog_dispatch_end:
+ *
+ * Called by the poll function of the default main context before it
+ * polls.
+ */
+void
+storage_watchdog_dispatch_end (void)
+{
+  gint64 begin;
+  gint64 now;
+
+  if (!watchdog.running)
+    return;
+
+  now = g_get_monotonic_time ();
+  g_mutex_lock (&watchdog.mutex);
+  begin = watchdog.dispatch_begin;
+  watchdog.dispatch_begin = 0;
+  g_mutex_unlock (&watchdog.mutex);
+
+  if (begin && now - begin >= watchdog.threshold)
+    storage_stats_record ("mainloop.stall", now - begin);
+}
@@ -0,0 +1,323 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include "zero.h"
+
+#include "daemon.h"
+#include "job.h"
+#include "threadedjob.h"
+
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <udisks/udisks.h>
+
+/*
+ * Zeroing a whole device, as fast as the device allows or as slow as the
+ * caller asks for. The device is opened with O_DIRECT so that we don't
+ * push everything else out of the page cache, and several large writes
+ * are kept in flight at once by a few writer threads, each taking the
+ * next chunk as soon as its previous write completes.
+ */
+
+#define ZERO_CHUNK        (4 * 1024 * 1024)
+#define ZERO_QUEUE_DEPTH  4
+#define ZERO_ALIGNMENT    4096
+
+/* How often the progress of the job is updated */
+#define PROGRESS_INTERVAL (250 * 1000)
+
+/* Longest sleep for the bandwidth cap, so cancelling stays responsive */
+#define THROTTLE_SLICE    (100 * 1000)
+
+typedef struct {
+  gchar *device;
+  guint64 max_rate;
+} ZeroJobData;
+
+typedef struct {
+  int fd;
+  const gchar *device;
+  GCancellable *cancellable;
+  guint64 size;
+  guint64 max_rate;
+  gint64 start;
+  gconstpointer zeroes;
+
+  /* Guarded by the mutex */
+  GMutex mutex;
+  GCond cond;
+  guint64 next_offset;
+  guint64 written;
+  guint running;
+  GError *error;
+} ZeroState;
+
+static void
+zero_job_data_free (gpointer user_data)
+{
+  ZeroJobData *data = user_data;
+  g_free (data->device);
+  g_free (data);
+}
+
+static gboolean
+throttle (ZeroState *st,
+          guint64 offset,
+          GError **error)
+{
+  gint64 not_before;
+  gint64 now;
+
+  /* A chunk may only start once all the bytes before it were due */
+  not_before = st->start + (gint64)((gdouble)offset / st->max_rate * G_USEC_PER_SEC);
+
+  for (;;)
+    {
+      if (g_cancellable_set_error_if_cancelled (st->cancellable, error))
+        return FALSE;
+      now = g_get_monotonic_time ();
+      if (now >= not_before)
+        return TRUE;
+      g_usleep (MIN (not_before - now, THROTTLE_SLICE));
+    }
+}
+
+static gboolean
+write_zeroes (ZeroState *st,
+              guint64 offset,
+              gsize length,
+              GError **error)
+{
+  gsize done = 0;
+  ssize_t ret;
+
+  while (done < length)
+    {
+      ret = pwrite (st->fd, (const gchar *)st->zeroes + done, length - done, offset + done);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        {
+          g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                       "Error writing to %s at offset %" G_GUINT64_FORMAT ": %s",
+                       st->device, offset + done, ret < 0 ? g_strerror (errno) : "No space left");
+          return FALSE;
+        }
+      done += ret;
+    }
+
+  return TRUE;
+}
+
+static gpointer
+zero_writer_thread (gpointer user_data)
+{
+  ZeroState *st = user_data;
+  GError *error = NULL;
+  guint64 offset;
+  gsize length;
+
+  for (;;)
+    {
+      g_mutex_lock (&st->mutex);
+      if (st->error || st->next_offset >= st->size)
+        {
+          g_mutex_unlock (&st->mutex);
+          break;
+        }
+      offset = st->next_offset;
+      length = MIN (ZERO_CHUNK, st->size - offset);
+      st->next_offset += length;
+      g_mutex_unlock (&st->mutex);
+
+      if ((st->max_rate > 0 && !throttle (st, offset, &error)) ||
+          g_cancellable_set_error_if_cancelled (st->cancellable, &error) ||
+          !write_zeroes (st, offset, length, &error))
+        {
+          g_mutex_lock (&st->mutex);
+          if (st->error == NULL)
+            st->error = error;
+          else
+            g_error_free (error);
+          g_mutex_unlock (&st->mutex);
+          break;
+        }
+
+      g_mutex_lock (&st->mutex);
+      st->written += length;
+      g_mutex_unlock (&st->mutex);
+    }
+
+  g_mutex_lock (&st->mutex);
+  st->running--;
+  g_cond_signal (&st->cond);
+  g_mutex_unlock (&st->mutex);
+
+  return NULL;
+}
+
+static gboolean
+zero_job_thread (StorageThreadedJob *job,
+                 GCancellable *cancellable,
+                 gpointer user_data,
+                 GError **error)
+{
+  ZeroJobData *data = user_data;
+  ZeroState st = { 0, };
+  GThread *threads[ZERO_QUEUE_DEPTH];
+  gpointer zeroes = NULL;
+  gboolean ret = FALSE;
+  gint64 last_report;
+  guint n_threads;
+  guint i;
+
+  st.device = data->device;
+  st.cancellable = cancellable;
+  st.max_rate = data->max_rate;
+
+  st.fd = open (data->device, O_WRONLY | O_DIRECT | O_EXCL | O_CLOEXEC);
+  if (st.fd < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error opening device %s: %m", data->device);
+      return FALSE;
+    }
+
+  if (ioctl (st.fd, BLKGETSIZE64, &st.size) < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error getting size of %s: %m", data->device);
+      goto out;
+    }
+
+  if (posix_memalign (&zeroes, ZERO_ALIGNMENT, ZERO_CHUNK) != 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error allocating buffer for %s", data->device);
+      zeroes = NULL;
+      goto out;
+    }
+  memset (zeroes, 0, ZERO_CHUNK);
+  st.zeroes = zeroes;
+
+  storage_threaded_job_set_bytes (job, st.size);
+  storage_threaded_job_set_progress (job, 0.0);
+
+  g_mutex_init (&st.mutex);
+  g_cond_init (&st.cond);
+  st.start = last_report = g_get_monotonic_time ();
+
+  n_threads = MIN (ZERO_QUEUE_DEPTH, (st.size + ZERO_CHUNK - 1) / ZERO_CHUNK);
+  st.running = n_threads;
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("zero", zero_writer_thread, &st);
+
+  /* Report progress until all writers are done */
+  g_mutex_lock (&st.mutex);
+  while (st.running > 0)
+    {
+      g_cond_wait_until (&st.cond, &st.mutex, last_report + PROGRESS_INTERVAL);
+      if (g_get_monotonic_time () >= last_report + PROGRESS_INTERVAL)
+        {
+          storage_threaded_job_set_progress (job, (gdouble)st.written / st.size);
+          last_report = g_get_monotonic_time ();
+        }
+    }
+  g_mutex_unlock (&st.mutex);
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_mutex_clear (&st.mutex);
+  g_cond_clear (&st.cond);
+
+  if (st.error)
+    {
+      g_propagate_error (error, st.error);
+      goto out;
+    }
+
+  if (fsync (st.fd) < 0)
+    {
+      g_set_error (error, UDISKS_ERROR, UDISKS_ERROR_FAILED,
+                   "Error syncing %s: %m", data->device);
+      goto out;
+    }
+
+  storage_threaded_job_set_progress (job, 1.0);
+  ret = TRUE;
+
+out:
+  free (zeroes);
+  close (st.fd);
+  return ret;
+}
+
+/**
+ * storage_zero_job_launch:
+ * @object_or_interface: The object the job is about.
+ * @job_operation: The operation for the job.
+ * @device_file: The block device to overwrite with zeroes.
+ * @max_rate: Most bytes per second to write, or 0 for no limit.
+ * @job_started_by_uid: The user who started the job.
+ *
+ * Launches a threaded job that writes zeroes over all of @device_file.
+ * The job reports its bytes, progress and rate, and can be cancelled.
+ *
+ * Returns: A #StorageJob owned by the daemon.
+ */
+StorageJob *
+storage_zero_job_launch (gpointer object_or_interface,
+                         const gchar *job_operation,
+                         const gchar *device_file,
+                         guint64 max_rate,
+                         uid_t job_started_by_uid)
+{
+  ZeroJobData *data;
+  StorageJob *job;
+
+  data = g_new0 (ZeroJobData, 1);
+  data->device = g_strdup (device_file);
+  data->max_rate = max_rate;
+
+  job = storage_daemon_launch_threaded_job (storage_daemon_get (),
+                                            object_or_interface,
+                                            job_operation,
+                                            job_started_by_uid,
+                                            zero_job_thread,
+                                            data,
+                                            zero_job_data_free,
+                                            NULL);
+
+  /* Turns our progress into a rate and an expected end time */
+  storage_job_set_auto_estimate (job, TRUE);
+
+  return job;
+}
@@ -0,0 +1,37 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2007-2010 David Zeuthen <zeuthen@gmail.com>
+ * Copyright (C) 2013-2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __STORAGE_ZERO_H__
+#define __STORAGE_ZERO_H__
+
+#include "types.h"
+
+G_BEGIN_DECLS
+
+StorageJob *        storage_zero_job_launch              (gpointer object_or_interface,
+                                                          const gchar *job_operation,
+                                                          const gchar *device_file,
+                                                          guint64 max_rate,
+                                                          uid_t job_started_by_uid);
+
+G_END_DECLS
+
+#endif /* __STORAGE_ZERO_H__ */